@@ -0,0 +1,61 @@
+package io.github.edsuns.adfilter
+
+import io.github.edsuns.adfilter.impl.CompiledDataCache
+import org.junit.After
+import org.junit.Assert.*
+import org.junit.Test
+import java.io.File
+import java.nio.file.Files
+
+class CompiledDataCacheTest {
+    private val root = Files.createTempDirectory("compiled").toFile()
+    private val cache = CompiledDataCache(File(root, "cache"))
+
+    @After
+    fun tearDown() {
+        root.deleteRecursively()
+    }
+
+    @Test
+    fun keyDependsOnRawData() {
+        assertEquals(cache.keyOf("a".toByteArray()), cache.keyOf("a".toByteArray()))
+        assertNotEquals(cache.keyOf("a".toByteArray()), cache.keyOf("b".toByteArray()))
+    }
+
+    @Test
+    fun keyOfFileIsKeyOfItsContent() {
+        val rules = ByteArray(3 * DEFAULT_BUFFER_SIZE + 1) { (it % 251).toByte() }
+        val file = File(root, "raw")
+        file.writeBytes(rules)
+        assertEquals(cache.keyOf(rules), cache.keyOf(file))
+    }
+
+    @Test
+    fun installReplacesTargetWithCachedData() {
+        val key = cache.keyOf("rules".toByteArray())
+        val target = File(root, "filter")
+        assertFalse(cache.install(key, target))
+
+        cache.getFile(key).writeText("compiled")
+        target.writeText("old")
+        assertTrue(cache.install(key, target))
+        assertEquals("compiled", target.readText())
+
+        cache.remove(key)
+        assertEquals("compiled", target.readText())
+    }
+
+    @Test
+    fun trimKeepsMostRecentlyUsed() {
+        val keys = (0..CompiledDataCache.MAX_ENTRIES).map { cache.keyOf(it.toString().toByteArray()) }
+        keys.forEachIndexed { i, key ->
+            cache.getFile(key).writeText(key)
+            cache.getFile(key).setLastModified(i * 1000L)
+        }
+        assertTrue(cache.install(keys[0], File(root, "filter")))
+        cache.trim()
+        assertTrue(cache.getFile(keys[0]).exists())
+        assertFalse(cache.getFile(keys[1]).exists())
+        assertTrue(cache.getFile(keys.last()).exists())
+    }
+}
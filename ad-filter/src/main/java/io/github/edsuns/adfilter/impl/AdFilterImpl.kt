@@ -1,6 +1,8 @@
 package io.github.edsuns.adfilter.impl
 
+import android.content.ComponentCallbacks2
 import android.content.Context
+import android.content.res.Configuration
 import android.net.Uri
 import android.webkit.WebResourceRequest
 import android.webkit.WebResourceResponse
@@ -9,6 +11,7 @@ import androidx.lifecycle.MutableLiveData
 import androidx.work.WorkInfo
 import io.github.edsuns.adblockclient.ResourceType
 import io.github.edsuns.adfilter.*
+import io.github.edsuns.adfilter.impl.Constants.COMPILED_DATA_DIR
 import io.github.edsuns.adfilter.impl.Constants.FILE_STORE_DIR
 import io.github.edsuns.adfilter.impl.Constants.KEY_ALREADY_UP_TO_DATE
 import io.github.edsuns.adfilter.impl.Constants.KEY_FILTERS_COUNT
@@ -30,9 +33,12 @@ import java.io.File
 internal class AdFilterImpl constructor(appContext: Context) : AdFilter {
 
     private val detector: Detector = DetectorImpl()
-    internal val binaryDataStore: BinaryDataStore =
-        BinaryDataStore(File(appContext.filesDir, FILE_STORE_DIR))
-    private val filterDataLoader: FilterDataLoader = FilterDataLoader(detector, binaryDataStore)
+    private val storeDir = File(appContext.filesDir, FILE_STORE_DIR)
+    internal val binaryDataStore: BinaryDataStore = BinaryDataStore(storeDir)
+    internal val compiledDataCache: CompiledDataCache =
+        CompiledDataCache(File(storeDir, COMPILED_DATA_DIR))
+    private val filterDataLoader: FilterDataLoader =
+        FilterDataLoader(detector, binaryDataStore, compiledDataCache)
 
     private val elementHiding: ElementHiding = ElementHiding(detector)
     private val scriptlet: Scriptlet = Scriptlet(detector)
@@ -63,6 +69,16 @@ internal class AdFilterImpl constructor(appContext: Context) : AdFilter {
             (viewModel.onDirty as MutableLiveData).value = None.Value
         }
         viewModel.workInfo.observeForever { list -> processWorkInfo(list) }
+        // the clients shed what they can rebuild rather than the app being killed
+        appContext.registerComponentCallbacks(object : ComponentCallbacks2 {
+            override fun onTrimMemory(level: Int) = detector.trimMemory(level)
+
+            override fun onConfigurationChanged(newConfig: Configuration) {}
+
+            @Deprecated("Deprecated in Java")
+            override fun onLowMemory() =
+                detector.trimMemory(ComponentCallbacks2.TRIM_MEMORY_COMPLETE)
+        })
     }
 
     private fun processWorkInfo(workInfoList: List<WorkInfo>) {
@@ -19,8 +19,19 @@ internal class BinaryDataStore(private val dir: File) {
     fun loadData(name: String): ByteArray =
         File(dir, name).readBytes()
 
+    fun getFile(name: String): File = File(dir, name)
+
+    /**
+     * Writes to a temporary file renamed over the old one, so clients still
+     * mapping the old file keep reading intact data.
+     */
     fun saveData(name: String, byteArray: ByteArray) {
-        File(dir, name).writeBytes(byteArray)
+        val tmp = File(dir, "$name.tmp")
+        tmp.writeBytes(byteArray)
+        if (!tmp.renameTo(File(dir, name))) {
+            tmp.delete()
+            Timber.v("BinaryDataStore: failed to save $name")
+        }
     }
 
     fun clearData(name: String) {
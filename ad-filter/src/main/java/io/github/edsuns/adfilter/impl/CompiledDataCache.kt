@@ -0,0 +1,85 @@
+package io.github.edsuns.adfilter.impl
+
+import android.system.ErrnoException
+import android.system.Os
+import io.github.edsuns.adblockclient.AdBlockClient
+import io.github.edsuns.adfilter.util.sha256
+import timber.log.Timber
+import java.io.File
+
+/**
+ * Processed data keyed by the hash of the raw filter list it was compiled from
+ * and the engine format version, so a list which was compiled before, e.g. one
+ * flipping between mirror versions, is never parsed again.
+ *
+ * Cached data is hard linked to the file a filter is loaded from, the two names
+ * share the data on disk and removing one doesn't affect the other.
+ */
+internal class CompiledDataCache(private val dir: File) {
+
+    init {
+        if (!dir.exists() && !dir.mkdirs()) {
+            Timber.v("CompiledDataCache: failed to create cache dirs")
+        }
+    }
+
+    /**
+     * Data of other engine versions gets other keys, so it's never used.
+     */
+    fun keyOf(rawData: ByteArray): String =
+        "${rawData.sha256}_v${AdBlockClient.engineFormatVersion}"
+
+    /**
+     * Same key as [keyOf] for the content of [rawFile], which is hashed as a stream.
+     */
+    fun keyOf(rawFile: File): String =
+        "${rawFile.sha256}_v${AdBlockClient.engineFormatVersion}"
+
+    fun getFile(key: String): File = File(dir, key)
+
+    /**
+     * Replaces [target] atomically with the cached data of [key].
+     *
+     * @return false if nothing is cached for [key] or it can't be linked
+     */
+    fun install(key: String, target: File): Boolean {
+        val data = getFile(key)
+        if (!data.exists()) {
+            return false
+        }
+        val tmp = File(target.path + ".tmp")
+        tmp.delete()
+        try {
+            Os.link(data.path, tmp.path)
+        } catch (e: ErrnoException) {
+            Timber.v(e, "CompiledDataCache: failed to link $key")
+            return false
+        }
+        if (!tmp.renameTo(target)) {
+            tmp.delete()
+            Timber.v("CompiledDataCache: failed to install $key")
+            return false
+        }
+        // trim() keeps the most recently used data
+        data.setLastModified(System.currentTimeMillis())
+        return true
+    }
+
+    fun remove(key: String) {
+        getFile(key).delete()
+    }
+
+    /**
+     * Removes the least recently used data beyond [MAX_ENTRIES].
+     */
+    fun trim() {
+        val files = dir.listFiles() ?: return
+        files.sortedByDescending { it.lastModified() }
+            .drop(MAX_ENTRIES)
+            .forEach { it.delete() }
+    }
+
+    companion object {
+        const val MAX_ENTRIES = 16
+    }
+}
@@ -5,6 +5,7 @@ package io.github.edsuns.adfilter.impl
  */
 internal object Constants {
     const val FILE_STORE_DIR = "filter_data"
+    const val COMPILED_DATA_DIR = "compiled"
     const val KEY_FILTER_ID = "KEY_FILTER_ID"
     const val KEY_DOWNLOAD_URL = "KEY_DOWNLOAD_URL"
     const val KEY_DOWNLOADED_DATA = "KEY_DOWNLOADED_DATA"
@@ -1,9 +1,7 @@
 package io.github.edsuns.adfilter.impl
 
 import io.github.edsuns.adblockclient.Client
-import io.github.edsuns.adblockclient.MatchResult
 import io.github.edsuns.adblockclient.ResourceType
-import io.github.edsuns.adblockclient.hasException
 import timber.log.Timber
 import java.util.concurrent.CopyOnWriteArrayList
 
@@ -22,6 +20,7 @@ internal interface Detector {
     fun getExtendedCssSelectors(documentUrl: String): List<String>
     fun getCssRules(documentUrl: String): List<String>
     fun getScriptlets(documentUrl: String): List<String>
+    fun trimMemory(level: Int)
 }
 
 internal class DetectorImpl : Detector {
@@ -73,26 +72,30 @@ internal class DetectorImpl : Detector {
         resourceType: ResourceType
     ): String? {
         // custom filter have a higher priority, match it first
-        customFilterClient?.matches(url, documentUrl, resourceType)?.let {
-            if (it.hasException) {
+        customFilterClient?.let {
+            val match = it.matchesPacked(url, documentUrl, resourceType)
+            if (match.hasException) {
                 return null// don't block exception
             }
-            if (it.shouldBlock) {
-                return it.matchedRule
+            if (match.shouldBlock) {
+                return it.getRuleText(match.matchedRuleId)
             }
         }
 
-        var shouldBlock: MatchResult? = null
+        // only look up the rule text of the final result
+        var blockingClient: Client? = null
+        var blockingRuleId = -1
         for (client in clients) {
-            val match: MatchResult = client.matches(url, documentUrl, resourceType)
+            val match = client.matchesPacked(url, documentUrl, resourceType)
             if (match.hasException) {
                 return null// don't block exception
             }
             if (match.shouldBlock) {
-                shouldBlock = match
+                blockingClient = client
+                blockingRuleId = match.matchedRuleId
             }
         }
-        return shouldBlock?.matchedRule
+        return blockingClient?.getRuleText(blockingRuleId)
     }
 
     override fun getElementHidingSelectors(documentUrl: String): String {
@@ -136,4 +139,13 @@ internal class DetectorImpl : Detector {
     override fun getScriptlets(documentUrl: String): List<String> =
         getRulesIntoList { it.getScriptlets(documentUrl) }
 
+    override fun trimMemory(level: Int) {
+        var freed = 0L
+        for (client in clients) {
+            freed += client.trimMemory(level)
+        }
+        customFilterClient?.let { freed += it.trimMemory(level) }
+        Timber.v("Trimmed $freed bytes (level $level)")
+    }
+
 }
\ No newline at end of file
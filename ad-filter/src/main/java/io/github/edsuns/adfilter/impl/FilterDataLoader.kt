@@ -9,21 +9,43 @@ import timber.log.Timber
  */
 internal class FilterDataLoader(
     val detector: Detector,
-    private val binaryDataStore: BinaryDataStore
+    private val binaryDataStore: BinaryDataStore,
+    private val compiledDataCache: CompiledDataCache
 ) {
 
-    fun load(id: String) {
-        if (binaryDataStore.hasData(id)) {
-            val client = AdBlockClient(id)
-            client.loadProcessedData(binaryDataStore.loadData(id))
-            if (id == ID_CUSTOM) {
-                detector.customFilterClient = client
-            } else {
-                detector.addClient(client)
-            }
-        } else {
+    /**
+     * @return false if the processed data is missing or can't be loaded, e.g. because
+     * it was processed by an older version of the engine and has to be reinstalled
+     */
+    fun load(id: String): Boolean {
+        // the processed custom filter is saved in the background and may be older than
+        // its rules, so it's looked up by the rules
+        if (id == ID_CUSTOM) {
+            return binaryDataStore.hasData(RAW_CUSTOM)
+                    && processCustomFilter(binaryDataStore.loadData(RAW_CUSTOM))
+        }
+        if (!binaryDataStore.hasData(id)) {
             Timber.v("Couldn't find client processed data: $id")
+            return false
+        }
+        if (loadClient(id)) {
+            return true
         }
+        Timber.v("Couldn't load client processed data: $id")
+        return false
+    }
+
+    private fun loadClient(id: String): Boolean {
+        val client = AdBlockClient(id)
+        if (!client.loadProcessedFile(binaryDataStore.getFile(id))) {
+            return false
+        }
+        if (id == ID_CUSTOM) {
+            detector.customFilterClient = client
+        } else {
+            detector.addClient(client)
+        }
+        return true
     }
 
     fun unload(id: String) {
@@ -51,10 +73,38 @@ internal class FilterDataLoader(
 
     fun loadCustomFilter(rawData: ByteArray) {
         binaryDataStore.saveData(RAW_CUSTOM, rawData)
+        processCustomFilter(rawData)
+    }
+
+    @Synchronized
+    private fun processCustomFilter(rawData: ByteArray): Boolean {
+        val key = compiledDataCache.keyOf(rawData)
+        val file = binaryDataStore.getFile(ID_CUSTOM)
+        if (compiledDataCache.install(key, file)) {
+            if (loadClient(ID_CUSTOM)) {
+                return true
+            }
+            // the cached data is corrupted, it's compiled again
+            compiledDataCache.remove(key)
+        }
+        // the parsed client is used right away and saved for the next start meanwhile
         val client = AdBlockClient(ID_CUSTOM)
         client.loadBasicData(rawData, true)
-        binaryDataStore.saveData(ID_CUSTOM, client.getProcessedData())
-        load(ID_CUSTOM)
+        detector.customFilterClient = client
+        client.saveProcessedDataAsync(compiledDataCache.getFile(key)) { saved ->
+            synchronized(this@FilterDataLoader) {
+                // newer rules replaced the client while it was saved
+                if (detector.customFilterClient !== client) {
+                    return@synchronized
+                }
+                if (saved && compiledDataCache.install(key, file)) {
+                    compiledDataCache.trim()
+                } else {
+                    Timber.v("Couldn't save client processed data: $ID_CUSTOM")
+                }
+            }
+        }
+        return true
     }
 
     fun unloadCustomFilter() {
@@ -140,7 +140,14 @@ internal class FilterViewModelImpl constructor(
 
     internal fun enableFilter(filter: Filter) {
         if (isEnabled.value == true && filter.filtersCount > 0) {
-            filterDataLoader.load(filter.id)
+            if (!filterDataLoader.load(filter.id)) {
+                // processed data of an older engine version, install the filter again.
+                // Marked enabled first, so the installation enables it when it succeeds.
+                filter.isEnabled = true
+                filter.checksum = ""
+                download(filter.id)
+                return
+            }
             filter.isEnabled = true
             updateEnabledFilterCount()
             // notify onDirty
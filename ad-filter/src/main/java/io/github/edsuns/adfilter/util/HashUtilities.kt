@@ -1,11 +1,29 @@
 package io.github.edsuns.adfilter.util
 
+import java.io.File
 import java.math.BigInteger
 import java.security.MessageDigest
 
 val ByteArray.sha256: String
     get() = sha("SHA-256", this)
 
+/**
+ * Hashes the file in chunks, it's never read into memory as a whole.
+ */
+val File.sha256: String
+    get() {
+        val md = MessageDigest.getInstance("SHA-256")
+        inputStream().use { input ->
+            val buffer = ByteArray(DEFAULT_BUFFER_SIZE)
+            var read = input.read(buffer)
+            while (read >= 0) {
+                md.update(buffer, 0, read)
+                read = input.read(buffer)
+            }
+        }
+        return toHex(md.digest())
+    }
+
 
 fun ByteArray.verifySha256(sha256: String): Boolean {
     return this.sha256 == sha256
@@ -18,10 +36,10 @@ fun String.verifySha1(sha1: String): Boolean {
     return this.sha1 == sha1
 }
 
-private fun sha(algorithm: String, bytes: ByteArray): String {
-    val digest = hash(algorithm, bytes)
-    return String.format("%0" + digest.size * 2 + "x", BigInteger(1, digest))
-}
+private fun sha(algorithm: String, bytes: ByteArray): String = toHex(hash(algorithm, bytes))
+
+private fun toHex(digest: ByteArray): String =
+    String.format("%0" + digest.size * 2 + "x", BigInteger(1, digest))
 
 fun md5(bytes: ByteArray): ByteArray {
     return hash("MD5", bytes)
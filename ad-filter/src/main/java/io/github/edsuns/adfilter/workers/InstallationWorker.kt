@@ -16,6 +16,7 @@ import io.github.edsuns.adfilter.impl.Constants.KEY_FILTER_NAME
 import io.github.edsuns.adfilter.impl.Constants.KEY_RAW_CHECKSUM
 import io.github.edsuns.adfilter.util.Checksum
 import timber.log.Timber
+import java.io.File
 
 /**
  * Created by Edsuns@qq.com on 2021/1/5.
@@ -24,46 +25,71 @@ internal class InstallationWorker(context: Context, params: WorkerParameters) :
     context,
     params
 ) {
-    private val binaryDataStore = (AdFilter.get(applicationContext) as AdFilterImpl).binaryDataStore
+    private val adFilter = AdFilter.get(applicationContext) as AdFilterImpl
+    private val binaryDataStore = adFilter.binaryDataStore
+    private val compiledDataCache = adFilter.compiledDataCache
 
     override fun doWork(): Result {
         val id = inputData.getString(KEY_FILTER_ID) ?: return Result.failure()
         val downloadedDataName = inputData.getString(KEY_DOWNLOADED_DATA) ?: return Result.failure()
         val rawChecksum = inputData.getString(KEY_RAW_CHECKSUM) ?: return Result.failure()
         val checkLicense = inputData.getBoolean(KEY_CHECK_LICENSE, false)
-        val rawData = binaryDataStore.loadData(downloadedDataName)
-        val dataStr = String(rawData)
-        val name = extractTitle(dataStr)
-        val checksum = Checksum(dataStr)
+        val downloadedFile = binaryDataStore.getFile(downloadedDataName)
+        val compiledKey = compiledDataCache.keyOf(downloadedFile)
+        val list = inspectList(downloadedFile, checkLicense)
         // reject filter that doesn't include both checksum and license if checkLicense is true
-        if (checksum.checksumIn == null && checkLicense && !validateLicense(dataStr)) {
+        if (list.isRejected) {
             Timber.v("Filter is invalid: $id")
             return Result.success()
         }
-        Timber.v("Checksum: $rawChecksum, ${checksum.checksumIn}, ${checksum.checksumCalc}, ${checksum.validate()}")
-        if (!checksum.validate()) {
+        Timber.v("Checksum: $rawChecksum, ${list.checksumIn}, ${list.checksumCalc}, ${list.isValid}")
+        if (!list.isValid) {
             return Result.failure()
         }
-        if (checksum.validate(rawChecksum)) {
+        if (list.checksumCalc == rawChecksum) {
             Timber.v("Filter is up to date: $id")
             return Result.success(
                 workDataOf(
-                    KEY_FILTER_NAME to name,
+                    KEY_FILTER_NAME to list.name,
                     KEY_ALREADY_UP_TO_DATE to true
                 )
             )
         }
-        val filtersCount = persistFilterData(id, rawData)
+        val filtersCount = persistFilterData(id, downloadedDataName, compiledKey) ?: return Result.failure()
         binaryDataStore.clearData(downloadedDataName)
         return Result.success(
             workDataOf(
                 KEY_FILTERS_COUNT to filtersCount,
-                KEY_FILTER_NAME to name,
-                KEY_RAW_CHECKSUM to checksum.checksumCalc
+                KEY_FILTER_NAME to list.name,
+                KEY_RAW_CHECKSUM to list.checksumCalc
             )
         )
     }
 
+    private class ListInfo(
+        val name: String?,
+        val checksumIn: String?,
+        val checksumCalc: String,
+        val isValid: Boolean,
+        val isRejected: Boolean
+    )
+
+    /**
+     * Checks the text of the list, which isn't kept afterwards, so it can be
+     * collected before the engine parses the file.
+     */
+    private fun inspectList(file: File, checkLicense: Boolean): ListInfo {
+        val dataStr = file.bufferedReader().use { it.readText() }
+        val checksum = Checksum(dataStr)
+        return ListInfo(
+            name = extractTitle(dataStr),
+            checksumIn = checksum.checksumIn,
+            checksumCalc = checksum.checksumCalc,
+            isValid = checksum.validate(),
+            isRejected = checksum.checksumIn == null && checkLicense && !validateLicense(dataStr)
+        )
+    }
+
     private val licenseRegexp = Regex(
         "^\\s*!\\s*licen[sc]e[\\s\\-:]+([\\S ]+)$",
         setOf(RegexOption.IGNORE_CASE, RegexOption.MULTILINE)
@@ -82,10 +108,34 @@ internal class InstallationWorker(context: Context, params: WorkerParameters) :
 
     private fun extractTitle(data: String): String? = titleRegexp.find(data)?.groupValues?.get(1)
 
-    private fun persistFilterData(id: String, rawBytes: ByteArray): Int {
+    /**
+     * Reuses the processed data of [compiledKey] if the same list was compiled before.
+     *
+     * @return the number of filters or null if the processed data can't be saved
+     */
+    private fun persistFilterData(id: String, downloadedDataName: String, compiledKey: String): Int? {
+        val file = binaryDataStore.getFile(id)
+        if (compiledDataCache.install(compiledKey, file)) {
+            val client = AdBlockClient(id)
+            if (client.loadProcessedFile(file)) {
+                Timber.v("Reused processed data: $id")
+                return client.getFiltersCount()
+            }
+            // the cached data is corrupted, it's compiled again
+            compiledDataCache.remove(compiledKey)
+        }
         val client = AdBlockClient(id)
-        client.loadBasicData(rawBytes, true)
-        binaryDataStore.saveData(id, client.getProcessedData())
+        if (!client.loadBasicFile(binaryDataStore.getFile(downloadedDataName), true)) {
+            Timber.v("Failed to parse downloaded data: $id")
+            return null
+        }
+        if (!client.saveProcessedData(compiledDataCache.getFile(compiledKey))
+            || !compiledDataCache.install(compiledKey, file)
+        ) {
+            Timber.v("Failed to save processed data: $id")
+            return null
+        }
+        compiledDataCache.trim()
         return client.getFiltersCount()
     }
 }
\ No newline at end of file
@@ -1,2 +1,4 @@
 # keep <init> function, which will be called by native lib
 -keepclassmembers class io.github.edsuns.adblockclient.MatchResult { <init>(boolean,java.lang.String,java.lang.String); }
+# looked up by name in JNI_OnLoad and called by the native save thread
+-keep interface io.github.edsuns.adblockclient.AdBlockClient$SaveCallback { *; }
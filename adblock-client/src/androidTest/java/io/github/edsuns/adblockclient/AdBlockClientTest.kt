@@ -16,8 +16,15 @@
 
 package io.github.edsuns.adblockclient
 
+import android.content.ComponentCallbacks2
+import org.json.JSONObject
 import org.junit.Assert.*
 import org.junit.Test
+import java.io.File
+import java.nio.ByteBuffer
+import java.nio.ByteOrder
+import java.util.concurrent.CountDownLatch
+import java.util.concurrent.TimeUnit
 
 /**
  * Modified by Edsuns@qq.com.
@@ -34,6 +41,25 @@ class AdBlockClientTest {
         private const val trackerUrl = "http://imasdk.googleapis.com/js/sdkloader/ima3.js"
         private const val nonTrackerUrl = "http://duckduckgo.com/index.html"
         private val resourceType = ResourceType.UNKNOWN
+        private val regexRules = listOf(
+            "/^https?:\\/\\/ads[0-9]+\\.example\\.com\\//",
+            "/\\/(banner|popup)\\.js$/",
+            "/[?&]uid=[a-f0-9]{8}&/",
+            "/(adzone)\\1/"
+        ).joinToString("\n")
+        // Rules which share domain lists, selectors and scriptlet arguments
+        private val sharedStringRules = listOf(
+            "||ads.net^\$domain=a.com|b.com",
+            "||track.net^\$script,domain=a.com|b.com",
+            "@@||ads.net/ok^\$domain=a.com|b.com",
+            "a.com,b.com##.ad-box",
+            "c.com##.ad-box",
+            "a.com,b.com##.sidebar",
+            "a.com#\$#.ad-box { display: none !important; }",
+            "b.com#\$#.ad-box { display: none !important; }",
+            "a.com#%#//scriptlet(\"set-constant\", \"adsEnabled\", \"false\")",
+            "b.com#%#//scriptlet(\"set-constant\", \"adsEnabled\", \"false\")"
+        ).joinToString("\n")
     }
 
     @Test
@@ -72,6 +98,102 @@ class AdBlockClientTest {
         assertFalse(result.shouldBlock)
     }
 
+    @Test
+    fun whenMatchedPackedThenResultIsSameAsMatchResult() {
+        val testee = AdBlockClient(id)
+        testee.loadBasicData(data(), true)
+        val exceptionUrl = "https://exception-rule.com/a/b/info"
+        for (url in listOf(trackerUrl, nonTrackerUrl, exceptionUrl)) {
+            val result = testee.matches(url, documentUrl, resourceType)
+            val packed = testee.matchesPacked(url, documentUrl, resourceType)
+            assertEquals(result.shouldBlock, packed.shouldBlock)
+            assertEquals(result.hasException, packed.hasException)
+            assertEquals(result.matchedRule, testee.getRuleText(packed.matchedRuleId))
+            assertEquals(
+                result.matchedExceptionRule,
+                testee.getRuleText(packed.matchedExceptionRuleId)
+            )
+        }
+        assertFalse(testee.matchesPacked(nonTrackerUrl, documentUrl, resourceType).shouldBlock)
+    }
+
+    @Test
+    fun whenMatchedBytesThenResultIsSameAsString() {
+        val testee = AdBlockClient(id)
+        testee.loadBasicData(data(), true)
+        val exceptionUrl = "https://exception-rule.com/a/b/info"
+        val nonAsciiUrl = "http://imasdk.googleapis.com/js/sdkloader/ima3.js?q=广告"
+        for (url in listOf(trackerUrl, nonTrackerUrl, exceptionUrl, nonAsciiUrl)) {
+            val expected = testee.matchesPacked(url, documentUrl, resourceType)
+            val bytes = url.toByteArray()
+            val buffer = ByteBuffer.allocateDirect(bytes.size).put(bytes)
+            buffer.flip()
+            assertEquals(expected, testee.matchesPacked(bytes, documentUrl, resourceType))
+            assertEquals(expected, testee.matchesPacked(buffer, documentUrl, resourceType))
+        }
+        val padded = "xx$trackerUrl".toByteArray()
+        assertTrue(testee.matchesPacked(padded, documentUrl, resourceType, 2).shouldBlock)
+        assertFalse(testee.matchesPacked(padded, documentUrl, resourceType, 2, padded.size).shouldBlock)
+    }
+
+    @Test
+    fun whenDirectBufferEndsInsideProtocolThenNothingPastItIsRead() {
+        val testee = AdBlockClient(id)
+        testee.loadBasicData(data())
+        for (url in listOf("https:", "https:/", "blob", "blob:", "blob:http", "wss:/")) {
+            val bytes = url.toByteArray()
+            val buffer = ByteBuffer.allocateDirect(bytes.size).put(bytes)
+            buffer.flip()
+            assertFalse(testee.matchesPacked(buffer, documentUrl, resourceType).shouldBlock)
+            assertNull(testee.getElementHidingSelectors(buffer))
+        }
+        val bytes = trackerUrl.toByteArray()
+        val buffer = ByteBuffer.allocateDirect(bytes.size).put(bytes)
+        buffer.flip()
+        assertFalse(testee.matchesPacked(buffer, documentUrl, resourceType, "https:".length).shouldBlock)
+        assertTrue(testee.matchesPacked(buffer, documentUrl, resourceType).shouldBlock)
+    }
+
+    @Test
+    fun whenRegexRulesLoadedThenAnchorsClassesAndQuantifiersAreHonored() {
+        val testee = AdBlockClient(id)
+        testee.loadBasicData(regexRules.toByteArray(), true)
+        fun blocks(url: String) = testee.matches(url, documentUrl, resourceType).shouldBlock
+        assertTrue(blocks("https://ads12.example.com/x.js"))
+        assertFalse(blocks("https://ads.example.com/x.js"))
+        assertFalse(blocks("https://cdn.net/?u=https://ads12.example.com/"))
+        assertTrue(blocks("https://cdn.example.org/static/banner.js"))
+        assertTrue(blocks("https://cdn.example.org/static/popup.js"))
+        assertFalse(blocks("https://cdn.example.org/static/banner.jsx"))
+        assertFalse(blocks("https://cdn.example.org/static/header.js"))
+        assertTrue(blocks("https://t.example.org/p?x=1&uid=0a1b2c3d&y=2"))
+        assertFalse(blocks("https://t.example.org/p?x=1&uid=0a1b2c3g&y=2"))
+        assertFalse(blocks("https://t.example.org/p?x=1&uid=0a1b2c3&y=2"))
+    }
+
+    @Test
+    fun whenRegexNeedsFallbackThenLongInputIsNotSearched() {
+        val testee = AdBlockClient(id)
+        testee.loadBasicData(regexRules.toByteArray(), true)
+        fun blocks(url: String) = testee.matches(url, documentUrl, resourceType).shouldBlock
+        val longTail = "a".repeat(20000)
+        // Backreferences only run on std::regex, which is skipped past its step budget
+        assertTrue(blocks("https://example.net/adzoneadzone"))
+        assertFalse(blocks("https://example.net/adzoneadzone?$longTail"))
+        // The linear time automaton has no budget
+        assertTrue(blocks("https://ads1.example.com/$longTail"))
+    }
+
+    @Test
+    fun whenGetSelectorsForBytesThenSameAsString() {
+        val testee = loadClientFromProcessedData()
+        testee.isGenericElementHidingEnabled = true
+        assertEquals(
+            testee.getElementHidingSelectors(documentUrl),
+            testee.getElementHidingSelectors(documentUrl.toByteArray())
+        )
+    }
+
     @Test
     fun whenProcessedDataLoadedThenTrackerIsBlocked() {
         val testee = loadClientFromProcessedData()
@@ -94,6 +216,135 @@ class AdBlockClientTest {
         assertFalse(result.shouldBlock)
     }
 
+    @Test
+    fun whenProcessedFileLoadedThenTrackerIsBlockedAndExceptionIsNot() {
+        val original = AdBlockClient(id)
+        original.loadBasicData(data(), true)
+        val file = File.createTempFile(id, null)
+        file.writeBytes(original.getProcessedData())
+        val testee = AdBlockClient(id)
+        assertTrue(testee.loadProcessedFile(file))
+        file.delete()
+        assertTrue(testee.matches(trackerUrl, documentUrl, resourceType).shouldBlock)
+        val exceptionUrl = "https://exception-rule.com/a/b/info"
+        assertTrue(testee.matches(exceptionUrl, documentUrl, resourceType).hasException)
+    }
+
+    @Test
+    fun whenProcessedFileCorruptedThenItIsRejected() {
+        val original = AdBlockClient(id)
+        original.loadBasicData(data(), true)
+        val data = original.getProcessedData()
+        val badMagic = data.copyOf().also { it[0] = (it[0].toInt() xor 1).toByte() }
+        val oldVersion = data.copyOf().also { it[4] = (it[4] - 1).toByte() }
+        val badCrc = data.copyOf().also { it[it.size - 1] = (it[it.size - 1].toInt() xor 0x55).toByte() }
+        val truncated = data.copyOf(data.size - 1)
+        val truncatedHeader = data.copyOf(10)
+        val file = File.createTempFile(id, null)
+        for (corrupted in listOf(badMagic, oldVersion, badCrc, truncated, truncatedHeader)) {
+            file.writeBytes(corrupted)
+            val testee = AdBlockClient(id)
+            assertFalse(testee.loadProcessedFile(file))
+            assertFalse(testee.matches(trackerUrl, documentUrl, resourceType).shouldBlock)
+        }
+        file.writeBytes(data)
+        assertTrue(AdBlockClient(id).loadProcessedFile(file))
+        file.delete()
+    }
+
+    @Test
+    fun whenCompressedSectionsLoadedThenSelectorsAreUnchanged() {
+        val original = AdBlockClient(id)
+        original.loadBasicData(data(), true)
+        original.isGenericElementHidingEnabled = true
+        val testee = loadClientFromProcessedData()
+        testee.isGenericElementHidingEnabled = true
+        for (url in listOf(documentUrl, nonTrackerUrl, trackerUrl)) {
+            assertEquals(original.getElementHidingSelectors(url), testee.getElementHidingSelectors(url))
+            assertArrayEquals(original.getCssRules(url), testee.getCssRules(url))
+            assertArrayEquals(original.getScriptlets(url), testee.getScriptlets(url))
+        }
+    }
+
+    @Test
+    fun whenCompressedSectionMalformedThenItLoadsEmpty() {
+        val original = AdBlockClient(id)
+        original.loadBasicData(data(), true)
+        val data = original.getProcessedData()
+        val header = ByteBuffer.wrap(data).order(ByteOrder.LITTLE_ENDIAN)
+        // The element hiding section, stored compressed, see binary_format.h
+        val entry = 68 + 17 * 20
+        assertEquals(1, header.getInt(entry + 4))
+        val offset = header.getInt(entry + 8)
+        val size = header.getInt(entry + 12)
+        // Literal lengths which run past the end of the LZ4 block
+        data.fill(0xff.toByte(), offset + 4, offset + size)
+        header.putInt(entry + 16, crc32c(data, offset, size))
+        val tableEnd = 68 + header.getInt(12) * 20 + 4
+        header.putInt(tableEnd - 4, crc32c(data, 0, tableEnd - 4))
+        val testee = AdBlockClient(id)
+        testee.loadProcessedData(data)
+        testee.isGenericElementHidingEnabled = true
+        assertEquals("#videoad", testee.getElementHidingSelectors(documentUrl))
+        assertTrue(testee.matches(trackerUrl, documentUrl, resourceType).shouldBlock)
+    }
+
+    @Test
+    fun whenProcessedDataSavedThenFileLoadsIdenticalData() {
+        val original = AdBlockClient(id)
+        original.loadBasicData(data(), true)
+        val file = File.createTempFile(id, null)
+        assertTrue(original.saveProcessedData(file))
+        assertArrayEquals(original.getProcessedData(), file.readBytes())
+        val testee = AdBlockClient(id)
+        assertTrue(testee.loadProcessedFile(file))
+        file.delete()
+        assertTrue(testee.matches(trackerUrl, documentUrl, resourceType).shouldBlock)
+    }
+
+    @Test
+    fun whenProcessedDataSavedInBackgroundThenClientKeepsMatching() {
+        val original = AdBlockClient(id)
+        original.loadBasicData(data(), true)
+        val file = File.createTempFile(id, null)
+        val saved = CountDownLatch(1)
+        var result = false
+        original.saveProcessedDataAsync(file) {
+            result = it
+            saved.countDown()
+        }
+        assertTrue(original.matches(trackerUrl, documentUrl, resourceType).shouldBlock)
+        assertTrue(saved.await(10, TimeUnit.SECONDS))
+        assertTrue(result)
+        assertArrayEquals(original.getProcessedData(), file.readBytes())
+        file.delete()
+    }
+
+    @Test
+    fun whenProcessedDataSharedThenSharedDataLoadsIdenticalData() {
+        val original = AdBlockClient(id)
+        original.loadBasicData(data(), true)
+        val fd = original.shareProcessedData() ?: return
+        val testee = AdBlockClient(id)
+        assertTrue(testee.loadSharedData(fd))
+        fd.close()
+        assertArrayEquals(original.getProcessedData(), testee.getProcessedData())
+        assertTrue(testee.matches(trackerUrl, documentUrl, resourceType).shouldBlock)
+    }
+
+    @Test
+    fun whenBasicFileLoadedThenProcessedDataIsIdentical() {
+        val original = AdBlockClient(id)
+        original.loadBasicData(data(), true)
+        val file = File.createTempFile(id, null)
+        file.writeBytes(data())
+        val testee = AdBlockClient(id)
+        assertTrue(testee.loadBasicFile(file, true))
+        file.delete()
+        assertArrayEquals(original.getProcessedData(), testee.getProcessedData())
+        assertTrue(testee.matches(trackerUrl, documentUrl, resourceType).shouldBlock)
+    }
+
     @Test
     fun whenProcessedDataLoadedThenUrlBlockedByRegexRule() {
         val testee = loadClientFromProcessedData()
@@ -104,6 +355,37 @@ class AdBlockClientTest {
         assertFalse(result.matchedRule.isNullOrBlank())
     }
 
+    @Test
+    fun whenRulesShareStringsThenProcessedDataMatchesTheSame() {
+        val original = AdBlockClient(id)
+        original.loadBasicData(sharedStringRules.toByteArray(), true)
+        val testee = AdBlockClient(id)
+        testee.loadProcessedData(original.getProcessedData())
+        val urls = listOf("https://ads.net/x", "https://ads.net/ok/x", "https://track.net/x.js")
+        for (document in listOf("https://a.com/", "https://b.com/", "https://c.com/", "https://d.com/")) {
+            for (url in urls) {
+                val expected = original.matches(url, document, ResourceType.SCRIPT)
+                val result = testee.matches(url, document, ResourceType.SCRIPT)
+                assertEquals(expected.shouldBlock, result.shouldBlock)
+                assertEquals(expected.hasException, result.hasException)
+                assertEquals(expected.matchedRule, result.matchedRule)
+                assertEquals(expected.matchedExceptionRule, result.matchedExceptionRule)
+            }
+            assertEquals(original.getElementHidingSelectors(document), testee.getElementHidingSelectors(document))
+            assertArrayEquals(original.getCssRules(document), testee.getCssRules(document))
+            assertArrayEquals(original.getScriptlets(document), testee.getScriptlets(document))
+        }
+        assertTrue(testee.matches(urls[0], "https://b.com/", ResourceType.SCRIPT).shouldBlock)
+        assertTrue(testee.matches(urls[1], "https://b.com/", ResourceType.SCRIPT).hasException)
+        assertEquals(".sidebar, .ad-box", testee.getElementHidingSelectors("https://b.com/"))
+        assertEquals(".ad-box", testee.getElementHidingSelectors("https://c.com/"))
+        assertEquals(1, testee.getCssRules("https://b.com/")?.size)
+        assertEquals(
+            "\"set-constant\", \"adsEnabled\", \"false\"",
+            testee.getScriptlets("https://a.com/")?.single()
+        )
+    }
+
     @Test
     fun whenGetSelectorsForNonTrackerUrlThenOnlyObtainGenericSelectors() {
         val testee = loadClientFromProcessedData()
@@ -127,6 +409,48 @@ class AdBlockClientTest {
         assertFalse(selectors.contains("#videoads"))
     }
 
+    @Test
+    fun whenMemoryTrimmedThenResultsAreLoadedAgain() {
+        val testee = loadClientFromProcessedData()
+        testee.isGenericElementHidingEnabled = true
+        val selectors = testee.getElementHidingSelectors(documentUrl)
+        val rule = testee.matches(trackerUrl, documentUrl, resourceType).matchedRule
+        assertTrue(testee.trimMemory(ComponentCallbacks2.TRIM_MEMORY_COMPLETE) > 0)
+        assertEquals(selectors, testee.getElementHidingSelectors(documentUrl))
+        assertEquals(rule, testee.matches(trackerUrl, documentUrl, resourceType).matchedRule)
+    }
+
+    @Test
+    fun whenMemoryReportedThenStructuresAreListed() {
+        val testee = AdBlockClient(id)
+        testee.loadBasicData(data())
+        val report = JSONObject(testee.getMemoryReport())
+        assertTrue(report.getLong("heapBytes") > 0)
+        val structures = report.getJSONArray("structures")
+        val names = (0 until structures.length()).map { structures.getJSONObject(it).getString("name") }
+        assertTrue(names.contains("filters"))
+        assertTrue(report.getJSONArray("bloomFilters").length() > 0)
+    }
+
+    @Test
+    fun whenLatencyStatsEnabledThenPhasesAreRecorded() {
+        val testee = AdBlockClient(id)
+        testee.loadBasicData(data())
+        assertNull(testee.getLatencyStats())
+        testee.isLatencyStatsEnabled = true
+        testee.matches(trackerUrl, documentUrl, resourceType)
+        testee.getElementHidingSelectors(documentUrl)
+        testee.isLatencyStatsEnabled = false
+        testee.matches(trackerUrl, documentUrl, resourceType)
+        val phases = JSONObject(testee.getLatencyStats()!!).getJSONArray("phases")
+        val counts = (0 until phases.length()).associate {
+            phases.getJSONObject(it).getString("name") to phases.getJSONObject(it).getLong("count")
+        }
+        assertEquals(1L, counts["matches"])
+        assertEquals(1L, counts["urlParse"])
+        assertEquals(1L, counts["elementHidingSelectors"])
+    }
+
     private fun loadClientFromProcessedData(): AdBlockClient {
         val original = AdBlockClient(id)
         original.loadBasicData(data(), true)
@@ -136,6 +460,15 @@ class AdBlockClientTest {
         return testee
     }
 
+    private fun crc32c(data: ByteArray, offset: Int, length: Int): Int {
+        var crc = -1
+        for (i in offset until offset + length) {
+            crc = crc xor (data[i].toInt() and 0xff)
+            repeat(8) { crc = if (crc and 1 != 0) (crc ushr 1) xor 0x82f63b78.toInt() else crc ushr 1 }
+        }
+        return crc.inv()
+    }
+
     private fun data(): ByteArray =
         javaClass.classLoader!!.getResource("binary/easylist_sample").readBytes()
 }
@@ -1,95 +1,131 @@
 #include <jni.h>
+#include <string>
 #include "third-party/ad-block/ad_block_client.h"
-
-extern "C"
-JNIEXPORT jlong
-JNICALL
-Java_io_github_edsuns_adblockclient_AdBlockClient_createClient(JNIEnv *env,
-                                                               jobject) {
+#include "third-party/ad-block/memory_report.h"
+#include "third-party/ad-block/latency_stats.h"
+
+// Looked up once in JNI_OnLoad instead of on every call
+static JavaVM *javaVm;
+static jclass matchResultClass;
+static jmethodID matchResultInit;
+static jclass stringClass;
+static jmethodID stringInit;
+static jstring utf8Encoding;
+static jmethodID saveCallbackOnSaved;
+
+static jlong createClient(JNIEnv *env,
+                          jobject) {
     auto *client = new AdBlockClient();
     return (long) client;
 }
 
-extern "C"
-JNIEXPORT void
-JNICALL
-Java_io_github_edsuns_adblockclient_AdBlockClient_releaseClient(JNIEnv *env,
-                                                                jobject,
-                                                                jlong clientPointer,
-                                                                jlong rawDataPointer,
-                                                                jlong processedDataPointer) {
+static void releaseClient(JNIEnv *env,
+                          jobject,
+                          jlong clientPointer,
+                          jlong processedDataPointer) {
     auto *client = (AdBlockClient *) clientPointer;
     delete client;
 
-    char *rawData = (char *) rawDataPointer;
-    delete[] rawData;
-
     char *processedData = (char *) processedDataPointer;
     delete[] processedData;
 }
 
-extern "C"
-JNIEXPORT jboolean JNICALL
-Java_io_github_edsuns_adblockclient_AdBlockClient_isGenericElementHidingEnabled(JNIEnv *env,
-                                                                                jobject /* this */,
-                                                                                jlong clientPointer) {
+static jint getEngineFormatVersion(JNIEnv *env,
+                                   jclass) {
+    return kEngineFormatVersion;
+}
+
+static jboolean isGenericElementHidingEnabled(JNIEnv *env,
+                                              jobject /* this */,
+                                              jlong clientPointer) {
     auto *client = (AdBlockClient *) clientPointer;
     return client->isGenericElementHidingEnabled;
 }
 
-extern "C"
-JNIEXPORT void JNICALL
-Java_io_github_edsuns_adblockclient_AdBlockClient_setGenericElementHidingEnabled(JNIEnv *env,
-                                                                                 jobject /* this */,
-                                                                                 jlong clientPointer,
-                                                                                 jboolean enabled) {
+static void setGenericElementHidingEnabled(JNIEnv *env,
+                                           jobject /* this */,
+                                           jlong clientPointer,
+                                           jboolean enabled) {
     auto *client = (AdBlockClient *) clientPointer;
     client->isGenericElementHidingEnabled = enabled;
 }
 
-extern "C"
-JNIEXPORT jlong
-JNICALL
-Java_io_github_edsuns_adblockclient_AdBlockClient_loadBasicData(JNIEnv *env,
-                                                                jobject,
-                                                                jlong clientPointer,
-                                                                jbyteArray data,
-                                                                jboolean preserveRules) {
+static void loadBasicData(JNIEnv *env,
+                          jobject,
+                          jlong clientPointer,
+                          jbyteArray data,
+                          jboolean preserveRules) {
     int dataLength = env->GetArrayLength(data);
     char *dataChars = new char[dataLength];
     env->GetByteArrayRegion(data, 0, dataLength, reinterpret_cast<jbyte *>(dataChars));
 
+    // The client keeps the text of the rules it preserves, so the list
+    // itself isn't needed afterwards
     auto *client = (AdBlockClient *) clientPointer;
-    client->parse(dataChars, preserveRules);
+    client->parse(dataChars, dataLength, preserveRules);
 
-    return (long) dataChars;
+    delete[] dataChars;
 }
 
-extern "C"
-JNIEXPORT jlong
-JNICALL
-Java_io_github_edsuns_adblockclient_AdBlockClient_loadProcessedData(JNIEnv *env,
-                                                                    jobject /* this */,
-                                                                    jlong clientPointer,
-                                                                    jbyteArray data) {
+static jboolean loadBasicFile(JNIEnv *env,
+                              jobject /* this */,
+                              jlong clientPointer,
+                              jstring path,
+                              jboolean preserveRules) {
+    const char *pathChars = env->GetStringUTFChars(path, nullptr);
+
+    // Parsed from a mapping of the file, the list is never copied into
+    // a Java array or native memory
+    auto *client = (AdBlockClient *) clientPointer;
+    bool loaded = client->parseFile(pathChars, preserveRules);
+
+    env->ReleaseStringUTFChars(path, pathChars);
+    return loaded;
+}
+
+static jlong loadProcessedData(JNIEnv *env,
+                               jobject /* this */,
+                               jlong clientPointer,
+                               jbyteArray data) {
     int dataLength = env->GetArrayLength(data);
     char *dataChars = new char[dataLength];
     env->GetByteArrayRegion(data, 0, dataLength, reinterpret_cast<jbyte *>(dataChars));
 
     auto *client = (AdBlockClient *) clientPointer;
-    client->deserialize(dataChars);
+    client->deserialize(dataChars, dataLength);
 
     // We cannot delete dataChars here as adblock keeps a ptr to it.
     // Instead we send back a ptr ref so we can delete it later in the release method
     return (long) dataChars;
 }
 
-extern "C"
-JNIEXPORT jbyteArray
-JNICALL
-Java_io_github_edsuns_adblockclient_AdBlockClient_getProcessedData(JNIEnv *env,
-                                                                   jobject /* this */,
-                                                                   jlong clientPointer) {
+static jboolean loadProcessedFile(JNIEnv *env,
+                                  jobject /* this */,
+                                  jlong clientPointer,
+                                  jstring path) {
+    const char *pathChars = env->GetStringUTFChars(path, nullptr);
+
+    // The client maps the file and keeps the mapping itself, so there is
+    // no buffer to hand back for the release method
+    auto *client = (AdBlockClient *) clientPointer;
+    bool loaded = client->deserializeFile(pathChars);
+
+    env->ReleaseStringUTFChars(path, pathChars);
+    return loaded;
+}
+
+static jboolean loadSharedData(JNIEnv *env,
+                               jobject /* this */,
+                               jlong clientPointer,
+                               jint fd) {
+    // Like a processed file, the client keeps the mapping itself
+    auto *client = (AdBlockClient *) clientPointer;
+    return client->deserializeSharedMemory(fd);
+}
+
+static jbyteArray getProcessedData(JNIEnv *env,
+                                   jobject /* this */,
+                                   jlong clientPointer) {
     auto *client = (AdBlockClient *) clientPointer;
 
     int size;
@@ -102,10 +138,63 @@ Java_io_github_edsuns_adblockclient_AdBlockClient_getProcessedData(JNIEnv *env,
     return dataBytes;
 }
 
-extern "C"
-JNIEXPORT jint JNICALL
-Java_io_github_edsuns_adblockclient_AdBlockClient_getFiltersCount(JNIEnv *env, jobject /* this */,
-                                                                  jlong clientPointer) {
+static void saveProcessedDataAsync(JNIEnv *env,
+                                   jobject /* this */,
+                                   jlong clientPointer,
+                                   jstring path,
+                                   jobject callback) {
+    const char *pathChars = env->GetStringUTFChars(path, nullptr);
+    jobject callbackRef = env->NewGlobalRef(callback);
+
+    // The callback runs on the client's save thread, which has to be
+    // attached to the VM to call it
+    auto *client = (AdBlockClient *) clientPointer;
+    client->serializeFileAsync(pathChars, false, [callbackRef](bool saved) {
+        JNIEnv *threadEnv;
+        if (javaVm->AttachCurrentThread(&threadEnv, nullptr) != JNI_OK) {
+            return;
+        }
+        threadEnv->CallVoidMethod(callbackRef, saveCallbackOnSaved, saved);
+        if (threadEnv->ExceptionCheck()) {
+            threadEnv->ExceptionClear();
+        }
+        threadEnv->DeleteGlobalRef(callbackRef);
+        javaVm->DetachCurrentThread();
+    });
+
+    env->ReleaseStringUTFChars(path, pathChars);
+}
+
+static jint shareProcessedData(JNIEnv *env,
+                               jobject /* this */,
+                               jlong clientPointer,
+                               jstring name) {
+    const char *nameChars = env->GetStringUTFChars(name, nullptr);
+
+    auto *client = (AdBlockClient *) clientPointer;
+    int fd = client->serializeToSharedMemory(nameChars, false);
+
+    env->ReleaseStringUTFChars(name, nameChars);
+    return fd;
+}
+
+static jboolean saveProcessedData(JNIEnv *env,
+                                  jobject /* this */,
+                                  jlong clientPointer,
+                                  jstring path) {
+    const char *pathChars = env->GetStringUTFChars(path, nullptr);
+
+    // Written section by section, the data never exists as a whole in
+    // native memory or as a Java array
+    auto *client = (AdBlockClient *) clientPointer;
+    bool saved = client->serializeFile(pathChars, false);
+
+    env->ReleaseStringUTFChars(path, pathChars);
+    return saved;
+}
+
+static jint getFiltersCount(JNIEnv *env, jobject /* this */,
+                            jlong clientPointer) {
     auto *client = (AdBlockClient *) clientPointer;
     int count = client->numFilters
                 + client->numCosmeticFilters
@@ -123,12 +212,10 @@ Java_io_github_edsuns_adblockclient_AdBlockClient_getFiltersCount(JNIEnv *env, j
     return count;
 }
 
-extern "C"
-JNIEXPORT jobject JNICALL
-Java_io_github_edsuns_adblockclient_AdBlockClient_matches(JNIEnv *env, jobject /* this */,
-                                                          jlong clientPointer, jstring url,
-                                                          jstring firstPartyDomain,
-                                                          jint filterOption) {
+static jobject matches(JNIEnv *env, jobject /* this */,
+                       jlong clientPointer, jstring url,
+                       jstring firstPartyDomain,
+                       jint filterOption) {
     jboolean isUrlCopy;
     const char *urlChars = env->GetStringUTFChars(url, &isUrlCopy);
 
@@ -142,15 +229,11 @@ Java_io_github_edsuns_adblockclient_AdBlockClient_matches(JNIEnv *env, jobject /
     bool shouldBlock = client->matches(urlChars, (FilterOption) filterOption, firstPartyDomainChars,
                                        &matchedFilter, &matchedExceptionFilter);
 
-    char *matchedRule = matchedFilter ? matchedFilter->ruleDefinition : nullptr;
-    char *matchedExceptionRule = matchedExceptionFilter ?
-                                 matchedExceptionFilter->ruleDefinition : nullptr;
+    const char *matchedRule = client->getRuleDefinition(matchedFilter);
+    const char *matchedExceptionRule = client->getRuleDefinition(matchedExceptionFilter);
 
     // create java MatchResult
-    jclass match_result_class = env->FindClass("io/github/edsuns/adblockclient/MatchResult");
-    jmethodID init_id = env->GetMethodID(match_result_class, "<init>",
-                                         "(ZLjava/lang/String;Ljava/lang/String;)V");
-    jobject matchResult = env->NewObject(match_result_class, init_id,
+    jobject matchResult = env->NewObject(matchResultClass, matchResultInit,
                                          shouldBlock,
                                          env->NewStringUTF(matchedRule),
                                          env->NewStringUTF(matchedExceptionRule));
@@ -161,6 +244,44 @@ Java_io_github_edsuns_adblockclient_AdBlockClient_matches(JNIEnv *env, jobject /
     return matchResult;
 }
 
+static jlong packMatch(AdBlockClient *client, bool shouldBlock,
+                       Filter *matchedFilter, Filter *matchedExceptionFilter) {
+    jlong matchedId = matchedFilter ? client->getRuleId(matchedFilter) + 1 : 0;
+    jlong matchedExceptionId = matchedExceptionFilter ?
+                               client->getRuleId(matchedExceptionFilter) + 1 : 0;
+    return (shouldBlock ? 1 : 0) | (matchedId & 0x7fffffff) << 1 | (matchedExceptionId & 0x7fffffff) << 32;
+}
+
+// Same as matches() without allocating a MatchResult, packed as:
+// bit 0: shouldBlock
+// bits 1-31: rule id of the matched filter + 1, 0 if none
+// bits 32-62: rule id of the matched exception filter + 1, 0 if none
+static jlong matchesPacked(JNIEnv *env, jobject /* this */,
+                           jlong clientPointer, jstring url,
+                           jstring firstPartyDomain,
+                           jint filterOption) {
+    const char *urlChars = env->GetStringUTFChars(url, nullptr);
+    const char *firstPartyDomainChars = env->GetStringUTFChars(firstPartyDomain, nullptr);
+
+    auto *client = (AdBlockClient *) clientPointer;
+
+    Filter *matchedFilter;
+    Filter *matchedExceptionFilter;
+    bool shouldBlock = client->matches(urlChars, (FilterOption) filterOption, firstPartyDomainChars,
+                                       &matchedFilter, &matchedExceptionFilter);
+
+    env->ReleaseStringUTFChars(url, urlChars);
+    env->ReleaseStringUTFChars(firstPartyDomain, firstPartyDomainChars);
+
+    return packMatch(client, shouldBlock, matchedFilter, matchedExceptionFilter);
+}
+
+static jstring getRuleText(JNIEnv *env, jobject /* this */,
+                           jlong clientPointer, jint ruleId) {
+    auto *client = (AdBlockClient *) clientPointer;
+    return env->NewStringUTF(client->getRuleText(ruleId));
+}
+
 // replacement for NewStringUTF()
 // won't throw JNI ERROR: input is not valid Modified UTF-8
 jstring bytesToStringUTF(JNIEnv *env, const char *src) {
@@ -169,21 +290,18 @@ jstring bytesToStringUTF(JNIEnv *env, const char *src) {
         return nullptr;
     }
     jsize len = strlen(src);
-    jstring encoding = env->NewStringUTF("UTF-8");
-    jclass stringCls = env->FindClass("java/lang/String");
-    jmethodID methodId = env->GetMethodID(stringCls, "<init>", "([BLjava/lang/String;)V");
     jbyteArray bytes = env->NewByteArray(len);
     env->SetByteArrayRegion(bytes, 0, len, (jbyte *) src);
 
-    return (jstring) env->NewObject(stringCls, methodId, bytes, encoding);
+    auto string = (jstring) env->NewObject(stringClass, stringInit, bytes, utf8Encoding);
+    env->DeleteLocalRef(bytes);
+    return string;
 }
 
-extern "C"
-JNIEXPORT jstring JNICALL
-Java_io_github_edsuns_adblockclient_AdBlockClient_getElementHidingSelectors(JNIEnv *env,
-                                                                            jobject /* this */,
-                                                                            jlong clientPointer,
-                                                                            jstring url) {
+static jstring getElementHidingSelectors(JNIEnv *env,
+                                         jobject /* this */,
+                                         jlong clientPointer,
+                                         jstring url) {
     jboolean isUrlCopy;
     const char *urlChars = env->GetStringUTFChars(url, &isUrlCopy);
 
@@ -199,22 +317,21 @@ jobjectArray toStringArray(JNIEnv *env, const LinkedList<std::string> *rules) {
     if (!rules) {
         return nullptr;
     }
-    auto array = env->NewObjectArray(rules->length(),
-                                     env->FindClass("java/lang/String"), nullptr);
+    auto array = env->NewObjectArray(rules->length(), stringClass, nullptr);
     int i = 0;
     for (auto r : *rules) {
-        env->SetObjectArrayElement(array, i, env->NewStringUTF(r.c_str()));
+        jstring rule = env->NewStringUTF(r.c_str());
+        env->SetObjectArrayElement(array, i, rule);
+        env->DeleteLocalRef(rule);
         i++;
     }
     return array;
 }
 
-extern "C"
-JNIEXPORT jobjectArray JNICALL
-Java_io_github_edsuns_adblockclient_AdBlockClient_getExtendedCssSelectors(JNIEnv *env,
-                                                                          jobject /* this */,
-                                                                          jlong clientPointer,
-                                                                          jstring url) {
+static jobjectArray getExtendedCssSelectors(JNIEnv *env,
+                                            jobject /* this */,
+                                            jlong clientPointer,
+                                            jstring url) {
     jboolean isUrlCopy;
     const char *urlChars = env->GetStringUTFChars(url, &isUrlCopy);
 
@@ -226,12 +343,10 @@ Java_io_github_edsuns_adblockclient_AdBlockClient_getExtendedCssSelectors(JNIEnv
     return toStringArray(env, rules);
 }
 
-extern "C"
-JNIEXPORT jobjectArray JNICALL
-Java_io_github_edsuns_adblockclient_AdBlockClient_getCssRules(JNIEnv *env,
-                                                              jobject /* this */,
-                                                              jlong clientPointer,
-                                                              jstring url) {
+static jobjectArray getCssRules(JNIEnv *env,
+                                jobject /* this */,
+                                jlong clientPointer,
+                                jstring url) {
     jboolean isUrlCopy;
     const char *urlChars = env->GetStringUTFChars(url, &isUrlCopy);
 
@@ -243,12 +358,10 @@ Java_io_github_edsuns_adblockclient_AdBlockClient_getCssRules(JNIEnv *env,
     return toStringArray(env, rules);
 }
 
-extern "C"
-JNIEXPORT jobjectArray JNICALL
-Java_io_github_edsuns_adblockclient_AdBlockClient_getScriptlets(JNIEnv *env,
-                                                                jobject /* this */,
-                                                                jlong clientPointer,
-                                                                jstring url) {
+static jobjectArray getScriptlets(JNIEnv *env,
+                                  jobject /* this */,
+                                  jlong clientPointer,
+                                  jstring url) {
     jboolean isUrlCopy;
     const char *urlChars = env->GetStringUTFChars(url, &isUrlCopy);
 
@@ -259,3 +372,250 @@ Java_io_github_edsuns_adblockclient_AdBlockClient_getScriptlets(JNIEnv *env,
 
     return toStringArray(env, rules);
 }
+
+// UTF-8 URLs passed as byte arrays are copied here, the buffer is reused
+// by every call on the same thread
+static thread_local std::string threadUrlBuffer;
+
+// Points to |length| bytes from |offset| of either the direct |buffer|,
+// which is read in place, or |bytes| copied into threadUrlBuffer. nullptr
+// if they don't hold that many.
+static const char *readUrl(JNIEnv *env, jobject buffer, jbyteArray bytes,
+                           jint offset, jint length) {
+    if (offset < 0 || length < 0) {
+        return nullptr;
+    }
+    if (buffer) {
+        auto *address = (const char *) env->GetDirectBufferAddress(buffer);
+        if (!address || env->GetDirectBufferCapacity(buffer) - offset < length) {
+            return nullptr;
+        }
+        return address + offset;
+    } else {
+        if (!bytes || env->GetArrayLength(bytes) - offset < length) {
+            return nullptr;
+        }
+        threadUrlBuffer.resize(length);
+        env->GetByteArrayRegion(bytes, offset, length, (jbyte *) &threadUrlBuffer[0]);
+    }
+    return threadUrlBuffer.c_str();
+}
+
+static jlong matchesBytes(JNIEnv *env, jobject /* this */,
+                          jlong clientPointer, jobject urlBuffer, jbyteArray urlBytes,
+                          jint urlOffset, jint urlLength,
+                          jstring firstPartyDomain,
+                          jint filterOption) {
+    const char *urlChars = readUrl(env, urlBuffer, urlBytes, urlOffset, urlLength);
+    if (!urlChars) {
+        return 0;
+    }
+    // Hosts are ASCII, so their Modified UTF-8 is the same
+    jsize firstPartyDomainLength = env->GetStringUTFLength(firstPartyDomain);
+    const char *firstPartyDomainChars = env->GetStringUTFChars(firstPartyDomain, nullptr);
+
+    auto *client = (AdBlockClient *) clientPointer;
+
+    Filter *matchedFilter;
+    Filter *matchedExceptionFilter;
+    bool shouldBlock = client->matches(urlChars, urlLength, (FilterOption) filterOption,
+                                       firstPartyDomainChars, firstPartyDomainLength,
+                                       &matchedFilter, &matchedExceptionFilter);
+
+    env->ReleaseStringUTFChars(firstPartyDomain, firstPartyDomainChars);
+
+    return packMatch(client, shouldBlock, matchedFilter, matchedExceptionFilter);
+}
+
+static jstring getElementHidingSelectorsBytes(JNIEnv *env,
+                                              jobject /* this */,
+                                              jlong clientPointer,
+                                              jobject urlBuffer, jbyteArray urlBytes,
+                                              jint urlOffset, jint urlLength) {
+    const char *urlChars = readUrl(env, urlBuffer, urlBytes, urlOffset, urlLength);
+    if (!urlChars) {
+        return nullptr;
+    }
+    auto *client = (AdBlockClient *) clientPointer;
+    return bytesToStringUTF(env, client->getUrlElementHidingSelectors(urlChars, urlLength));
+}
+
+static jobjectArray getExtendedCssSelectorsBytes(JNIEnv *env,
+                                                 jobject /* this */,
+                                                 jlong clientPointer,
+                                                 jobject urlBuffer, jbyteArray urlBytes,
+                                                 jint urlOffset, jint urlLength) {
+    const char *urlChars = readUrl(env, urlBuffer, urlBytes, urlOffset, urlLength);
+    if (!urlChars) {
+        return nullptr;
+    }
+    auto *client = (AdBlockClient *) clientPointer;
+    return toStringArray(env, client->getExtendedCssSelectors(urlChars, urlLength));
+}
+
+static jobjectArray getCssRulesBytes(JNIEnv *env,
+                                     jobject /* this */,
+                                     jlong clientPointer,
+                                     jobject urlBuffer, jbyteArray urlBytes,
+                                     jint urlOffset, jint urlLength) {
+    const char *urlChars = readUrl(env, urlBuffer, urlBytes, urlOffset, urlLength);
+    if (!urlChars) {
+        return nullptr;
+    }
+    auto *client = (AdBlockClient *) clientPointer;
+    return toStringArray(env, client->getCssRules(urlChars, urlLength));
+}
+
+static jobjectArray getScriptletsBytes(JNIEnv *env,
+                                       jobject /* this */,
+                                       jlong clientPointer,
+                                       jobject urlBuffer, jbyteArray urlBytes,
+                                       jint urlOffset, jint urlLength) {
+    const char *urlChars = readUrl(env, urlBuffer, urlBytes, urlOffset, urlLength);
+    if (!urlChars) {
+        return nullptr;
+    }
+    auto *client = (AdBlockClient *) clientPointer;
+    return toStringArray(env, client->getScriptlets(urlChars, urlLength));
+}
+
+static jlong trim(JNIEnv *env,
+                  jobject /* this */,
+                  jlong clientPointer,
+                  jint level) {
+    auto *client = (AdBlockClient *) clientPointer;
+    return (jlong) client->trim((TrimLevel) level);
+}
+
+static jstring getMemoryReport(JNIEnv *env,
+                               jobject /* this */,
+                               jlong clientPointer) {
+    auto *client = (AdBlockClient *) clientPointer;
+    MemoryReport report;
+    client->getMemoryReport(&report);
+    return env->NewStringUTF(report.toJson().c_str());
+}
+
+static jboolean isLatencyStatsEnabled(JNIEnv *env,
+                                      jobject /* this */,
+                                      jlong clientPointer) {
+    auto *client = (AdBlockClient *) clientPointer;
+    return client->isLatencyStatsEnabled();
+}
+
+static void setLatencyStatsEnabled(JNIEnv *env,
+                                   jobject /* this */,
+                                   jlong clientPointer,
+                                   jboolean enabled) {
+    auto *client = (AdBlockClient *) clientPointer;
+    client->setLatencyStatsEnabled(enabled);
+}
+
+static jstring getLatencyStats(JNIEnv *env,
+                               jobject /* this */,
+                               jlong clientPointer) {
+    auto *client = (AdBlockClient *) clientPointer;
+    const LatencyStats *stats = client->getLatencyStats();
+    return stats ? env->NewStringUTF(stats->toJson().c_str()) : nullptr;
+}
+
+static void resetLatencyStats(JNIEnv *env,
+                              jobject /* this */,
+                              jlong clientPointer) {
+    auto *client = (AdBlockClient *) clientPointer;
+    client->resetLatencyStats();
+}
+
+static const JNINativeMethod clientMethods[] = {
+        {"createClient",                   "()J",                                          (void *) createClient},
+        {"releaseClient",                  "(JJ)V",                                        (void *) releaseClient},
+        {"getEngineFormatVersion",         "()I",                                          (void *) getEngineFormatVersion},
+        {"isGenericElementHidingEnabled",  "(J)Z",                                         (void *) isGenericElementHidingEnabled},
+        {"setGenericElementHidingEnabled", "(JZ)V",                                        (void *) setGenericElementHidingEnabled},
+        {"loadBasicData",                  "(J[BZ)V",                                      (void *) loadBasicData},
+        {"loadBasicFile",                  "(JLjava/lang/String;Z)Z",                      (void *) loadBasicFile},
+        {"loadProcessedData",              "(J[B)J",                                       (void *) loadProcessedData},
+        {"loadProcessedFile",              "(JLjava/lang/String;)Z",                       (void *) loadProcessedFile},
+        {"loadSharedData",                 "(JI)Z",                                        (void *) loadSharedData},
+        {"getProcessedData",               "(J)[B",                                        (void *) getProcessedData},
+        {"saveProcessedData",              "(JLjava/lang/String;)Z",                       (void *) saveProcessedData},
+        {"saveProcessedDataAsync",         "(JLjava/lang/String;"
+                                           "Lio/github/edsuns/adblockclient/AdBlockClient$SaveCallback;)V",
+                                                                                           (void *) saveProcessedDataAsync},
+        {"shareProcessedData",             "(JLjava/lang/String;)I",                       (void *) shareProcessedData},
+        {"getFiltersCount",                "(J)I",                                         (void *) getFiltersCount},
+        {"matches",                        "(JLjava/lang/String;Ljava/lang/String;I)"
+                                           "Lio/github/edsuns/adblockclient/MatchResult;", (void *) matches},
+        {"matchesPacked",                  "(JLjava/lang/String;Ljava/lang/String;I)J",    (void *) matchesPacked},
+        {"getRuleText",                    "(JI)Ljava/lang/String;",                       (void *) getRuleText},
+        {"getElementHidingSelectors",      "(JLjava/lang/String;)Ljava/lang/String;",      (void *) getElementHidingSelectors},
+        {"getExtendedCssSelectors",        "(JLjava/lang/String;)[Ljava/lang/String;",     (void *) getExtendedCssSelectors},
+        {"getCssRules",                    "(JLjava/lang/String;)[Ljava/lang/String;",     (void *) getCssRules},
+        {"getScriptlets",                  "(JLjava/lang/String;)[Ljava/lang/String;",     (void *) getScriptlets},
+        {"matchesBytes",                   "(JLjava/nio/ByteBuffer;[BIILjava/lang/String;I)J",
+                                                                                           (void *) matchesBytes},
+        {"getElementHidingSelectorsBytes", "(JLjava/nio/ByteBuffer;[BII)Ljava/lang/String;",
+                                                                                           (void *) getElementHidingSelectorsBytes},
+        {"getExtendedCssSelectorsBytes",   "(JLjava/nio/ByteBuffer;[BII)[Ljava/lang/String;",
+                                                                                           (void *) getExtendedCssSelectorsBytes},
+        {"getCssRulesBytes",               "(JLjava/nio/ByteBuffer;[BII)[Ljava/lang/String;",
+                                                                                           (void *) getCssRulesBytes},
+        {"getScriptletsBytes",             "(JLjava/nio/ByteBuffer;[BII)[Ljava/lang/String;",
+                                                                                           (void *) getScriptletsBytes},
+        {"trim",                           "(JI)J",                                        (void *) trim},
+        {"getMemoryReport",                "(J)Ljava/lang/String;",                        (void *) getMemoryReport},
+        {"isLatencyStatsEnabled",          "(J)Z",                                         (void *) isLatencyStatsEnabled},
+        {"setLatencyStatsEnabled",         "(JZ)V",                                        (void *) setLatencyStatsEnabled},
+        {"getLatencyStats",                "(J)Ljava/lang/String;",                        (void *) getLatencyStats},
+        {"resetLatencyStats",              "(J)V",                                         (void *) resetLatencyStats},
+};
+
+static jclass findGlobalClass(JNIEnv *env, const char *name) {
+    jclass localClass = env->FindClass(name);
+    if (!localClass) {
+        return nullptr;
+    }
+    auto globalClass = (jclass) env->NewGlobalRef(localClass);
+    env->DeleteLocalRef(localClass);
+    return globalClass;
+}
+
+// Registers the natives by table rather than by symbol name and caches what
+// the calls need, so none of them looks up classes or methods by name
+extern "C"
+JNIEXPORT jint JNICALL JNI_OnLoad(JavaVM *vm, void * /* reserved */) {
+    JNIEnv *env;
+    if (vm->GetEnv(reinterpret_cast<void **>(&env), JNI_VERSION_1_6) != JNI_OK) {
+        return JNI_ERR;
+    }
+    javaVm = vm;
+
+    jclass clientClass = env->FindClass("io/github/edsuns/adblockclient/AdBlockClient");
+    if (!clientClass || env->RegisterNatives(clientClass, clientMethods,
+                                             sizeof(clientMethods) / sizeof(clientMethods[0])) != JNI_OK) {
+        return JNI_ERR;
+    }
+    env->DeleteLocalRef(clientClass);
+
+    matchResultClass = findGlobalClass(env, "io/github/edsuns/adblockclient/MatchResult");
+    stringClass = findGlobalClass(env, "java/lang/String");
+    jclass saveCallbackClass =
+            env->FindClass("io/github/edsuns/adblockclient/AdBlockClient$SaveCallback");
+    if (!matchResultClass || !stringClass || !saveCallbackClass) {
+        return JNI_ERR;
+    }
+    matchResultInit = env->GetMethodID(matchResultClass, "<init>",
+                                       "(ZLjava/lang/String;Ljava/lang/String;)V");
+    stringInit = env->GetMethodID(stringClass, "<init>", "([BLjava/lang/String;)V");
+    saveCallbackOnSaved = env->GetMethodID(saveCallbackClass, "onSaved", "(Z)V");
+    env->DeleteLocalRef(saveCallbackClass);
+
+    jstring encoding = env->NewStringUTF("UTF-8");
+    utf8Encoding = (jstring) env->NewGlobalRef(encoding);
+    env->DeleteLocalRef(encoding);
+
+    if (!matchResultInit || !stringInit || !saveCallbackOnSaved) {
+        return JNI_ERR;
+    }
+    return JNI_VERSION_1_6;
+}
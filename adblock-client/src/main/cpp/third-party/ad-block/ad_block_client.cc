@@ -10,6 +10,10 @@
 
 #include <string.h>
 #include <stdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <functional>
 #include "./protocol.h"
 #include "./ad_block_client.h"
 #include "./bad_fingerprint.h"
@@ -17,6 +21,17 @@
 #include "./cosmetic_filter.h"
 #include "../hashset-cpp/hashFn.h"
 #include "./no_fingerprint_domain.h"
+#include "./regex_matcher.h"
+#include "./fingerprint_optimizer.h"
+#include "./mapped_file.h"
+#include "./binary_format.h"
+#include "./file_writer.h"
+#include "./lz4_block.h"
+#include "./shared_memory.h"
+#include "./arena.h"
+#include "./string_pool.h"
+#include "./memory_report.h"
+#include "./latency_stats.h"
 
 #include "../bloom-filter-cpp/BloomFilter.h"
 
@@ -44,34 +59,36 @@ public:
 
 const int kMaxLineLength = 2048;
 
-const int AdBlockClient::kFingerprintSize = 6;
+const int AdBlockClient::kFingerprintSize;
+const int AdBlockClient::kMinFingerprintSize;
+const int AdBlockClient::kMaxFingerprintSize;
 
 static HashFn2Byte hashFn2Byte;
 
-static char *rule_definition_fallback = "-";
 
 /**
  * Finds the host within the passed in URL and returns its length
  */
-const char *getUrlHost(const char *input, int *len) {
+const char *getUrlHost(const char *input, int inputLen, int *len) {
+  const char *end = input + inputLen;
   const char *p = input;
-  while (*p != '\0' && *p != ':') {
+  while (p != end && *p != ':') {
     p++;
   }
-  if (*p == ':') {
+  if (p != end) {
     p++;
   }
-  while (*p == '/') {
+  while (p != end && *p == '/') {
     p++;
   }
-  const char *q = p;
-  while (*q != '\0') {
-    q++;
-  }
-  *len = findFirstSeparatorChar(p, q);
+  *len = findFirstSeparatorChar(p, end);
   return p;
 }
 
+const char *getUrlHost(const char *input, int *len) {
+  return getUrlHost(input, static_cast<int>(strlen(input)), len);
+}
+
 void AddFilterDomainsToHashSet(Filter *filter,
                                HashSet<NoFingerprintDomain> *hashSet) {
   if (filter->domainList) {
@@ -107,15 +124,12 @@ void AddFilterDomainsToHashSet(Filter *filter,
   }
 }
 
+// The selector of a filter which borrows its strings from the arena is
+// shared by all of its domains rather than copied for each
 void putElementHidingFilterToHashMap(Filter *filter, CosmeticFilterHashMap *hashMap) {
   if (filter->domainList && filter->data) {
-    // copy the domainList char* which will be deleted by deconstructor
-    size_t size = strlen(filter->domainList) + 1;
-    char *filter_domain_list = new char[size];
-    memcpy(filter_domain_list, filter->domainList, size);
-
     int len;
-    const char *p = filter_domain_list;
+    const char *p = filter->domainList;
     const char *q;
     while (*p != '\0') {
       len = 0;
@@ -128,7 +142,8 @@ void putElementHidingFilterToHashMap(Filter *filter, CosmeticFilterHashMap *hash
         q++;
       }
       if (len > 0) {
-        hashMap->putCosmeticFilter(NoFingerprintDomain(p, len), CosmeticFilter(filter->data));
+        hashMap->putCosmeticFilter(NoFingerprintDomain(p, len),
+                                 CosmeticFilter(filter->data, filter->borrowed_data));
         p += len;
       }
       if (*p == '\0') {
@@ -230,7 +245,16 @@ char *removeException(char *src, uint32_t srcLen, char *exception) {
   return result;
 }
 
-char *AdBlockClient::getElementHidingSelectors(const char *host, int hostLen) const {
+// Estimated size of a cache entry for a host of |hostLen| chars which holds
+// |valueSize| bytes
+static size_t cacheEntrySize(int hostLen, size_t valueSize) {
+  return sizeof(HashItem<MapNode<NoFingerprintDomain, CosmeticFilter>>)
+         + sizeof(MapNode<NoFingerprintDomain, CosmeticFilter>)
+         + sizeof(NoFingerprintDomain) + hostLen + 1 + valueSize;
+}
+
+char *AdBlockClient::getElementHidingSelectors(const char *host, int hostLen) {
+  loadSection(ESElementHidingHashMap);
   CosmeticFilterHashSet filterHashSet(5);
   auto onFind = [&filterHashSet](CosmeticFilter *f) { filterHashSet.Add(*f); };
   if (getFrom<CosmeticFilter>(elementHidingSelectorHashMap, host, hostLen, onFind)) {
@@ -239,7 +263,8 @@ char *AdBlockClient::getElementHidingSelectors(const char *host, int hostLen) co
   return nullptr;
 }
 
-char *AdBlockClient::getElementHidingExceptionSelectors(const char *host, int hostLen) const {
+char *AdBlockClient::getElementHidingExceptionSelectors(const char *host, int hostLen) {
+  loadSection(ESElementHidingExceptionHashMap);
   CosmeticFilterHashSet filterHashSet(5);
   auto onFind = [&filterHashSet](CosmeticFilter *f) { filterHashSet.Add(*f); };
   if (getFrom<CosmeticFilter>(elementHidingExceptionSelectorHashMap, host, hostLen, onFind)) {
@@ -249,13 +274,19 @@ char *AdBlockClient::getElementHidingExceptionSelectors(const char *host, int ho
 }
 
 const char *AdBlockClient::getElementHidingSelectors(const char *contextUrl) {
-  int urlLen = static_cast<int>(strlen(contextUrl));
-  if (!isBlockableProtocol(contextUrl, urlLen)) {
+  return getUrlElementHidingSelectors(contextUrl, static_cast<int>(strlen(contextUrl)));
+}
+
+const char *AdBlockClient::getUrlElementHidingSelectors(const char *contextUrl,
+                                                        int contextUrlLen) {
+  LatencyTimer timer(activeLatencyStats.load(std::memory_order_acquire),
+                     LPElementHidingSelectors);
+  if (!isBlockableProtocol(contextUrl, contextUrlLen)) {
     return nullptr;
   }
   std::string buffer;
   int hostLen;
-  const char *host = getUrlHost(contextUrl, &hostLen);
+  const char *host = getUrlHost(contextUrl, contextUrlLen, &hostLen);
   if (!elementHidingSelectorsCache) {
     elementHidingSelectorsCache = new HashMap<NoFingerprintDomain, CosmeticFilter>(100);
   } else if (const CosmeticFilter *f =
@@ -267,6 +298,7 @@ const char *AdBlockClient::getElementHidingSelectors(const char *contextUrl) {
     buffer.append(selectors);
   }
   if (isGenericElementHidingEnabled) {
+    loadSection(ESGenericElementHidingSelectors);
     if (buffer.length() > 0) {
       buffer.append(", ");
     }
@@ -282,7 +314,9 @@ const char *AdBlockClient::getElementHidingSelectors(const char *contextUrl) {
     combine = removeException(combine, len, exception);
   }
   auto *filter = new CosmeticFilter(combine);
-  elementHidingSelectorsCache->put(NoFingerprintDomain(host, hostLen), filter);
+  // The key is kept, so it can't borrow from |contextUrl|
+  elementHidingSelectorsCache->put(NoFingerprintDomain(host, hostLen, false), filter);
+  cacheSize += cacheEntrySize(hostLen, sizeof(CosmeticFilter) + strlen(filter->data) + 1);
   delete[] selectors;
   delete[] exception;
   if (exception) {
@@ -291,17 +325,19 @@ const char *AdBlockClient::getElementHidingSelectors(const char *contextUrl) {
   return filter->data;
 }
 
+// Adds the results of |map| for the host of |contextUrl| to |*cache| and
+// their estimated size to |cacheSize|, hosts without any are cached too
 const LinkedList<std::string> *getRulesFrom(HashMap<NoFingerprintDomain,
                                                     CosmeticFilterHashSet> *map,
                                             HashMap<NoFingerprintDomain,
                                                     LinkedList<std::string>> **cache,
-                                            const char *contextUrl) {
-  int urlLen = static_cast<int>(strlen(contextUrl));
-  if (!isBlockableProtocol(contextUrl, urlLen)) {
+                                            size_t *cacheSize,
+                                            const char *contextUrl, int contextUrlLen) {
+  if (!isBlockableProtocol(contextUrl, contextUrlLen)) {
     return nullptr;
   }
   int hostLen;
-  const char *host = getUrlHost(contextUrl, &hostLen);
+  const char *host = getUrlHost(contextUrl, contextUrlLen, &hostLen);
   if (!*cache) {
     *cache = new HashMap<NoFingerprintDomain, LinkedList<std::string>>(100);
   } else if (const LinkedList<std::string> *f = (*cache)->get(NoFingerprintDomain(host, hostLen))) {
@@ -309,25 +345,51 @@ const LinkedList<std::string> *getRulesFrom(HashMap<NoFingerprintDomain,
   }
   auto *result = new LinkedList<std::string>();
   auto onFind = [result](CosmeticFilterHashSet *set) { result->concat(set->toStringList()); };
-  if (getFrom<CosmeticFilterHashSet>(map, host, hostLen, onFind)) {
-    (*cache)->put(NoFingerprintDomain(host, hostLen), result);
+  getFrom<CosmeticFilterHashSet>(map, host, hostLen, onFind);
+  size_t size = sizeof(LinkedList<std::string>);
+  for (const auto &rule : *result) {
+    size += sizeof(Node<std::string>) + sizeof(std::string) + rule.capacity();
   }
+  (*cache)->put(NoFingerprintDomain(host, hostLen, false), result);
+  *cacheSize += cacheEntrySize(hostLen, size);
   return result;
 }
 
 const LinkedList<std::string> *AdBlockClient::getExtendedCssSelectors(const char *contextUrl) {
-  return getRulesFrom(extendedCssMap, &extendedCssCache, contextUrl);
+  return getExtendedCssSelectors(contextUrl, static_cast<int>(strlen(contextUrl)));
+}
+
+const LinkedList<std::string> *AdBlockClient::getExtendedCssSelectors(const char *contextUrl,
+                                                                      int contextUrlLen) {
+  LatencyTimer timer(activeLatencyStats.load(std::memory_order_acquire),
+                     LPExtendedCssSelectors);
+  loadSection(ESExtendedCssHashMap);
+  return getRulesFrom(extendedCssMap, &extendedCssCache, &cacheSize, contextUrl, contextUrlLen);
 }
 
 const LinkedList<std::string> *AdBlockClient::getCssRules(const char *contextUrl) {
-  return getRulesFrom(cssRulesMap, &cssRulesCache, contextUrl);
+  return getCssRules(contextUrl, static_cast<int>(strlen(contextUrl)));
+}
+
+const LinkedList<std::string> *AdBlockClient::getCssRules(const char *contextUrl,
+                                                          int contextUrlLen) {
+  LatencyTimer timer(activeLatencyStats.load(std::memory_order_acquire), LPCssRules);
+  loadSection(ESCssRulesHashMap);
+  return getRulesFrom(cssRulesMap, &cssRulesCache, &cacheSize, contextUrl, contextUrlLen);
 }
 
 const LinkedList<std::string> *AdBlockClient::getScriptlets(const char *contextUrl) {
-  return getRulesFrom(scriptletMap, &scriptletCache, contextUrl);
+  return getScriptlets(contextUrl, static_cast<int>(strlen(contextUrl)));
 }
 
-bool extractScriptletArgsAsData(Filter &filter) {
+const LinkedList<std::string> *AdBlockClient::getScriptlets(const char *contextUrl,
+                                                            int contextUrlLen) {
+  LatencyTimer timer(activeLatencyStats.load(std::memory_order_acquire), LPScriptlets);
+  loadSection(ESScriptletHashMap);
+  return getRulesFrom(scriptletMap, &scriptletCache, &cacheSize, contextUrl, contextUrlLen);
+}
+
+bool extractScriptletArgsAsData(Filter &filter, StringPool *stringPool) {
   if (!filter.data) {
     return false;// fix nullptr when scriptlet rule data is empty
   }
@@ -343,11 +405,16 @@ bool extractScriptletArgsAsData(Filter &filter) {
   // copy extracted data
   int len = static_cast<int>(q - p);
   if (len > 0) {
-    char *args = new char[len + 1];
-    args[len] = '\0';
-    memcpy(args, p, len);
-    delete[] filter.data;
-    filter.data = args;
+    if (filter.borrowed_data) {
+      // The rest of the old data stays in the arena until it's cleared
+      filter.data = stringPool->intern(p, len);
+    } else {
+      char *args = new char[len + 1];
+      args[len] = '\0';
+      memcpy(args, p, len);
+      delete[] filter.data;
+      filter.data = args;
+    }
   }
   return true;
 }
@@ -356,21 +423,49 @@ inline bool isFingerprintChar(char c) {
   return c != '|' && c != '*' && c != '^';
 }
 
-static HashSet<NoFingerprintDomain> createBadFingerprintsHashSet() {
-  HashSet<NoFingerprintDomain> hashSet(15000, false);
+// The bad fingerprints are trained for the default size, shorter sizes
+// use them truncated to that size.
+static HashSet<NoFingerprintDomain> createBadFingerprintsHashSet(int size) {
+  HashSet<NoFingerprintDomain> hashSet(
+      sizeof(badFingerprints) / sizeof(badFingerprints[0]) + 1, false);
   for (auto &badFingerprint : badFingerprints) {
-    hashSet.Add(NoFingerprintDomain(badFingerprint, AdBlockClient::kFingerprintSize));
+    hashSet.Add(NoFingerprintDomain(badFingerprint, size));
   }
   return hashSet;
 }
 
 // NoFingerprintDomain is used to keep BadFingerprint
 // because it supports for borrowed data and has implemented hash function.
-static HashSet<NoFingerprintDomain> staticBadFingerprintsHashSet = createBadFingerprintsHashSet();
+// Built on first use, the hash function of NoFingerprintDomain is a static
+// of another translation unit.
+static HashSet<NoFingerprintDomain> &getBadFingerprintsHashSet(int size) {
+  static HashSet<NoFingerprintDomain> hashSets[] = {
+    createBadFingerprintsHashSet(3),
+    createBadFingerprintsHashSet(4),
+    createBadFingerprintsHashSet(5),
+    createBadFingerprintsHashSet(AdBlockClient::kFingerprintSize),
+  };
+  static_assert(sizeof(hashSets) / sizeof(hashSets[0])
+      == AdBlockClient::kFingerprintSize - AdBlockClient::kMinFingerprintSize + 1,
+      "One bad fingerprint set is needed for each size up to the default");
+  return hashSets[size - AdBlockClient::kMinFingerprintSize];
+}
 
 bool isBadFingerprint(const char *fingerprint, const char *fingerprintEnd) {
-  auto len = static_cast<uint32_t>(fingerprintEnd - fingerprint);
-  return staticBadFingerprintsHashSet.Exists(NoFingerprintDomain(fingerprint, len));
+  auto len = static_cast<int>(fingerprintEnd - fingerprint);
+  if (len <= AdBlockClient::kFingerprintSize) {
+    return getBadFingerprintsHashSet(len).Exists(NoFingerprintDomain(fingerprint, len));
+  }
+  // Longer fingerprints are bad when they contain a bad fingerprint
+  HashSet<NoFingerprintDomain> &hashSet =
+      getBadFingerprintsHashSet(AdBlockClient::kFingerprintSize);
+  for (const char *p = fingerprint;
+       p + AdBlockClient::kFingerprintSize <= fingerprintEnd; p++) {
+    if (hashSet.Exists(NoFingerprintDomain(p, AdBlockClient::kFingerprintSize))) {
+      return true;
+    }
+  }
+  return false;
 }
 
 bool hasBadSubstring(const char *fingerprint, const char *fingerprintEnd) {
@@ -385,12 +480,18 @@ bool hasBadSubstring(const char *fingerprint, const char *fingerprintEnd) {
 }
 
 /**
- * Obtains a fingerprint for the specified filter
+ * Obtains a fingerprint for the specified filter, that is the first window
+ * of |fingerprintSize| chars without wildcards or bad substrings, or the
+ * rarest such window if an optimizer is specified.
  */
-bool AdBlockClient::getFingerprint(char *buffer, const char *input) {
+bool AdBlockClient::getFingerprint(char *buffer, const char *input,
+                                   int fingerprintSize,
+                                   const FingerprintOptimizer *optimizer) {
   if (!input) {
     return false;
   }
+  const char *best = nullptr;
+  uint32_t bestCount = 0;
   int size = 0;
   const char *p = input;
   const char *start = input;
@@ -401,9 +502,6 @@ bool AdBlockClient::getFingerprint(char *buffer, const char *input) {
       start = p;
       continue;
     }
-    if (buffer) {
-      buffer[size] = *p;
-    }
     if (hasBadSubstring(start, start + size + 1)) {
       size = 0;
       start++;
@@ -412,39 +510,57 @@ bool AdBlockClient::getFingerprint(char *buffer, const char *input) {
     }
     size++;
 
-    if (size == kFingerprintSize) {
-      if (buffer) {
-        buffer[size] = '\0';
-      }
-      if (isBadFingerprint(start, start + size)) {
-        size = 0;
-        start++;
-        p = start;
-        continue;
+    if (size == fingerprintSize) {
+      if (!isBadFingerprint(start, start + size)) {
+        if (!optimizer) {
+          best = start;
+          break;
+        }
+        uint32_t count = optimizer->getCount(start);
+        if (!best || count < bestCount) {
+          best = start;
+          bestCount = count;
+          if (!count) {
+            break;
+          }
+        }
       }
-      return true;
+      size = 0;
+      start++;
+      p = start;
+      continue;
     }
     p++;
   }
+  if (!best) {
+    if (buffer) {
+      buffer[0] = '\0';
+    }
+    return false;
+  }
   if (buffer) {
-    buffer[0] = '\0';
+    memcpy(buffer, best, fingerprintSize);
+    buffer[fingerprintSize] = '\0';
   }
-  return false;
+  return true;
 }
 
-bool AdBlockClient::getFingerprint(char *buffer, const Filter &f) {
+bool AdBlockClient::getFingerprint(char *buffer, const Filter &f,
+                                   int fingerprintSize,
+                                   const FingerprintOptimizer *optimizer) {
   if (f.filterType & FTRegex) {
     // cout << "Get fingerprint for regex returning false; " << endl;
     return false;
   }
 
   if (f.filterType & FTHostAnchored) {
-    if (AdBlockClient::getFingerprint(buffer, f.data + strlen(f.host))) {
+    if (AdBlockClient::getFingerprint(buffer, f.data + strlen(f.host),
+                                      fingerprintSize, optimizer)) {
       return true;
     }
   }
 
-  bool b = AdBlockClient::getFingerprint(buffer, f.data);
+  bool b = AdBlockClient::getFingerprint(buffer, f.data, fingerprintSize, optimizer);
   // if (!b && f.data) {
   //   cout << "No fingerprint for: " << f.data << endl;
   // }
@@ -473,12 +589,37 @@ void parseFilter(const char *input, Filter *f, BloomFilter *bloomFilter,
                  HashSet<Filter> *hostAnchoredHashSet,
                  HashSet<Filter> *hostAnchoredExceptionHashSet,
                  HashSet<CosmeticFilter> *simpleCosmeticFilters,
-                 bool preserveRules) {
+                 std::string *ruleText,
+                 int fingerprintSize,
+                 const FingerprintOptimizer *fingerprintOptimizer,
+                 Arena *arena,
+                 StringPool *stringPool) {
   const char *end = input;
   while (*end != '\0')
     end++;
   parseFilter(input, end, f, bloomFilter, exceptionBloomFilter,
-              hostAnchoredHashSet, hostAnchoredExceptionHashSet, simpleCosmeticFilters);
+              hostAnchoredHashSet, hostAnchoredExceptionHashSet, simpleCosmeticFilters,
+              ruleText, fingerprintSize, fingerprintOptimizer, arena,
+              stringPool);
+}
+
+// Filter strings come from |arena| if there is one, the filter borrows them
+static char *newFilterString(Arena *arena, size_t size) {
+  return arena ? arena->alloc(size) : new char[size];
+}
+
+// Copies |len| chars of |data| plus a terminator like newFilterString(),
+// strings which are often repeated are shared through |stringPool|, which
+// has to allocate from |arena|
+static char *copyFilterString(Arena *arena, StringPool *stringPool,
+                              const char *data, size_t len) {
+  if (stringPool) {
+    return stringPool->intern(data, len);
+  }
+  char *copy = newFilterString(arena, len + 1);
+  memcpy(copy, data, len);
+  copy[len] = '\0';
+  return copy;
 }
 
 enum FilterParseState {
@@ -498,7 +639,12 @@ void parseFilter(const char *input, const char *end, Filter *f,
                  HashSet<Filter> *hostAnchoredHashSet,
                  HashSet<Filter> *hostAnchoredExceptionHashSet,
                  HashSet<CosmeticFilter> *simpleCosmeticFilters,
-                 bool preserveRules) {
+                 std::string *ruleText,
+                 int fingerprintSize,
+                 const FingerprintOptimizer *fingerprintOptimizer,
+                 Arena *arena,
+                 StringPool *stringPool) {
+  f->borrowed_data = arena != nullptr;
   FilterParseState parseState = FPStart;
   const char *p = input;
   const char *filterRuleStart = p;
@@ -539,7 +685,7 @@ void parseFilter(const char *input, const char *end, Filter *f,
           if (len > 0 && p[len - 1] == '|') {
             len--;
           }
-          f->host = new char[len + 1];
+          f->host = newFilterString(arena, len + 1);
           f->host[len] = '\0';
           memcpy(f->host, p, len);
 
@@ -603,7 +749,7 @@ void parseFilter(const char *input, const char *end, Filter *f,
           filterRuleEndPos++;
 
           if (regexLen > 0 && (filterRuleEndPos == end || *filterRuleEndPos == '$')) {
-            f->data = new char[regexLen + 1];
+            f->data = newFilterString(arena, regexLen + 1);
             f->data[regexLen] = '\0';
             memcpy(f->data, p + 1, regexLen);
 
@@ -625,8 +771,7 @@ void parseFilter(const char *input, const char *end, Filter *f,
         // see https://kb.adguard.com/en/general/how-to-create-your-own-ad-filters#html-filtering-rules-syntax-1
         if (*(p + 1) == '$') {
           if (i != 0) {
-            f->domainList = new char[i + 1];
-            memcpy(f->domainList, data, i + 1);
+            f->domainList = copyFilterString(arena, stringPool, data, i);
             i = 0;
           }
           parseState = FPDataOnly;
@@ -638,7 +783,7 @@ void parseFilter(const char *input, const char *end, Filter *f,
         while (*filterRuleEndPos != '\0' && !isEndOfLine(*filterRuleEndPos)) {
           filterRuleEndPos++;
         }
-        f->parseOptions(p + 1);
+        f->parseOptions(p + 1, arena, stringPool);
         earlyBreak = true;
         continue;
       case '#':
@@ -695,8 +840,7 @@ void parseFilter(const char *input, const char *end, Filter *f,
             return;// ignore unsupported rule
           }
           if (i != 0) {
-            f->domainList = new char[i + 1];
-            memcpy(f->domainList, data, i + 1);
+            f->domainList = copyFilterString(arena, stringPool, data, i);
             i = 0;
           }
           parseState = FPDataOnly;
@@ -722,11 +866,13 @@ void parseFilter(const char *input, const char *end, Filter *f,
     return;
   }
 
-  if (preserveRules) {
-    int ruleTextLength = filterRuleEndPos - filterRuleStart;
-    f->ruleDefinition = new char[ruleTextLength + 1];
-    memcpy(f->ruleDefinition, filterRuleStart, ruleTextLength);
-    f->ruleDefinition[ruleTextLength] = '\0';
+  // Cosmetic rules don't outlive parsing as filters, so their text is
+  // never looked up
+  if (ruleText && !(f->filterType & FTCosmeticMask)) {
+    f->ruleOffset = static_cast<uint32_t>(ruleText->size());
+    f->ruleLen = static_cast<int>(filterRuleEndPos - filterRuleStart);
+    ruleText->append(filterRuleStart, f->ruleLen);
+    ruleText->push_back('\0');
   }
 
   // regex rule has finished
@@ -736,15 +882,20 @@ void parseFilter(const char *input, const char *end, Filter *f,
 
   if (i > 0) {
     data[i] = '\0';
-    f->data = new char[i + 1];
-    memcpy(f->data, data, i + 1);
+    if (f->filterType & FTCosmeticMask) {
+      // Selectors of different rules are shared
+      f->data = copyFilterString(arena, stringPool, data, i);
+    } else {
+      f->data = newFilterString(arena, i + 1);
+      memcpy(f->data, data, i + 1);
+    }
   } else {
     f->data = nullptr;
   }
   f->dataLen = i;
 
-  char fingerprintBuffer[AdBlockClient::kFingerprintSize + 1];
-  fingerprintBuffer[AdBlockClient::kFingerprintSize] = '\0';
+  char fingerprintBuffer[AdBlockClient::kMaxFingerprintSize + 1];
+  fingerprintBuffer[0] = '\0';
 
   if (f->filterType == FTCss || f->filterType == FTCssException
       || f->filterType == FTScriptlet || f->filterType == FTExtendedCss) {
@@ -765,7 +916,8 @@ void parseFilter(const char *input, const char *end, Filter *f,
   } else if (hostAnchoredHashSet && (f->filterType & FTHostOnly)) {
     // cout << "add host anchored bloom filter: " << f->host << endl;
     hostAnchoredHashSet->Add(*f);
-  } else if (AdBlockClient::getFingerprint(fingerprintBuffer, *f)) {
+  } else if (AdBlockClient::getFingerprint(fingerprintBuffer, *f,
+                                           fingerprintSize, fingerprintOptimizer)) {
     if (exceptionBloomFilter && f->filterType & FTException) {
       exceptionBloomFilter->add(fingerprintBuffer);
     } else if (bloomFilter) {
@@ -776,16 +928,7 @@ void parseFilter(const char *input, const char *end, Filter *f,
   }
 }
 
-AdBlockClient::AdBlockClient() : filters(nullptr),
-                                 htmlFilters(nullptr),
-                                 exceptionFilters(nullptr),
-                                 noFingerprintFilters(nullptr),
-                                 noFingerprintExceptionFilters(nullptr),
-                                 noFingerprintDomainOnlyFilters(nullptr),
-                                 noFingerprintAntiDomainOnlyFilters(nullptr),
-                                 noFingerprintDomainOnlyExceptionFilters(nullptr),
-                                 noFingerprintAntiDomainOnlyExceptionFilters(nullptr),
-                                 numFilters(0),
+AdBlockClient::AdBlockClient() : numFilters(0),
                                  numCosmeticFilters(0),
                                  numHtmlFilters(0),
                                  numScriptletFilters(0),
@@ -814,6 +957,7 @@ AdBlockClient::AdBlockClient() : filters(nullptr),
                                  numHashSetSaves(0),
                                  numExceptionHashSetSaves(0),
                                  deserializedBuffer(nullptr),
+                                 mappedFile(nullptr),
                                  elementHidingSelectorHashMap(nullptr),
                                  elementHidingExceptionSelectorHashMap(nullptr),
                                  genericElementHidingSelectors(nullptr),
@@ -824,51 +968,46 @@ AdBlockClient::AdBlockClient() : filters(nullptr),
                                  cssRulesMap(nullptr),
                                  cssRulesCache(nullptr),
                                  scriptletMap(nullptr),
-                                 scriptletCache(nullptr) {
+                                 scriptletCache(nullptr),
+                                 fingerprintSize(kFingerprintSize),
+                                 fingerprintOptimizer(nullptr) {
+  for (int i = 0; i < ESNumSections; i++) {
+    sectionPending[i] = false;
+    inflatedSections[i] = nullptr;
+    parsedSections[i] = nullptr;
+    parsedSectionSizes[i] = 0;
+  }
+  compressedSections = kDefaultCompressedSections;
+  arena = nullptr;
+  ruleTextData = nullptr;
+  ruleTextSize = 0;
+  cacheSize = 0;
+  reloadableSections = 0;
+  saving = false;
+  regexSet = nullptr;
+  stringTableData = nullptr;
+  stringTableSize = 0;
+  latencyStats = nullptr;
+  activeLatencyStats = nullptr;
 }
 
 AdBlockClient::~AdBlockClient() {
   clear();
+  delete latencyStats;
 }
 
 // Clears all data and stats from the AdBlockClient
 void AdBlockClient::clear() {
-  if (filters) {
-    delete[] filters;
-    filters = nullptr;
-  }
-  if (htmlFilters) {
-    delete[] htmlFilters;
-    htmlFilters = nullptr;
-  }
-  if (exceptionFilters) {
-    delete[] exceptionFilters;
-    exceptionFilters = nullptr;
-  }
-  if (noFingerprintFilters) {
-    delete[] noFingerprintFilters;
-    noFingerprintFilters = nullptr;
-  }
-  if (noFingerprintExceptionFilters) {
-    delete[] noFingerprintExceptionFilters;
-    noFingerprintExceptionFilters = nullptr;
-  }
-  if (noFingerprintDomainOnlyFilters) {
-    delete[] noFingerprintDomainOnlyFilters;
-    noFingerprintDomainOnlyFilters = nullptr;
-  }
-  if (noFingerprintAntiDomainOnlyFilters) {
-    delete[] noFingerprintAntiDomainOnlyFilters;
-    noFingerprintAntiDomainOnlyFilters = nullptr;
-  }
-  if (noFingerprintDomainOnlyExceptionFilters) {
-    delete[] noFingerprintDomainOnlyExceptionFilters;
-    noFingerprintDomainOnlyExceptionFilters = nullptr;
-  }
-  if (noFingerprintAntiDomainOnlyExceptionFilters) {
-    delete[] noFingerprintAntiDomainOnlyExceptionFilters;
-    noFingerprintAntiDomainOnlyExceptionFilters = nullptr;
-  }
+  waitForSave();
+  filters.clear();
+  htmlFilters.clear();
+  exceptionFilters.clear();
+  noFingerprintFilters.clear();
+  noFingerprintExceptionFilters.clear();
+  noFingerprintDomainOnlyFilters.clear();
+  noFingerprintAntiDomainOnlyFilters.clear();
+  noFingerprintDomainOnlyExceptionFilters.clear();
+  noFingerprintAntiDomainOnlyExceptionFilters.clear();
   if (bloomFilter) {
     delete bloomFilter;
     bloomFilter = nullptr;
@@ -901,6 +1040,8 @@ void AdBlockClient::clear() {
     delete noFingerprintAntiDomainExceptionHashSet;
     noFingerprintAntiDomainExceptionHashSet = nullptr;
   }
+  delete regexSet.load();
+  regexSet = nullptr;
   if (badFingerprintsHashSet) {
     delete badFingerprintsHashSet;
     badFingerprintsHashSet = nullptr;
@@ -945,6 +1086,34 @@ void AdBlockClient::clear() {
     delete scriptletCache;
     scriptletCache = nullptr;
   }
+  cacheSize = 0;
+  for (auto &pending : sectionPending) {
+    pending.store(false, std::memory_order_relaxed);
+  }
+  reloadableSections = 0;
+  // Released last, everything above may borrow from it
+  if (mappedFile) {
+    delete mappedFile;
+    mappedFile = nullptr;
+  }
+  for (auto &inflated : inflatedSections) {
+    delete[] inflated;
+    inflated = nullptr;
+  }
+  for (int i = 0; i < ESNumSections; i++) {
+    delete[] parsedSections[i];
+    parsedSections[i] = nullptr;
+    parsedSectionSizes[i] = 0;
+  }
+  stringTableData = nullptr;
+  stringTableSize = 0;
+  if (arena) {
+    delete arena;
+    arena = nullptr;
+  }
+  std::string().swap(ruleText);
+  ruleTextData = nullptr;
+  ruleTextSize = 0;
 
   numFilters = 0;
   numCosmeticFilters = 0;
@@ -967,26 +1136,61 @@ void AdBlockClient::clear() {
   numExceptionHashSetSaves = 0;
 }
 
-bool AdBlockClient::hasMatchingFilters(Filter *filter, int numFilters,
+bool AdBlockClient::hasMatchingFilters(FilterList *filterList,
                                        const char *input,
                                        int inputLen,
                                        FilterOption contextOption,
                                        const char *contextDomain,
+                                       int contextDomainLen,
                                        BloomFilter *inputBloomFilter,
                                        const char *inputHost,
                                        int inputHostLen,
-                                       Filter **matchingFilter) const {
+                                       Filter **matchingFilter,
+                                       RegexSetMatches *regexSetMatches) {
+  int numFilters = filterList->getSize();
   for (int i = 0; i < numFilters; i++) {
-    if (filter->matches(input, inputLen, contextOption,
-                        contextDomain, inputBloomFilter, inputHost, inputHostLen)) {
-      if (filter->tagLen == 0 || tagExists(std::string(filter->tag, filter->tagLen))) {
-        if (matchingFilter) {
-          *matchingFilter = filter;
-        }
-        return true;
+    FilterRecord record;
+    if (!filterList->getRecord(i, &record)
+        || !Filter::matchesOptionFlags(record.filterOption,
+                                       record.antiFilterOption,
+                                       contextOption)) {
+      continue;
+    }
+    // Regexes and domain lists need the runtime state of a filter, the
+    // other records are matched where they are
+    Filter *filter = nullptr;
+    bool regexMatched = false;
+    if (record.filterType & FTRegex) {
+      filter = filterList->getFilter(i);
+      // The regex set already knows which of its regexes are in the
+      // input, only the options of those are left to check
+      regexMatched = filter->regexSetId >= 0 && regexSetMatches;
+      if (regexMatched && !regexSetMatches->contains(filter->regexSetId)) {
+        continue;
       }
+    } else if (!Filter::matchesPattern(record.filterType, record.data,
+                                       record.dataLen, record.host,
+                                       record.hostLen, input, inputLen,
+                                       inputBloomFilter, inputHost,
+                                       inputHostLen)) {
+      continue;
+    }
+    if (filter || record.domainList) {
+      if (!filter) {
+        filter = filterList->getFilter(i);
+      }
+      if (!filter->matches(input, inputLen, contextOption, contextDomain,
+                           contextDomainLen, inputBloomFilter, inputHost,
+                           inputHostLen, regexMatched)) {
+        continue;
+      }
+    }
+    if (record.tagLen == 0 || tagExists(std::string(record.tag, record.tagLen))) {
+      if (matchingFilter) {
+        *matchingFilter = filter ? filter : filterList->getFilter(i);
+      }
+      return true;
     }
-    filter++;
   }
   if (matchingFilter) {
     *matchingFilter = nullptr;
@@ -995,12 +1199,11 @@ bool AdBlockClient::hasMatchingFilters(Filter *filter, int numFilters,
 }
 
 void discoverMatchingPrefix(BadFingerprintsHashSet *badFingerprintsHashSet,
-                            const char *str,
+                            const char *str, int strLen,
                             BloomFilter *bloomFilter,
-                            int prefixLen = AdBlockClient::kFingerprintSize) {
+                            int prefixLen) {
   char sz[32];
   memset(sz, 0, sizeof(sz));
-  int strLen = static_cast<int>(strlen(str));
   for (int i = 0; i < strLen - prefixLen + 1; i++) {
     if (bloomFilter->exists(str + i, prefixLen)) {
       memcpy(sz, str + i, prefixLen);
@@ -1035,14 +1238,14 @@ bool isNoFingerprintDomainHashSetMiss(HashSet<NoFingerprintDomain> *hashSet,
   }
   while (start != host) {
     if (*(start - 1) == '.') {
-      if (hashSet->Find(NoFingerprintDomain(start,
-                                            static_cast<int>(host + hostLen - start)))) {
+      if (hashSet->Exists(NoFingerprintDomain(start,
+                                              static_cast<int>(host + hostLen - start)))) {
         return false;
       }
     }
     start--;
   }
-  return !hashSet->Find(NoFingerprintDomain(host, hostLen));
+  return !hashSet->Exists(NoFingerprintDomain(host, hostLen));
 }
 
 bool AdBlockClient::isHostAnchoredHashSetMiss(const char *input, int inputLen,
@@ -1051,6 +1254,7 @@ bool AdBlockClient::isHostAnchoredHashSetMiss(const char *input, int inputLen,
                                               int inputHostLen,
                                               FilterOption contextOption,
                                               const char *contextDomain,
+                                              int contextDomainLen,
                                               Filter **foundFilter) const {
   if (!hashSet) {
     return false;
@@ -1070,7 +1274,9 @@ bool AdBlockClient::isHostAnchoredHashSetMiss(const char *input, int inputLen,
       Filter *filter = hashSet->Find(Filter(start,
                                             static_cast<int>(inputHost + inputHostLen - start),
                                             nullptr, start, inputHostLen - (start - inputHost)));
-      if (filter && filter->matches(input, inputLen, contextOption, contextDomain)) {
+      if (filter && filter->matches(input, inputLen, contextOption,
+                                    contextDomain, contextDomainLen,
+                                    nullptr, nullptr, 0)) {
         if (filter->tagLen == 0 ||
             tagExists(std::string(filter->tag, filter->tagLen))) {
           if (foundFilter) {
@@ -1089,7 +1295,8 @@ bool AdBlockClient::isHostAnchoredHashSetMiss(const char *input, int inputLen,
   if (!filter) {
     return true;
   }
-  bool result = !filter->matches(input, inputLen, contextOption, contextDomain);
+  bool result = !filter->matches(input, inputLen, contextOption,
+                                 contextDomain, contextDomainLen, nullptr, nullptr, 0);
   if (!result) {
     if (filter->tagLen > 0 &&
         !tagExists(std::string(filter->tag, filter->tagLen))) {
@@ -1105,25 +1312,31 @@ bool AdBlockClient::isHostAnchoredHashSetMiss(const char *input, int inputLen,
 bool AdBlockClient::matches(const char *input, FilterOption contextOption,
                             const char *contextDomain, Filter **matchedFilter,
                             Filter **matchedExceptionFilter) {
+  return matches(input, static_cast<int>(strlen(input)), contextOption,
+                 contextDomain,
+                 contextDomain ? static_cast<int>(strlen(contextDomain)) : 0,
+                 matchedFilter, matchedExceptionFilter);
+}
+
+bool AdBlockClient::matches(const char *input, int inputLen,
+                            FilterOption contextOption,
+                            const char *contextDomain, int contextDomainLen,
+                            Filter **matchedFilter,
+                            Filter **matchedExceptionFilter) {
+  LatencyTimer timer(activeLatencyStats.load(std::memory_order_acquire), LPMatches);
   if (matchedFilter) {
     *matchedFilter = nullptr;
   }
   if (matchedExceptionFilter) {
     *matchedExceptionFilter = nullptr;
   }
-  int inputLen = static_cast<int>(strlen(input));
 
   if (!isBlockableProtocol(input, inputLen)) {
     return false;
   }
 
   int inputHostLen;
-  const char *inputHost = getUrlHost(input, &inputHostLen);
-
-  int contextDomainLen = 0;
-  if (contextDomain) {
-    contextDomainLen = static_cast<int>(strlen(contextDomain));
-  }
+  const char *inputHost = getUrlHost(input, inputLen, &inputHostLen);
   // If neither first party nor third party was specified, try to figure it out
   if (contextDomain && !(contextOption & (FOThirdParty | FONotThirdParty))) {
     if (isThirdPartyHost(contextDomain, contextDomainLen,
@@ -1134,6 +1347,8 @@ bool AdBlockClient::matches(const char *input, FilterOption contextOption,
     }
   }
 
+  RegexSetMatches regexSetMatches(getRegexSet(), input, inputLen);
+
   // Optimization for the manual filter checks which are needed.
   // Avoid having to check individual filters if the filter parts are not found
   // inside the input bloom filter.
@@ -1142,6 +1357,7 @@ bool AdBlockClient::matches(const char *input, FilterOption contextOption,
   for (int i = 1; i < inputLen; i++) {
     inputBloomFilter.add(input + i - 1, 2);
   }
+  timer.lap(LPUrlParse);
 
   // We always have to check noFingerprintFilters because the bloom filter opt
   // cannot be used for them
@@ -1150,73 +1366,75 @@ bool AdBlockClient::matches(const char *input, FilterOption contextOption,
   // Only bother checking the no fingerprint domain related filters if needed
   if (!isNoFingerprintDomainHashSetMiss(
       noFingerprintDomainHashSet, contextDomain, contextDomainLen)) {
-    hasMatch = hasMatch || hasMatchingFilters(noFingerprintDomainOnlyFilters,
-                                              numNoFingerprintDomainOnlyFilters, input, inputLen,
+    hasMatch = hasMatch || hasMatchingFilters(&noFingerprintDomainOnlyFilters, input, inputLen,
                                               contextOption,
-                                              contextDomain, &inputBloomFilter, inputHost,
+                                              contextDomain, contextDomainLen, &inputBloomFilter, inputHost,
                                               inputHostLen,
-                                              matchedFilter);
+                                              matchedFilter, &regexSetMatches);
   }
   if (isNoFingerprintDomainHashSetMiss(
       noFingerprintAntiDomainHashSet, contextDomain, contextDomainLen)) {
     hasMatch = hasMatch ||
-        hasMatchingFilters(noFingerprintAntiDomainOnlyFilters,
-                           numNoFingerprintAntiDomainOnlyFilters, input, inputLen,
+        hasMatchingFilters(&noFingerprintAntiDomainOnlyFilters, input, inputLen,
                            contextOption,
-                           contextDomain, &inputBloomFilter, inputHost, inputHostLen,
-                           matchedFilter);
+                           contextDomain, contextDomainLen, &inputBloomFilter, inputHost, inputHostLen,
+                           matchedFilter, &regexSetMatches);
   }
+  timer.lap(LPDomainOnlyScan);
 
   // If no noFingerprintFilters were hit, check the bloom filter substring
   // fingerprint for the normal filter list.
   if (!hasMatch) {
     bool bloomFilterMiss = bloomFilter
-        && !bloomFilter->substringExists(input, AdBlockClient::kFingerprintSize);
+        && !bloomFilter->substringExists(input, inputLen, fingerprintSize);
+    timer.lap(LPBloomProbe);
     bool hostAnchoredHashSetMiss = isHostAnchoredHashSetMiss(input, inputLen,
                                                         hostAnchoredHashSet, inputHost,
                                                         inputHostLen,
-                                                        contextOption, contextDomain,
+                                                        contextOption, contextDomain, contextDomainLen,
                                                         matchedFilter);
+    timer.lap(LPHostAnchoredLookup);
     if (bloomFilterMiss && hostAnchoredHashSetMiss) {
       if (bloomFilterMiss) {
-        numBloomFilterSaves++;
+        numBloomFilterSaves.fetch_add(1, std::memory_order_relaxed);
       }
       if (hostAnchoredHashSetMiss) {
-        numHashSetSaves++;
+        numHashSetSaves.fetch_add(1, std::memory_order_relaxed);
       }
     }
 
     if (!hostAnchoredHashSetMiss) {
-      numHashSetSaves++;
+      numHashSetSaves.fetch_add(1, std::memory_order_relaxed);
       hasMatch = true;
     }
 
     // We need to check the filters list manually because there is either a match
     // or a false positive
     if (hostAnchoredHashSetMiss && !bloomFilterMiss) {
-      hasMatch = hasMatchingFilters(filters, numFilters, input, inputLen,
-                                    contextOption, contextDomain, &inputBloomFilter,
-                                    inputHost, inputHostLen, matchedFilter);
+      hasMatch = hasMatchingFilters(&filters, input, inputLen,
+                                    contextOption, contextDomain, contextDomainLen, &inputBloomFilter,
+                                    inputHost, inputHostLen, matchedFilter, &regexSetMatches);
       // If there's still no match after checking the block filters, then no need
       // to try to block this because there is a false positive.
       if (!hasMatch) {
-        numFalsePositives++;
+        numFalsePositives.fetch_add(1, std::memory_order_relaxed);
         if (badFingerprintsHashSet) {
           // cout << "false positive for input: " << input << " bloomFilterMiss: "
           // << bloomFilterMiss << ", hostAnchoredHashSetMiss: "
           // << hostAnchoredHashSetMiss << endl;
-          discoverMatchingPrefix(badFingerprintsHashSet, input, bloomFilter);
+          discoverMatchingPrefix(badFingerprintsHashSet, input, inputLen, bloomFilter,
+                                 fingerprintSize);
         }
       }
     }
   }
 
   // Iteration at the end can increase efficiency.
-  hasMatch = hasMatch || hasMatchingFilters(noFingerprintFilters,
-                                            numNoFingerprintFilters, input, inputLen, contextOption,
-                                            contextDomain, &inputBloomFilter, inputHost,
+  hasMatch = hasMatch || hasMatchingFilters(&noFingerprintFilters, input, inputLen, contextOption,
+                                            contextDomain, contextDomainLen, &inputBloomFilter, inputHost,
                                             inputHostLen,
-                                            matchedFilter);
+                                            matchedFilter, &regexSetMatches);
+  timer.lap(LPFilterScan);
 
   bool hasExceptionMatch = false;
 
@@ -1224,62 +1442,60 @@ bool AdBlockClient::matches(const char *input, FilterOption contextOption,
   if (!isNoFingerprintDomainHashSetMiss(
       noFingerprintDomainExceptionHashSet, contextDomain, contextDomainLen)) {
     hasExceptionMatch = hasExceptionMatch ||
-        hasMatchingFilters(noFingerprintDomainOnlyExceptionFilters,
-                           numNoFingerprintDomainOnlyExceptionFilters, input,
+        hasMatchingFilters(&noFingerprintDomainOnlyExceptionFilters, input,
                            inputLen,
-                           contextOption, contextDomain, &inputBloomFilter,
+                           contextOption, contextDomain, contextDomainLen, &inputBloomFilter,
                            inputHost,
-                           inputHostLen, matchedExceptionFilter);
+                           inputHostLen, matchedExceptionFilter, &regexSetMatches);
   }
 
   if (isNoFingerprintDomainHashSetMiss(
       noFingerprintAntiDomainExceptionHashSet, contextDomain,
       contextDomainLen)) {
     hasExceptionMatch = hasExceptionMatch ||
-        hasMatchingFilters(noFingerprintAntiDomainOnlyExceptionFilters,
-                           numNoFingerprintAntiDomainOnlyExceptionFilters, input,
+        hasMatchingFilters(&noFingerprintAntiDomainOnlyExceptionFilters, input,
                            inputLen,
-                           contextOption, contextDomain, &inputBloomFilter,
+                           contextOption, contextDomain, contextDomainLen, &inputBloomFilter,
                            inputHost, inputHostLen,
-                           matchedExceptionFilter);
+                           matchedExceptionFilter, &regexSetMatches);
   }
 
   // If there's a matching no fingerprint exception then we can just return
   // right away because we shouldn't block
   if (!hasExceptionMatch) {
     bool bloomExceptionFilterMiss = exceptionBloomFilter
-        && !exceptionBloomFilter->substringExists(input, AdBlockClient::kFingerprintSize);
+        && !exceptionBloomFilter->substringExists(input, inputLen, fingerprintSize);
     bool hostAnchoredExceptionHashSetMiss =
         isHostAnchoredHashSetMiss(input, inputLen, hostAnchoredExceptionHashSet,
-                                  inputHost, inputHostLen, contextOption, contextDomain,
+                                  inputHost, inputHostLen, contextOption, contextDomain, contextDomainLen,
                                   matchedExceptionFilter);
 
     if (bloomExceptionFilterMiss && hostAnchoredExceptionHashSetMiss) {
       if (bloomExceptionFilterMiss) {
-        numExceptionBloomFilterSaves++;
+        numExceptionBloomFilterSaves.fetch_add(1, std::memory_order_relaxed);
       }
       if (hostAnchoredExceptionHashSetMiss) {
-        numExceptionHashSetSaves++;
+        numExceptionHashSetSaves.fetch_add(1, std::memory_order_relaxed);
       }
     }
 
     if (!hostAnchoredExceptionHashSetMiss) {
-      numExceptionHashSetSaves++;
+      numExceptionHashSetSaves.fetch_add(1, std::memory_order_relaxed);
       hasExceptionMatch = true;
     }
 
     if (hostAnchoredExceptionHashSetMiss && !bloomExceptionFilterMiss) {
-      hasExceptionMatch = hasMatchingFilters(exceptionFilters, numExceptionFilters, input,
-                                             inputLen, contextOption, contextDomain,
+      hasExceptionMatch = hasMatchingFilters(&exceptionFilters, input,
+                                             inputLen, contextOption, contextDomain, contextDomainLen,
                                              &inputBloomFilter, inputHost, inputHostLen,
-                                             matchedExceptionFilter);
+                                             matchedExceptionFilter, &regexSetMatches);
       if (!hasExceptionMatch) {
         // False positive on the exception filter list
-        numExceptionFalsePositives++;
+        numExceptionFalsePositives.fetch_add(1, std::memory_order_relaxed);
         // cout << "exception false positive for input: " << input << endl;
         if (badFingerprintsHashSet) {
           discoverMatchingPrefix(badFingerprintsHashSet,
-                                 input, exceptionBloomFilter);
+                                 input, inputLen, exceptionBloomFilter, fingerprintSize);
         }
       }
     }
@@ -1287,21 +1503,100 @@ bool AdBlockClient::matches(const char *input, FilterOption contextOption,
 
   // Iteration at the end can increase efficiency.
   hasExceptionMatch = hasExceptionMatch ||
-      hasMatchingFilters(noFingerprintExceptionFilters,
-                         numNoFingerprintExceptionFilters, input, inputLen,
+      hasMatchingFilters(&noFingerprintExceptionFilters, input, inputLen,
                          contextOption,
-                         contextDomain, &inputBloomFilter, inputHost, inputHostLen,
-                         matchedExceptionFilter);
+                         contextDomain, contextDomainLen, &inputBloomFilter, inputHost, inputHostLen,
+                         matchedExceptionFilter, &regexSetMatches);
+  timer.lap(LPExceptionPipeline);
 
-  // If rule definitions have not been saved, use fallback.
-  if (*matchedFilter && !(*matchedFilter)->ruleDefinition) {
-    (*matchedFilter)->ruleDefinition = rule_definition_fallback;
+  return hasMatch && !hasExceptionMatch;
+}
+
+// Numbers filters in the order they are first asked for
+// A rule id holds the section of a filter above its index in the section
+static const int kRuleIdIndexBits = 24;
+static const int kRuleIdIndexMask = (1 << kRuleIdIndexBits) - 1;
+
+static int getRuleIdOf(EngineSection section, uint32_t index) {
+  if (index > static_cast<uint32_t>(kRuleIdIndexMask)) {
+    return -1;
   }
-  if (*matchedExceptionFilter && !(*matchedExceptionFilter)->ruleDefinition) {
-    (*matchedExceptionFilter)->ruleDefinition = rule_definition_fallback;
+  return static_cast<int>(section) << kRuleIdIndexBits | static_cast<int>(index);
+}
+
+int AdBlockClient::getRuleId(const Filter *filter) const {
+  if (!filter) {
+    return -1;
+  }
+  for (int i = 0; i < ESNumSections; i++) {
+    auto section = static_cast<EngineSection>(i);
+    const FilterList *filterList = getFilterList(section);
+    int index;
+    if (filterList && filterList->indexOf(filter, &index)) {
+      return getRuleIdOf(section, static_cast<uint32_t>(index));
+    }
+  }
+  uint32_t index;
+  if (hostAnchoredHashSet && hostAnchoredHashSet->IndexOf(filter, &index)) {
+    return getRuleIdOf(ESHostAnchoredHashSet, index);
   }
+  if (hostAnchoredExceptionHashSet
+      && hostAnchoredExceptionHashSet->IndexOf(filter, &index)) {
+    return getRuleIdOf(ESHostAnchoredExceptionHashSet, index);
+  }
+  return -1;
+}
 
-  return hasMatch && !hasExceptionMatch;
+const char *AdBlockClient::getRuleText(int ruleId) {
+  if (ruleId < 0) {
+    return nullptr;
+  }
+  int section = ruleId >> kRuleIdIndexBits;
+  int index = ruleId & kRuleIdIndexMask;
+  if (section >= ESNumSections) {
+    return nullptr;
+  }
+  // Rules in the filter lists are read from their record, the host
+  // anchored ones from their item, so nothing has to be built
+  const FilterList *filterList = getFilterList(static_cast<EngineSection>(section));
+  if (filterList) {
+    FilterRecord record;
+    if (index >= filterList->getSize() || !filterList->getRecord(index, &record)) {
+      return nullptr;
+    }
+    return getRuleTextAt(record.ruleOffset, record.ruleLen);
+  }
+  HashSet<Filter> *hashSet = nullptr;
+  if (section == ESHostAnchoredHashSet) {
+    hashSet = hostAnchoredHashSet;
+  } else if (section == ESHostAnchoredExceptionHashSet) {
+    hashSet = hostAnchoredExceptionHashSet;
+  }
+  Filter filter;
+  if (!hashSet || !hashSet->ReadItem(static_cast<uint32_t>(index), &filter)) {
+    return nullptr;
+  }
+  return getRuleTextAt(filter.ruleOffset, filter.ruleLen);
+}
+
+const char *AdBlockClient::getRuleDefinition(const Filter *filter) {
+  if (!filter) {
+    return nullptr;
+  }
+  return getRuleTextAt(filter->ruleOffset, filter->ruleLen);
+}
+
+const char *AdBlockClient::getRuleTextAt(uint32_t ruleOffset, int ruleLen) {
+  if (ruleLen < 0) {
+    return ruleDefinitionFallback;
+  }
+  loadSection(ESRuleText);
+  // Offsets of damaged data don't point out of the rule text
+  if (ruleOffset >= ruleTextSize
+      || static_cast<uint32_t>(ruleLen) >= ruleTextSize - ruleOffset) {
+    return ruleDefinitionFallback;
+  }
+  return ruleTextData + ruleOffset;
 }
 
 /**
@@ -1315,16 +1610,21 @@ bool AdBlockClient::findMatchingFilters(const char *input,
                                         const char *contextDomain,
                                         Filter **matchingFilter,
                                         Filter **matchingExceptionFilter) {
+  return findMatchingFilters(input, static_cast<int>(strlen(input)), contextOption,
+                             contextDomain,
+                             contextDomain ? static_cast<int>(strlen(contextDomain)) : 0,
+                             matchingFilter, matchingExceptionFilter);
+}
+
+bool AdBlockClient::findMatchingFilters(const char *input, int inputLen,
+                                        FilterOption contextOption,
+                                        const char *contextDomain, int contextDomainLen,
+                                        Filter **matchingFilter,
+                                        Filter **matchingExceptionFilter) {
   *matchingFilter = nullptr;
   *matchingExceptionFilter = nullptr;
-  int inputLen = static_cast<int>(strlen(input));
   int inputHostLen;
-  const char *inputHost = getUrlHost(input, &inputHostLen);
-
-  int contextDomainLen = 0;
-  if (contextDomain) {
-    contextDomainLen = static_cast<int>(strlen(contextDomain));
-  }
+  const char *inputHost = getUrlHost(input, inputLen, &inputHostLen);
   // If neither first party nor third party was specified, try to figure it out
   if (contextDomain && !(contextOption & (FOThirdParty | FONotThirdParty))) {
     if (isThirdPartyHost(contextDomain, contextDomainLen,
@@ -1335,71 +1635,67 @@ bool AdBlockClient::findMatchingFilters(const char *input,
     }
   }
 
-  hasMatchingFilters(noFingerprintFilters,
-                     numNoFingerprintFilters, input, inputLen, contextOption,
-                     contextDomain, nullptr,
-                     inputHost, inputHostLen, matchingFilter);
+  RegexSetMatches regexSetMatches(getRegexSet(), input, inputLen);
+
+  hasMatchingFilters(&noFingerprintFilters, input, inputLen, contextOption,
+                     contextDomain, contextDomainLen, nullptr,
+                     inputHost, inputHostLen, matchingFilter, &regexSetMatches);
 
   if (!*matchingFilter) {
-    hasMatchingFilters(noFingerprintDomainOnlyFilters,
-                       numNoFingerprintDomainOnlyFilters, input, inputLen, contextOption,
-                       contextDomain, nullptr,
-                       inputHost, inputHostLen, matchingFilter);
+    hasMatchingFilters(&noFingerprintDomainOnlyFilters, input, inputLen, contextOption,
+                       contextDomain, contextDomainLen, nullptr,
+                       inputHost, inputHostLen, matchingFilter, &regexSetMatches);
   }
   if (!*matchingFilter) {
-    hasMatchingFilters(noFingerprintAntiDomainOnlyFilters,
-                       numNoFingerprintAntiDomainOnlyFilters, input, inputLen, contextOption,
-                       contextDomain, nullptr,
-                       inputHost, inputHostLen, matchingFilter);
+    hasMatchingFilters(&noFingerprintAntiDomainOnlyFilters, input, inputLen, contextOption,
+                       contextDomain, contextDomainLen, nullptr,
+                       inputHost, inputHostLen, matchingFilter, &regexSetMatches);
   }
 
   if (!*matchingFilter) {
-    hasMatchingFilters(filters,
-                       numFilters, input, inputLen, contextOption,
-                       contextDomain, nullptr,
-                       inputHost, inputHostLen, matchingFilter);
+    hasMatchingFilters(&filters, input, inputLen, contextOption,
+                       contextDomain, contextDomainLen, nullptr,
+                       inputHost, inputHostLen, matchingFilter, &regexSetMatches);
   }
 
   if (!*matchingFilter) {
     isHostAnchoredHashSetMiss(input, inputLen,
                               hostAnchoredHashSet, inputHost, inputHostLen,
-                              contextOption, contextDomain, matchingFilter);
+                              contextOption, contextDomain, contextDomainLen, matchingFilter);
   }
 
   if (!*matchingFilter) {
     return false;
   }
 
-  hasMatchingFilters(noFingerprintExceptionFilters,
-                     numNoFingerprintExceptionFilters, input, inputLen, contextOption,
-                     contextDomain,
-                     nullptr, inputHost, inputHostLen, matchingExceptionFilter);
+  hasMatchingFilters(&noFingerprintExceptionFilters, input, inputLen, contextOption,
+                     contextDomain, contextDomainLen,
+                     nullptr, inputHost, inputHostLen, matchingExceptionFilter,
+                     &regexSetMatches);
 
   if (!*matchingExceptionFilter) {
-    hasMatchingFilters(noFingerprintDomainOnlyExceptionFilters,
-                       numNoFingerprintDomainOnlyExceptionFilters, input, inputLen,
-                       contextOption, contextDomain, nullptr, inputHost, inputHostLen,
-                       matchingExceptionFilter);
+    hasMatchingFilters(&noFingerprintDomainOnlyExceptionFilters, input, inputLen,
+                       contextOption, contextDomain, contextDomainLen, nullptr, inputHost, inputHostLen,
+                       matchingExceptionFilter, &regexSetMatches);
   }
 
   if (!*matchingExceptionFilter) {
-    hasMatchingFilters(noFingerprintAntiDomainOnlyExceptionFilters,
-                       numNoFingerprintAntiDomainOnlyExceptionFilters, input, inputLen,
-                       contextOption, contextDomain, nullptr, inputHost, inputHostLen,
-                       matchingExceptionFilter);
+    hasMatchingFilters(&noFingerprintAntiDomainOnlyExceptionFilters, input, inputLen,
+                       contextOption, contextDomain, contextDomainLen, nullptr, inputHost, inputHostLen,
+                       matchingExceptionFilter, &regexSetMatches);
   }
 
   if (!*matchingExceptionFilter) {
     isHostAnchoredHashSetMiss(input, inputLen, hostAnchoredExceptionHashSet,
-                              inputHost, inputHostLen, contextOption, contextDomain,
+                              inputHost, inputHostLen, contextOption, contextDomain, contextDomainLen,
                               matchingExceptionFilter);
   }
 
   if (!*matchingExceptionFilter) {
-    hasMatchingFilters(exceptionFilters,
-                       numExceptionFilters, input, inputLen, contextOption,
-                       contextDomain,
-                       nullptr, inputHost, inputHostLen, matchingExceptionFilter);
+    hasMatchingFilters(&exceptionFilters, input, inputLen, contextOption,
+                       contextDomain, contextDomainLen,
+                       nullptr, inputHost, inputHostLen, matchingExceptionFilter,
+                     &regexSetMatches);
   }
   return !*matchingExceptionFilter;
 }
@@ -1409,8 +1705,10 @@ void AdBlockClient::initBloomFilter(BloomFilter **pp,
   if (*pp) {
     delete *pp;
   }
+  // The deserialized buffer outlives the client like for the filters, so
+  // the bits are used in place until a new filter gets added
   if (len > 0) {
-    *pp = new BloomFilter(buffer, len);
+    *pp = new BloomFilter(buffer, len, true);
   }
 }
 
@@ -1422,7 +1720,8 @@ bool AdBlockClient::initHashSet(HashSet<T> **pp, char *buffer, int len) {
   if (len > 0) {
     *pp = new HashSet<T>(0, false);
 
-    return (*pp)->Deserialize(buffer, len);
+    // Only looked up while matching, so the sets are used in place
+    return (*pp)->DeserializeInPlace(buffer, len) == static_cast<uint32_t>(len);
   }
 
   return true;
@@ -1436,15 +1735,107 @@ bool AdBlockClient::initHashMap(HashMap<K, V> **pp, char *buffer, int len) {
   if (len > 0) {
     *pp = new HashMap<K, V>(0);
 
-    return (*pp)->Deserialize(buffer, len);
+    return (*pp)->Deserialize(buffer, len) == static_cast<uint32_t>(len);
   }
 
   return true;
 }
 
+const RegexSet *AdBlockClient::getRegexSet() {
+  RegexSet *set = regexSet.load(std::memory_order_acquire);
+  if (set) {
+    return set;
+  }
+  std::lock_guard<std::mutex> guard(regexSetLock);
+  set = regexSet.load(std::memory_order_relaxed);
+  if (set) {
+    return set;
+  }
+  set = new RegexSet();
+  FilterList *filterLists[] = {
+      &filters,
+      &exceptionFilters,
+      &noFingerprintFilters,
+      &noFingerprintExceptionFilters,
+      &noFingerprintDomainOnlyFilters,
+      &noFingerprintAntiDomainOnlyFilters,
+      &noFingerprintDomainOnlyExceptionFilters,
+      &noFingerprintAntiDomainOnlyExceptionFilters
+  };
+  for (FilterList *filterList : filterLists) {
+    for (int i = 0; i < filterList->getSize(); i++) {
+      FilterRecord record;
+      if (filterList->getRecord(i, &record) && (record.filterType & FTRegex)
+          && record.data) {
+        filterList->getFilter(i)->regexSetId =
+            set->add(record.data, record.dataLen);
+      }
+    }
+  }
+  regexSet.store(set, std::memory_order_release);
+  return set;
+}
+
+// Writes the records of |filterList| followed by |numNewFilters| records
+// for |newFilters| into a new buffer of |*size| bytes, their strings are
+// added to |stringTable|
+static char *appendFilterRecords(const FilterList &filterList,
+                                 const Filter *newFilters, int numNewFilters,
+                                 StringTable *stringTable, uint32_t *size) {
+  int numFilters = filterList.getSize();
+  *size = static_cast<uint32_t>(numFilters + numNewFilters) * kFilterRecordSize;
+  auto *records = new char[*size];
+  char *record = records;
+  for (int i = 0; i < numFilters; i++) {
+    FilterRecord old;
+    if (filterList.getRecord(i, &old)) {
+      putFilterRecord(record, Filter(old), stringTable);
+    } else {
+      putFilterRecord(record, Filter(), stringTable);
+    }
+    record += kFilterRecordSize;
+  }
+  for (int i = 0; i < numNewFilters; i++) {
+    putFilterRecord(record, newFilters[i], stringTable);
+    record += kFilterRecordSize;
+  }
+  return records;
+}
+
+// Turns |hashSet|, which parse() added to, back into one used in place
+// from |section| of parsedSections like a deserialized one
+void AdBlockClient::sealHashSet(HashSet<Filter> *hashSet,
+                                EngineSection section) {
+  uint32_t size;
+  char *buffer = hashSet->SerializeOut(&size);
+  // Items added from the old buffer borrow from it until they're replaced
+  if (hashSet->DeserializeInPlace(buffer, size) != size) {
+    delete[] buffer;
+    return;
+  }
+  delete[] parsedSections[section];
+  parsedSections[section] = buffer;
+  parsedSectionSizes[section] = size;
+}
+
 // Parses the filter data into a few collections of filters and enables
 // efficient querying.
 bool AdBlockClient::parse(const char *input, bool preserveRules) {
+  return parse(input, strlen(input), preserveRules);
+}
+
+bool AdBlockClient::parse(const char *input, size_t len, bool preserveRules) {
+  // The filters are about to be reallocated
+  waitForSave();
+  // New cosmetic filters are merged into the loaded ones
+  for (int i = 0; i < ESNumSections; i++) {
+    loadSection(static_cast<EngineSection>(i));
+  }
+  // They differ from deserializedBuffer from now on, so they're kept
+  {
+    std::lock_guard<std::mutex> guard(sectionLock);
+    reloadableSections = 0;
+  }
   // If the user is parsing and we have regex support,
   // then we can determine the fingerprints for the bloom filter.
   // Otherwise it needs to be done manually via initBloomFilter and
@@ -1501,27 +1892,52 @@ bool AdBlockClient::parse(const char *input, bool preserveRules) {
   // Simple cosmetic filters apply to all sites without exception
   CosmeticFilterHashSet genericCosmeticFilters(1000);
 
-  // record parsing results in a linked list
+  // record parsing results in a linked list, the filters borrow their
+  // strings from the arena so copying them doesn't copy the strings
   LinkedList<Filter> filterList;
+  if (!arena) {
+    arena = new Arena();
+  }
+  // Domain lists and selectors repeated by the rules of this list are
+  // only stored once, the pooled strings stay in the arena
+  StringPool stringPool(arena);
+  // Rule text is appended to ruleText, which becomes a copy of the loaded
+  // rule text first
+  if (preserveRules && ruleTextData != ruleText.data()) {
+    ruleText.assign(ruleTextData ? ruleTextData : "", ruleTextSize);
+  }
 
+  const char *end = input + len;
   const char *lineStart = input;
   const char *p = lineStart + 1;
 
-  while (true) {
-    if ((isEndOfLine(*p) || *p == '\0') && p > lineStart) {
+  while (p <= end) {
+    bool isLastLine = p == end || *p == '\0';
+    if ((isLastLine || isEndOfLine(*p)) && p > lineStart) {
+      const char *line = lineStart;
+      const char *lineEnd = p;
+      // parseFilter() peeks past the end of a line, so a last line without
+      // a terminator is parsed from a copy rather than reading past |end|
+      std::string lastLine;
+      if (p == end) {
+        lastLine.assign(lineStart, p - lineStart);
+        line = lastLine.c_str();
+        lineEnd = line + lastLine.length();
+      }
       Filter f;
-      parseFilter(lineStart, p, &f, bloomFilter, exceptionBloomFilter,
+      parseFilter(line, lineEnd, &f, bloomFilter, exceptionBloomFilter,
                   hostAnchoredHashSet,
                   hostAnchoredExceptionHashSet,
                   &genericCosmeticFilters,
-                  preserveRules);
+                  preserveRules ? &ruleText : nullptr,
+                  fingerprintSize, fingerprintOptimizer, arena, &stringPool);
       if (f.isValid()) {
         filterList.push_back(f);
         switch (f.filterType & FTListTypesMask) {
         case FTException:
           if (f.filterType & FTHostOnly) {
             newNumHostAnchoredExceptionFilters++;
-          } else if (AdBlockClient::getFingerprint(nullptr, f)) {
+          } else if (AdBlockClient::getFingerprint(nullptr, f, fingerprintSize)) {
             newNumExceptionFilters++;
           } else if (f.isDomainOnlyFilter()) {
             newNumNoFingerprintDomainOnlyExceptionFilters++;
@@ -1556,7 +1972,7 @@ bool AdBlockClient::parse(const char *input, bool preserveRules) {
         default:
           if (f.filterType & FTHostOnly) {
             newNumHostAnchoredFilters++;
-          } else if (AdBlockClient::getFingerprint(nullptr, f)) {
+          } else if (AdBlockClient::getFingerprint(nullptr, f, fingerprintSize)) {
             newNumFilters++;
           } else if (f.isDomainOnlyFilter()) {
             newNumNoFingerprintDomainOnlyFilters++;
@@ -1571,15 +1987,21 @@ bool AdBlockClient::parse(const char *input, bool preserveRules) {
       lineStart = p + 1;
     }
 
-    if (*p == '\0') {
+    if (isLastLine) {
       break;
     }
 
     p++;
   }
 
+  if (preserveRules) {
+    ruleText.shrink_to_fit();
+    ruleTextData = ruleText.data();
+    ruleTextSize = static_cast<uint32_t>(ruleText.size());
+  }
+
 #ifdef PERF_STATS
-  cout << "Fingerprint size: " << AdBlockClient::kFingerprintSize << endl;
+  cout << "Fingerprint size: " << fingerprintSize << endl;
   cout << "Num new filters: " << newNumFilters << endl;
   cout << "Num new cosmetic filters: " << newNumCosmeticFilters << endl;
   cout << "Num new HTML filters: " << newNumHtmlFilters << endl;
@@ -1602,28 +2024,22 @@ bool AdBlockClient::parse(const char *input, bool preserveRules) {
     << newNumNoFingerprintAntiDomainOnlyExceptionFilters << endl;
 #endif
 
-  auto *newFilters = new Filter[newNumFilters + numFilters];
-  auto *newHtmlFilters =
-      new Filter[newNumHtmlFilters + numHtmlFilters];
-  auto *newExceptionFilters =
-      new Filter[newNumExceptionFilters + numExceptionFilters];
-  auto *newNoFingerprintFilters =
-      new Filter[newNumNoFingerprintFilters + numNoFingerprintFilters];
+  // The new filters are only kept until they're appended to the records
+  // of the filter lists
+  auto *newFilters = new Filter[newNumFilters];
+  auto *newHtmlFilters = new Filter[newNumHtmlFilters];
+  auto *newExceptionFilters = new Filter[newNumExceptionFilters];
+  auto *newNoFingerprintFilters = new Filter[newNumNoFingerprintFilters];
   auto *newNoFingerprintExceptionFilters =
-      new Filter[newNumNoFingerprintExceptionFilters
-          + numNoFingerprintExceptionFilters];
+      new Filter[newNumNoFingerprintExceptionFilters];
   auto *newNoFingerprintDomainOnlyFilters =
-      new Filter[newNumNoFingerprintDomainOnlyFilters +
-          numNoFingerprintDomainOnlyFilters];
+      new Filter[newNumNoFingerprintDomainOnlyFilters];
   auto *newNoFingerprintAntiDomainOnlyFilters =
-      new Filter[newNumNoFingerprintAntiDomainOnlyFilters +
-          numNoFingerprintAntiDomainOnlyFilters];
+      new Filter[newNumNoFingerprintAntiDomainOnlyFilters];
   auto *newNoFingerprintDomainOnlyExceptionFilters =
-      new Filter[newNumNoFingerprintDomainOnlyExceptionFilters
-          + numNoFingerprintDomainOnlyExceptionFilters];
+      new Filter[newNumNoFingerprintDomainOnlyExceptionFilters];
   auto *newNoFingerprintAntiDomainOnlyExceptionFilters =
-      new Filter[newNumNoFingerprintAntiDomainOnlyExceptionFilters
-          + numNoFingerprintAntiDomainOnlyExceptionFilters];
+      new Filter[newNumNoFingerprintAntiDomainOnlyExceptionFilters];
 
   Filter *curFilters = newFilters;
   Filter *curHtmlFilters = newHtmlFilters;
@@ -1638,83 +2054,6 @@ bool AdBlockClient::parse(const char *input, bool preserveRules) {
   Filter *curNoFingerprintAntiDomainOnlyExceptionFilters =
       newNoFingerprintAntiDomainOnlyExceptionFilters;
 
-  // If we've had a parse before copy the old data into the new data structure
-  if (filters || htmlFilters || exceptionFilters ||
-      noFingerprintFilters || noFingerprintExceptionFilters ||
-      noFingerprintDomainOnlyFilters ||
-      noFingerprintDomainOnlyExceptionFilters ||
-      noFingerprintAntiDomainOnlyFilters ||
-      noFingerprintAntiDomainOnlyExceptionFilters) {
-    // - Copy the old data in, we can't simply use memcpy here
-    // since filters manages some pointers that get deleted.
-    // - Set the old filter lists borrowedMemory to true
-    // since it'll be taken by the new filters.
-    for (int i = 0; i < numFilters; i++) {
-      newFilters[i].swapData(&(filters[i]));
-      filters[i].borrowed_data = true;
-    }
-    for (int i = 0; i < numHtmlFilters; i++) {
-      newHtmlFilters[i].swapData(&(htmlFilters[i]));
-      htmlFilters[i].borrowed_data = true;
-    }
-    for (int i = 0; i < numExceptionFilters; i++) {
-      newExceptionFilters[i].swapData(&(exceptionFilters[i]));
-      exceptionFilters[i].borrowed_data = true;
-    }
-    for (int i = 0; i < numNoFingerprintFilters; i++) {
-      newNoFingerprintFilters[i].swapData(&(noFingerprintFilters[i]));
-      noFingerprintFilters[i].borrowed_data = true;
-    }
-    for (int i = 0; i < numNoFingerprintExceptionFilters; i++) {
-      newNoFingerprintExceptionFilters[i].swapData(
-          &(noFingerprintExceptionFilters[i]));
-      noFingerprintExceptionFilters[i].borrowed_data = true;
-    }
-    for (int i = 0; i < numNoFingerprintDomainOnlyFilters; i++) {
-      newNoFingerprintDomainOnlyFilters[i].swapData(
-          &(noFingerprintDomainOnlyFilters[i]));
-      noFingerprintDomainOnlyFilters[i].borrowed_data = true;
-    }
-    for (int i = 0; i < numNoFingerprintAntiDomainOnlyFilters; i++) {
-      newNoFingerprintAntiDomainOnlyFilters[i].swapData(
-          &(noFingerprintAntiDomainOnlyFilters[i]));
-      noFingerprintAntiDomainOnlyFilters[i].borrowed_data = true;
-    }
-    for (int i = 0; i < numNoFingerprintDomainOnlyExceptionFilters; i++) {
-      newNoFingerprintDomainOnlyExceptionFilters[i].swapData(
-          &(noFingerprintDomainOnlyExceptionFilters[i]));
-      noFingerprintDomainOnlyExceptionFilters[i].borrowed_data = true;
-    }
-    for (int i = 0; i < numNoFingerprintAntiDomainOnlyExceptionFilters; i++) {
-      newNoFingerprintAntiDomainOnlyExceptionFilters[i].swapData(
-          &(noFingerprintAntiDomainOnlyExceptionFilters[i]));
-      noFingerprintAntiDomainOnlyExceptionFilters[i].borrowed_data = true;
-    }
-
-    // Free up the old memory for filter storage
-    delete[] filters;
-    delete[] htmlFilters;
-    delete[] exceptionFilters;
-    delete[] noFingerprintFilters;
-    delete[] noFingerprintExceptionFilters;
-    delete[] noFingerprintDomainOnlyFilters;
-    delete[] noFingerprintAntiDomainOnlyFilters;
-    delete[] noFingerprintDomainOnlyExceptionFilters;
-    delete[] noFingerprintAntiDomainOnlyExceptionFilters;
-
-    // Adjust the current pointers to be just after the copied in data
-    curFilters += numFilters;
-    curHtmlFilters += numHtmlFilters;
-    curExceptionFilters += numExceptionFilters;
-    curNoFingerprintFilters += numNoFingerprintFilters;
-    curNoFingerprintExceptionFilters += numNoFingerprintExceptionFilters;
-    curNoFingerprintDomainOnlyFilters += numNoFingerprintDomainOnlyFilters;
-    curNoFingerprintAntiDomainOnlyFilters += numNoFingerprintAntiDomainOnlyFilters;
-    curNoFingerprintDomainOnlyExceptionFilters += numNoFingerprintDomainOnlyExceptionFilters;
-    curNoFingerprintAntiDomainOnlyExceptionFilters +=
-        numNoFingerprintAntiDomainOnlyExceptionFilters;
-  }
-
   // And finally update with the new counts
   numFilters += newNumFilters;
   numCosmeticFilters += newNumCosmeticFilters;
@@ -1731,19 +2070,6 @@ bool AdBlockClient::parse(const char *input, bool preserveRules) {
   numHostAnchoredFilters += newNumHostAnchoredFilters;
   numHostAnchoredExceptionFilters += newNumHostAnchoredExceptionFilters;
 
-  // Adjust the new member list pointers
-  filters = newFilters;
-  htmlFilters = newHtmlFilters;
-  exceptionFilters = newExceptionFilters;
-  noFingerprintFilters = newNoFingerprintFilters;
-  noFingerprintExceptionFilters = newNoFingerprintExceptionFilters;
-  noFingerprintDomainOnlyFilters = newNoFingerprintDomainOnlyFilters;
-  noFingerprintAntiDomainOnlyFilters = newNoFingerprintAntiDomainOnlyFilters;
-  noFingerprintDomainOnlyExceptionFilters =
-      newNoFingerprintDomainOnlyExceptionFilters;
-  noFingerprintAntiDomainOnlyExceptionFilters =
-      newNoFingerprintAntiDomainOnlyExceptionFilters;
-
   CosmeticFilterHashMap elementHidingFilterHashMap(6000);
   CosmeticFilterHashMap elementHidingExceptionFilterHashMap(2000);
   // rules count is often close to rules domain count, so we use rules count here
@@ -1756,7 +2082,7 @@ bool AdBlockClient::parse(const char *input, bool preserveRules) {
     case FTException:
       if (f.filterType & FTHostOnly) {
         // do nothing, handled by hash set.
-      } else if (AdBlockClient::getFingerprint(nullptr, f)) {
+      } else if (AdBlockClient::getFingerprint(nullptr, f, fingerprintSize)) {
         (*curExceptionFilters).swapData(&f);
         curExceptionFilters++;
       } else if (f.isDomainOnlyFilter()) {
@@ -1792,7 +2118,7 @@ bool AdBlockClient::parse(const char *input, bool preserveRules) {
       curHtmlFilters++;
       break;
     case FTScriptlet:
-      if (extractScriptletArgsAsData(f)) {
+      if (extractScriptletArgsAsData(f, &stringPool)) {
         putElementHidingFilterToHashMap(&f, scriptletHashMap);
       }
       break;
@@ -1803,7 +2129,7 @@ bool AdBlockClient::parse(const char *input, bool preserveRules) {
     default:
       if (f.filterType & FTHostOnly) {
         // Do nothing
-      } else if (AdBlockClient::getFingerprint(nullptr, f)) {
+      } else if (AdBlockClient::getFingerprint(nullptr, f, fingerprintSize)) {
         (*curFilters).swapData(&f);
         curFilters++;
       } else if (f.isDomainOnlyFilter()) {
@@ -1822,6 +2148,73 @@ bool AdBlockClient::parse(const char *input, bool preserveRules) {
     }
   }
 
+  // The new filters are appended to the records of the old ones, the
+  // lists then use their records in place like deserialized ones do.
+  // Every string moves into a new string table, so the old records and
+  // strings are released once all lists use the new ones.
+  struct {
+    EngineSection section;
+    FilterList *filterList;
+    Filter *newFilters;
+    int numNewFilters;
+  } filterSections[] = {
+      {ESFilters, &filters, newFilters, newNumFilters},
+      {ESExceptionFilters, &exceptionFilters, newExceptionFilters,
+       newNumExceptionFilters},
+      {ESHtmlFilters, &htmlFilters, newHtmlFilters, newNumHtmlFilters},
+      {ESNoFingerprintFilters, &noFingerprintFilters, newNoFingerprintFilters,
+       newNumNoFingerprintFilters},
+      {ESNoFingerprintExceptionFilters, &noFingerprintExceptionFilters,
+       newNoFingerprintExceptionFilters, newNumNoFingerprintExceptionFilters},
+      {ESNoFingerprintDomainOnlyFilters, &noFingerprintDomainOnlyFilters,
+       newNoFingerprintDomainOnlyFilters, newNumNoFingerprintDomainOnlyFilters},
+      {ESNoFingerprintAntiDomainOnlyFilters,
+       &noFingerprintAntiDomainOnlyFilters,
+       newNoFingerprintAntiDomainOnlyFilters,
+       newNumNoFingerprintAntiDomainOnlyFilters},
+      {ESNoFingerprintDomainOnlyExceptionFilters,
+       &noFingerprintDomainOnlyExceptionFilters,
+       newNoFingerprintDomainOnlyExceptionFilters,
+       newNumNoFingerprintDomainOnlyExceptionFilters},
+      {ESNoFingerprintAntiDomainOnlyExceptionFilters,
+       &noFingerprintAntiDomainOnlyExceptionFilters,
+       newNoFingerprintAntiDomainOnlyExceptionFilters,
+       newNumNoFingerprintAntiDomainOnlyExceptionFilters},
+  };
+  StringTable stringTable;
+  char *records[sizeof(filterSections) / sizeof(filterSections[0])];
+  uint32_t recordsSize[sizeof(filterSections) / sizeof(filterSections[0])];
+  int i = 0;
+  for (auto &filterSection : filterSections) {
+    records[i] = appendFilterRecords(*filterSection.filterList,
+                                     filterSection.newFilters,
+                                     filterSection.numNewFilters,
+                                     &stringTable, &recordsSize[i]);
+    i++;
+  }
+  auto *strings = new char[stringTable.getSize()];
+  memcpy(strings, stringTable.getData(), stringTable.getSize());
+  // The regex set ids are kept by the filters the lists built
+  delete regexSet.load();
+  regexSet = nullptr;
+  i = 0;
+  for (auto &filterSection : filterSections) {
+    filterSection.filterList->init(records[i], recordsSize[i], strings,
+                                   stringTable.getSize());
+    delete[] filterSection.newFilters;
+    delete[] parsedSections[filterSection.section];
+    parsedSections[filterSection.section] = records[i];
+    parsedSectionSizes[filterSection.section] = recordsSize[i];
+    i++;
+  }
+  delete[] parsedSections[ESStringTable];
+  parsedSections[ESStringTable] = strings;
+  parsedSectionSizes[ESStringTable] = stringTable.getSize();
+  stringTableData = strings;
+  stringTableSize = stringTable.getSize();
+  sealHashSet(hostAnchoredHashSet, ESHostAnchoredHashSet);
+  sealHashSet(hostAnchoredExceptionHashSet, ESHostAnchoredExceptionHashSet);
+
   if (!elementHidingSelectorHashMap) {
     elementHidingSelectorHashMap =
         new HashMap<NoFingerprintDomain, CosmeticFilter>(elementHidingFilterHashMap.GetSize());
@@ -1877,442 +2270,983 @@ bool AdBlockClient::tagExists(const std::string &tag) const {
   return tags.find(tag) != tags.end();
 }
 
-// Fills the specified buffer if specified, returns the number of characters
-// written or needed
-int serializeFilters(char *buffer, size_t bufferSizeAvail,
-                     Filter *f, int numFilters) {
-  int bufferSize = 0;
-  for (int i = 0; i < numFilters; i++) {
-    bufferSize += f->Serialize(buffer ? (buffer + bufferSize) : nullptr);
-    f++;
+FilterList *AdBlockClient::getFilterList(EngineSection section) {
+  return const_cast<FilterList *>(
+      static_cast<const AdBlockClient *>(this)->getFilterList(section));
+}
+
+const FilterList *AdBlockClient::getFilterList(EngineSection section) const {
+  switch (section) {
+    case ESFilters:
+      return &filters;
+    case ESExceptionFilters:
+      return &exceptionFilters;
+    case ESHtmlFilters:
+      return &htmlFilters;
+    case ESNoFingerprintFilters:
+      return &noFingerprintFilters;
+    case ESNoFingerprintExceptionFilters:
+      return &noFingerprintExceptionFilters;
+    case ESNoFingerprintDomainOnlyFilters:
+      return &noFingerprintDomainOnlyFilters;
+    case ESNoFingerprintAntiDomainOnlyFilters:
+      return &noFingerprintAntiDomainOnlyFilters;
+    case ESNoFingerprintDomainOnlyExceptionFilters:
+      return &noFingerprintDomainOnlyExceptionFilters;
+    case ESNoFingerprintAntiDomainOnlyExceptionFilters:
+      return &noFingerprintAntiDomainOnlyExceptionFilters;
+    default:
+      return nullptr;
+  }
+}
+
+template<class T>
+uint32_t serializeHashSet(char *buffer, HashSet<T> *hashSet) {
+  return hashSet ? hashSet->Serialize(buffer) : 0;
+}
+
+// Fills the specified buffer with |section| if specified, returns the
+// number of bytes written or needed
+uint32_t AdBlockClient::serializeSection(EngineSection section, char *buffer,
+                                         int adjustedNumHtmlFilters) const {
+  // Sections which weren't loaded yet are still the deserialized bytes
+  if (sectionPending[section].load(std::memory_order_acquire)) {
+    const SectionEntry &entry = pendingSections[section];
+    if (buffer) {
+      memcpy(buffer, deserializedBuffer + entry.offset, entry.size);
+    }
+    return entry.size;
+  }
+  // The filter records point into the string table, so they're copied
+  // as they are. Only the first |adjustedNumHtmlFilters| HTML filters are
+  // kept.
+  const FilterList *filterList = getFilterList(section);
+  if (filterList) {
+    uint32_t size = section == ESHtmlFilters
+        ? static_cast<uint32_t>(adjustedNumHtmlFilters) * kFilterRecordSize
+        : filterList->getRecordsSize();
+    if (buffer && size > 0) {
+      memcpy(buffer, filterList->getRecords(), size);
+    }
+    return size;
+  }
+  switch (section) {
+    case ESBloomFilter:
+    case ESExceptionBloomFilter: {
+      BloomFilter *filter =
+          section == ESBloomFilter ? bloomFilter : exceptionBloomFilter;
+      if (!filter) {
+        return 0;
+      }
+      if (buffer) {
+        memcpy(buffer, filter->getBuffer(), filter->getByteBufferSize());
+      }
+      return filter->getByteBufferSize();
+    }
+    case ESHostAnchoredHashSet:
+      return serializeHashSet(buffer, hostAnchoredHashSet);
+    case ESHostAnchoredExceptionHashSet:
+      return serializeHashSet(buffer, hostAnchoredExceptionHashSet);
+    case ESNoFingerprintDomainHashSet:
+      return serializeHashSet(buffer, noFingerprintDomainHashSet);
+    case ESNoFingerprintAntiDomainHashSet:
+      return serializeHashSet(buffer, noFingerprintAntiDomainHashSet);
+    case ESNoFingerprintDomainExceptionHashSet:
+      return serializeHashSet(buffer, noFingerprintDomainExceptionHashSet);
+    case ESNoFingerprintAntiDomainExceptionHashSet:
+      return serializeHashSet(buffer, noFingerprintAntiDomainExceptionHashSet);
+    case ESElementHidingHashMap:
+      return serializeHashSet(buffer, elementHidingSelectorHashMap);
+    case ESElementHidingExceptionHashMap:
+      return serializeHashSet(buffer, elementHidingExceptionSelectorHashMap);
+    case ESGenericElementHidingSelectors:
+      return genericElementHidingSelectors
+             ? genericElementHidingSelectors->Serialize(buffer) : 0;
+    case ESExtendedCssHashMap:
+      return serializeHashSet(buffer, extendedCssMap);
+    case ESCssRulesHashMap:
+      return serializeHashSet(buffer, cssRulesMap);
+    case ESScriptletHashMap:
+      return serializeHashSet(buffer, scriptletMap);
+    case ESStringTable:
+      if (buffer && stringTableSize > 0) {
+        memcpy(buffer, stringTableData, stringTableSize);
+      }
+      return stringTableSize;
+    case ESRuleText:
+      if (buffer && ruleTextSize > 0) {
+        memcpy(buffer, ruleTextData, ruleTextSize);
+      }
+      return ruleTextSize;
+    case ESNumSections:
+      break;
+  }
+  return 0;
+}
+
+// A save in progress reads compressedSections, so it's finished first
+void AdBlockClient::setSectionCompression(EngineSection section, bool compressed) {
+  waitForSave();
+  if (compressed) {
+    compressedSections |= 1u << section;
+  } else {
+    compressedSections &= ~(1u << section);
+  }
+}
+
+// Serializes |section| of |*size| bytes compressed if that is selected
+// and makes it smaller. Returns the compressed data, which should be
+// deleted, and updates |size|, or returns nullptr to store it as is.
+char *AdBlockClient::compressSection(EngineSection section, uint32_t *size,
+                                     int adjustedNumHtmlFilters) const {
+  if (!(compressedSections & (1u << section)) || *size == 0
+      || sectionPending[section].load(std::memory_order_relaxed)) {
+    return nullptr;
+  }
+  char *data = new char[*size];
+  serializeSection(section, data, adjustedNumHtmlFilters);
+  char *packed = new char[4 + lz4CompressBound(*size)];
+  putUint32LE(packed, *size);
+  uint32_t packedSize = 4 + lz4Compress(data, *size, packed + 4);
+  delete[] data;
+  if (packedSize >= *size) {
+    delete[] packed;
+    return nullptr;
   }
-  return bufferSize;
+  *size = packedSize;
+  return packed;
+}
+
+// Flags of |section| when it's stored uncompressed, sections which weren't
+// loaded are copied as stored
+uint32_t AdBlockClient::storedSectionFlags(EngineSection section) const {
+  return sectionPending[section].load(std::memory_order_relaxed)
+         ? pendingSections[section].flags : 0;
+}
+
+// Fills the header and section table in front of the sections
+void AdBlockClient::putHeader(char *buffer, const SectionEntry *sections,
+                              int adjustedNumHtmlFilters) const {
+  const int counts[kEngineHeaderCounts] = {
+      numFilters,
+      numExceptionFilters,
+      numCosmeticFilters,
+      adjustedNumHtmlFilters,
+      numScriptletFilters,
+      numNoFingerprintFilters,
+      numNoFingerprintExceptionFilters,
+      numNoFingerprintDomainOnlyFilters,
+      numNoFingerprintAntiDomainOnlyFilters,
+      numNoFingerprintDomainOnlyExceptionFilters,
+      numNoFingerprintAntiDomainOnlyExceptionFilters,
+      numHostAnchoredFilters,
+      numHostAnchoredExceptionFilters
+  };
+  putUint32LE(buffer, kEngineMagic);
+  putUint32LE(buffer + 4, kEngineFormatVersion);
+  putUint32LE(buffer + 8, fingerprintSize);
+  putUint32LE(buffer + 12, ESNumSections);
+  for (uint32_t i = 0; i < kEngineHeaderCounts; i++) {
+    putUint32LE(buffer + 16 + i * 4, counts[i]);
+  }
+  for (int i = 0; i < ESNumSections; i++) {
+    putSectionEntry(buffer + kEngineHeaderSize + i * kSectionEntrySize,
+                    sections[i]);
+  }
+  putUint32LE(buffer + kEngineTableEnd - 4,
+              crc32c(buffer, kEngineTableEnd - 4));
 }
 
 // Returns a newly allocated buffer, caller must manually delete[] the buffer
 char *AdBlockClient::serialize(int *totalSize, bool ignoreHtmlFilters) const {
-  *totalSize = 0;
   int adjustedNumHtmlFilters = ignoreHtmlFilters ? 0 : numHtmlFilters;
+  // Keeps sections from being loaded in between the two passes
+  std::lock_guard<std::mutex> guard(sectionLock);
+
+  // Lay out the sections to get the number of bytes that we'll need.
+  // Compressed sections are produced here already since only that tells
+  // their size.
+  SectionEntry sections[ESNumSections];
+  char *compressed[ESNumSections];
+  uint32_t pos = kEngineTableEnd;
+  for (int i = 0; i < ESNumSections; i++) {
+    auto section = static_cast<EngineSection>(i);
+    pos = alignSection(pos);
+    sections[i].id = i;
+    sections[i].offset = pos;
+    sections[i].size = serializeSection(section, nullptr, adjustedNumHtmlFilters);
+    compressed[i] = compressSection(section, &sections[i].size,
+                                    adjustedNumHtmlFilters);
+    sections[i].flags = compressed[i] ? kSectionCompressed
+                                      : storedSectionFlags(section);
+    pos += sections[i].size;
+  }
+  *totalSize = static_cast<int>(pos);
 
-  uint32_t hostAnchoredHashSetSize = 0;
-  char *hostAnchoredHashSetBuffer = nullptr;
-  if (hostAnchoredHashSet) {
-    hostAnchoredHashSetBuffer =
-        hostAnchoredHashSet->SerializeOut(&hostAnchoredHashSetSize);
+  // Allocate it
+  char *buffer = new char[pos];
+  memset(buffer, 0, pos);
+
+  // And start copying stuff in
+  for (int i = 0; i < ESNumSections; i++) {
+    if (compressed[i]) {
+      memcpy(buffer + sections[i].offset, compressed[i], sections[i].size);
+      delete[] compressed[i];
+    } else {
+      serializeSection(static_cast<EngineSection>(i),
+                       buffer + sections[i].offset, adjustedNumHtmlFilters);
+    }
+    sections[i].crc = crc32c(buffer + sections[i].offset, sections[i].size);
   }
+  putHeader(buffer, sections, adjustedNumHtmlFilters);
 
-  uint32_t hostAnchoredExceptionHashSetSize = 0;
-  char *hostAnchoredExceptionHashSetBuffer = nullptr;
-  if (hostAnchoredExceptionHashSet) {
-    hostAnchoredExceptionHashSetBuffer =
-        hostAnchoredExceptionHashSet->SerializeOut(
-            &hostAnchoredExceptionHashSetSize);
+  return buffer;
+}
+
+// Appends a section to a FileWriter piece by piece and keeps its CRC
+class SectionWriter {
+ public:
+  explicit SectionWriter(FileWriter *file) : file(file), room(nullptr),
+                                             size(0), crc(0) {
   }
 
-  uint32_t noFingerprintDomainHashSetSize = 0;
-  char *noFingerprintDomainHashSetBuffer = nullptr;
-  if (noFingerprintDomainHashSet) {
-    noFingerprintDomainHashSetBuffer =
-        noFingerprintDomainHashSet->SerializeOut(&noFingerprintDomainHashSetSize);
+  char *reserve(uint32_t n) {
+    room = file->reserve(n);
+    return room;
   }
 
-  uint32_t noFingerprintAntiDomainHashSetSize = 0;
-  char *noFingerprintAntiDomainHashSetBuffer = nullptr;
-  if (noFingerprintAntiDomainHashSet) {
-    noFingerprintAntiDomainHashSetBuffer =
-        noFingerprintAntiDomainHashSet->SerializeOut(
-            &noFingerprintAntiDomainHashSetSize);
+  void append(uint32_t n) {
+    crc = crc32c(room, n, crc);
+    size += n;
+    file->append(n);
   }
 
-  uint32_t noFingerprintDomainExceptionHashSetSize = 0;
-  char *noFingerprintDomainExceptionHashSetBuffer = nullptr;
-  if (noFingerprintDomainExceptionHashSet) {
-    noFingerprintDomainExceptionHashSetBuffer =
-        noFingerprintDomainExceptionHashSet->SerializeOut(
-            &noFingerprintDomainExceptionHashSetSize);
+  uint32_t getSize() const {
+    return size;
   }
 
-  uint32_t noFingerprintAntiDomainExceptionHashSetSize = 0;
-  char *noFingerprintAntiDomainExceptionHashSetBuffer = nullptr;
-  if (noFingerprintAntiDomainExceptionHashSet) {
-    noFingerprintAntiDomainExceptionHashSetBuffer =
-        noFingerprintAntiDomainExceptionHashSet->SerializeOut(
-            &noFingerprintAntiDomainExceptionHashSetSize);
+  uint32_t getCrc() const {
+    return crc;
   }
 
-  uint32_t elementHidingHashMapSize = 0;
-  char *elementHidingHashMapBuffer = nullptr;
-  if (elementHidingSelectorHashMap) {
-    elementHidingHashMapBuffer =
-        elementHidingSelectorHashMap->SerializeOut(&elementHidingHashMapSize);
+ private:
+  FileWriter *file;
+  char *room;
+  uint32_t size;
+  uint32_t crc;
+};
+
+template<class W, class T>
+void streamHashSet(W *writer, HashSet<T> *hashSet) {
+  if (hashSet) {
+    hashSet->SerializeTo(writer);
   }
+}
 
-  uint32_t elementHidingExceptionHashMapSize = 0;
-  char *elementHidingExceptionHashMapBuffer = nullptr;
-  if (elementHidingExceptionSelectorHashMap) {
-    elementHidingExceptionHashMapBuffer =
-        elementHidingExceptionSelectorHashMap->SerializeOut(&elementHidingExceptionHashMapSize);
+// Serializes |section| into |writer| like serializeSection() but hash set
+// items one at a time, so only the largest one has to fit into memory
+// instead of the whole section
+template<class W>
+void AdBlockClient::streamSection(EngineSection section, W *writer,
+                                  int adjustedNumHtmlFilters) const {
+  if (!sectionPending[section].load(std::memory_order_relaxed)) {
+    switch (section) {
+      case ESHostAnchoredHashSet:
+        return streamHashSet(writer, hostAnchoredHashSet);
+      case ESHostAnchoredExceptionHashSet:
+        return streamHashSet(writer, hostAnchoredExceptionHashSet);
+      case ESNoFingerprintDomainHashSet:
+        return streamHashSet(writer, noFingerprintDomainHashSet);
+      case ESNoFingerprintAntiDomainHashSet:
+        return streamHashSet(writer, noFingerprintAntiDomainHashSet);
+      case ESNoFingerprintDomainExceptionHashSet:
+        return streamHashSet(writer, noFingerprintDomainExceptionHashSet);
+      case ESNoFingerprintAntiDomainExceptionHashSet:
+        return streamHashSet(writer, noFingerprintAntiDomainExceptionHashSet);
+      case ESElementHidingHashMap:
+        return streamHashSet(writer, elementHidingSelectorHashMap);
+      case ESElementHidingExceptionHashMap:
+        return streamHashSet(writer, elementHidingExceptionSelectorHashMap);
+      case ESExtendedCssHashMap:
+        return streamHashSet(writer, extendedCssMap);
+      case ESCssRulesHashMap:
+        return streamHashSet(writer, cssRulesMap);
+      case ESScriptletHashMap:
+        return streamHashSet(writer, scriptletMap);
+      default:
+        break;
+    }
   }
+  // The filter records, the bloom filters, generic selectors, the string
+  // table and sections which weren't loaded are single pieces
+  uint32_t size = serializeSection(section, nullptr, adjustedNumHtmlFilters);
+  serializeSection(section, writer->reserve(size), adjustedNumHtmlFilters);
+  writer->append(size);
+}
 
-  uint32_t genericElementHidingSelectorsSize = 0;
-  if (genericElementHidingSelectors) {
-    genericElementHidingSelectorsSize = genericElementHidingSelectors->Serialize(nullptr);
+bool AdBlockClient::serializeFile(const char *path, bool ignoreHtmlFilters) const {
+  FileWriter *writer = FileWriter::create(path);
+  if (!writer) {
+    return false;
   }
+  bool saved = serializeTo(writer, ignoreHtmlFilters);
+  delete writer;
+  return saved;
+}
 
-  uint32_t extendedCssHashMapSize = 0;
-  char *extendedCssHashMapBuffer = nullptr;
-  if (extendedCssMap) {
-    extendedCssHashMapBuffer =
-        extendedCssMap->SerializeOut(&extendedCssHashMapSize);
+void AdBlockClient::serializeFileAsync(const char *path, bool ignoreHtmlFilters,
+                                       std::function<void(bool)> done) {
+  waitForSave();
+  std::string target(path);
+  // trim() leaves the sections alone until the thread is done with them
+  {
+    std::lock_guard<std::mutex> guard(sectionLock);
+    saving = true;
+  }
+  saveThread = std::thread([this, target, ignoreHtmlFilters, done]() {
+    bool saved = serializeFile(target.c_str(), ignoreHtmlFilters);
+    {
+      std::lock_guard<std::mutex> guard(sectionLock);
+      saving = false;
+    }
+    if (done) {
+      done(saved);
+    }
+  });
+}
+
+void AdBlockClient::waitForSave() {
+  if (saveThread.joinable()) {
+    saveThread.join();
   }
+}
 
-  uint32_t cssRulesHashMapSize = 0;
-  char *cssRulesHashMapBuffer = nullptr;
-  if (cssRulesMap) {
-    cssRulesHashMapBuffer =
-        cssRulesMap->SerializeOut(&cssRulesHashMapSize);
+int AdBlockClient::serializeToSharedMemory(const char *name,
+                                           bool ignoreHtmlFilters) const {
+  int fd = createSharedMemory(name);
+  if (fd < 0) {
+    return -1;
+  }
+  FileWriter *writer = FileWriter::wrap(fd);
+  bool saved = serializeTo(writer, ignoreHtmlFilters);
+  delete writer;
+  if (!saved || !sealSharedMemory(fd)) {
+    close(fd);
+    return -1;
   }
+  return fd;
+}
 
-  uint32_t scriptletHashMapSize = 0;
-  char *scriptletHashMapBuffer = nullptr;
-  if (scriptletMap) {
-    scriptletHashMapBuffer =
-        scriptletMap->SerializeOut(&scriptletHashMapSize);
-  }
-
-  // Get the number of bytes that we'll need
-  char sz[512];
-  *totalSize += 1 + snprintf(sz,
-                             sizeof(sz),
-                             "%x,%x,%x,%x,%x,%x,%x,%x,%x,%x,%x,%x,%x,%x,%x,%x,%x,%x,%x,%x,%x,%x,%x,%x,%x,%x,%x",
-                             numFilters,
-                             numExceptionFilters,
-                             numCosmeticFilters,
-                             adjustedNumHtmlFilters,
-                             numScriptletFilters,
-                             numNoFingerprintFilters,
-                             numNoFingerprintExceptionFilters,
-                             numNoFingerprintDomainOnlyFilters,
-                             numNoFingerprintAntiDomainOnlyFilters,
-                             numNoFingerprintDomainOnlyExceptionFilters,
-                             numNoFingerprintAntiDomainOnlyExceptionFilters,
-                             numHostAnchoredFilters,
-                             numHostAnchoredExceptionFilters,
-                             bloomFilter ? bloomFilter->getByteBufferSize() : 0,
-                             exceptionBloomFilter
-                             ? exceptionBloomFilter->getByteBufferSize() : 0,
-                             hostAnchoredHashSetSize,
-                             hostAnchoredExceptionHashSetSize,
-                             noFingerprintDomainHashSetSize,
-                             noFingerprintAntiDomainHashSetSize,
-                             noFingerprintDomainExceptionHashSetSize,
-                             noFingerprintAntiDomainExceptionHashSetSize,
-                             elementHidingHashMapSize,
-                             elementHidingExceptionHashMapSize,
-                             genericElementHidingSelectorsSize,
-                             extendedCssHashMapSize,
-                             cssRulesHashMapSize,
-                             scriptletHashMapSize);
-  *totalSize += serializeFilters(nullptr, 0, filters, numFilters) +
-      serializeFilters(nullptr, 0, exceptionFilters, numExceptionFilters) +
-      serializeFilters(nullptr, 0, htmlFilters, adjustedNumHtmlFilters) +
-      serializeFilters(nullptr, 0,
-                       noFingerprintFilters, numNoFingerprintFilters) +
-      serializeFilters(nullptr, 0, noFingerprintExceptionFilters,
-                       numNoFingerprintExceptionFilters) +
-      serializeFilters(nullptr, 0,
-                       noFingerprintDomainOnlyFilters,
-                       numNoFingerprintDomainOnlyFilters) +
-      serializeFilters(nullptr, 0,
-                       noFingerprintAntiDomainOnlyFilters,
-                       numNoFingerprintAntiDomainOnlyFilters) +
-      serializeFilters(nullptr, 0, noFingerprintDomainOnlyExceptionFilters,
-                       numNoFingerprintDomainOnlyExceptionFilters) +
-      serializeFilters(nullptr, 0, noFingerprintAntiDomainOnlyExceptionFilters,
-                       numNoFingerprintAntiDomainOnlyExceptionFilters);
-
-  *totalSize += bloomFilter ? bloomFilter->getByteBufferSize() : 0;
-  *totalSize += exceptionBloomFilter
-                ? exceptionBloomFilter->getByteBufferSize() : 0;
-  *totalSize += hostAnchoredHashSetSize;
-  *totalSize += hostAnchoredExceptionHashSetSize;
-  *totalSize += noFingerprintDomainHashSetSize;
-  *totalSize += noFingerprintAntiDomainHashSetSize;
-  *totalSize += noFingerprintDomainExceptionHashSetSize;
-  *totalSize += noFingerprintAntiDomainExceptionHashSetSize;
-  *totalSize += elementHidingHashMapSize;
-  *totalSize += elementHidingExceptionHashMapSize;
-  *totalSize += genericElementHidingSelectorsSize;
-  *totalSize += extendedCssHashMapSize;
-  *totalSize += cssRulesHashMapSize;
-  *totalSize += scriptletHashMapSize;
+bool AdBlockClient::serializeTo(FileWriter *writer, bool ignoreHtmlFilters) const {
+  int adjustedNumHtmlFilters = ignoreHtmlFilters ? 0 : numHtmlFilters;
+  std::lock_guard<std::mutex> guard(sectionLock);
+
+  // Sections are appended while they're serialized, the header is filled
+  // in at the end once the section table is known
+  SectionEntry sections[ESNumSections];
+  memset(writer->reserve(kEngineTableEnd), 0, kEngineTableEnd);
+  writer->append(kEngineTableEnd);
+  for (int i = 0; i < ESNumSections; i++) {
+    auto section = static_cast<EngineSection>(i);
+    auto pos = static_cast<uint32_t>(writer->getSize());
+    uint32_t padding = alignSection(pos) - pos;
+    memset(writer->reserve(padding), 0, padding);
+    writer->append(padding);
+
+    // Compression needs the whole section, which is only done for the
+    // small selector sections by default
+    SectionWriter out(writer);
+    char *compressed = nullptr;
+    if (compressedSections & (1u << section)) {
+      uint32_t size = serializeSection(section, nullptr, adjustedNumHtmlFilters);
+      compressed = compressSection(section, &size, adjustedNumHtmlFilters);
+      if (compressed) {
+        memcpy(out.reserve(size), compressed, size);
+        out.append(size);
+        delete[] compressed;
+      }
+    }
+    if (!compressed) {
+      streamSection(section, &out, adjustedNumHtmlFilters);
+    }
+    sections[i].id = i;
+    sections[i].flags = compressed ? kSectionCompressed : storedSectionFlags(section);
+    sections[i].offset = pos + padding;
+    sections[i].size = out.getSize();
+    sections[i].crc = out.getCrc();
+  }
 
-  // Allocate it
-  int pos = 0;
-  char *buffer = new char[*totalSize];
-  memset(buffer, 0, *totalSize);
+  char header[kEngineTableEnd];
+  putHeader(header, sections, adjustedNumHtmlFilters);
+  writer->writeAt(0, header, kEngineTableEnd);
+  return writer->commit();
+}
 
-  // And start copying stuff in
-  snprintf(buffer, *totalSize, "%s", sz);
-  pos += static_cast<int>(strlen(sz)) + 1;
-  pos += serializeFilters(buffer + pos, *totalSize - pos, filters, numFilters);
-  pos += serializeFilters(buffer + pos, *totalSize - pos,
-                          exceptionFilters, numExceptionFilters);
-  pos += serializeFilters(buffer + pos, *totalSize - pos, htmlFilters,
-                          adjustedNumHtmlFilters);
-  pos += serializeFilters(buffer + pos, *totalSize - pos, noFingerprintFilters,
-                          numNoFingerprintFilters);
-  pos += serializeFilters(buffer + pos, *totalSize - pos,
-                          noFingerprintExceptionFilters, numNoFingerprintExceptionFilters);
-  pos += serializeFilters(buffer + pos, *totalSize - pos,
-                          noFingerprintDomainOnlyFilters,
-                          numNoFingerprintDomainOnlyFilters);
-  pos += serializeFilters(buffer + pos, *totalSize - pos,
-                          noFingerprintAntiDomainOnlyFilters,
-                          numNoFingerprintAntiDomainOnlyFilters);
-  pos += serializeFilters(buffer + pos, *totalSize - pos,
-                          noFingerprintDomainOnlyExceptionFilters,
-                          numNoFingerprintDomainOnlyExceptionFilters);
-  pos += serializeFilters(buffer + pos, *totalSize - pos,
-                          noFingerprintAntiDomainOnlyExceptionFilters,
-                          numNoFingerprintAntiDomainOnlyExceptionFilters);
+// Returns the size of the serialized data in |buffer| according to its
+// header or 0 if it isn't serialized data of this version
+size_t getSerializedSize(const char *buffer) {
+  if (getUint32LE(buffer) != kEngineMagic
+      || getUint32LE(buffer + 4) != kEngineFormatVersion
+      || getUint32LE(buffer + 12) != ESNumSections
+      || crc32c(buffer, kEngineTableEnd - 4)
+          != getUint32LE(buffer + kEngineTableEnd - 4)) {
+    return 0;
+  }
+  size_t size = kEngineTableEnd;
+  for (int i = 0; i < ESNumSections; i++) {
+    SectionEntry entry =
+        getSectionEntry(buffer + kEngineHeaderSize + i * kSectionEntrySize);
+    size = std::max(size, static_cast<size_t>(entry.offset) + entry.size);
+  }
+  return size;
+}
 
-  if (bloomFilter) {
-    memcpy(buffer + pos, bloomFilter->getBuffer(),
-           bloomFilter->getByteBufferSize());
-    pos += bloomFilter->getByteBufferSize();
+bool AdBlockClient::deserialize(char *buffer) {
+  size_t size = getSerializedSize(buffer);
+  return size > 0 && deserialize(buffer, size);
+}
+
+// Sections which deserialize() leaves to loadSection()
+static const uint32_t kLazySections =
+    1u << ESElementHidingHashMap
+    | 1u << ESElementHidingExceptionHashMap
+    | 1u << ESGenericElementHidingSelectors
+    | 1u << ESExtendedCssHashMap
+    | 1u << ESCssRulesHashMap
+    | 1u << ESScriptletHashMap
+    | 1u << ESRuleText;
+
+bool AdBlockClient::deserialize(char *buffer, size_t size) {
+  clear();
+  if (size < kEngineTableEnd
+      || getUint32LE(buffer) != kEngineMagic
+      || getUint32LE(buffer + 4) != kEngineFormatVersion
+      || getUint32LE(buffer + 12) != ESNumSections
+      || crc32c(buffer, kEngineTableEnd - 4)
+          != getUint32LE(buffer + kEngineTableEnd - 4)) {
+    return false;
   }
-  if (exceptionBloomFilter) {
-    memcpy(buffer + pos, exceptionBloomFilter->getBuffer(),
-           exceptionBloomFilter->getByteBufferSize());
-    pos += exceptionBloomFilter->getByteBufferSize();
+
+  SectionEntry sections[ESNumSections];
+  for (int i = 0; i < ESNumSections; i++) {
+    sections[i] =
+        getSectionEntry(buffer + kEngineHeaderSize + i * kSectionEntrySize);
+    const SectionEntry &entry = sections[i];
+    if (entry.id != static_cast<uint32_t>(i)
+        || (entry.flags & ~kSectionCompressed) != 0
+        || entry.offset > size || entry.size > size - entry.offset
+        || crc32c(buffer + entry.offset, entry.size) != entry.crc) {
+      return false;
+    }
   }
-  if (hostAnchoredHashSet) {
-    memcpy(buffer + pos, hostAnchoredHashSetBuffer, hostAnchoredHashSetSize);
-    pos += hostAnchoredHashSetSize;
-    delete[] hostAnchoredHashSetBuffer;
+
+  int serializedFingerprintSize = static_cast<int>(getUint32LE(buffer + 8));
+  if (serializedFingerprintSize < kMinFingerprintSize
+      || serializedFingerprintSize > kMaxFingerprintSize) {
+    return false;
   }
-  if (hostAnchoredExceptionHashSet) {
-    memcpy(buffer + pos, hostAnchoredExceptionHashSetBuffer,
-           hostAnchoredExceptionHashSetSize);
-    pos += hostAnchoredExceptionHashSetSize;
-    delete[] hostAnchoredExceptionHashSetBuffer;
+
+  // Nothing is allocated for the counts, the filter sections are checked
+  // against them below
+  int *counts[kEngineHeaderCounts] = {
+      &numFilters,
+      &numExceptionFilters,
+      &numCosmeticFilters,
+      &numHtmlFilters,
+      &numScriptletFilters,
+      &numNoFingerprintFilters,
+      &numNoFingerprintExceptionFilters,
+      &numNoFingerprintDomainOnlyFilters,
+      &numNoFingerprintAntiDomainOnlyFilters,
+      &numNoFingerprintDomainOnlyExceptionFilters,
+      &numNoFingerprintAntiDomainOnlyExceptionFilters,
+      &numHostAnchoredFilters,
+      &numHostAnchoredExceptionFilters
+  };
+  for (uint32_t i = 0; i < kEngineHeaderCounts; i++) {
+    uint32_t count = getUint32LE(buffer + 16 + i * 4);
+    if (count > size) {
+      clear();
+      return false;
+    }
+    *counts[i] = static_cast<int>(count);
   }
-  if (noFingerprintDomainHashSet) {
-    memcpy(buffer + pos, noFingerprintDomainHashSetBuffer,
-           noFingerprintDomainHashSetSize);
-    pos += noFingerprintDomainHashSetSize;
-    delete[] noFingerprintDomainHashSetBuffer;
+  fingerprintSize = serializedFingerprintSize;
+  deserializedBuffer = buffer;
+
+  // The cosmetic sections and the rule text aren't needed for matching
+  // requests, they're deserialized on first use
+  char *data[ESNumSections];
+  uint32_t len[ESNumSections];
+  for (int i = 0; i < ESNumSections; i++) {
+    if (kLazySections & (1u << i)) {
+      pendingSections[i] = sections[i];
+      sectionPending[i].store(true, std::memory_order_release);
+    } else if (!inflateSection(sections[i], &data[i], &len[i])) {
+      clear();
+      return false;
+    }
   }
-  if (noFingerprintAntiDomainHashSet) {
-    memcpy(buffer + pos, noFingerprintAntiDomainHashSetBuffer,
-           noFingerprintAntiDomainHashSetSize);
-    pos += noFingerprintAntiDomainHashSetSize;
-    delete[] noFingerprintAntiDomainHashSetBuffer;
+
+  // The filters point into the string table, so it has to end with the
+  // terminator of its last string
+  if (len[ESStringTable] > 0
+      && data[ESStringTable][len[ESStringTable] - 1] != '\0') {
+    clear();
+    return false;
   }
-  if (noFingerprintDomainExceptionHashSet) {
-    memcpy(buffer + pos, noFingerprintDomainExceptionHashSetBuffer,
-           noFingerprintDomainExceptionHashSetSize);
-    pos += noFingerprintDomainExceptionHashSetSize;
-    delete[] noFingerprintDomainExceptionHashSetBuffer;
+
+  // The filter records are used in place, a filter is only built when a
+  // match needs its regex or domains
+  struct {
+    EngineSection section;
+    int numFilters;
+  } filterSections[] = {
+      {ESFilters, numFilters},
+      {ESExceptionFilters, numExceptionFilters},
+      {ESHtmlFilters, numHtmlFilters},
+      {ESNoFingerprintFilters, numNoFingerprintFilters},
+      {ESNoFingerprintExceptionFilters, numNoFingerprintExceptionFilters},
+      {ESNoFingerprintDomainOnlyFilters, numNoFingerprintDomainOnlyFilters},
+      {ESNoFingerprintAntiDomainOnlyFilters,
+       numNoFingerprintAntiDomainOnlyFilters},
+      {ESNoFingerprintDomainOnlyExceptionFilters,
+       numNoFingerprintDomainOnlyExceptionFilters},
+      {ESNoFingerprintAntiDomainOnlyExceptionFilters,
+       numNoFingerprintAntiDomainOnlyExceptionFilters},
+  };
+  for (auto &filterSection : filterSections) {
+    EngineSection section = filterSection.section;
+    FilterList *filterList = getFilterList(section);
+    if (!filterList->init(data[section], len[section], data[ESStringTable],
+                          len[ESStringTable])
+        || filterList->getSize() != filterSection.numFilters) {
+      clear();
+      return false;
+    }
   }
-  if (noFingerprintAntiDomainExceptionHashSet) {
-    memcpy(buffer + pos, noFingerprintAntiDomainExceptionHashSetBuffer,
-           noFingerprintAntiDomainExceptionHashSetSize);
-    pos += noFingerprintAntiDomainExceptionHashSetSize;
-    delete[] noFingerprintAntiDomainExceptionHashSetBuffer;
+  stringTableData = data[ESStringTable];
+  stringTableSize = len[ESStringTable];
+
+  initBloomFilter(&bloomFilter, data[ESBloomFilter], len[ESBloomFilter]);
+  initBloomFilter(&exceptionBloomFilter,
+                  data[ESExceptionBloomFilter],
+                  len[ESExceptionBloomFilter]);
+
+  if (!initHashSet(&hostAnchoredHashSet,
+                   data[ESHostAnchoredHashSet],
+                   len[ESHostAnchoredHashSet])
+      || !initHashSet(&hostAnchoredExceptionHashSet,
+                      data[ESHostAnchoredExceptionHashSet],
+                      len[ESHostAnchoredExceptionHashSet])
+      || !initHashSet(&noFingerprintDomainHashSet,
+                      data[ESNoFingerprintDomainHashSet],
+                      len[ESNoFingerprintDomainHashSet])
+      || !initHashSet(&noFingerprintAntiDomainHashSet,
+                      data[ESNoFingerprintAntiDomainHashSet],
+                      len[ESNoFingerprintAntiDomainHashSet])
+      || !initHashSet(&noFingerprintDomainExceptionHashSet,
+                      data[ESNoFingerprintDomainExceptionHashSet],
+                      len[ESNoFingerprintDomainExceptionHashSet])
+      || !initHashSet(&noFingerprintAntiDomainExceptionHashSet,
+                      data[ESNoFingerprintAntiDomainExceptionHashSet],
+                      len[ESNoFingerprintAntiDomainExceptionHashSet])) {
+    clear();
+    return false;
   }
-  if (elementHidingSelectorHashMap) {
-    memcpy(buffer + pos, elementHidingHashMapBuffer,
-           elementHidingHashMapSize);
-    pos += elementHidingHashMapSize;
-    delete[] elementHidingHashMapBuffer;
+
+  return true;
+}
+
+void AdBlockClient::loadSection(EngineSection section) {
+  if (!sectionPending[section].load(std::memory_order_acquire)) {
+    return;
   }
-  if (elementHidingExceptionSelectorHashMap) {
-    memcpy(buffer + pos, elementHidingExceptionHashMapBuffer,
-           elementHidingExceptionHashMapSize);
-    pos += elementHidingExceptionHashMapSize;
-    delete[] elementHidingExceptionHashMapBuffer;
+  std::lock_guard<std::mutex> guard(sectionLock);
+  if (!sectionPending[section].load(std::memory_order_relaxed)) {
+    return;
   }
-  if (genericElementHidingSelectors) {
-    genericElementHidingSelectors->Serialize(buffer + pos);
-    pos += genericElementHidingSelectorsSize;
+  char *buffer = nullptr;
+  uint32_t size = 0;
+  bool inflated = inflateSection(pendingSections[section], &buffer, &size);
+  int len = static_cast<int>(size);
+  // The CRC was checked by deserialize(), a section which still doesn't
+  // load is left empty rather than failing the lookups
+  switch (section) {
+    case ESElementHidingHashMap:
+      if (!inflated || !initHashMap(&elementHidingSelectorHashMap, buffer, len)) {
+        delete elementHidingSelectorHashMap;
+        elementHidingSelectorHashMap =
+            new HashMap<NoFingerprintDomain, CosmeticFilter>(0);
+      }
+      break;
+    case ESElementHidingExceptionHashMap:
+      if (!inflated || !initHashMap(&elementHidingExceptionSelectorHashMap, buffer, len)) {
+        delete elementHidingExceptionSelectorHashMap;
+        elementHidingExceptionSelectorHashMap =
+            new HashMap<NoFingerprintDomain, CosmeticFilter>(0);
+      }
+      break;
+    case ESGenericElementHidingSelectors:
+      delete genericElementHidingSelectors;
+      genericElementHidingSelectors = new CosmeticFilter();
+      if (!inflated || len == 0
+          || genericElementHidingSelectors->Deserialize(buffer, len) != size) {
+        delete genericElementHidingSelectors;
+        genericElementHidingSelectors = new CosmeticFilter("");
+      }
+      break;
+    case ESExtendedCssHashMap:
+      if (!inflated || !initHashMap(&extendedCssMap, buffer, len)) {
+        delete extendedCssMap;
+        extendedCssMap = new HashMap<NoFingerprintDomain, CosmeticFilterHashSet>(0);
+      }
+      break;
+    case ESCssRulesHashMap:
+      if (!inflated || !initHashMap(&cssRulesMap, buffer, len)) {
+        delete cssRulesMap;
+        cssRulesMap = new HashMap<NoFingerprintDomain, CosmeticFilterHashSet>(0);
+      }
+      break;
+    case ESScriptletHashMap:
+      if (!inflated || !initHashMap(&scriptletMap, buffer, len)) {
+        delete scriptletMap;
+        scriptletMap = new HashMap<NoFingerprintDomain, CosmeticFilterHashSet>(0);
+      }
+      break;
+    case ESRuleText:
+      // The rule text is used where it was inflated or mapped, it has to
+      // end with the terminator of its last rule
+      if (inflated && size > 0 && buffer[size - 1] == '\0') {
+        ruleTextData = buffer;
+        ruleTextSize = size;
+      }
+      break;
+    default:
+      break;
   }
-  if (extendedCssMap) {
-    memcpy(buffer + pos, extendedCssHashMapBuffer, extendedCssHashMapSize);
-    pos += extendedCssHashMapSize;
-    delete[] extendedCssHashMapBuffer;
+  // Rule text used from the mapping holds no memory, releasing it would
+  // only make the next getRuleDefinition() take sectionLock again
+  if (section != ESRuleText || inflatedSections[section]) {
+    reloadableSections |= 1u << section;
   }
-  if (cssRulesMap) {
-    memcpy(buffer + pos, cssRulesHashMapBuffer, cssRulesHashMapSize);
-    pos += cssRulesHashMapSize;
-    delete[] cssRulesHashMapBuffer;
+  sectionPending[section].store(false, std::memory_order_release);
+}
+
+bool AdBlockClient::inflateSection(const SectionEntry &entry, char **data,
+                                   uint32_t *len) {
+  char *stored = deserializedBuffer + entry.offset;
+  if (!(entry.flags & kSectionCompressed)) {
+    *data = stored;
+    *len = entry.size;
+    return true;
   }
-  if (scriptletMap) {
-    memcpy(buffer + pos, scriptletHashMapBuffer, scriptletHashMapSize);
-    pos += scriptletHashMapSize;
-    delete[] scriptletHashMapBuffer;
+  // LZ4 expands at most 255 times, which bounds the allocation
+  if (entry.size < 4 || getUint32LE(stored) / 255 > entry.size) {
+    return false;
   }
+  uint32_t size = getUint32LE(stored);
+  auto *inflated = new char[size];
+  if (!lz4Decompress(stored + 4, entry.size - 4, inflated, size)) {
+    delete[] inflated;
+    return false;
+  }
+  delete[] inflatedSections[entry.id];
+  inflatedSections[entry.id] = inflated;
+  *data = inflated;
+  *len = size;
+  return true;
+}
 
-  return buffer;
+// Size of |map| and what it allocated
+template<class K, class V>
+static size_t deserializedSize(HashMap<K, V> *map) {
+  if (!map) {
+    return 0;
+  }
+  return sizeof(HashMap<K, V>) + map->GetAllocatedSize();
 }
 
-// Fills the specified buffer if specified, returns the number of characters
-// written or needed
-int deserializeFilters(char *buffer, Filter *f, int numFilters) {
-  int pos = 0;
-  for (int i = 0; i < numFilters; i++) {
-    pos += f->Deserialize(buffer + pos, 1024 * 16);
-    f++;
+size_t AdBlockClient::releaseSection(EngineSection section) {
+  size_t freed = 0;
+  switch (section) {
+    case ESElementHidingHashMap:
+      freed = deserializedSize(elementHidingSelectorHashMap);
+      delete elementHidingSelectorHashMap;
+      elementHidingSelectorHashMap = nullptr;
+      break;
+    case ESElementHidingExceptionHashMap:
+      freed = deserializedSize(elementHidingExceptionSelectorHashMap);
+      delete elementHidingExceptionSelectorHashMap;
+      elementHidingExceptionSelectorHashMap = nullptr;
+      break;
+    case ESGenericElementHidingSelectors:
+      if (genericElementHidingSelectors) {
+        freed = sizeof(CosmeticFilter)
+            + genericElementHidingSelectors->GetAllocatedSize();
+      }
+      delete genericElementHidingSelectors;
+      genericElementHidingSelectors = nullptr;
+      break;
+    case ESExtendedCssHashMap:
+      freed = deserializedSize(extendedCssMap);
+      delete extendedCssMap;
+      extendedCssMap = nullptr;
+      break;
+    case ESCssRulesHashMap:
+      freed = deserializedSize(cssRulesMap);
+      delete cssRulesMap;
+      cssRulesMap = nullptr;
+      break;
+    case ESScriptletHashMap:
+      freed = deserializedSize(scriptletMap);
+      delete scriptletMap;
+      scriptletMap = nullptr;
+      break;
+    case ESRuleText:
+      ruleTextData = nullptr;
+      ruleTextSize = 0;
+      break;
+    default:
+      break;
   }
-  return pos;
+  // The decompressed bytes start with their size, a mapped section is
+  // left to the kernel which can drop its clean pages anyway
+  if (inflatedSections[section]) {
+    freed += getUint32LE(deserializedBuffer + pendingSections[section].offset);
+    delete[] inflatedSections[section];
+    inflatedSections[section] = nullptr;
+  }
+  return freed;
 }
 
-bool AdBlockClient::deserialize(char *buffer) {
-  clear();
-  deserializedBuffer = buffer;
-  int bloomFilterSize = 0, exceptionBloomFilterSize = 0,
-      hostAnchoredHashSetSize = 0, hostAnchoredExceptionHashSetSize = 0,
-      noFingerprintDomainHashSetSize = 0,
-      noFingerprintAntiDomainHashSetSize = 0,
-      noFingerprintDomainExceptionHashSetSize = 0,
-      noFingerprintAntiDomainExceptionHashSetSize = 0,
-      elementHidingHashMapSize = 0,
-      elementHidingExceptionHashMapSize = 0,
-      genericElementHidingSelectorsSize = 0,
-      extendedCssHashMapSize = 0,
-      cssRulesHashMapSize = 0,
-      scriptletHashMapSize = 0;
-  int pos = 0;
-  sscanf(buffer + pos,
-         "%x,%x,%x,%x,%x,%x,%x,%x,%x,%x,%x,%x,%x,%x,%x,%x,%x,%x,%x,%x,%x,%x,%x,%x,%x,%x,%x",
-         &numFilters,
-         &numExceptionFilters, &numCosmeticFilters, &numHtmlFilters, &numScriptletFilters,
-         &numNoFingerprintFilters, &numNoFingerprintExceptionFilters,
-         &numNoFingerprintDomainOnlyFilters,
-         &numNoFingerprintAntiDomainOnlyFilters,
-         &numNoFingerprintDomainOnlyExceptionFilters,
-         &numNoFingerprintAntiDomainOnlyExceptionFilters,
-         &numHostAnchoredFilters, &numHostAnchoredExceptionFilters,
-         &bloomFilterSize, &exceptionBloomFilterSize,
-         &hostAnchoredHashSetSize, &hostAnchoredExceptionHashSetSize,
-         &noFingerprintDomainHashSetSize,
-         &noFingerprintAntiDomainHashSetSize,
-         &noFingerprintDomainExceptionHashSetSize,
-         &noFingerprintAntiDomainExceptionHashSetSize,
-         &elementHidingHashMapSize, &elementHidingExceptionHashMapSize,
-         &genericElementHidingSelectorsSize, &extendedCssHashMapSize,
-         &cssRulesHashMapSize, &scriptletHashMapSize);
-  pos += static_cast<int>(strlen(buffer + pos)) + 1;
-
-  filters = new Filter[numFilters];
-  exceptionFilters = new Filter[numExceptionFilters];
-  htmlFilters = new Filter[numHtmlFilters];
-  noFingerprintFilters = new Filter[numNoFingerprintFilters];
-  noFingerprintExceptionFilters = new Filter[numNoFingerprintExceptionFilters];
-  noFingerprintDomainOnlyFilters =
-      new Filter[numNoFingerprintDomainOnlyFilters];
-  noFingerprintAntiDomainOnlyFilters =
-      new Filter[numNoFingerprintAntiDomainOnlyFilters];
-  noFingerprintDomainOnlyExceptionFilters =
-      new Filter[numNoFingerprintDomainOnlyExceptionFilters];
-  noFingerprintAntiDomainOnlyExceptionFilters =
-      new Filter[numNoFingerprintAntiDomainOnlyExceptionFilters];
-
-  pos += deserializeFilters(buffer + pos, filters, numFilters);
-  pos += deserializeFilters(buffer + pos,
-                            exceptionFilters, numExceptionFilters);
-  pos += deserializeFilters(buffer + pos,
-                            htmlFilters, numHtmlFilters);
-  pos += deserializeFilters(buffer + pos,
-                            noFingerprintFilters, numNoFingerprintFilters);
-  pos += deserializeFilters(buffer + pos,
-                            noFingerprintExceptionFilters, numNoFingerprintExceptionFilters);
-
-  pos += deserializeFilters(buffer + pos,
-                            noFingerprintDomainOnlyFilters, numNoFingerprintDomainOnlyFilters);
-  pos += deserializeFilters(buffer + pos,
-                            noFingerprintAntiDomainOnlyFilters,
-                            numNoFingerprintAntiDomainOnlyFilters);
-  pos += deserializeFilters(buffer + pos,
-                            noFingerprintDomainOnlyExceptionFilters,
-                            numNoFingerprintDomainOnlyExceptionFilters);
-  pos += deserializeFilters(buffer + pos,
-                            noFingerprintAntiDomainOnlyExceptionFilters,
-                            numNoFingerprintAntiDomainOnlyExceptionFilters);
-
-  initBloomFilter(&bloomFilter, buffer + pos, bloomFilterSize);
-  pos += bloomFilterSize;
-  initBloomFilter(&exceptionBloomFilter,
-                  buffer + pos, exceptionBloomFilterSize);
-  pos += exceptionBloomFilterSize;
-  if (!initHashSet(&hostAnchoredHashSet,
-                   buffer + pos, hostAnchoredHashSetSize)) {
-    return false;
+size_t AdBlockClient::trim(TrimLevel level) {
+  size_t freed = cacheSize;
+  delete elementHidingSelectorsCache;
+  elementHidingSelectorsCache = nullptr;
+  delete extendedCssCache;
+  extendedCssCache = nullptr;
+  delete cssRulesCache;
+  cssRulesCache = nullptr;
+  delete scriptletCache;
+  scriptletCache = nullptr;
+  cacheSize = 0;
+  if (level < TLSections) {
+    return freed;
+  }
+  std::lock_guard<std::mutex> guard(sectionLock);
+  if (saving) {
+    return freed;
+  }
+  for (int i = 0; i < ESNumSections; i++) {
+    if (!(reloadableSections & (1u << i))) {
+      continue;
+    }
+    // Marked first, so a section is never seen loaded once it's released
+    sectionPending[i].store(true, std::memory_order_release);
+    freed += releaseSection(static_cast<EngineSection>(i));
   }
-  pos += hostAnchoredHashSetSize;
-  if (!initHashSet(&hostAnchoredExceptionHashSet,
-                   buffer + pos, hostAnchoredExceptionHashSetSize)) {
-    return false;
+  reloadableSections = 0;
+  return freed;
+}
+
+void AdBlockClient::setLatencyStatsEnabled(bool enabled) {
+  if (enabled && !latencyStats) {
+    latencyStats = new LatencyStats();
   }
-  pos += hostAnchoredExceptionHashSetSize;
+  activeLatencyStats.store(enabled ? latencyStats : nullptr, std::memory_order_release);
+}
 
-  if (!initHashSet(&noFingerprintDomainHashSet,
-                   buffer + pos, noFingerprintDomainHashSetSize)) {
-    return false;
+void AdBlockClient::resetLatencyStats() {
+  if (latencyStats) {
+    latencyStats->reset();
   }
-  pos += noFingerprintDomainHashSetSize;
+}
 
-  if (!initHashSet(&noFingerprintAntiDomainHashSet,
-                   buffer + pos, noFingerprintAntiDomainHashSetSize)) {
-    return false;
+// Only the filters built from the records take memory of their own
+static void addFiltersUsage(MemoryReport *report, const char *name,
+                            const FilterList &filterList) {
+  report->structures.push_back({name, static_cast<size_t>(filterList.getSize()),
+                                filterList.getAllocatedSize()});
+}
+
+// Also used for the hash maps, which are hash sets of their nodes
+template<class T>
+static void addHashSetUsage(MemoryReport *report, const char *name, HashSet<T> *set) {
+  if (!set) {
+    report->structures.push_back({name, 0, 0});
+    return;
   }
-  pos += noFingerprintAntiDomainHashSetSize;
+  report->structures.push_back({name, set->GetSize(), sizeof(*set) + set->GetAllocatedSize()});
+  HashSetUsage usage;
+  usage.name = name;
+  usage.bucketCount = set->GetBucketCount();
+  set->GetChainLengths(&usage.chainLengths);
+  report->hashSets.push_back(usage);
+}
 
-  if (!initHashSet(&noFingerprintDomainExceptionHashSet,
-                   buffer + pos, noFingerprintDomainExceptionHashSetSize)) {
-    return false;
+static void addBloomFilterUsage(MemoryReport *report, const char *name, BloomFilter *filter) {
+  if (!filter) {
+    report->structures.push_back({name, 0, 0});
+    return;
   }
-  pos += noFingerprintDomainExceptionHashSetSize;
+  report->structures.push_back({name, filter->getBitBufferSize(), sizeof(BloomFilter)
+      + (filter->isBufferBorrowed() ? 0 : filter->getByteBufferSize())});
+  report->bloomFilters.push_back({name, filter->getBitBufferSize(), filter->getNumSetBits()});
+}
 
-  if (!initHashSet(&noFingerprintAntiDomainExceptionHashSet,
-                   buffer + pos, noFingerprintAntiDomainExceptionHashSetSize)) {
-    return false;
+void AdBlockClient::getMemoryReport(MemoryReport *report) {
+  addFiltersUsage(report, "filters", filters);
+  addFiltersUsage(report, "htmlFilters", htmlFilters);
+  addFiltersUsage(report, "exceptionFilters", exceptionFilters);
+  addFiltersUsage(report, "noFingerprintFilters", noFingerprintFilters);
+  addFiltersUsage(report, "noFingerprintExceptionFilters", noFingerprintExceptionFilters);
+  addFiltersUsage(report, "noFingerprintDomainOnlyFilters", noFingerprintDomainOnlyFilters);
+  addFiltersUsage(report, "noFingerprintAntiDomainOnlyFilters",
+                  noFingerprintAntiDomainOnlyFilters);
+  addFiltersUsage(report, "noFingerprintDomainOnlyExceptionFilters",
+                  noFingerprintDomainOnlyExceptionFilters);
+  addFiltersUsage(report, "noFingerprintAntiDomainOnlyExceptionFilters",
+                  noFingerprintAntiDomainOnlyExceptionFilters);
+
+  addBloomFilterUsage(report, "bloomFilter", bloomFilter);
+  addBloomFilterUsage(report, "exceptionBloomFilter", exceptionBloomFilter);
+  addHashSetUsage(report, "hostAnchoredHashSet", hostAnchoredHashSet);
+  addHashSetUsage(report, "hostAnchoredExceptionHashSet", hostAnchoredExceptionHashSet);
+  addHashSetUsage(report, "noFingerprintDomainHashSet", noFingerprintDomainHashSet);
+  addHashSetUsage(report, "noFingerprintAntiDomainHashSet", noFingerprintAntiDomainHashSet);
+  addHashSetUsage(report, "noFingerprintDomainExceptionHashSet",
+                  noFingerprintDomainExceptionHashSet);
+  addHashSetUsage(report, "noFingerprintAntiDomainExceptionHashSet",
+                  noFingerprintAntiDomainExceptionHashSet);
+  const RegexSet *set = regexSet.load(std::memory_order_acquire);
+  report->structures.push_back({"regexSet", 0,
+      set ? sizeof(RegexSet) + set->getAllocatedSize() : 0});
+
+  {
+    std::lock_guard<std::mutex> guard(sectionLock);
+    addHashSetUsage(report, "elementHidingSelectorHashMap", elementHidingSelectorHashMap);
+    addHashSetUsage(report, "elementHidingExceptionSelectorHashMap",
+                    elementHidingExceptionSelectorHashMap);
+    addHashSetUsage(report, "extendedCssMap", extendedCssMap);
+    addHashSetUsage(report, "cssRulesMap", cssRulesMap);
+    addHashSetUsage(report, "scriptletMap", scriptletMap);
+    report->structures.push_back({"genericElementHidingSelectors",
+        genericElementHidingSelectors ? 1u : 0u, genericElementHidingSelectors
+        ? sizeof(CosmeticFilter) + genericElementHidingSelectors->GetAllocatedSize() : 0});
+
+    // The decompressed bytes start with their size like in releaseSection()
+    size_t count = 0;
+    size_t heapBytes = 0;
+    for (int i = 0; i < ESNumSections; i++) {
+      if (inflatedSections[i]) {
+        SectionEntry entry =
+            getSectionEntry(deserializedBuffer + kEngineHeaderSize + i * kSectionEntrySize);
+        count++;
+        heapBytes += getUint32LE(deserializedBuffer + entry.offset);
+      }
+    }
+    report->structures.push_back({"inflatedSections", count, heapBytes});
+    if (deserializedBuffer) {
+      report->deserializedBytes = getSerializedSize(deserializedBuffer);
+    }
   }
-  pos += noFingerprintAntiDomainExceptionHashSetSize;
 
-  if (!initHashMap(&elementHidingSelectorHashMap,
-                   buffer + pos, elementHidingHashMapSize)) {
+  size_t cacheCount = 0;
+  if (elementHidingSelectorsCache) {
+    cacheCount += elementHidingSelectorsCache->GetSize();
+  }
+  if (extendedCssCache) {
+    cacheCount += extendedCssCache->GetSize();
+  }
+  if (cssRulesCache) {
+    cacheCount += cssRulesCache->GetSize();
+  }
+  if (scriptletCache) {
+    cacheCount += scriptletCache->GetSize();
+  }
+  report->structures.push_back({"cosmeticCaches", cacheCount, cacheSize});
+  size_t parsedCount = 0;
+  size_t parsedBytes = 0;
+  for (int i = 0; i < ESNumSections; i++) {
+    if (parsedSections[i]) {
+      parsedCount++;
+      parsedBytes += parsedSectionSizes[i];
+    }
+  }
+  report->structures.push_back({"parsedSections", parsedCount, parsedBytes});
+  report->structures.push_back({"ruleText", ruleText.size(), ruleText.capacity()});
+  report->structures.push_back({"arena", 0, arena ? arena->getReservedSize() : 0});
+  report->structures.push_back({"latencyStats", latencyStats ? 1u : 0u,
+      latencyStats ? sizeof(LatencyStats) : 0});
+}
+
+bool AdBlockClient::deserializeFile(const char *path) {
+  MappedFile *file = MappedFile::open(path);
+  if (!file) {
+    return false;
+  }
+  // deserialize() and everything borrowing from the buffer only read it
+  if (!deserialize(const_cast<char *>(file->getData()), file->getSize())) {
+    clear();
+    delete file;
     return false;
   }
-  pos += elementHidingHashMapSize;
+  mappedFile = file;
+  return true;
+}
 
-  if (!initHashMap(&elementHidingExceptionSelectorHashMap,
-                   buffer + pos, elementHidingExceptionHashMapSize)) {
+bool AdBlockClient::deserializeSharedMemory(int fd) {
+  // Unsealed memory could still be changed by the process which shared it
+  if (!isSealedSharedMemory(fd)) {
     return false;
   }
-  pos += elementHidingExceptionHashMapSize;
+  MappedFile *file = MappedFile::openFd(fd);
+  if (!file) {
+    return false;
+  }
+  if (!deserialize(const_cast<char *>(file->getData()), file->getSize())) {
+    clear();
+    delete file;
+    return false;
+  }
+  mappedFile = file;
+  return true;
+}
 
-  delete genericElementHidingSelectors;
-  genericElementHidingSelectors = new CosmeticFilter();
-  genericElementHidingSelectors->Deserialize(buffer + pos, genericElementHidingSelectorsSize);
-  pos += genericElementHidingSelectorsSize;
+bool AdBlockClient::parseFile(const char *path, bool preserveRules) {
+  MappedFile *file = MappedFile::open(path);
+  if (!file) {
+    // Empty files can't be mapped but are valid lists
+    struct stat st;
+    return stat(path, &st) == 0 && st.st_size == 0 && parse("", 0, preserveRules);
+  }
+  // Filters keep copies of what they need, so the mapping can go right away
+  bool ok = parse(file->getData(), file->getSize(), preserveRules);
+  delete file;
+  return ok;
+}
 
-  if (!initHashMap(&extendedCssMap, buffer + pos, extendedCssHashMapSize)) {
+bool AdBlockClient::setFingerprintSize(int size) {
+  if (size < kMinFingerprintSize || size > kMaxFingerprintSize) {
     return false;
   }
-  pos += extendedCssHashMapSize;
-
-  if (!initHashMap(&cssRulesMap, buffer + pos, cssRulesHashMapSize)) {
+  // Fingerprints already in the bloom filters have the old size
+  if (bloomFilter || exceptionBloomFilter) {
     return false;
   }
-  pos += cssRulesHashMapSize;
-
-  if (!initHashMap(&scriptletMap, buffer + pos, scriptletHashMapSize)) {
+  if (fingerprintOptimizer && fingerprintOptimizer->getFingerprintSize() != size) {
     return false;
   }
-  pos += scriptletHashMapSize;
+  fingerprintSize = size;
+  return true;
+}
 
+bool AdBlockClient::setFingerprintOptimizer(const FingerprintOptimizer *optimizer) {
+  if (optimizer && optimizer->getFingerprintSize() != fingerprintSize) {
+    return false;
+  }
+  fingerprintOptimizer = optimizer;
   return true;
 }
 
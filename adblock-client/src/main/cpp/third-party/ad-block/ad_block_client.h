@@ -11,10 +11,16 @@
 #ifndef AD_BLOCK_CLIENT_H_
 #define AD_BLOCK_CLIENT_H_
 
+#include <atomic>
+#include <functional>
+#include <mutex>
 #include <string>
 #include <set>
+#include <thread>
 #include "./filter.h"
+#include "./filter_list.h"
 #include "cosmetic_filter.h"
+#include "./binary_format.h"
 
 class CosmeticFilter;
 
@@ -22,6 +28,26 @@ class BloomFilter;
 
 class BadFingerprintsHashSet;
 
+class RegexSet;
+
+class FingerprintOptimizer;
+
+class MappedFile;
+
+class Arena;
+
+class StringPool;
+
+class StringTable;
+
+class MemoryReport;
+
+class LatencyStats;
+
+class FileWriter;
+
+class RegexSetMatches;
+
 class NoFingerprintDomain;
 
 template<class T>
@@ -30,6 +56,15 @@ class HashSet;
 template<class K, class V>
 class HashMap;
 
+// What AdBlockClient::trim() releases
+enum TrimLevel {
+    // The cosmetic results cached per host
+    TLCaches,
+    // The caches and the sections of deserialized data which were loaded
+    // on first use, they're loaded again when needed
+    TLSections
+};
+
 class AdBlockClient {
 public:
     AdBlockClient();
@@ -41,21 +76,60 @@ public:
 //   bool parse(const char *input);
     bool parse(const char *input, bool preserveRules = false);
 
+    // Parses |len| bytes of |input| which don't need to be NUL terminated.
+    // Nothing borrows from |input|, it can be freed once this returns.
+    bool parse(const char *input, size_t len, bool preserveRules = false);
+
+    // Parses the filter list in |path| straight from a read only mapping
+    // of the file instead of a copy in memory. Returns false if the file
+    // can't be read.
+    bool parseFile(const char *path, bool preserveRules = false);
+
     bool matches(const char *input,
                  FilterOption contextOption = FONoFilterOption,
                  const char *contextDomain = nullptr,
                  Filter **matchedFilter = nullptr,
                  Filter **matchedExceptionFilter = nullptr);
 
+    // Same as above with the lengths of |input| and |contextDomain| known,
+    // so neither is measured again and neither needs to be NUL terminated.
+    bool matches(const char *input, int inputLen,
+                 FilterOption contextOption,
+                 const char *contextDomain, int contextDomainLen,
+                 Filter **matchedFilter = nullptr,
+                 Filter **matchedExceptionFilter = nullptr);
+
     bool findMatchingFilters(const char *input,
                              FilterOption contextOption,
                              const char *contextDomain,
                              Filter **matchingFilter,
                              Filter **matchingExceptionFilter);
 
-    char *getElementHidingSelectors(const char *host, int hostLen) const;
+    bool findMatchingFilters(const char *input, int inputLen,
+                             FilterOption contextOption,
+                             const char *contextDomain, int contextDomainLen,
+                             Filter **matchingFilter,
+                             Filter **matchingExceptionFilter);
 
-    char *getElementHidingExceptionSelectors(const char *host, int hostLen) const;
+    // Returns a number for |filter| from matches() which getRuleText()
+    // resolves, so callers can keep it instead of the rule text. It tells
+    // the section the filter is stored in and its index there, so it
+    // stays valid until the filters change. -1 if |filter| isn't stored
+    // in one of the filter lists or host anchored hash sets.
+    int getRuleId(const Filter *filter) const;
+
+    // Returns the rule text of |ruleId|, nullptr if the number is unknown
+    // or ruleDefinitionFallback if the rule text wasn't preserved
+    const char *getRuleText(int ruleId);
+
+    // Returns the text of the rule |filter| was parsed from, nullptr
+    // without a filter or ruleDefinitionFallback if the rule text wasn't
+    // preserved. Loads the rule text of deserialized data on first use.
+    const char *getRuleDefinition(const Filter *filter);
+
+    char *getElementHidingSelectors(const char *host, int hostLen);
+
+    char *getElementHidingExceptionSelectors(const char *host, int hostLen);
 
     const char *getElementHidingSelectors(const char *contextUrl);
 
@@ -65,6 +139,47 @@ public:
 
     const LinkedList<std::string> *getScriptlets(const char *contextUrl);
 
+    // Same as above for the first |contextUrlLen| chars of |contextUrl|
+    const char *getUrlElementHidingSelectors(const char *contextUrl, int contextUrlLen);
+
+    const LinkedList<std::string> *getExtendedCssSelectors(const char *contextUrl,
+                                                           int contextUrlLen);
+
+    const LinkedList<std::string> *getCssRules(const char *contextUrl, int contextUrlLen);
+
+    const LinkedList<std::string> *getScriptlets(const char *contextUrl, int contextUrlLen);
+
+    // Releases memory up to |level| which is rebuilt when it's needed again
+    // and returns an estimate of the bytes freed. Sections aren't released
+    // while serializeFileAsync() runs. What the cosmetic getters and
+    // getRuleDefinition() returned is freed, so they must not run on other
+    // threads meanwhile, matches() may.
+    size_t trim(TrimLevel level);
+
+    // Fills |report| with the memory of each structure, the chain lengths
+    // of the hash sets and the fill of the bloom filters. Cosmetic sections
+    // which weren't loaded yet count as empty. Like trim() it must not run
+    // along the cosmetic getters on other threads.
+    void getMemoryReport(MemoryReport *report);
+
+    // Starts or stops recording how long the phases of matches() and the
+    // cosmetic getters take into the histograms of LatencyStats. It's off
+    // by default and costs a clock read per phase when on. Must not run
+    // along itself or getLatencyStats() on other threads.
+    void setLatencyStatsEnabled(bool enabled);
+
+    bool isLatencyStatsEnabled() const {
+        return activeLatencyStats.load(std::memory_order_relaxed) != nullptr;
+    }
+
+    // What was recorded while enabled, kept when disabled, nullptr if it
+    // was never enabled
+    const LatencyStats *getLatencyStats() const {
+        return latencyStats;
+    }
+
+    void resetLatencyStats();
+
     void addTag(const std::string &tag);
 
     void removeTag(const std::string &tag);
@@ -75,29 +190,102 @@ public:
     // The returned buffer should be deleted.
     char *serialize(int *size, bool ignoreHtmlFilters = true) const;
 
+    // Serializes like serialize() but straight into the file at |path|,
+    // one section at a time instead of the whole data in memory. The file
+    // is replaced atomically, so a client mapping the old one keeps
+    // working. Returns false if it can't be written.
+    bool serializeFile(const char *path, bool ignoreHtmlFilters = true) const;
+
+    // Runs serializeFile() on a background thread which calls |done| with
+    // the result, the client keeps matching meanwhile. The thread belongs
+    // to the client: parse(), clear() and the destructor wait for it, so
+    // |done| must not call them.
+    void serializeFileAsync(const char *path, bool ignoreHtmlFilters,
+                            std::function<void(bool)> done);
+
+    // Blocks until the save started by serializeFileAsync() is finished
+    void waitForSave();
+
+    // Serializes like serialize() into sealed shared memory which other
+    // processes can map with deserializeSharedMemory() after receiving
+    // the returned descriptor, e.g. over a Unix socket. The caller owns
+    // the descriptor. Returns -1 if shared memory isn't supported.
+    int serializeToSharedMemory(const char *name,
+                                bool ignoreHtmlFilters = true) const;
+
     // Deserializes the buffer, a size is not needed since a serialized.
-    // buffer is self described
+    // buffer is self described. Prefer the sized version for data which
+    // isn't known to be complete.
     bool deserialize(char *buffer);
 
+    // Deserializes |size| bytes of |buffer|, returns false if the data is
+    // truncated, corrupted or of another format version. The buffer must
+    // outlive the client like for deserialize(char *). Apart from checking
+    // the CRCs it takes constant time: the filter sections and the hash
+    // sets are used in place and build their filters when they're first
+    // needed, the RegexSet is built by the first match and the cosmetic
+    // sections are only loaded on first use.
+    bool deserialize(char *buffer, size_t size);
+
+    // Whether serialize() stores |section| compressed, by default the
+    // cosmetic sections are. A compressed section is decompressed into
+    // memory when it is loaded instead of being used from a mapping.
+    void setSectionCompression(EngineSection section, bool compressed);
+
+    // Deserializes the processed data in |path| straight from a read only
+    // mapping of the file, which is kept until the client is cleared.
+    // The file must be replaced by renaming rather than rewritten while
+    // it is mapped.
+    bool deserializeFile(const char *path);
+
+    // Deserializes the shared memory |fd| from serializeToSharedMemory()
+    // straight from a read only mapping like deserializeFile(), so every
+    // process uses the same pages. Fails for memory which isn't sealed.
+    // The descriptor can be closed afterwards.
+    bool deserializeSharedMemory(int fd);
+
+    // Collects the fingerprints of bloom filter false positives in
+    // badFingerprintsHashSet. It starts from the badFingerprints table the
+    // engine is built with, which is empty unless
+    // ENABLE_BadFingerprints_Exclusion is defined.
     void enableBadFingerprintDetection();
 
     const char *getDeserializedBuffer() {
         return deserializedBuffer;
     }
 
-    static bool getFingerprint(char *buffer, const char *input);
+    // Sets the length of the bloom filter fingerprints, only possible before
+    // anything is parsed. Returns false if the size is out of range or
+    // filters were already added.
+    bool setFingerprintSize(int size);
 
-    static bool getFingerprint(char *buffer, const Filter &f);
+    int getFingerprintSize() const {
+        return fingerprintSize;
+    }
 
-    Filter *filters;
-    Filter *htmlFilters;
-    Filter *exceptionFilters;
-    Filter *noFingerprintFilters;
-    Filter *noFingerprintExceptionFilters;
-    Filter *noFingerprintDomainOnlyFilters;
-    Filter *noFingerprintAntiDomainOnlyFilters;
-    Filter *noFingerprintDomainOnlyExceptionFilters;
-    Filter *noFingerprintAntiDomainOnlyExceptionFilters;
+    // Uses |optimizer| to pick the rarest window as fingerprint for the next
+    // parse() calls, the optimizer must outlive them and its size must
+    // match the fingerprint size. Pass nullptr to pick the first window.
+    bool setFingerprintOptimizer(const FingerprintOptimizer *optimizer);
+
+    // Fills |buffer| which must hold fingerprintSize + 1 chars if specified
+    static bool getFingerprint(char *buffer, const char *input,
+                               int fingerprintSize = kFingerprintSize,
+                               const FingerprintOptimizer *optimizer = nullptr);
+
+    static bool getFingerprint(char *buffer, const Filter &f,
+                               int fingerprintSize = kFingerprintSize,
+                               const FingerprintOptimizer *optimizer = nullptr);
+
+    FilterList filters;
+    FilterList htmlFilters;
+    FilterList exceptionFilters;
+    FilterList noFingerprintFilters;
+    FilterList noFingerprintExceptionFilters;
+    FilterList noFingerprintDomainOnlyFilters;
+    FilterList noFingerprintAntiDomainOnlyFilters;
+    FilterList noFingerprintDomainOnlyExceptionFilters;
+    FilterList noFingerprintAntiDomainOnlyExceptionFilters;
 
     int numFilters;
     int numCosmeticFilters;
@@ -135,23 +323,29 @@ public:
     // Used only in the perf program to create a list of bad fingerprints
     BadFingerprintsHashSet *badFingerprintsHashSet;
 
-    // Stats kept for matching
-    unsigned int numFalsePositives;
-    unsigned int numExceptionFalsePositives;
-    unsigned int numBloomFilterSaves;
-    unsigned int numExceptionBloomFilterSaves;
-    unsigned int numHashSetSaves;
-    unsigned int numExceptionHashSetSaves;
+    // Stats kept for matching, relaxed atomics since matches() may run on
+    // several threads
+    std::atomic<unsigned int> numFalsePositives;
+    std::atomic<unsigned int> numExceptionFalsePositives;
+    std::atomic<unsigned int> numBloomFilterSaves;
+    std::atomic<unsigned int> numExceptionBloomFilterSaves;
+    std::atomic<unsigned int> numHashSetSaves;
+    std::atomic<unsigned int> numExceptionHashSetSaves;
 
-    static const int kFingerprintSize;
+    static const int kFingerprintSize = 6;
+    static const int kMinFingerprintSize = 3;
+    static const int kMaxFingerprintSize = 16;
 
 protected:
-    // Determines if a passed in array of filter pointers matches for any of
-    // the input
-    bool hasMatchingFilters(Filter *filter, int numFilters, const char *input,
-                            int inputLen, FilterOption contextOption, const char *contextDomain,
+    // Determines if any filter of |filterList| matches for the input. Only
+    // filters which need runtime state are built, the others are matched
+    // straight from their records.
+    bool hasMatchingFilters(FilterList *filterList, const char *input,
+                            int inputLen, FilterOption contextOption,
+                            const char *contextDomain, int contextDomainLen,
                             BloomFilter *inputBloomFilter, const char *inputHost, int inputHostLen,
-                            Filter **matchingFilter = nullptr) const;
+                            Filter **matchingFilter = nullptr,
+                            RegexSetMatches *regexSetMatches = nullptr);
 
     bool isHostAnchoredHashSetMiss(const char *input, int inputLen,
                                    HashSet<Filter> *hashSet,
@@ -159,8 +353,39 @@ protected:
                                    int inputHostLen,
                                    FilterOption contextOption,
                                    const char *contextDomain,
+                                   int contextDomainLen,
                                    Filter **foundFilter = nullptr) const;
 
+    // The filter list stored in |section|, nullptr for other sections
+    FilterList *getFilterList(EngineSection section);
+
+    const FilterList *getFilterList(EngineSection section) const;
+
+    uint32_t serializeSection(EngineSection section, char *buffer,
+                              int adjustedNumHtmlFilters) const;
+
+    char *compressSection(EngineSection section, uint32_t *size,
+                          int adjustedNumHtmlFilters) const;
+
+    uint32_t storedSectionFlags(EngineSection section) const;
+
+    bool serializeTo(FileWriter *writer, bool ignoreHtmlFilters) const;
+
+    template<class W>
+    void streamSection(EngineSection section, W *writer,
+                       int adjustedNumHtmlFilters) const;
+
+    void putHeader(char *buffer, const SectionEntry *sections,
+                   int adjustedNumHtmlFilters) const;
+
+    // Deserializes |section| if deserialize() deferred it, safe to call
+    // from several threads
+    void loadSection(EngineSection section);
+
+    // Points |data| and |len| to the bytes of the section described by
+    // |entry|, decompressing it first if it is stored compressed
+    bool inflateSection(const SectionEntry &entry, char **data, uint32_t *len);
+
     static void initBloomFilter(BloomFilter **, const char *buffer, int len);
 
     template<class T>
@@ -169,12 +394,73 @@ protected:
     template<class K, class V>
     bool initHashMap(HashMap<K, V> **, char *buffer, int len);
 
+    // Serializes |hashSet| into |section| of parsedSections and uses it
+    // from there
+    void sealHashSet(HashSet<Filter> *hashSet, EngineSection section);
+
+    // The RegexSet of the regex filters of all filter lists, built the
+    // first time it's needed. Safe to call from several threads.
+    const RegexSet *getRegexSet();
+
+    // The text of the rule at |ruleOffset| of the rule text like
+    // getRuleDefinition() returns it
+    const char *getRuleTextAt(uint32_t ruleOffset, int ruleLen);
+
+    // Frees what loadSection() loaded for |section| and returns an estimate
+    // of its size, the caller marks it pending again
+    size_t releaseSection(EngineSection section);
+
     HashMap<NoFingerprintDomain, CosmeticFilter> *elementHidingSelectorsCache;
     HashMap<NoFingerprintDomain, LinkedList<std::string>> *extendedCssCache;
     HashMap<NoFingerprintDomain, LinkedList<std::string>> *cssRulesCache;
     HashMap<NoFingerprintDomain, LinkedList<std::string>> *scriptletCache;
+    // Estimated bytes held by the caches above
+    size_t cacheSize;
     char *deserializedBuffer;
+    MappedFile *mappedFile;
+    // Sections of deserializedBuffer which loadSection() still has to
+    // deserialize, guarded by sectionLock
+    SectionEntry pendingSections[ESNumSections];
+    std::atomic<bool> sectionPending[ESNumSections];
+    mutable std::mutex sectionLock;
+    // Sections loadSection() loaded unchanged from deserializedBuffer, which
+    // trim() may release and leave to it again. Guarded by sectionLock.
+    uint32_t reloadableSections;
+    // Created once setLatencyStatsEnabled() enables it, which also sets
+    // activeLatencyStats to it until it's disabled
+    LatencyStats *latencyStats;
+    std::atomic<LatencyStats *> activeLatencyStats;
+    // Runs serializeFileAsync()
+    std::thread saveThread;
+    // Whether saveThread runs, guarded by sectionLock
+    bool saving;
+    // All regex filters which run on the automaton, scanned once per input.
+    // Set by getRegexSet(), which builds it under regexSetLock.
+    std::atomic<RegexSet *> regexSet;
+    std::mutex regexSetLock;
+    // Strings of the filters parse() creates, they borrow from it
+    Arena *arena;
+    // Text of the rules parse() preserved, each NUL terminated where the
+    // ruleOffset of its filters points. ruleTextData is either ruleText or
+    // the ESRuleText section once it's loaded.
+    std::string ruleText;
+    const char *ruleTextData;
+    uint32_t ruleTextSize;
+    // Decompressed sections, items borrow from them like from
+    // deserializedBuffer
+    char *inflatedSections[ESNumSections];
+    // The filter sections, the string table and the host anchored hash
+    // sets parse() built, which are used in place like deserialized ones
+    char *parsedSections[ESNumSections];
+    uint32_t parsedSectionSizes[ESNumSections];
+    // Strings of the filter lists, either the ESStringTable section or the
+    // one parse() built
+    const char *stringTableData;
+    uint32_t stringTableSize;
+    uint32_t compressedSections;
     std::set<std::string> tags;
+    int fingerprintSize;
+    const FingerprintOptimizer *fingerprintOptimizer;
 };
 
 extern std::set<std::string> unknownOptions;
@@ -186,7 +472,11 @@ void parseFilter(const char *input, const char *end, Filter *f,
                  HashSet<Filter> *hostAnchoredHashSet = nullptr,
                  HashSet<Filter> *hostAnchoredExceptionHashSet = nullptr,
                  HashSet<CosmeticFilter> *simpleCosmeticFilters = nullptr,
-                 bool preserveRules = false);
+                 std::string *ruleText = nullptr,
+                 int fingerprintSize = AdBlockClient::kFingerprintSize,
+                 const FingerprintOptimizer *fingerprintOptimizer = nullptr,
+                 Arena *arena = nullptr,
+                 StringPool *stringPool = nullptr);
 
 void parseFilter(const char *input, Filter *f,
                  BloomFilter *bloomFilter = nullptr,
@@ -194,7 +484,11 @@ void parseFilter(const char *input, Filter *f,
                  HashSet<Filter> *hostAnchoredHashSet = nullptr,
                  HashSet<Filter> *hostAnchoredExceptionHashSet = nullptr,
                  HashSet<CosmeticFilter> *simpleCosmeticFilters = nullptr,
-                 bool preserveRules = false);
+                 std::string *ruleText = nullptr,
+                 int fingerprintSize = AdBlockClient::kFingerprintSize,
+                 const FingerprintOptimizer *fingerprintOptimizer = nullptr,
+                 Arena *arena = nullptr,
+                 StringPool *stringPool = nullptr);
 
 bool isSeparatorChar(char c);
 int findFirstSeparatorChar(const char *input, const char *end);
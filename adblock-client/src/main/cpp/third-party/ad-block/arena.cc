@@ -0,0 +1,62 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "./arena.h"
+
+#include <string.h>
+
+Arena::Arena(size_t blockSize) :
+        blockSize(blockSize),
+        blocks(nullptr),
+        pos(nullptr),
+        end(nullptr),
+        reservedSize(0) {
+}
+
+Arena::~Arena() {
+    clear();
+}
+
+char *Arena::alloc(size_t size) {
+    if (static_cast<size_t>(end - pos) < size) {
+        // Larger requests get a block of their own, so the rest of the
+        // current block isn't wasted on them
+        size_t dataSize = size > blockSize / 4 ? size : blockSize;
+        auto *block = reinterpret_cast<Block *>(new char[sizeof(Block) + dataSize]);
+        block->size = sizeof(Block) + dataSize;
+        reservedSize += block->size;
+        char *data = reinterpret_cast<char *>(block + 1);
+        if (dataSize != blockSize && blocks) {
+            // Keep bumping in the current block
+            block->next = blocks->next;
+            blocks->next = block;
+            return data;
+        }
+        block->next = blocks;
+        blocks = block;
+        pos = data;
+        end = data + dataSize;
+    }
+    char *result = pos;
+    pos += size;
+    return result;
+}
+
+char *Arena::copy(const char *data, size_t len) {
+    char *result = alloc(len + 1);
+    memcpy(result, data, len);
+    result[len] = '\0';
+    return result;
+}
+
+void Arena::clear() {
+    while (blocks) {
+        Block *next = blocks->next;
+        delete[] reinterpret_cast<char *>(blocks);
+        blocks = next;
+    }
+    pos = nullptr;
+    end = nullptr;
+    reservedSize = 0;
+}
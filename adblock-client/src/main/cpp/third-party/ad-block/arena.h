@@ -0,0 +1,59 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef ARENA_H_
+#define ARENA_H_
+
+#include <stddef.h>
+#include "./base.h"
+
+/**
+ * Bump allocator for memory which lives as long as its owner, e.g. the
+ * strings of parsed filters. Allocations are carved out of large blocks
+ * one after another and are only released all at once by clear() or the
+ * destructor, so parsing a list takes a few block allocations instead of
+ * several per rule, and the strings of neighbouring rules stay close.
+ *
+ * Not thread safe.
+ */
+class Arena {
+public:
+    explicit Arena(size_t blockSize = kDefaultBlockSize);
+
+    ~Arena();
+
+    // Returns |size| bytes, valid until clear()
+    char *alloc(size_t size);
+
+    // Copies |len| chars of |data| and a terminator
+    char *copy(const char *data, size_t len);
+
+    // Releases every allocation
+    void clear();
+
+    // Bytes taken from the heap for blocks
+    size_t getReservedSize() const {
+        return reservedSize;
+    }
+
+    static const size_t kDefaultBlockSize = 64 * 1024;
+
+private:
+    struct Block {
+        Block *next;
+        size_t size;
+    };
+
+    Arena(const Arena &) = delete;
+
+    Arena &operator=(const Arena &) = delete;
+
+    size_t blockSize;
+    Block *blocks;
+    char *pos;
+    char *end;
+    size_t reservedSize;
+};
+
+#endif  // ARENA_H_
@@ -12,17 +12,18 @@
 #define BAD_FINGERPRINT_H_
 
 #include <string.h>
+#include <stdio.h>
 #include <math.h>
+#include <algorithm>
+#include <vector>
 #include "../hashset-cpp/hash_set.h"
-
-#ifdef PERF_STATS
-#include <fstream>
-#endif
+#include "../hashset-cpp/hashFn.h"
 
 class BadFingerprint {
 public:
     uint64_t GetHash() const {
-        return 0;
+        static HashFn hashFn(19);
+        return hashFn(data, static_cast<int>(strlen(data)));
     }
 
     ~BadFingerprint() {
@@ -73,33 +74,57 @@ public:
     char *data;
 };
 
+static inline bool compareBadFingerprints(const char *a, const char *b) {
+    return strcmp(a, b) < 0;
+}
+
 class BadFingerprintsHashSet : public HashSet<BadFingerprint> {
 public:
-    BadFingerprintsHashSet() : HashSet<BadFingerprint>(1, false) {
+    BadFingerprintsHashSet() : HashSet<BadFingerprint>(2048, false) {
     }
 
-    void generateHeader(const char *filename) {
-#ifdef PERF_STATS
-        std::ofstream outFile;
-        outFile.open(filename);
-
-        outFile << "#pragma once\n";
-        outFile << "/**\n  *\n  * Auto generated bad filters\n  */\n";
-        outFile << "const char *badFingerprints[] = {\n";
+    // Writes the set as a bad_fingerprints.h replacement, sorted so that
+    // regenerated headers diff well. Returns false if the file can't be
+    // written.
+    bool generateHeader(const char *filename) {
+        std::vector<const char *> fingerprints;
         for (uint32_t bucket_index = 0; bucket_index < bucket_count_;
-            bucket_index++) {
-          HashItem<BadFingerprint> *hashItem = buckets_[bucket_index];
-          while (hashItem) {
-            BadFingerprint *badFingerprint = hashItem->hash_item_storage_;
-            outFile << "\"" << badFingerprint->data << "\"," << std::endl;
-            hashItem = hashItem->next_;
-          }
+             bucket_index++) {
+            HashItem<BadFingerprint> *hashItem = buckets_[bucket_index];
+            while (hashItem) {
+                fingerprints.push_back(hashItem->hash_item_storage_->data);
+                hashItem = hashItem->next_;
+            }
+        }
+        std::sort(fingerprints.begin(), fingerprints.end(),
+                  compareBadFingerprints);
+
+        FILE *outFile = fopen(filename, "w");
+        if (!outFile) {
+            return false;
+        }
+        fputs("#pragma once\n\n", outFile);
+        fputs("const char *badSubstrings[] = {\"http\", \"www\"};\n\n", outFile);
+        fputs("// BadFingerprints exclusion is not reliable and appreciable for "
+              "performance optimization.\n"
+              "// Disable it temporarily.\n"
+              "#ifndef ENABLE_BadFingerprints_Exclusion\n"
+              "const char *badFingerprints[] = {};\n"
+              "#else\n", outFile);
+        fputs("/**\n  *\n  * Auto generated bad filters\n  */\n", outFile);
+        fputs("const char *badFingerprints[] = {\n", outFile);
+        for (size_t i = 0; i < fingerprints.size(); i++) {
+            fputs("        \"", outFile);
+            for (const char *p = fingerprints[i]; *p != '\0'; p++) {
+                if (*p == '"' || *p == '\\') {
+                    fputc('\\', outFile);
+                }
+                fputc(*p, outFile);
+            }
+            fputs("\",\n", outFile);
         }
-        outFile << "};\n" << std::endl;
-        outFile << "const char *badSubstrings[] = {\"http\", \"www\" };"
-          << std::endl;
-        outFile.close();
-#endif
+        fputs("};\n#endif\n", outFile);
+        return fclose(outFile) == 0;
     }
 };
 
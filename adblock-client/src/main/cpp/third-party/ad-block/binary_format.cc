@@ -0,0 +1,126 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include <string.h>
+#include "./binary_format.h"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <nmmintrin.h>
+#define CRC32C_HARDWARE_X86
+#elif defined(__aarch64__) && defined(__linux__)
+#include <arm_acle.h>
+#include <sys/auxv.h>
+#define CRC32C_HARDWARE_ARM64
+#ifndef HWCAP_CRC32
+#define HWCAP_CRC32 (1 << 7)
+#endif
+#endif
+
+namespace {
+
+// Reflected Castagnoli polynomial
+const uint32_t kCrc32cPolynomial = 0x82f63b78;
+
+// Slicing by 8 tables for CPUs without CRC instructions
+struct Crc32cTables {
+    Crc32cTables() {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t crc = i;
+            for (int j = 0; j < 8; j++) {
+                crc = crc & 1 ? (crc >> 1) ^ kCrc32cPolynomial : crc >> 1;
+            }
+            table[0][i] = crc;
+        }
+        for (uint32_t i = 0; i < 256; i++) {
+            for (int k = 1; k < 8; k++) {
+                table[k][i] = (table[k - 1][i] >> 8) ^ table[0][table[k - 1][i] & 0xff];
+            }
+        }
+    }
+
+    uint32_t table[8][256];
+};
+
+uint32_t crc32cSoftware(const char *data, size_t len, uint32_t crc) {
+    static const Crc32cTables tables;
+    const uint32_t (*t)[256] = tables.table;
+    auto *p = reinterpret_cast<const unsigned char *>(data);
+    while (len >= 8) {
+        uint32_t low = crc ^ getUint32LE(reinterpret_cast<const char *>(p));
+        uint32_t high = getUint32LE(reinterpret_cast<const char *>(p + 4));
+        crc = t[7][low & 0xff] ^ t[6][(low >> 8) & 0xff]
+              ^ t[5][(low >> 16) & 0xff] ^ t[4][low >> 24]
+              ^ t[3][high & 0xff] ^ t[2][(high >> 8) & 0xff]
+              ^ t[1][(high >> 16) & 0xff] ^ t[0][high >> 24];
+        p += 8;
+        len -= 8;
+    }
+    while (len--) {
+        crc = t[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+#if defined(CRC32C_HARDWARE_X86)
+
+__attribute__((target("sse4.2")))
+uint32_t crc32cHardware(const char *data, size_t len, uint32_t crc) {
+    uint64_t crc64 = crc;
+    while (len >= 8) {
+        uint64_t value;
+        memcpy(&value, data, 8);
+        crc64 = _mm_crc32_u64(crc64, value);
+        data += 8;
+        len -= 8;
+    }
+    crc = static_cast<uint32_t>(crc64);
+    while (len--) {
+        crc = _mm_crc32_u8(crc, static_cast<unsigned char>(*data++));
+    }
+    return crc;
+}
+
+bool hasCrc32cHardware() {
+    return __builtin_cpu_supports("sse4.2");
+}
+
+#elif defined(CRC32C_HARDWARE_ARM64)
+
+#if defined(__clang__)
+__attribute__((target("crc")))
+#else
+__attribute__((target("+crc")))
+#endif
+uint32_t crc32cHardware(const char *data, size_t len, uint32_t crc) {
+    while (len >= 8) {
+        uint64_t value;
+        memcpy(&value, data, 8);
+        crc = __crc32cd(crc, value);
+        data += 8;
+        len -= 8;
+    }
+    while (len--) {
+        crc = __crc32cb(crc, static_cast<uint8_t>(*data++));
+    }
+    return crc;
+}
+
+bool hasCrc32cHardware() {
+    return (getauxval(AT_HWCAP) & HWCAP_CRC32) != 0;
+}
+
+#endif
+
+}  // namespace
+
+uint32_t crc32c(const char *data, size_t len, uint32_t crc) {
+    crc = ~crc;
+#if defined(CRC32C_HARDWARE_X86) || defined(CRC32C_HARDWARE_ARM64)
+    static const bool hardware = hasCrc32cHardware();
+    if (hardware) {
+        return ~crc32cHardware(data, len, crc);
+    }
+#endif
+    return ~crc32cSoftware(data, len, crc);
+}
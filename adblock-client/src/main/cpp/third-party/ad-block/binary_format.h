@@ -0,0 +1,128 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef BINARY_FORMAT_H_
+#define BINARY_FORMAT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "./base.h"
+#include "../hashset-cpp/little_endian.h"
+
+/**
+ * Layout of the serialized engine data, all integers are little endian
+ * uint32:
+ *
+ *   header        magic, version, fingerprint size, number of sections and
+ *                 the kEngineHeaderCounts filter counts
+ *   section table id, flags, offset, size and CRC32C of every section
+ *   header CRC    CRC32C of the header and section table
+ *   sections      each starting kSectionAlignment aligned
+ *
+ * Sections appear in the table in EngineSection order. Data of another
+ * version is rejected rather than converted, it is rebuilt from the lists.
+ *
+ * A section flagged kSectionCompressed holds its uncompressed size
+ * followed by the LZ4 block of its data, the CRC covers the stored bytes.
+ *
+ * The filter sections are arrays of kFilterRecordSize records, see
+ * putFilterRecord(). A record references its strings by offset in the
+ * ESStringTable section, which holds each distinct one NUL terminated,
+ * and its rule text by offset and length in the ESRuleText section.
+ *
+ * Everything needed for matching requests is used from the buffer as it
+ * is: the filter records, the bloom filters and the hash sets, which
+ * hold the offset of every item. Runtime state like compiled regexes and
+ * parsed domains is kept in side tables indexed by the position of a
+ * filter and filled when a match first needs it.
+ */
+static const uint32_t kEngineMagic = 0x4b424441;  // "ADBK"
+static const uint32_t kEngineFormatVersion = 6;
+static const uint32_t kEngineHeaderCounts = 13;
+static const uint32_t kEngineHeaderSize = (4 + kEngineHeaderCounts) * 4;
+static const uint32_t kSectionEntrySize = 5 * 4;
+static const uint32_t kSectionAlignment = 8;
+
+enum EngineSection {
+    ESFilters,
+    ESExceptionFilters,
+    ESHtmlFilters,
+    ESNoFingerprintFilters,
+    ESNoFingerprintExceptionFilters,
+    ESNoFingerprintDomainOnlyFilters,
+    ESNoFingerprintAntiDomainOnlyFilters,
+    ESNoFingerprintDomainOnlyExceptionFilters,
+    ESNoFingerprintAntiDomainOnlyExceptionFilters,
+    ESBloomFilter,
+    ESExceptionBloomFilter,
+    ESHostAnchoredHashSet,
+    ESHostAnchoredExceptionHashSet,
+    ESNoFingerprintDomainHashSet,
+    ESNoFingerprintAntiDomainHashSet,
+    ESNoFingerprintDomainExceptionHashSet,
+    ESNoFingerprintAntiDomainExceptionHashSet,
+    ESElementHidingHashMap,
+    ESElementHidingExceptionHashMap,
+    ESGenericElementHidingSelectors,
+    ESExtendedCssHashMap,
+    ESCssRulesHashMap,
+    ESScriptletHashMap,
+    ESStringTable,
+    ESRuleText,
+    ESNumSections
+};
+
+// Section flags
+static const uint32_t kSectionCompressed = 1;
+
+struct SectionEntry {
+    uint32_t id;
+    uint32_t flags;
+    uint32_t offset;
+    uint32_t size;
+    uint32_t crc;
+};
+
+// The selector sections, which serialize() compresses by default. Network
+// sections and the rule text stay uncompressed so they can be used from a
+// mapping, getRuleDefinition() runs for each blocked request.
+static const uint32_t kDefaultCompressedSections =
+        1u << ESElementHidingHashMap
+        | 1u << ESElementHidingExceptionHashMap
+        | 1u << ESGenericElementHidingSelectors
+        | 1u << ESExtendedCssHashMap
+        | 1u << ESCssRulesHashMap
+        | 1u << ESScriptletHashMap;
+
+// Size of everything before the first section
+static const uint32_t kEngineTableEnd =
+        kEngineHeaderSize + ESNumSections * kSectionEntrySize + 4;
+
+inline uint32_t alignSection(uint32_t pos) {
+    return (pos + kSectionAlignment - 1) & ~(kSectionAlignment - 1);
+}
+
+inline void putSectionEntry(char *buffer, const SectionEntry &entry) {
+    putUint32LE(buffer, entry.id);
+    putUint32LE(buffer + 4, entry.flags);
+    putUint32LE(buffer + 8, entry.offset);
+    putUint32LE(buffer + 12, entry.size);
+    putUint32LE(buffer + 16, entry.crc);
+}
+
+inline SectionEntry getSectionEntry(const char *buffer) {
+    SectionEntry entry;
+    entry.id = getUint32LE(buffer);
+    entry.flags = getUint32LE(buffer + 4);
+    entry.offset = getUint32LE(buffer + 8);
+    entry.size = getUint32LE(buffer + 12);
+    entry.crc = getUint32LE(buffer + 16);
+    return entry;
+}
+
+// CRC32C (Castagnoli) of |data| continuing from |crc|, uses the CRC
+// instructions of SSE4.2 and ARMv8 when the CPU has them
+uint32_t crc32c(const char *data, size_t len, uint32_t crc = 0);
+
+#endif  // BINARY_FORMAT_H_
@@ -61,6 +61,11 @@ public:
         return 0;
     }
 
+    // Nothing is allocated, the domain is borrowed
+    size_t GetAllocatedSize() const {
+        return 0;
+    }
+
 private:
     const char *start_;
     int len_;
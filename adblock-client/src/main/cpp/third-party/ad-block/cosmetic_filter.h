@@ -14,6 +14,7 @@
 #include <math.h>
 #include <string>
 #include "../hashset-cpp/hash_set.h"
+#include "../hashset-cpp/little_endian.h"
 #include "hash_map.h"
 #include "no_fingerprint_domain.h"
 
@@ -28,23 +29,39 @@ public:
     }
 
     ~CosmeticFilter() {
-        if (data) {
+        if (data && !borrowed_data) {
             delete[] data;
         }
     }
 
-    explicit CosmeticFilter(const char *data) {
+    explicit CosmeticFilter(const char *data) : borrowed_data(false) {
         size_t len = strlen(data) + 1;
         this->data = new char[len];
         snprintf(this->data, len, "%s", data);
     }
 
-    CosmeticFilter(const CosmeticFilter &rhs) {
-        data = new char[strlen(rhs.data) + 1];
-        memcpy(data, rhs.data, strlen(rhs.data) + 1);
+    // Borrows |data| instead of copying it if |borrowedData|, it has to
+    // outlive the filter and its copies then
+    CosmeticFilter(char *data, bool borrowedData) : borrowed_data(borrowedData) {
+        if (borrowedData) {
+            this->data = data;
+        } else {
+            size_t len = strlen(data) + 1;
+            this->data = new char[len];
+            memcpy(this->data, data, len);
+        }
     }
 
-    CosmeticFilter() : data(nullptr) {
+    CosmeticFilter(const CosmeticFilter &rhs) : borrowed_data(rhs.borrowed_data) {
+        if (rhs.borrowed_data) {
+            data = rhs.data;
+        } else {
+            data = new char[strlen(rhs.data) + 1];
+            memcpy(data, rhs.data, strlen(rhs.data) + 1);
+        }
+    }
+
+    CosmeticFilter() : data(nullptr), borrowed_data(false) {
     }
 
     bool operator==(const CosmeticFilter &rhs) const {
@@ -58,21 +75,48 @@ public:
     // Nothing needs to be updated for multiple adds
     void Update(const CosmeticFilter &) {}
 
+    // Serialized as the length as little endian uint32 and the NUL
+    // terminated text
     uint32_t Serialize(char *buffer) {
+        auto len = static_cast<uint32_t>(data ? strlen(data) : 0);
         if (buffer) {
-            memcpy(buffer, data, strlen(data) + 1);
+            putUint32LE(buffer, len);
+            if (len > 0) {
+                memcpy(buffer + 4, data, len);
+            }
+            buffer[4 + len] = '\0';
         }
-        return static_cast<uint32_t>(strlen(data)) + 1;
+        return 4 + len + 1;
     }
 
     uint32_t Deserialize(char *buffer, uint32_t bufferSize) {
-        int len = static_cast<int>(strlen(buffer));
-        data = new char[len + 1];
-        memcpy(data, buffer, len + 1);
-        return len + 1;
+        if (bufferSize < 4) {
+            return 0;
+        }
+        uint32_t len = getUint32LE(buffer);
+        if (len >= bufferSize - 4 || buffer[4 + len] != '\0') {
+            return 0;
+        }
+        if (!borrowed_data) {
+            delete[] data;
+        }
+        // Borrowed like the domain keys, the buffer is either the mapped
+        // data or an inflated section, which are freed after their maps
+        data = buffer + 4;
+        borrowed_data = true;
+        return 4 + len + 1;
+    }
+
+    // Bytes allocated for |data| unless it's borrowed
+    size_t GetAllocatedSize() const {
+        return data && !borrowed_data ? strlen(data) + 1 : 0;
     }
 
     char *data;
+
+    // Holds true if |data| isn't owned, e.g. a selector which is shared
+    // by the filters of every domain of its rule
+    bool borrowed_data;
 };
 
 class CosmeticFilterHashSet : public HashSet<CosmeticFilter> {
@@ -0,0 +1,116 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "./file_writer.h"
+
+static const uint32_t kInitialCapacity = 64 * 1024;
+
+// Writes all of |data| at |offset| or at the end if |offset| is negative
+static bool writeFully(int fd, const char *data, size_t size, off_t offset) {
+    while (size > 0) {
+        ssize_t written = offset < 0 ? write(fd, data, size)
+                                     : pwrite(fd, data, size, offset);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += written;
+        size -= written;
+        if (offset >= 0) {
+            offset += written;
+        }
+    }
+    return true;
+}
+
+FileWriter *FileWriter::create(const char *path) {
+    std::string tmpPath = std::string(path) + ".tmp";
+    int fd = open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        return nullptr;
+    }
+    return new FileWriter(fd, path, tmpPath);
+}
+
+FileWriter *FileWriter::wrap(int fd) {
+    return new FileWriter(fd, std::string(), std::string());
+}
+
+FileWriter::FileWriter(int fd, const std::string &path, const std::string &tmpPath) :
+        fd(fd), path(path), tmpPath(tmpPath), buffer(new char[kInitialCapacity]),
+        capacity(kInitialCapacity), used(0), flushed(0), failed(false),
+        committed(false) {
+}
+
+FileWriter::~FileWriter() {
+    // Wrapped descriptors have no path and aren't ours to close
+    if (!path.empty()) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        if (!committed) {
+            unlink(tmpPath.c_str());
+        }
+    }
+    delete[] buffer;
+}
+
+char *FileWriter::reserve(uint32_t size) {
+    if (size > capacity - used) {
+        flush();
+    }
+    if (size > capacity) {
+        // Nothing is buffered after the flush, so there is nothing to copy
+        delete[] buffer;
+        capacity = size;
+        buffer = new char[capacity];
+    }
+    return buffer + used;
+}
+
+void FileWriter::append(uint32_t size) {
+    used += size;
+}
+
+void FileWriter::writeAt(uint64_t offset, const char *data, uint32_t size) {
+    flush();
+    if (!failed && !writeFully(fd, data, size, static_cast<off_t>(offset))) {
+        failed = true;
+    }
+}
+
+void FileWriter::flush() {
+    if (used > 0 && !failed && !writeFully(fd, buffer, used, -1)) {
+        failed = true;
+    }
+    flushed += used;
+    used = 0;
+}
+
+bool FileWriter::commit() {
+    flush();
+    if (path.empty()) {
+        committed = !failed;
+        return committed;
+    }
+    if (fsync(fd) != 0) {
+        failed = true;
+    }
+    if (close(fd) != 0) {
+        failed = true;
+    }
+    fd = -1;
+    if (failed || rename(tmpPath.c_str(), path.c_str()) != 0) {
+        return false;
+    }
+    committed = true;
+    return true;
+}
@@ -0,0 +1,72 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef FILE_WRITER_H_
+#define FILE_WRITER_H_
+
+#include <stdint.h>
+#include <string>
+#include "./base.h"
+
+/**
+ * Writes a file through a buffer which is flushed whenever it is full, so
+ * the content never has to be in memory as a whole. The buffer only grows
+ * when a single piece doesn't fit.
+ *
+ * The data goes to a temporary file next to the target which commit()
+ * renames over it. Readers, including clients mapping the old file, never
+ * see a partially written file.
+ */
+class FileWriter {
+public:
+    // Starts writing |path|, returns nullptr if the temporary file can't
+    // be created
+    static FileWriter *create(const char *path);
+
+    // Writes at the current position of |fd|, which stays open and owned
+    // by the caller. commit() only writes out the buffer then.
+    static FileWriter *wrap(int fd);
+
+    // Removes the temporary file unless commit() succeeded
+    ~FileWriter();
+
+    // Returns room for |size| bytes at the end of the file which stays
+    // valid until the next call
+    char *reserve(uint32_t size);
+
+    // Appends the first |size| bytes of the room from reserve()
+    void append(uint32_t size);
+
+    // Overwrites |size| bytes at |offset| which were appended before
+    void writeAt(uint64_t offset, const char *data, uint32_t size);
+
+    uint64_t getSize() const {
+        return flushed + used;
+    }
+
+    // Writes out everything, syncs it and renames the temporary file over
+    // the target. Returns false if any write failed.
+    bool commit();
+
+private:
+    FileWriter(int fd, const std::string &path, const std::string &tmpPath);
+
+    FileWriter(const FileWriter &) = delete;
+
+    FileWriter &operator=(const FileWriter &) = delete;
+
+    void flush();
+
+    int fd;
+    std::string path;
+    std::string tmpPath;
+    char *buffer;
+    uint32_t capacity;
+    uint32_t used;
+    uint64_t flushed;
+    bool failed;
+    bool committed;
+};
+
+#endif  // FILE_WRITER_H_
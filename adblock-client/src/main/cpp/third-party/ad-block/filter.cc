@@ -8,13 +8,6 @@
  * Origin: https://github.com/brave/ad-block
  */
 
-#define ENABLE_REGEX
-
-#ifdef ENABLE_REGEX
-// putting it at the top can solve the dependency conflict problem
-#include <regex> // NOLINT
-#endif
-
 #include "./filter.h"
 #include <string.h>
 #include <stdio.h>
@@ -25,19 +18,26 @@
 
 #include "../hashset-cpp/hash_set.h"
 #include "./ad_block_client.h"
+#include "./arena.h"
+#include "./string_pool.h"
 #include "../hashset-cpp/hashFn.h"
+#include "../hashset-cpp/little_endian.h"
 #include "../bloom-filter-cpp/BloomFilter.h"
+#include "./regex_matcher.h"
 
 static HashFn h(19);
 
-const char *getUrlHost(const char *input, int *len);
+char ruleDefinitionFallback[] = "-";
+
+const char *getUrlHost(const char *input, int inputLen, int *len);
 
 Filter::Filter() :
         borrowed_data(false),
         filterType(FTNoFilterType),
         filterOption(FONoFilterOption),
         antiFilterOption(FONoFilterOption),
-        ruleDefinition(nullptr),
+        ruleOffset(0),
+        ruleLen(-1),
         data(nullptr),
         dataLen(-1),
         domainList(nullptr),
@@ -47,16 +47,18 @@ Filter::Filter() :
         hostLen(-1),
         domains(nullptr),
         antiDomains(nullptr),
-        domainsParsed(false) {
+        domainsParsed(false),
+        regexSetId(-1),
+        regex(nullptr) {
 }
 
 Filter::~Filter() {
     delete domains;
     delete antiDomains;
+    delete regex.load();
 
     if (!borrowed_data) {
         delete[] data;
-        delete[] ruleDefinition;
         delete[] domainList;
         delete[] tag;
         delete[] host;
@@ -69,13 +71,14 @@ Filter::Filter(const char *data, int dataLen,
                char *tag, int tagLen) :
         borrowed_data(true), filterType(FTNoFilterType),
         filterOption(FONoFilterOption),
-        antiFilterOption(FONoFilterOption), ruleDefinition(nullptr),
+        antiFilterOption(FONoFilterOption), ruleOffset(0), ruleLen(-1),
         data(const_cast<char *>(data)), dataLen(dataLen),
         domainList(domainList),
         tag(tag), tagLen(tagLen),
         host(const_cast<char *>(host)),
         hostLen(hostLen), domains(nullptr),
-        antiDomains(nullptr), domainsParsed(false) {
+        antiDomains(nullptr), domainsParsed(false),
+        regexSetId(-1), regex(nullptr) {
 }
 
 Filter::Filter(FilterType filterType, FilterOption filterOption,
@@ -86,19 +89,35 @@ Filter::Filter(FilterType filterType, FilterOption filterOption,
                char *tag, int tagLen) :
         borrowed_data(true), filterType(filterType),
         filterOption(filterOption),
-        antiFilterOption(antiFilterOption), ruleDefinition(nullptr),
+        antiFilterOption(antiFilterOption), ruleOffset(0), ruleLen(-1),
         data(const_cast<char *>(data)), dataLen(dataLen),
         domainList(domainList),
         tag(tag), tagLen(tagLen),
         host(const_cast<char *>(host)), hostLen(hostLen),
-        domains(nullptr), antiDomains(nullptr), domainsParsed(false) {
+        domains(nullptr), antiDomains(nullptr), domainsParsed(false),
+        regexSetId(-1), regex(nullptr) {
+}
+
+Filter::Filter(const FilterRecord &record) :
+        borrowed_data(true), filterType(record.filterType),
+        filterOption(record.filterOption),
+        antiFilterOption(record.antiFilterOption),
+        ruleOffset(record.ruleOffset), ruleLen(record.ruleLen),
+        data(const_cast<char *>(record.data)), dataLen(record.dataLen),
+        domainList(const_cast<char *>(record.domainList)),
+        tag(const_cast<char *>(record.tag)), tagLen(record.tagLen),
+        host(const_cast<char *>(record.host)), hostLen(record.hostLen),
+        domains(nullptr), antiDomains(nullptr), domainsParsed(false),
+        regexSetId(-1), regex(nullptr) {
 }
 
-Filter::Filter(const Filter &other) {
+Filter::Filter(const Filter &other) : regexSetId(-1), regex(nullptr) {
     borrowed_data = other.borrowed_data;
     filterType = other.filterType;
     filterOption = other.filterOption;
     antiFilterOption = other.antiFilterOption;
+    ruleOffset = other.ruleOffset;
+    ruleLen = other.ruleLen;
     dataLen = other.dataLen;
     hostLen = other.hostLen;
     domainsParsed = false;
@@ -114,7 +133,6 @@ Filter::Filter(const Filter &other) {
         tag = other.tag;
         tagLen = other.tagLen;
         host = other.host;
-        ruleDefinition = other.ruleDefinition;
     } else {
         if (other.data) {
             data = new char[dataLen + 1];
@@ -144,24 +162,19 @@ Filter::Filter(const Filter &other) {
         } else {
             host = nullptr;
         }
-
-        if (other.ruleDefinition) {
-            size_t len = strlen(other.ruleDefinition) + 1;
-            ruleDefinition = new char[len];
-            snprintf(ruleDefinition, len, "%s", other.ruleDefinition);
-        } else {
-            ruleDefinition = nullptr;
-        }
     }
 }
 
 void Filter::swapData(Filter *other) {
+    // Whether the data is owned travels with it
+    bool tempBorrowedData = borrowed_data;
     FilterType tempFilterType = filterType;
     FilterOption tempFilterOption = filterOption;
     FilterOption tempAntiFilterOption = antiFilterOption;
     char *tempData = data;
     int tempDataLen = dataLen;
-    char *tempRuleDefinition = ruleDefinition;
+    uint32_t tempRuleOffset = ruleOffset;
+    int tempRuleLen = ruleLen;
     char *tempDomainList = domainList;
     char *tempTag = tag;
     int tempTagLen = tagLen;
@@ -170,11 +183,15 @@ void Filter::swapData(Filter *other) {
     bool tempDomainsParsed = domainsParsed;
     HashSet<ContextDomain> *tempDomains = domains;
     HashSet<ContextDomain> *tempAntiDomains = antiDomains;
+    int tempRegexSetId = regexSetId;
+    Regex *tempRegex = regex.load();
 
+    borrowed_data = other->borrowed_data;
     filterType = other->filterType;
     filterOption = other->filterOption;
     antiFilterOption = other->antiFilterOption;
-    ruleDefinition = other->ruleDefinition;;
+    ruleOffset = other->ruleOffset;
+    ruleLen = other->ruleLen;
     data = other->data;
     dataLen = other->dataLen;
     domainList = other->domainList;
@@ -185,11 +202,15 @@ void Filter::swapData(Filter *other) {
     domainsParsed = other->domainsParsed;
     domains = other->domains;
     antiDomains = other->antiDomains;
+    regexSetId = other->regexSetId;
+    regex.store(other->regex.load());
 
+    other->borrowed_data = tempBorrowedData;
     other->filterType = tempFilterType;
     other->filterOption = tempFilterOption;
     other->antiFilterOption = tempAntiFilterOption;
-    other->ruleDefinition = tempRuleDefinition;
+    other->ruleOffset = tempRuleOffset;
+    other->ruleLen = tempRuleLen;
     other->data = tempData;
     other->dataLen = tempDataLen;
     other->domainList = tempDomainList;
@@ -200,6 +221,8 @@ void Filter::swapData(Filter *other) {
     other->domainsParsed = tempDomainsParsed;
     other->domains = tempDomains;
     other->antiDomains = tempAntiDomains;
+    other->regexSetId = tempRegexSetId;
+    other->regex.store(tempRegex);
 }
 
 bool Filter::containsDomain(const char *domain, size_t domainLen,
@@ -241,7 +264,8 @@ bool Filter::isAntiDomainOnlyFilter() {
     return getDomainCount(true) && !getDomainCount(false);
 }
 
-void Filter::parseOption(const char *input, int len) {
+void Filter::parseOption(const char *input, int len, Arena *arena,
+                         StringPool *stringPool) {
     FilterOption *pFilterOption = &filterOption;
     const char *pStart = input;
     if (input[0] == '~') {
@@ -252,12 +276,22 @@ void Filter::parseOption(const char *input, int len) {
 
     if (len >= 7 && !strncmp(pStart, "domain=", 7)) {
         len -= 7;
-        domainList = new char[len + 1];
-        domainList[len] = '\0';
-        memcpy(domainList, pStart + 7, len);
+        if (stringPool) {
+            domainList = stringPool->intern(pStart + 7, len);
+        } else if (arena) {
+            domainList = arena->copy(pStart + 7, len);
+        } else {
+            domainList = new char[len + 1];
+            domainList[len] = '\0';
+            memcpy(domainList, pStart + 7, len);
+        }
     } else if (len >= 4 && !strncmp(pStart, "tag=", 4)) {
         len -= 4;
-        tag = new char[len];
+        if (arena) {
+            tag = arena->alloc(len);
+        } else {
+            tag = new char[len];
+        }
         memcpy(tag, pStart + 4, len);
         tagLen = len;
     } else if (!strncmp(pStart, "script", len)) {
@@ -330,7 +364,8 @@ void Filter::parseOption(const char *input, int len) {
     // Otherwise just ignore the option, maybe something new we don't support yet
 }
 
-void Filter::parseOptions(const char *input) {
+void Filter::parseOptions(const char *input, Arena *arena,
+                          StringPool *stringPool) {
     filterOption = FONoFilterOption;
     antiFilterOption = FONoFilterOption;
     int startOffset = 0;
@@ -338,14 +373,14 @@ void Filter::parseOptions(const char *input) {
     const char *p = input;
     while (*p != '\0' && !isEndOfLine(*p)) {
         if (*p == ',') {
-            parseOption(input + startOffset, len);
+            parseOption(input + startOffset, len, arena, stringPool);
             startOffset += len + 1;
             len = -1;
         }
         p++;
         len++;
     }
-    parseOption(input + startOffset, len);
+    parseOption(input + startOffset, len, arena, stringPool);
 }
 
 bool endsWith(const char *input, const char *sub, int inputLen, int subLen) {
@@ -390,7 +425,7 @@ bool Filter::isValid() const {
         && (filterType & FTComment) == 0;
 }
 
-bool Filter::contextDomainMatchesFilter(const char *contextDomain) {
+bool Filter::contextDomainMatchesFilter(const char *contextDomain, int contextDomainLen) {
     // If there are no context domains, then this filter can still apply
     // to all domains.
     if (getDomainCount(false) == 0 && getDomainCount(true) == 0) {
@@ -401,10 +436,10 @@ bool Filter::contextDomainMatchesFilter(const char *contextDomain) {
     // Start keeps track of the start of the last match
     // We do this to avoid extraTLD checks for rules.
     const char *start = contextDomain;
-    size_t contextDomainLen = strlen(contextDomain);
-    while (*p != '\0') {
+    const char *end = contextDomain + contextDomainLen;
+    while (p != end) {
         if (*p == '.') {
-            const size_t domainLen = contextDomainLen - (start - contextDomain);
+            const size_t domainLen = end - start;
             if (containsDomain(start, domainLen, false)) {
                 return true;
             }
@@ -435,8 +470,28 @@ bool Filter::contextDomainMatchesFilter(const char *contextDomain) {
 // By specifying context params, you can filter out the number of rules
 // which are considered.
 bool Filter::matchesOptions(const char *input, FilterOption context,
-                            const char *contextDomain) {
-    if (hasUnsupportedOptions()) {
+                            const char *contextDomain, int contextDomainLen) {
+    if (!matchesOptionFlags(filterOption, antiFilterOption, context)) {
+        return false;
+    }
+
+    // Domain options check
+    if (domainList && contextDomain) {
+        if (contextDomainLen == -1) {
+            contextDomainLen = static_cast<int>(strlen(contextDomain));
+        }
+        if (!contextDomainMatchesFilter(contextDomain, contextDomainLen)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool Filter::matchesOptionFlags(FilterOption filterOption,
+                                FilterOption antiFilterOption,
+                                FilterOption context) {
+    if (filterOption & FOUnsupportedSoSkipCheck) {
         return false;
     }
 
@@ -470,13 +525,6 @@ bool Filter::matchesOptions(const char *input, FilterOption context,
         }
     }
 
-    // Domain options check
-    if (domainList && contextDomain) {
-        if (!contextDomainMatchesFilter(contextDomain)) {
-            return false;
-        }
-    }
-
     // If we're in the context of third-party site, then consider
     // third-party option checks
     if (context & (FOThirdParty | FONotThirdParty)) {
@@ -517,7 +565,8 @@ int indexOfFilter(const char *input, int inputLen,
     for (int i = 0; i < inputLen; ++i) {
         bool match = true;
         for (int j = 0; j < filterLen; ++j) {
-            const char inputChar = input[i + j];
+            // Past the input counts as its end, like a terminator would
+            const char inputChar = i + j < inputLen ? input[i + j] : '\0';
             const char filterChar = filterBegin[j];
 
             if (filterChar != inputChar) {
@@ -550,7 +599,17 @@ bool Filter::matches(const char *input, FilterOption contextOption,
 bool Filter::matches(const char *input, int inputLen,
                      FilterOption contextOption, const char *contextDomain,
                      BloomFilter *inputBloomFilter, const char *inputHost, int inputHostLen) {
-    if (!matchesOptions(input, contextOption, contextDomain)) {
+    return matches(input, inputLen, contextOption, contextDomain,
+                   contextDomain ? static_cast<int>(strlen(contextDomain)) : 0,
+                   inputBloomFilter, inputHost, inputHostLen);
+}
+
+bool Filter::matches(const char *input, int inputLen,
+                     FilterOption contextOption,
+                     const char *contextDomain, int contextDomainLen,
+                     BloomFilter *inputBloomFilter, const char *inputHost, int inputHostLen,
+                     bool regexMatched) {
+    if (!matchesOptions(input, contextOption, contextDomain, contextDomainLen)) {
         return false;
     }
 
@@ -563,24 +622,32 @@ bool Filter::matches(const char *input, int inputLen,
         dataLen = static_cast<int>(strlen(data));
     }
 
-    // Check for a regex match
+    // Check for a regex match, unless the regex set already found it
     if (filterType & FTRegex) {
-#ifdef ENABLE_REGEX
-        try {
-            std::regex exp(data, std::regex_constants::ECMAScript);
-            std::string s(input);
-            return std::regex_search(s, exp);
-        } catch (std::regex_error &ignore) {
-            return false;
-        }
-#else
+        return regexMatched || getRegex()->search(input, inputLen);
+    }
+
+    return matchesPattern(filterType, data, dataLen, host, hostLen,
+                          input, inputLen, inputBloomFilter,
+                          inputHost, inputHostLen);
+}
+
+bool Filter::matchesPattern(FilterType filterType,
+                            const char *data, int dataLen,
+                            const char *host, int hostLen,
+                            const char *input, int inputLen,
+                            BloomFilter *inputBloomFilter,
+                            const char *inputHost, int inputHostLen) {
+    if (!data) {
         return false;
-#endif
+    }
+    if (dataLen == -1) {
+        dataLen = static_cast<int>(strlen(data));
     }
 
     // Check for both left and right anchored
     if ((filterType & FTLeftAnchored) && (filterType & FTRightAnchored)) {
-        return !strcmp(data, input);
+        return dataLen == inputLen && !memcmp(data, input, dataLen);
     }
 
     // Check for right anchored
@@ -589,12 +656,12 @@ bool Filter::matches(const char *input, int inputLen,
             return false;
         }
 
-        return !strcmp(input + (inputLen - dataLen), data);
+        return !memcmp(input + (inputLen - dataLen), data, dataLen);
     }
 
     // Check for left anchored
     if (filterType & FTLeftAnchored) {
-        return !strncmp(data, input, dataLen);
+        return dataLen <= inputLen && !memcmp(data, input, dataLen);
     }
 
     // Check for domain name anchored
@@ -602,12 +669,12 @@ bool Filter::matches(const char *input, int inputLen,
         int currentHostLen = inputHostLen;
         const char *currentHost = inputHost;
         if (!currentHostLen) {
-            currentHost = getUrlHost(input, &currentHostLen);
+            currentHost = getUrlHost(input, inputLen, &currentHostLen);
         }
-        int hostLen = 0;
-        if (host) {
-            hostLen = this->hostLen == -1 ?
-                      static_cast<int>(strlen(host)) : this->hostLen;
+        if (!host) {
+            hostLen = 0;
+        } else if (hostLen == -1) {
+            hostLen = static_cast<int>(strlen(host));
         }
 
         if (inputBloomFilter) {
@@ -655,7 +722,7 @@ bool Filter::matches(const char *input, int inputLen,
         filterPartStart = filterPartEnd + 1;
         filterPartEnd = temp;
         index = newIndex + filterPartLen;
-        if (*(input + newIndex) == '\0') {
+        if (newIndex >= inputLen) {
             break;
         }
     }
@@ -663,6 +730,47 @@ bool Filter::matches(const char *input, int inputLen,
     return true;
 }
 
+const Regex *Filter::getRegex() {
+    Regex *compiled = regex.load(std::memory_order_acquire);
+    if (compiled) {
+        return compiled;
+    }
+    std::lock_guard<std::mutex> synchronize(lock);
+    compiled = regex.load(std::memory_order_relaxed);
+    if (!compiled) {
+        compiled = new Regex(data, dataLen);
+        regex.store(compiled, std::memory_order_release);
+    }
+    return compiled;
+}
+
+static size_t allocatedStringSize(const char *str, int len) {
+    if (!str) {
+        return 0;
+    }
+    return (len < 0 ? strlen(str) : static_cast<size_t>(len)) + 1;
+}
+
+size_t Filter::GetAllocatedSize() const {
+    size_t size = 0;
+    if (domains) {
+        size += sizeof(HashSet<ContextDomain>) + domains->GetAllocatedSize();
+    }
+    if (antiDomains) {
+        size += sizeof(HashSet<ContextDomain>) + antiDomains->GetAllocatedSize();
+    }
+    if (const Regex *compiled = regex.load(std::memory_order_acquire)) {
+        size += sizeof(Regex) + compiled->getAllocatedSize();
+    }
+    if (!borrowed_data) {
+        size += allocatedStringSize(data, dataLen)
+                + allocatedStringSize(domainList, -1)
+                + allocatedStringSize(tag, tagLen)
+                + allocatedStringSize(host, hostLen);
+    }
+    return size;
+}
+
 void Filter::parseDomains(const char *domainList) {
     if (!domainList || domainsParsed) {
         return;
@@ -710,129 +818,77 @@ uint64_t Filter::hash() const {
     return h(data, dataLen);
 }
 
+// Serialized filters start with the filter type, the options, the offset
+// and length of the rule text and the lengths of data, host, tag and
+// domain list as little endian uint32, followed by each of these strings
+// NUL terminated. Apart from the data an empty string stands for a
+// missing one. The rule text stays in the rule text of the client, a
+// length of 0xffffffff stands for none. The filter sections use records
+// instead, this is the format of the host anchored hash set items.
+static const uint32_t kSerializedFilterHeaderSize = 9 * 4;
+static const uint32_t kSerializedLengthsOffset = 5 * 4;
+static const int kNumSerializedStrings = 4;
+
 uint32_t Filter::Serialize(char *buffer) const {
-    uint32_t totalSize = 0;
-    char sz[64];
-    uint32_t dataLenSize = 1 + snprintf(sz, sizeof(sz),
-                                        "%x,%x,%x,%x", dataLen, filterType,
-                                        filterOption, antiFilterOption);
-    if (buffer) {
-        memcpy(buffer + totalSize, sz, dataLenSize);
-    }
-    totalSize += dataLenSize;
+    const char *strings[kNumSerializedStrings] = {
+            data, host, tag, domainList
+    };
+    uint32_t lengths[kNumSerializedStrings] = {
+            static_cast<uint32_t>(dataLen > 0 ? dataLen : 0),
+            static_cast<uint32_t>(host ? (hostLen == -1 ? strlen(host) : hostLen) : 0),
+            static_cast<uint32_t>(tag && tagLen > 0 ? tagLen : 0),
+            static_cast<uint32_t>(domainList ? strlen(domainList) : 0)
+    };
+    uint32_t totalSize = kSerializedFilterHeaderSize;
     if (buffer) {
-        memcpy(buffer + totalSize, data, dataLen);
-    }
-    totalSize += dataLen;
-
-    if (host) {
-        int hostLength = this->hostLen == -1 ?
-                         static_cast<int>(strlen(host)) : this->hostLen;
-        if (buffer) {
-            memcpy(buffer + totalSize, host, hostLength + 1);
-        }
-        totalSize += hostLength;
-    }
-    totalSize++;
-
-    // Serialize any kind fo list based data here, as long as you can use a
-    // separator between lists which is not \0.  Currently using #
-    if (tagLen > 0) {
-        if (buffer) {
-            buffer[totalSize] = '~';
-            buffer[totalSize + 1] = '#';
-            memcpy(buffer + totalSize + 2, tag, tagLen);
-            buffer[totalSize + 2 + tagLen] = ',';
-        }
-        totalSize += tagLen + 3;
+        putUint32LE(buffer, filterType);
+        putUint32LE(buffer + 4, filterOption);
+        putUint32LE(buffer + 8, antiFilterOption);
+        putUint32LE(buffer + 12, ruleOffset);
+        putUint32LE(buffer + 16, static_cast<uint32_t>(ruleLen));
     }
-
-    if (domainList) {
-        int domainListLen = static_cast<int>(strlen(domainList));
-        if (buffer) {
-            memcpy(buffer + totalSize, domainList, domainListLen + 1);
-        }
-        totalSize += domainListLen;
-    }
-    totalSize++;
-
-    if (ruleDefinition) {
-        int ruleDefinitionLen = static_cast<int>(strlen(ruleDefinition));
+    for (int i = 0; i < kNumSerializedStrings; i++) {
         if (buffer) {
-            memcpy(buffer + totalSize, ruleDefinition, ruleDefinitionLen + 1);
+            putUint32LE(buffer + kSerializedLengthsOffset + i * 4, lengths[i]);
+            if (lengths[i] > 0) {
+                memcpy(buffer + totalSize, strings[i], lengths[i]);
+            }
+            buffer[totalSize + lengths[i]] = '\0';
         }
-        totalSize += ruleDefinitionLen;
+        totalSize += lengths[i] + 1;
     }
-    totalSize++;
-
     return totalSize;
 }
 
-bool hasNewlineBefore(char *buffer, uint32_t bufferSize) {
-    char *p = buffer;
-    for (uint32_t i = 0; i < bufferSize; ++i) {
-        if (*p == '\0')
-            return true;
-        p++;
-    }
-    return false;
-}
-
 uint32_t Filter::Deserialize(char *buffer, uint32_t bufferSize) {
-    dataLen = 0;
-    if (!hasNewlineBefore(buffer, bufferSize)) {
-        return 0;
-    }
-    sscanf(buffer, "%x,%x,%x,%x", &dataLen, (unsigned int *) &filterType,
-           (unsigned int *) &filterOption, (unsigned int *) &antiFilterOption);
-    uint32_t consumed = static_cast<uint32_t>(strlen(buffer)) + 1;
-    if (consumed + dataLen >= bufferSize) {
+    if (bufferSize < kSerializedFilterHeaderSize) {
         return 0;
     }
-
-    data = buffer + consumed;
-    consumed += dataLen;
-
-    auto hostLength = static_cast<uint32_t>(strlen(buffer + consumed));
-    if (hostLength != 0) {
-        host = buffer + consumed;
-    } else {
-        host = nullptr;
-    }
-    consumed += hostLength + 1;
-
-    // If the domain section starts with a # then we're in a tag
-    // block.
-    if (buffer[consumed] == '~' && buffer[consumed + 1] == '#') {
-        consumed += 2;
-        tag = buffer + consumed;
-        tagLen = 0;
-        while (buffer[consumed + tagLen] != '\0') {
-            if (buffer[consumed + tagLen] == ',') {
-                consumed += tagLen + 1;
-                break;
-            }
-            tagLen++;
+    char *strings[kNumSerializedStrings];
+    uint32_t lengths[kNumSerializedStrings];
+    uint32_t consumed = kSerializedFilterHeaderSize;
+    for (int i = 0; i < kNumSerializedStrings; i++) {
+        lengths[i] = getUint32LE(buffer + kSerializedLengthsOffset + i * 4);
+        // Every string must fit and be terminated, so strlen() stays in bounds
+        if (lengths[i] >= bufferSize - consumed || buffer[consumed + lengths[i]] != '\0') {
+            return 0;
         }
+        strings[i] = buffer + consumed;
+        consumed += lengths[i] + 1;
     }
 
-    auto listSectionLen = static_cast<uint32_t>(strlen(buffer + consumed));
-    if (listSectionLen != 0) {
-        domainList = buffer + consumed;
-        consumed += listSectionLen;
-    } else {
-        domainList = nullptr;
-    }
-    consumed++;
-
-    auto ruleDefinitionLen = static_cast<uint32_t>(strlen(buffer + consumed));
-    if (ruleDefinitionLen != 0) {
-        ruleDefinition = buffer + consumed;
-        consumed += ruleDefinitionLen;
-    } else {
-        ruleDefinition = nullptr;
-    }
-    consumed++;
+    filterType = static_cast<FilterType>(getUint32LE(buffer));
+    filterOption = static_cast<FilterOption>(getUint32LE(buffer + 4));
+    antiFilterOption = static_cast<FilterOption>(getUint32LE(buffer + 8));
+    ruleOffset = getUint32LE(buffer + 12);
+    ruleLen = static_cast<int>(getUint32LE(buffer + 16));
+    data = strings[0];
+    dataLen = static_cast<int>(lengths[0]);
+    host = lengths[1] ? strings[1] : nullptr;
+    hostLen = lengths[1] ? static_cast<int>(lengths[1]) : -1;
+    tag = lengths[2] ? strings[2] : nullptr;
+    tagLen = static_cast<int>(lengths[2]);
+    domainList = lengths[3] ? strings[3] : nullptr;
 
     borrowed_data = true;
     domainsParsed = false;
@@ -848,3 +904,88 @@ uint32_t Filter::Deserialize(char *buffer, uint32_t bufferSize) {
 
     return consumed;
 }
+
+// Records of the filter sections are 12 little endian uint32: the filter
+// type, the options, the offset and length of the rule text like above,
+// the data, host and tag each as its offset in the string table plus one
+// and its length, and the domain list as its offset plus one. An offset
+// field of 0 stands for a missing string. Every record has the same size,
+// so filter i of a section is found without reading the ones before.
+static uint32_t putRecordString(StringTable *stringTable,
+                                const char *str, size_t len) {
+    return str ? stringTable->add(str, len) + 1 : 0;
+}
+
+void putFilterRecord(char *buffer, const Filter &filter,
+                     StringTable *stringTable) {
+    size_t dataLen = 0;
+    if (filter.data) {
+        dataLen = filter.dataLen == -1 ? strlen(filter.data) : filter.dataLen;
+    }
+    size_t hostLen = 0;
+    if (filter.host) {
+        hostLen = filter.hostLen == -1 ? strlen(filter.host) : filter.hostLen;
+    }
+    size_t tagLen = filter.tag && filter.tagLen > 0 ? filter.tagLen : 0;
+    putUint32LE(buffer, filter.filterType);
+    putUint32LE(buffer + 4, filter.filterOption);
+    putUint32LE(buffer + 8, filter.antiFilterOption);
+    putUint32LE(buffer + 12, filter.ruleOffset);
+    putUint32LE(buffer + 16, static_cast<uint32_t>(filter.ruleLen));
+    putUint32LE(buffer + 20, putRecordString(stringTable, filter.data, dataLen));
+    putUint32LE(buffer + 24, static_cast<uint32_t>(dataLen));
+    putUint32LE(buffer + 28, putRecordString(stringTable, filter.host, hostLen));
+    putUint32LE(buffer + 32, static_cast<uint32_t>(hostLen));
+    putUint32LE(buffer + 36, putRecordString(stringTable,
+                                             tagLen > 0 ? filter.tag : nullptr,
+                                             tagLen));
+    putUint32LE(buffer + 40, static_cast<uint32_t>(tagLen));
+    putUint32LE(buffer + 44, filter.domainList
+                             ? stringTable->add(filter.domainList) + 1 : 0);
+}
+
+// Points |str| to the string at |offset| minus one, which has to be |len|
+// chars followed by a NUL
+static bool getRecordString(const char *strings, uint32_t stringsSize,
+                            uint32_t offset, uint32_t len, const char **str) {
+    if (offset == 0) {
+        *str = nullptr;
+        return true;
+    }
+    if (offset - 1 >= stringsSize || len >= stringsSize - (offset - 1)
+        || strings[offset - 1 + len] != '\0') {
+        return false;
+    }
+    *str = strings + offset - 1;
+    return true;
+}
+
+bool getFilterRecord(const char *buffer, const char *strings,
+                     uint32_t stringsSize, FilterRecord *record) {
+    uint32_t dataLen = getUint32LE(buffer + 24);
+    uint32_t hostLen = getUint32LE(buffer + 32);
+    uint32_t tagLen = getUint32LE(buffer + 40);
+    // The table ends with a NUL, so any domain list in it is terminated
+    uint32_t domainListOffset = getUint32LE(buffer + 44);
+    if (!getRecordString(strings, stringsSize, getUint32LE(buffer + 20),
+                         dataLen, &record->data)
+        || !getRecordString(strings, stringsSize, getUint32LE(buffer + 28),
+                            hostLen, &record->host)
+        || !getRecordString(strings, stringsSize, getUint32LE(buffer + 36),
+                            tagLen, &record->tag)
+        || domainListOffset > stringsSize) {
+        return false;
+    }
+    record->filterType = static_cast<FilterType>(getUint32LE(buffer));
+    record->filterOption = static_cast<FilterOption>(getUint32LE(buffer + 4));
+    record->antiFilterOption =
+            static_cast<FilterOption>(getUint32LE(buffer + 8));
+    record->ruleOffset = getUint32LE(buffer + 12);
+    record->ruleLen = static_cast<int>(getUint32LE(buffer + 16));
+    record->dataLen = record->data ? static_cast<int>(dataLen) : -1;
+    record->hostLen = record->host ? static_cast<int>(hostLen) : -1;
+    record->tagLen = record->tag ? static_cast<int>(tagLen) : 0;
+    record->domainList = domainListOffset ? strings + domainListOffset - 1
+                                          : nullptr;
+    return true;
+}
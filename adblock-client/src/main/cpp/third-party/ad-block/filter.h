@@ -13,12 +13,19 @@
 
 #include <stdint.h>
 #include <string.h>
+#include <atomic>
 #include <mutex>
 #include "./base.h"
 #include "./context_domain.h"
 
+class Arena;
+class StringPool;
+class StringTable;
+
 class BloomFilter;
 
+class Regex;
+
 template<typename T>
 class HashSet;
 
@@ -43,6 +50,8 @@ enum FilterType {
     FTExtendedCss = 040000,
     FTListTypesMask = FTException | FTElementHiding | FTElementHidingException | FTExtendedCss
         | FTEmpty | FTComment | FTHTMLFiltering | FTCss | FTCssException | FTScriptlet,
+    FTCosmeticMask = FTElementHiding | FTElementHidingException | FTExtendedCss
+        | FTCss | FTCssException | FTScriptlet,
 };
 
 enum FilterOption {
@@ -98,6 +107,26 @@ enum FilterOption {
                            FOThirdParty | FONotThirdParty
 };
 
+// Size of a filter in the filter sections of the serialized data
+static const uint32_t kFilterRecordSize = 12 * 4;
+
+// A filter as it is stored in a filter section, the strings point into
+// the string table and missing ones are nullptr. See getFilterRecord().
+struct FilterRecord {
+    FilterType filterType;
+    FilterOption filterOption;
+    FilterOption antiFilterOption;
+    uint32_t ruleOffset;
+    int ruleLen;
+    const char *data;
+    int dataLen;
+    const char *host;
+    int hostLen;
+    const char *tag;
+    int tagLen;
+    const char *domainList;
+};
+
 class Filter {
     friend class AdBlockClient;
 
@@ -106,6 +135,9 @@ public:
 
     Filter(const Filter &other);
 
+    // Borrows the strings of |record|
+    explicit Filter(const FilterRecord &record);
+
     Filter(const char *data, int dataLen, char *domainList = nullptr,
            const char *host = nullptr, int hostLen = -1,
            char *tag = nullptr, int tagLen = 0);
@@ -131,6 +163,18 @@ public:
                  BloomFilter *inputBloomFilter = nullptr,
                  const char *inputHost = nullptr, int inputHostLen = 0);
 
+    // Same as above with the length of |contextDomain| known. Only the
+    // first |inputLen| chars of |input| are read, it needn't be NUL
+    // terminated. |regexMatched| tells a regex filter that its regex is
+    // known to be in the input, e.g. found by a RegexSet, so it isn't
+    // searched again.
+    bool matches(const char *input, int inputLen,
+                 FilterOption contextOption,
+                 const char *contextDomain, int contextDomainLen,
+                 BloomFilter *inputBloomFilter,
+                 const char *inputHost, int inputHostLen,
+                 bool regexMatched = false);
+
     bool matches(const char *input, FilterOption contextOption = FONoFilterOption,
                  const char *contextDomain = nullptr,
                  BloomFilter *inputBloomFilter = nullptr,
@@ -139,15 +183,40 @@ public:
     // Nothing needs to be updated when a filter is added multiple times
     void Update(const Filter &) {}
 
+    // Bytes allocated for the parsed domains, the compiled regex and the
+    // strings unless they're borrowed
+    size_t GetAllocatedSize() const;
+
     bool hasUnsupportedOptions() const;
 
     bool isValid() const;
 
     // Checks to see if the filter options match for the passed in data
+    // A |contextDomainLen| of -1 means |contextDomain| is NUL terminated
     bool matchesOptions(const char *input, FilterOption contextOption,
-                        const char *contextDomain = nullptr);
-
-    void parseOptions(const char *input);
+                        const char *contextDomain = nullptr,
+                        int contextDomainLen = -1);
+
+    // The checks of matchesOptions() which need no parsed domains: the
+    // unsupported, document, resource type and third-party options
+    static bool matchesOptionFlags(FilterOption filterOption,
+                                   FilterOption antiFilterOption,
+                                   FilterOption contextOption);
+
+    // The pattern check of matches() for filters which aren't regexes, so
+    // a record can be matched without building a filter. A |dataLen| or
+    // |hostLen| of -1 means the string is NUL terminated.
+    static bool matchesPattern(FilterType filterType,
+                               const char *data, int dataLen,
+                               const char *host, int hostLen,
+                               const char *input, int inputLen,
+                               BloomFilter *inputBloomFilter,
+                               const char *inputHost, int inputHostLen);
+
+    // Option strings are allocated from |arena| if given, a domain list
+    // is shared through |stringPool| if given
+    void parseOptions(const char *input, Arena *arena = nullptr,
+                      StringPool *stringPool = nullptr);
 
     // Checks to see if the specified context domain is in the
     // domain (or antiDomain) list.
@@ -215,8 +284,12 @@ public:
     FilterOption filterOption;
     FilterOption antiFilterOption;
 
-    // The text of the filter list rule, as it appeared before being parsed.
-    char *ruleDefinition;
+    // Where the text of the filter list rule, as it appeared before being
+    // parsed, is in the rule text of the owning AdBlockClient, see
+    // AdBlockClient::getRuleDefinition(). |ruleLen| is -1 if the text
+    // wasn't preserved.
+    uint32_t ruleOffset;
+    int ruleLen;
 
     char *data;
     int dataLen;
@@ -230,24 +303,46 @@ public:
     HashSet<ContextDomain> *domains;
     HashSet<ContextDomain> *antiDomains;
     bool domainsParsed;
+    // Index of the regex in the owning AdBlockClient's RegexSet or -1 if
+    // the regex isn't part of it.
+    int regexSetId;
 
 protected:
     // Fills |domains| and |antiDomains| sets
     void parseDomains(const char *domainList);
 
-    bool contextDomainMatchesFilter(const char *contextDomain);
+    bool contextDomainMatchesFilter(const char *contextDomain, int contextDomainLen);
 
     // Parses a single option
-    void parseOption(const char *input, int len);
+    void parseOption(const char *input, int len, Arena *arena,
+                     StringPool *stringPool);
+
+    // Lazily compiles the regex of a FTRegex filter
+    const Regex *getRegex();
 
     std::mutex lock;
+    std::atomic<Regex *> regex;
 };
 
+// Writes |filter| as a record of kFilterRecordSize bytes into |buffer|,
+// its strings are added to |stringTable|
+void putFilterRecord(char *buffer, const Filter &filter,
+                     StringTable *stringTable);
+
+// Reads the record at |buffer| whose strings are in the |stringsSize|
+// bytes of |strings|, which end with a NUL. Returns false if a string of
+// the record is out of bounds.
+bool getFilterRecord(const char *buffer, const char *strings,
+                     uint32_t stringsSize, FilterRecord *record);
+
 bool isThirdPartyHost(const char *baseContextHost,
                       int baseContextHostLen,
                       const char *testHost,
                       int testHostLen);
 
+// Rule text of matched filters which were parsed without preserveRules
+extern char ruleDefinitionFallback[];
+
 static inline bool isEndOfLine(char c) {
     return c == '\r' || c == '\n';
 }
@@ -0,0 +1,59 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "./filter_list.h"
+
+#include <new>
+
+FilterList::FilterList() : records(nullptr), size(0), strings(nullptr),
+                           stringsSize(0) {
+}
+
+bool FilterList::init(const char *records, uint32_t size,
+                      const char *strings, uint32_t stringsSize) {
+    clear();
+    if (size % kFilterRecordSize != 0
+        || (stringsSize > 0 && strings[stringsSize - 1] != '\0')) {
+        return false;
+    }
+    this->records = records;
+    this->size = static_cast<int>(size / kFilterRecordSize);
+    this->strings = strings;
+    this->stringsSize = stringsSize;
+    filters.Reset(static_cast<uint32_t>(this->size));
+    return true;
+}
+
+void FilterList::clear() {
+    filters.Reset(0);
+    records = nullptr;
+    size = 0;
+    strings = nullptr;
+    stringsSize = 0;
+}
+
+bool FilterList::getRecord(int index, FilterRecord *record) const {
+    return getFilterRecord(records + index * kFilterRecordSize, strings,
+                           stringsSize, record);
+}
+
+Filter *FilterList::getFilter(int index) {
+    return filters.Get(static_cast<uint32_t>(index), [this, index](void *room) {
+        FilterRecord record;
+        if (getRecord(index, &record)) {
+            new (room) Filter(record);
+        } else {
+            new (room) Filter();
+        }
+    });
+}
+
+bool FilterList::indexOf(const Filter *filter, int *index) const {
+    uint32_t found;
+    if (!filters.IndexOf(filter, &found)) {
+        return false;
+    }
+    *index = static_cast<int>(found);
+    return true;
+}
@@ -0,0 +1,77 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef FILTER_LIST_H_
+#define FILTER_LIST_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "./base.h"
+#include "./filter.h"
+#include "../hashset-cpp/lazy_items.h"
+
+/**
+ * A filter section used in place, e.g. straight from the mapped data.
+ * Matching reads the records where they are, a Filter is only built for
+ * a record which needs runtime state: its compiled regex, its parsed
+ * domains or its id in the RegexSet. Built filters are kept in a side
+ * table at the index of their record, so they keep their address until
+ * the list is initialized again and the index can be told from it.
+ *
+ * getFilter() is safe to call from several threads, init() and clear()
+ * are not.
+ */
+class FilterList {
+public:
+    FilterList();
+
+    // Uses the |size| bytes of |records|, which have to be whole records,
+    // with their strings in the |stringsSize| bytes of |strings|, which
+    // end with a NUL. Both have to outlive the list. Returns false and
+    // leaves the list empty otherwise.
+    bool init(const char *records, uint32_t size,
+              const char *strings, uint32_t stringsSize);
+
+    void clear();
+
+    int getSize() const {
+        return size;
+    }
+
+    const char *getRecords() const {
+        return records;
+    }
+
+    uint32_t getRecordsSize() const {
+        return static_cast<uint32_t>(size) * kFilterRecordSize;
+    }
+
+    // Reads record |index|, returns false if it's damaged
+    bool getRecord(int index, FilterRecord *record) const;
+
+    // The filter of record |index|, built the first time it's asked for.
+    // A damaged record gives an empty filter which matches nothing.
+    Filter *getFilter(int index);
+
+    // Finds the index of |filter| if getFilter() returned it
+    bool indexOf(const Filter *filter, int *index) const;
+
+    // Bytes allocated for the side table and the filters built so far
+    size_t getAllocatedSize() const {
+        return filters.GetAllocatedSize();
+    }
+
+private:
+    FilterList(const FilterList &) = delete;
+
+    FilterList &operator=(const FilterList &) = delete;
+
+    const char *records;
+    int size;
+    const char *strings;
+    uint32_t stringsSize;
+    LazyItems<Filter> filters;
+};
+
+#endif  // FILTER_LIST_H_
@@ -0,0 +1,81 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "./fingerprint_optimizer.h"
+#include <string.h>
+#include <stdlib.h>
+
+FingerprintOptimizer::FingerprintOptimizer(int fingerprintSize,
+                                           int numBuckets) :
+        fingerprintSize(fingerprintSize),
+        counts(numBuckets > 0 ? numBuckets : 1, 0),
+        numWindows(0) {
+}
+
+uint32_t FingerprintOptimizer::bucketFor(const char *ngram) const {
+    // FNV-1a
+    uint64_t hash = 14695981039346656037ULL;
+    for (int i = 0; i < fingerprintSize; i++) {
+        hash ^= static_cast<unsigned char>(ngram[i]);
+        hash *= 1099511628211ULL;
+    }
+    return static_cast<uint32_t>(hash % counts.size());
+}
+
+void FingerprintOptimizer::addUrl(const char *url, int urlLen) {
+    for (int i = 0; i + fingerprintSize <= urlLen; i++) {
+        uint32_t &count = counts[bucketFor(url + i)];
+        if (count != UINT32_MAX) {
+            count++;
+        }
+        numWindows++;
+    }
+}
+
+void FingerprintOptimizer::addUrl(const char *url) {
+    addUrl(url, static_cast<int>(strlen(url)));
+}
+
+void FingerprintOptimizer::addNgram(const char *ngram, int ngramLen,
+                                    uint32_t count) {
+    if (ngramLen != fingerprintSize) {
+        return;
+    }
+    uint32_t &current = counts[bucketFor(ngram)];
+    current = UINT32_MAX - current < count ? UINT32_MAX : current + count;
+    numWindows += count;
+}
+
+bool FingerprintOptimizer::loadStats(const char *buffer) {
+    const char *p = buffer;
+    while (*p != '\0') {
+        const char *lineEnd = p;
+        while (*lineEnd != '\0' && *lineEnd != '\n') {
+            lineEnd++;
+        }
+        if (lineEnd != p && *p != '#') {
+            const char *tab = p;
+            while (tab != lineEnd && *tab != '\t') {
+                tab++;
+            }
+            if (tab == lineEnd) {
+                return false;
+            }
+            char *countEnd;
+            unsigned long count = strtoul(tab + 1, &countEnd, 10);  // NOLINT
+            if (countEnd == tab + 1) {
+                return false;
+            }
+            addNgram(p, static_cast<int>(tab - p),
+                     count > UINT32_MAX ? UINT32_MAX :
+                     static_cast<uint32_t>(count));
+        }
+        p = *lineEnd == '\0' ? lineEnd : lineEnd + 1;
+    }
+    return true;
+}
+
+uint32_t FingerprintOptimizer::getCount(const char *ngram) const {
+    return counts[bucketFor(ngram)];
+}
@@ -0,0 +1,60 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef FINGERPRINT_OPTIMIZER_H_
+#define FINGERPRINT_OPTIMIZER_H_
+
+#include <stdint.h>
+#include <vector>
+#include "./base.h"
+
+/**
+ * Keeps n-gram frequencies of a URL corpus so a filter can be given the
+ * window which the fewest URLs contain as its fingerprint, instead of the
+ * first usable one. Rare fingerprints mean fewer bloom filter hits on
+ * clean URLs and so fewer manual scans of the filter list.
+ *
+ * Counts are kept in a fixed size table indexed by the n-gram hash, a
+ * collision can only make an n-gram look more common than it is.
+ */
+class FingerprintOptimizer {
+public:
+    static const int kDefaultNumBuckets = 1 << 18;
+
+    explicit FingerprintOptimizer(int fingerprintSize,
+                                  int numBuckets = kDefaultNumBuckets);
+
+    int getFingerprintSize() const {
+        return fingerprintSize;
+    }
+
+    // Counts every fingerprint sized window of the url
+    void addUrl(const char *url, int urlLen);
+
+    void addUrl(const char *url);
+
+    // Adds a precomputed count for an n-gram of the fingerprint size
+    void addNgram(const char *ngram, int ngramLen, uint32_t count);
+
+    // Loads n-gram statistics with one "<ngram>\t<count>" entry per line,
+    // lines with an n-gram of another size are skipped.
+    // Returns false if the buffer is malformed.
+    bool loadStats(const char *buffer);
+
+    uint32_t getCount(const char *ngram) const;
+
+    // Number of windows seen in the corpus
+    uint64_t getNumWindows() const {
+        return numWindows;
+    }
+
+private:
+    uint32_t bucketFor(const char *ngram) const;
+
+    int fingerprintSize;
+    std::vector<uint32_t> counts;
+    uint64_t numWindows;
+};
+
+#endif  // FINGERPRINT_OPTIMIZER_H_
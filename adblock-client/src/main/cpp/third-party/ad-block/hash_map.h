@@ -32,6 +32,18 @@ public:
         return _key->GetHash();
     }
 
+    // The key and value with what they allocate
+    size_t GetAllocatedSize() const {
+        size_t size = 0;
+        if (_key) {
+            size += sizeof(K) + _key->GetAllocatedSize();
+        }
+        if (_value) {
+            size += sizeof(V) + _value->GetAllocatedSize();
+        }
+        return size;
+    }
+
     bool operator==(const MapNode<K, V> &keyValue) const {
         return *_key == *keyValue._key;
     }
@@ -44,50 +56,28 @@ public:
         // do nothing
     }
 
+    // Serialized as the key followed by the value
     uint32_t Serialize(char *buffer) {
-        int totalSize = 0;
-        char printBuffer[128];
-        int keySize = _key->Serialize(nullptr);
-        int valueSize = _value->Serialize(nullptr);
-
-        int printLen = 1 + snprintf(printBuffer, sizeof(printBuffer), "%x,%x", keySize, valueSize);
-        if (buffer) {
-            memcpy(buffer, printBuffer, printLen);
-        }
-        totalSize += printLen;
-
-        if (buffer) {
-            _key->Serialize(buffer + totalSize);
-        }
-        totalSize += keySize;
-
-        if (buffer) {
-            _value->Serialize(buffer + totalSize);
-        }
-        totalSize += valueSize;
-
+        uint32_t totalSize = _key->Serialize(buffer);
+        totalSize += _value->Serialize(buffer ? buffer + totalSize : nullptr);
         return totalSize;
     }
 
     uint32_t Deserialize(char *buffer, uint32_t buffer_size) {
-        int pos = 0;
-        int keySize = 0;
-        int valueSize = 0;
-        sscanf(buffer, "%x,%x", &keySize, &valueSize);
-        pos += static_cast<uint32_t>(strlen(buffer)) + 1;
-
         delete _key;
         delete _value;
         _key = new K();
         _value = new V();
 
-        _key->Deserialize(buffer + pos, buffer_size);
-        pos += keySize;
-
-        _value->Deserialize(buffer + pos, buffer_size);
-        pos += valueSize;
-
-        return pos;
+        uint32_t keySize = _key->Deserialize(buffer, buffer_size);
+        if (keySize == 0) {
+            return 0;
+        }
+        uint32_t valueSize = _value->Deserialize(buffer + keySize, buffer_size - keySize);
+        if (valueSize == 0) {
+            return 0;
+        }
+        return keySize + valueSize;
     }
 
 private:
@@ -0,0 +1,138 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "./latency_stats.h"
+
+#include <stdio.h>
+#include <algorithm>
+#include <chrono>
+
+static const char *kPhaseNames[LPNumPhases] = {
+        "urlParse",
+        "domainOnlyScan",
+        "bloomProbe",
+        "hostAnchoredLookup",
+        "filterScan",
+        "exceptionPipeline",
+        "matches",
+        "elementHidingSelectors",
+        "extendedCssSelectors",
+        "cssRules",
+        "scriptlets"
+};
+
+LatencyHistogram::LatencyHistogram() {
+    reset();
+}
+
+void LatencyHistogram::record(uint64_t nanos) {
+    buckets[getBucket(nanos)].fetch_add(1, std::memory_order_relaxed);
+    count.fetch_add(1, std::memory_order_relaxed);
+    sum.fetch_add(nanos, std::memory_order_relaxed);
+    uint64_t previous = max.load(std::memory_order_relaxed);
+    while (nanos > previous
+           && !max.compare_exchange_weak(previous, nanos, std::memory_order_relaxed)) {
+    }
+}
+
+void LatencyHistogram::reset() {
+    for (int i = 0; i < kNumBuckets; i++) {
+        buckets[i].store(0, std::memory_order_relaxed);
+    }
+    count.store(0, std::memory_order_relaxed);
+    sum.store(0, std::memory_order_relaxed);
+    max.store(0, std::memory_order_relaxed);
+}
+
+int LatencyHistogram::getBucket(uint64_t nanos) {
+    if (nanos < kSubBuckets) {
+        return static_cast<int>(nanos);
+    }
+    int exponent = 63 - __builtin_clzll(nanos);
+    int subBucket = static_cast<int>(nanos >> (exponent - kSubBucketBits)) - kSubBuckets;
+    int bucket = (exponent - kSubBucketBits + 1) * kSubBuckets + subBucket;
+    return bucket < kNumBuckets ? bucket : kNumBuckets - 1;
+}
+
+uint64_t LatencyHistogram::getBucketLowerBound(int bucket) {
+    if (bucket < kSubBuckets) {
+        return static_cast<uint64_t>(bucket);
+    }
+    int exponent = bucket / kSubBuckets + kSubBucketBits - 1;
+    uint64_t subBucket = static_cast<uint64_t>(bucket % kSubBuckets);
+    return (kSubBuckets + subBucket) << (exponent - kSubBucketBits);
+}
+
+uint64_t LatencyHistogram::getPercentile(double percentile) const {
+    uint64_t total = getCount();
+    if (total == 0) {
+        return 0;
+    }
+    auto rank = static_cast<uint64_t>(percentile / 100 * total);
+    uint64_t seen = 0;
+    for (int i = 0; i < kNumBuckets - 1; i++) {
+        seen += getBucketCount(i);
+        if (seen > rank) {
+            return std::min(getBucketLowerBound(i + 1) - 1, getMax());
+        }
+    }
+    return getMax();
+}
+
+void LatencyStats::reset() {
+    for (LatencyHistogram &histogram : histograms) {
+        histogram.reset();
+    }
+}
+
+std::string LatencyStats::toJson() const {
+    std::string json = "{\"phases\":[";
+    char buffer[256];
+    bool first = true;
+    for (int i = 0; i < LPNumPhases; i++) {
+        const LatencyHistogram &histogram = histograms[i];
+        if (histogram.getCount() == 0) {
+            continue;
+        }
+        if (!first) {
+            json.push_back(',');
+        }
+        first = false;
+        snprintf(buffer, sizeof(buffer),
+                 "{\"name\":\"%s\",\"count\":%llu,\"sumNanos\":%llu,\"maxNanos\":%llu,"
+                 "\"p50\":%llu,\"p90\":%llu,\"p99\":%llu,\"buckets\":[",
+                 kPhaseNames[i],
+                 static_cast<unsigned long long>(histogram.getCount()),
+                 static_cast<unsigned long long>(histogram.getSum()),
+                 static_cast<unsigned long long>(histogram.getMax()),
+                 static_cast<unsigned long long>(histogram.getPercentile(50)),
+                 static_cast<unsigned long long>(histogram.getPercentile(90)),
+                 static_cast<unsigned long long>(histogram.getPercentile(99)));
+        json.append(buffer);
+        bool firstBucket = true;
+        for (int bucket = 0; bucket < LatencyHistogram::kNumBuckets; bucket++) {
+            uint64_t count = histogram.getBucketCount(bucket);
+            if (count == 0) {
+                continue;
+            }
+            snprintf(buffer, sizeof(buffer), "%s[%llu,%llu]", firstBucket ? "" : ",",
+                     static_cast<unsigned long long>(LatencyHistogram::getBucketLowerBound(bucket)),
+                     static_cast<unsigned long long>(count));
+            json.append(buffer);
+            firstBucket = false;
+        }
+        json.append("]}");
+    }
+    json.append("]}");
+    return json;
+}
+
+const char *LatencyStats::getPhaseName(LatencyPhase phase) {
+    return kPhaseNames[phase];
+}
+
+uint64_t LatencyStats::now() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+}
@@ -0,0 +1,153 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef LATENCY_STATS_H_
+#define LATENCY_STATS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include "./base.h"
+
+// Timed phases of AdBlockClient::matches() and the cosmetic getters
+enum LatencyPhase {
+    // Protocol check, host, party and the bloom filter of the input
+    LPUrlParse,
+    // Filters which only apply on some domains or all but some
+    LPDomainOnlyScan,
+    LPBloomProbe,
+    LPHostAnchoredLookup,
+    // Filters the bloom filter didn't rule out and those without fingerprint
+    LPFilterScan,
+    // Everything for the exception filters
+    LPExceptionPipeline,
+    // Whole calls
+    LPMatches,
+    LPElementHidingSelectors,
+    LPExtendedCssSelectors,
+    LPCssRules,
+    LPScriptlets,
+    LPNumPhases
+};
+
+/**
+ * Histogram of durations in nanoseconds with log-linear buckets, the values
+ * below kSubBuckets have a bucket each and every power of two above is split
+ * into kSubBuckets buckets, so a bucket is at most 1 / kSubBuckets of its
+ * values wide. Recording is lock free and may run on several threads.
+ */
+class LatencyHistogram {
+public:
+    static const int kSubBucketBits = 3;
+    static const int kSubBuckets = 1 << kSubBucketBits;
+    // Up to 2^34ns, longer durations are counted in the last bucket
+    static const int kNumBuckets = 256;
+
+    LatencyHistogram();
+
+    void record(uint64_t nanos);
+
+    void reset();
+
+    static int getBucket(uint64_t nanos);
+
+    // Smallest duration counted in |bucket|
+    static uint64_t getBucketLowerBound(int bucket);
+
+    uint64_t getCount() const {
+        return count.load(std::memory_order_relaxed);
+    }
+
+    uint64_t getBucketCount(int bucket) const {
+        return buckets[bucket].load(std::memory_order_relaxed);
+    }
+
+    // Upper bound of the bucket holding the |percentile| percent value, at
+    // most the largest recorded one
+    uint64_t getPercentile(double percentile) const;
+
+    uint64_t getSum() const {
+        return sum.load(std::memory_order_relaxed);
+    }
+
+    uint64_t getMax() const {
+        return max.load(std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<uint64_t> buckets[kNumBuckets];
+    std::atomic<uint64_t> count;
+    std::atomic<uint64_t> sum;
+    std::atomic<uint64_t> max;
+};
+
+// A histogram per LatencyPhase
+class LatencyStats {
+public:
+    void record(LatencyPhase phase, uint64_t nanos) {
+        histograms[phase].record(nanos);
+    }
+
+    const LatencyHistogram &getHistogram(LatencyPhase phase) const {
+        return histograms[phase];
+    }
+
+    void reset();
+
+    // Writes the stats as JSON, an object with an array "phases" of the
+    // histograms which recorded anything. Each has its "name", "count",
+    // "sumNanos", "maxNanos", "p50", "p90", "p99" and "buckets", pairs of
+    // lower bound and count of the buckets which aren't empty.
+    std::string toJson() const;
+
+    static const char *getPhaseName(LatencyPhase phase);
+
+    // Monotonic clock
+    static uint64_t now();
+
+private:
+    LatencyHistogram histograms[LPNumPhases];
+};
+
+/**
+ * Records the time from its construction until it's destroyed for |phase|,
+ * unless |stats| is nullptr.
+ */
+class LatencyTimer {
+public:
+    LatencyTimer(LatencyStats *stats, LatencyPhase phase)
+            : stats(stats), phase(phase), start(stats ? LatencyStats::now() : 0),
+              lapStart(start) {
+    }
+
+    ~LatencyTimer() {
+        if (stats) {
+            stats->record(phase, LatencyStats::now() - start);
+        }
+    }
+
+    // Records the time since the construction or the previous lap() for
+    // |lapPhase|, the whole time is still recorded for the phase of the
+    // timer when it's destroyed
+    void lap(LatencyPhase lapPhase) {
+        if (stats) {
+            uint64_t time = LatencyStats::now();
+            stats->record(lapPhase, time - lapStart);
+            lapStart = time;
+        }
+    }
+
+private:
+    LatencyTimer(const LatencyTimer &) = delete;
+
+    LatencyTimer &operator=(const LatencyTimer &) = delete;
+
+    LatencyStats *stats;
+    LatencyPhase phase;
+    uint64_t start;
+    uint64_t lapStart;
+};
+
+#endif  // LATENCY_STATS_H_
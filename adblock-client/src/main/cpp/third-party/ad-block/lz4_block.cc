@@ -0,0 +1,178 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include <string.h>
+#include "./lz4_block.h"
+
+namespace {
+
+const int kHashBits = 14;
+const uint32_t kMinMatch = 4;
+// The format requires the last 5 bytes to be literals and the last match
+// to start at least 12 bytes before the end
+const uint32_t kLastLiterals = 5;
+const uint32_t kMatchStartLimit = 12;
+const uint32_t kMaxOffset = 65535;
+
+inline uint32_t read32(const unsigned char *p) {
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+inline uint32_t hash4(uint32_t value) {
+    return (value * 2654435761u) >> (32 - kHashBits);
+}
+
+unsigned char *writeLength(unsigned char *op, uint32_t len) {
+    while (len >= 255) {
+        *op++ = 255;
+        len -= 255;
+    }
+    *op++ = static_cast<unsigned char>(len);
+    return op;
+}
+
+// Writes the literals followed by a match of |matchLen| bytes at |offset|,
+// the last sequence of a block has literals only and |matchLen| 0
+unsigned char *writeSequence(unsigned char *op, const unsigned char *literals,
+                             uint32_t numLiterals, uint32_t offset, uint32_t matchLen) {
+    unsigned char *token = op++;
+    *token = static_cast<unsigned char>((numLiterals < 15 ? numLiterals : 15) << 4);
+    if (numLiterals >= 15) {
+        op = writeLength(op, numLiterals - 15);
+    }
+    memcpy(op, literals, numLiterals);
+    op += numLiterals;
+    if (matchLen == 0) {
+        return op;
+    }
+    *op++ = static_cast<unsigned char>(offset);
+    *op++ = static_cast<unsigned char>(offset >> 8);
+    uint32_t len = matchLen - kMinMatch;
+    *token |= static_cast<unsigned char>(len < 15 ? len : 15);
+    if (len >= 15) {
+        op = writeLength(op, len - 15);
+    }
+    return op;
+}
+
+// Adds the length bytes following a token nibble of 15 to |len|, fails
+// when the input ends or the length exceeds |limit|
+bool readLength(const unsigned char **ip, const unsigned char *ipEnd,
+                uint32_t limit, uint32_t *len) {
+    unsigned char b;
+    do {
+        if (*ip >= ipEnd) {
+            return false;
+        }
+        b = *(*ip)++;
+        *len += b;
+        if (*len > limit) {
+            return false;
+        }
+    } while (b == 255);
+    return true;
+}
+
+}  // namespace
+
+uint32_t lz4Compress(const char *src, uint32_t len, char *dst) {
+    auto *base = reinterpret_cast<const unsigned char *>(src);
+    const unsigned char *ip = base;
+    const unsigned char *anchor = base;
+    const unsigned char *end = base + len;
+    auto *op = reinterpret_cast<unsigned char *>(dst);
+
+    if (len > kMatchStartLimit) {
+        const unsigned char *matchLimit = end - kLastLiterals;
+        const unsigned char *searchEnd = end - kMatchStartLimit;
+        auto *table = new uint32_t[1 << kHashBits];
+        memset(table, 0, sizeof(uint32_t) << kHashBits);
+        while (ip <= searchEnd) {
+            uint32_t h = hash4(read32(ip));
+            const unsigned char *ref = base + table[h];
+            table[h] = static_cast<uint32_t>(ip - base);
+            if (ref >= ip || ip - ref > kMaxOffset || read32(ref) != read32(ip)) {
+                // Skip faster through data which doesn't compress
+                ip += 1 + ((ip - anchor) >> 6);
+                continue;
+            }
+            while (ip > anchor && ref > base && ip[-1] == ref[-1]) {
+                ip--;
+                ref--;
+            }
+            const unsigned char *matchEnd = ip + kMinMatch;
+            const unsigned char *r = ref + kMinMatch;
+            while (matchEnd < matchLimit && *matchEnd == *r) {
+                matchEnd++;
+                r++;
+            }
+            op = writeSequence(op, anchor, static_cast<uint32_t>(ip - anchor),
+                               static_cast<uint32_t>(ip - ref),
+                               static_cast<uint32_t>(matchEnd - ip));
+            ip = matchEnd;
+            anchor = ip;
+        }
+        delete[] table;
+    }
+
+    op = writeSequence(op, anchor, static_cast<uint32_t>(end - anchor), 0, 0);
+    return static_cast<uint32_t>(op - reinterpret_cast<unsigned char *>(dst));
+}
+
+bool lz4Decompress(const char *src, uint32_t len, char *dst, uint32_t dstLen) {
+    auto *ip = reinterpret_cast<const unsigned char *>(src);
+    const unsigned char *ipEnd = ip + len;
+    auto *base = reinterpret_cast<unsigned char *>(dst);
+    unsigned char *op = base;
+    unsigned char *opEnd = base + dstLen;
+
+    while (ip < ipEnd) {
+        unsigned char token = *ip++;
+        uint32_t numLiterals = token >> 4;
+        if (numLiterals == 15 && !readLength(&ip, ipEnd, dstLen, &numLiterals)) {
+            return false;
+        }
+        if (numLiterals > static_cast<uint32_t>(ipEnd - ip)
+            || numLiterals > static_cast<uint32_t>(opEnd - op)) {
+            return false;
+        }
+        memcpy(op, ip, numLiterals);
+        op += numLiterals;
+        ip += numLiterals;
+        if (ip == ipEnd) {
+            // The last sequence has no match
+            return op == opEnd;
+        }
+
+        if (ipEnd - ip < 2) {
+            return false;
+        }
+        uint32_t offset = ip[0] | static_cast<uint32_t>(ip[1]) << 8;
+        ip += 2;
+        if (offset == 0 || offset > static_cast<uint32_t>(op - base)) {
+            return false;
+        }
+        uint32_t matchLen = token & 15;
+        if (matchLen == 15 && !readLength(&ip, ipEnd, dstLen, &matchLen)) {
+            return false;
+        }
+        matchLen += kMinMatch;
+        if (matchLen > static_cast<uint32_t>(opEnd - op)) {
+            return false;
+        }
+        const unsigned char *ref = op - offset;
+        if (offset >= matchLen) {
+            memcpy(op, ref, matchLen);
+            op += matchLen;
+        } else {
+            // Overlapping matches repeat the last |offset| bytes
+            for (uint32_t i = 0; i < matchLen; i++) {
+                *op++ = *ref++;
+            }
+        }
+    }
+    return false;
+}
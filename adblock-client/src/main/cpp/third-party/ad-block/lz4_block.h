@@ -0,0 +1,28 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+// Compressor and decompressor for the LZ4 block format, used for the
+// engine sections which are stored compressed. The output can be read by
+// any LZ4 block decoder, the compressor is a plain single pass greedy one
+// which trades ratio for speed.
+
+#ifndef LZ4_BLOCK_H_
+#define LZ4_BLOCK_H_
+
+#include <stdint.h>
+
+// Largest compressed size of |len| bytes
+inline uint32_t lz4CompressBound(uint32_t len) {
+    return len + len / 255 + 16;
+}
+
+// Compresses |len| bytes of |src| into |dst| which has room for
+// lz4CompressBound(len) bytes, returns the compressed size
+uint32_t lz4Compress(const char *src, uint32_t len, char *dst);
+
+// Decompresses |len| bytes of |src| which have to expand to exactly
+// |dstLen| bytes of |dst|, returns false for malformed input
+bool lz4Decompress(const char *src, uint32_t len, char *dst, uint32_t dstLen);
+
+#endif  // LZ4_BLOCK_H_
@@ -0,0 +1,40 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "./mapped_file.h"
+
+MappedFile *MappedFile::open(const char *path) {
+    int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return nullptr;
+    }
+    MappedFile *file = openFd(fd);
+    // The mapping keeps its own reference to the file
+    close(fd);
+    return file;
+}
+
+MappedFile *MappedFile::openFd(int fd) {
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        return nullptr;
+    }
+    size_t size = static_cast<size_t>(st.st_size);
+    void *data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+        return nullptr;
+    }
+    return new MappedFile(static_cast<const char *>(data), size);
+}
+
+MappedFile::MappedFile(const char *data, size_t size) : data(data), size(size) {
+}
+
+MappedFile::~MappedFile() {
+    munmap(const_cast<char *>(data), size);
+}
@@ -0,0 +1,49 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef MAPPED_FILE_H_
+#define MAPPED_FILE_H_
+
+#include <stddef.h>
+#include "./base.h"
+
+/**
+ * A file mapped read only into memory. The pages come from the kernel page
+ * cache, so they are only read from disk when first touched and are shared
+ * by every process mapping the same file.
+ *
+ * The mapping stays valid if the file is deleted or replaced by a rename,
+ * but not if the file is truncated or rewritten in place.
+ */
+class MappedFile {
+public:
+    // Maps |path|, returns nullptr if it can't be opened or is empty
+    static MappedFile *open(const char *path);
+
+    // Maps the whole file |fd| refers to, the descriptor can be closed
+    // afterwards. Returns nullptr if it can't be mapped or is empty.
+    static MappedFile *openFd(int fd);
+
+    ~MappedFile();
+
+    const char *getData() const {
+        return data;
+    }
+
+    size_t getSize() const {
+        return size;
+    }
+
+private:
+    MappedFile(const char *data, size_t size);
+
+    MappedFile(const MappedFile &) = delete;
+
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    const char *data;
+    size_t size;
+};
+
+#endif  // MAPPED_FILE_H_
@@ -0,0 +1,64 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "./memory_report.h"
+
+#include <stdio.h>
+
+size_t MemoryReport::getHeapBytes() const {
+    size_t bytes = 0;
+    for (const StructureUsage &usage : structures) {
+        bytes += usage.heapBytes;
+    }
+    return bytes;
+}
+
+// The names are member names, so they're written without escaping
+std::string MemoryReport::toJson() const {
+    char buffer[128];
+    std::string json;
+    snprintf(buffer, sizeof(buffer), "{\"heapBytes\":%zu,\"deserializedBytes\":%zu",
+             getHeapBytes(), deserializedBytes);
+    json.append(buffer);
+
+    json.append(",\"structures\":[");
+    for (size_t i = 0; i < structures.size(); i++) {
+        const StructureUsage &usage = structures[i];
+        snprintf(buffer, sizeof(buffer),
+                 "%s{\"name\":\"", i > 0 ? "," : "");
+        json.append(buffer).append(usage.name);
+        snprintf(buffer, sizeof(buffer),
+                 "\",\"count\":%zu,\"heapBytes\":%zu}", usage.count, usage.heapBytes);
+        json.append(buffer);
+    }
+
+    json.append("],\"hashSets\":[");
+    for (size_t i = 0; i < hashSets.size(); i++) {
+        const HashSetUsage &usage = hashSets[i];
+        snprintf(buffer, sizeof(buffer), "%s{\"name\":\"", i > 0 ? "," : "");
+        json.append(buffer).append(usage.name);
+        snprintf(buffer, sizeof(buffer), "\",\"bucketCount\":%u,\"chainLengths\":[",
+                 usage.bucketCount);
+        json.append(buffer);
+        for (size_t length = 0; length < usage.chainLengths.size(); length++) {
+            snprintf(buffer, sizeof(buffer), "%s%u", length > 0 ? "," : "",
+                     usage.chainLengths[length]);
+            json.append(buffer);
+        }
+        json.append("]}");
+    }
+
+    json.append("],\"bloomFilters\":[");
+    for (size_t i = 0; i < bloomFilters.size(); i++) {
+        const BloomFilterUsage &usage = bloomFilters[i];
+        snprintf(buffer, sizeof(buffer), "%s{\"name\":\"", i > 0 ? "," : "");
+        json.append(buffer).append(usage.name);
+        snprintf(buffer, sizeof(buffer),
+                 "\",\"numBits\":%u,\"numSetBits\":%u,\"fillRatio\":%.4f}",
+                 usage.numBits, usage.numSetBits, usage.getFillRatio());
+        json.append(buffer);
+    }
+    json.append("]}");
+    return json;
+}
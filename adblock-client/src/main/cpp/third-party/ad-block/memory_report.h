@@ -0,0 +1,68 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef MEMORY_REPORT_H_
+#define MEMORY_REPORT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "./base.h"
+
+// Memory of one structure of an AdBlockClient
+struct StructureUsage {
+    // Name of the member, e.g. "filters" or "hostAnchoredHashSet"
+    std::string name;
+    // Number of elements, e.g. filters, set items or bloom filter bits
+    size_t count;
+    // Bytes allocated on the heap, without allocator overhead
+    size_t heapBytes;
+};
+
+// Bucket usage of a hash set
+struct HashSetUsage {
+    std::string name;
+    // Buckets, or slots for a set deserialized in place
+    uint32_t bucketCount;
+    // Number of buckets by chain length, see HashSet::GetChainLengths()
+    std::vector<uint32_t> chainLengths;
+};
+
+struct BloomFilterUsage {
+    std::string name;
+    uint32_t numBits;
+    uint32_t numSetBits;
+
+    double getFillRatio() const {
+        return numBits ? static_cast<double>(numSetBits) / numBits : 0;
+    }
+};
+
+/**
+ * Where the memory of an AdBlockClient goes, filled by
+ * AdBlockClient::getMemoryReport(). The byte counts are computed from the
+ * sizes of the structures and what they allocate, so they are estimates
+ * which leave out allocator overhead.
+ */
+class MemoryReport {
+public:
+    MemoryReport() : deserializedBytes(0) {}
+
+    // Sum of the heap bytes of the structures
+    size_t getHeapBytes() const;
+
+    // Writes the report as a JSON object with the members below, named
+    // like them, and "heapBytes"
+    std::string toJson() const;
+
+    // Size of the deserialized data the structures use in place, which
+    // isn't on the heap if it's mapped
+    size_t deserializedBytes;
+    std::vector<StructureUsage> structures;
+    std::vector<HashSetUsage> hashSets;
+    std::vector<BloomFilterUsage> bloomFilters;
+};
+
+#endif  // MEMORY_REPORT_H_
@@ -14,6 +14,7 @@
 #include <string.h>
 
 #include "../hashset-cpp/hashFn.h"
+#include "../hashset-cpp/little_endian.h"
 
 static HashFn h(19);
 
@@ -47,6 +48,18 @@ NoFingerprintDomain::NoFingerprintDomain(const char *data, int dataLen) :
         dataLen(dataLen) {
 }
 
+NoFingerprintDomain::NoFingerprintDomain(const char *data, int dataLen,
+                                         bool borrowedData) :
+        borrowed_data(borrowedData), dataLen(dataLen) {
+  if (borrowedData) {
+    this->data = const_cast<char *>(data);
+  } else {
+    this->data = new char[dataLen + 1];
+    memcpy(this->data, data, dataLen);
+    this->data[dataLen] = '\0';
+  }
+}
+
 NoFingerprintDomain::~NoFingerprintDomain() {
   if (borrowed_data) {
     return;
@@ -56,6 +69,13 @@ NoFingerprintDomain::~NoFingerprintDomain() {
   }
 }
 
+size_t NoFingerprintDomain::GetAllocatedSize() const {
+  if (borrowed_data || !data) {
+    return 0;
+  }
+  return (dataLen == -1 ? strlen(data) : dataLen) + 1;
+}
+
 uint64_t NoFingerprintDomain::hash() const {
   if (!data) {
     return 0;
@@ -63,38 +83,32 @@ uint64_t NoFingerprintDomain::hash() const {
   return h(data, dataLen);
 }
 
+// Serialized as the length as little endian uint32 and the NUL terminated
+// domain
 uint32_t NoFingerprintDomain::Serialize(char *buffer) {
-  uint32_t totalSize = 0;
-  char sz[64];
-  uint32_t dataLenSize = 1 + snprintf(sz, sizeof(sz),
-                                      "%x", dataLen);
+  uint32_t len = dataLen > 0 ? static_cast<uint32_t>(dataLen) : 0;
   if (buffer) {
-    memcpy(buffer + totalSize, sz, dataLenSize);
-  }
-  totalSize += dataLenSize;
-  if (buffer) {
-    memcpy(buffer + totalSize, data, dataLen);
+    putUint32LE(buffer, len);
+    if (len > 0) {
+      memcpy(buffer + 4, data, len);
+    }
+    buffer[4 + len] = '\0';
   }
-  totalSize += dataLen;
-
-  totalSize += 1;
-
-  return totalSize;
+  return 4 + len + 1;
 }
 
 uint32_t NoFingerprintDomain::Deserialize(char *buffer, uint32_t bufferSize) {
-  dataLen = 0;
-  sscanf(buffer, "%x", &dataLen);
-  uint32_t consumed = static_cast<uint32_t>(strlen(buffer)) + 1;
-  if (consumed + dataLen >= bufferSize) {
+  if (bufferSize < 4) {
+    return 0;
+  }
+  uint32_t len = getUint32LE(buffer);
+  if (len >= bufferSize - 4 || buffer[4 + len] != '\0') {
     return 0;
   }
-  data = buffer + consumed;
-  consumed += dataLen;
+  data = buffer + 4;
+  dataLen = static_cast<int>(len);
   borrowed_data = true;
-  // Since we serialize a \0 character, we need to skip past it.
-  consumed++;
-  return consumed;
+  return 4 + len + 1;
 }
 
 bool NoFingerprintDomain::operator==(const NoFingerprintDomain &rhs) const {
@@ -11,6 +11,7 @@
 #ifndef NO_FINGERPRINT_DOMAIN_H_
 #define NO_FINGERPRINT_DOMAIN_H_
 
+#include <stddef.h>
 #include "./base.h"
 
 class NoFingerprintDomain {
@@ -21,6 +22,10 @@ public:
 
     NoFingerprintDomain(const char *data, int dataLen);
 
+    // Copies |data| instead of borrowing it unless |borrowedData|, for
+    // keys which outlive the string they were made from
+    NoFingerprintDomain(const char *data, int dataLen, bool borrowedData);
+
     ~NoFingerprintDomain();
 
     uint64_t hash() const;
@@ -38,6 +43,9 @@ public:
 
     bool operator==(const NoFingerprintDomain &rhs) const;
 
+    // Bytes allocated for the domain unless it's borrowed
+    size_t GetAllocatedSize() const;
+
 private:
     // Holds true if the data should not free memory because for example it
     // was loaded from a large buffer somewhere else via the serialize and
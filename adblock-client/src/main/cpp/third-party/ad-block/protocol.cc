@@ -43,6 +43,9 @@ bool isBlockableProtocol(const char *url, int urlLen) {
     int numCharsReadInState;
     char lowerChar;
     ProtocolParseState parseState = ProtocolParseStateStart;
+    // The URL may not be null terminated, so every look ahead checks how
+    // many characters are left
+    int remaining;
 
     // The below loop encodes a state machine.  Free transitions between states
     // are continues.  States that consume input "break" so that the can
@@ -52,6 +55,7 @@ bool isBlockableProtocol(const char *url, int urlLen) {
     // be collapsed) but its written in this _slightly_ more verbose way
     // to make it easier to grok.
     while (true) {
+        remaining = urlLen - totalCharsRead;
         switch (parseState) {
             case ProtocolParseStateStart:
                 if (tolower(*curChar) == 'b') {
@@ -77,7 +81,8 @@ bool isBlockableProtocol(const char *url, int urlLen) {
                 return false;
 
             case ProtocolParseStateReadingBlob:
-                if (tolower(*curChar) == 'b' &&
+                if (remaining >= 5 &&
+                    tolower(*curChar) == 'b' &&
                     tolower(*(curChar + 1)) == 'l' &&
                     tolower(*(curChar + 2)) == 'o' &&
                     tolower(*(curChar + 3)) == 'b' &&
@@ -90,7 +95,8 @@ bool isBlockableProtocol(const char *url, int urlLen) {
                 return false;
 
             case ProtocolParseStateReadingProtoHTTP:
-                if (tolower(*curChar) == 'h' &&
+                if (remaining >= 4 &&
+                    tolower(*curChar) == 'h' &&
                     tolower(*(curChar + 1)) == 't' &&
                     tolower(*(curChar + 2)) == 't' &&
                     tolower(*(curChar + 3)) == 'p') {
@@ -102,7 +108,8 @@ bool isBlockableProtocol(const char *url, int urlLen) {
                 return false;
 
             case ProtocolParseStateReadingProtoWebSocket:
-                if (tolower(*curChar) == 'w' &&
+                if (remaining >= 2 &&
+                    tolower(*curChar) == 'w' &&
                     tolower(*(curChar + 1)) == 's') {
                     parseState = ProtocolParseStatePostProto;
                     numCharsReadInState = 2;
@@ -120,7 +127,8 @@ bool isBlockableProtocol(const char *url, int urlLen) {
                 [[fallthrough]];
                 // Intentional fall through
             case ProtocolParseStateReadingSeperator:
-                if (*curChar == ':' &&
+                if (remaining >= 3 &&
+                    *curChar == ':' &&
                     (*(curChar + 1)) == '/' &&
                     (*(curChar + 2)) == '/') {
                     return true;
@@ -0,0 +1,862 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#define ENABLE_REGEX
+
+#ifdef ENABLE_REGEX
+// putting it at the top can solve the dependency conflict problem
+#include <regex> // NOLINT
+#endif
+
+#include "./regex_matcher.h"
+#include <string.h>
+#include <string>
+
+const int kRegexStepBudget = 1 << 17;
+
+// Limits which keep a single hostile pattern from blowing up the program
+static const int kMaxRegexInsts = 1 << 13;
+static const int kMaxRegexRepeat = 1000;
+static const int kMaxRegexDepth = 64;
+
+enum RegexNodeType {
+    RNChar,
+    RNClass,
+    RNAny,
+    RNConcat,
+    RNAlternate,
+    RNRepeat,
+    RNBeginLine,
+    RNEndLine,
+    RNWordBoundary,
+    RNNotWordBoundary
+};
+
+struct RegexNode {
+    RegexNodeType type;
+    // RNChar: the byte, RNClass: index of the byte set
+    int arg;
+    // RNRepeat bounds, max is -1 when unbounded
+    int min;
+    int max;
+    std::vector<int> children;
+};
+
+static inline bool isRegexWordChar(unsigned char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+           (c >= '0' && c <= '9') || c == '_';
+}
+
+static inline bool isRegexSpaceChar(unsigned char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\v' || c == '\f' ||
+           c == '\r';
+}
+
+static inline int hexValue(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+// Recursive descent parser producing a tree of RegexNode, returns -1 for
+// syntax errors and for anything the automaton can't express.
+class RegexParser {
+public:
+    RegexParser(const char *pattern, int patternLen,
+                std::vector<uint32_t> *classes) :
+            p(pattern), end(pattern + patternLen), classes(classes),
+            depth(0) {
+    }
+
+    int parse() {
+        int root = parseAlternate();
+        if (root < 0 || p != end) {
+            return -1;
+        }
+        return root;
+    }
+
+    std::vector<RegexNode> nodes;
+
+private:
+    int newNode(RegexNodeType type, int arg = 0) {
+        RegexNode node;
+        node.type = type;
+        node.arg = arg;
+        node.min = 0;
+        node.max = 0;
+        nodes.push_back(node);
+        return static_cast<int>(nodes.size()) - 1;
+    }
+
+    int newClass() {
+        int index = static_cast<int>(classes->size() / 8);
+        classes->resize(classes->size() + 8, 0);
+        return index;
+    }
+
+    void addToClass(int index, int c) {
+        (*classes)[index * 8 + c / 32] |= 1u << (c % 32);
+    }
+
+    // Adds the set of a \d, \D, \w, \W, \s or \S escape to the class
+    void addShorthandToClass(int index, char e) {
+        for (int c = 0; c < 256; c++) {
+            bool in;
+            switch (e) {
+                case 'd':
+                case 'D':
+                    in = c >= '0' && c <= '9';
+                    break;
+                case 'w':
+                case 'W':
+                    in = isRegexWordChar(static_cast<unsigned char>(c));
+                    break;
+                default:
+                    in = isRegexSpaceChar(static_cast<unsigned char>(c));
+                    break;
+            }
+            if (e == 'D' || e == 'W' || e == 'S') {
+                in = !in;
+            }
+            if (in) {
+                addToClass(index, c);
+            }
+        }
+    }
+
+    static bool isShorthand(char e) {
+        return e == 'd' || e == 'D' || e == 'w' || e == 'W' || e == 's' ||
+               e == 'S';
+    }
+
+    // Parses the escape after the backslash and |e| which was already
+    // consumed into a single byte
+    bool parseCharEscape(char e, int *value) {
+        switch (e) {
+            case 't':
+                *value = '\t';
+                return true;
+            case 'n':
+                *value = '\n';
+                return true;
+            case 'r':
+                *value = '\r';
+                return true;
+            case 'f':
+                *value = '\f';
+                return true;
+            case 'v':
+                *value = '\v';
+                return true;
+            case '0':
+                if (p < end && *p >= '0' && *p <= '9') {
+                    return false;
+                }
+                *value = 0;
+                return true;
+            case 'c':
+                if (p < end && ((*p >= 'a' && *p <= 'z') ||
+                                (*p >= 'A' && *p <= 'Z'))) {
+                    *value = *p % 32;
+                    p++;
+                    return true;
+                }
+                return false;
+            case 'x':
+            case 'u': {
+                int digits = e == 'x' ? 2 : 4;
+                if (end - p < digits) {
+                    return false;
+                }
+                int v = 0;
+                for (int i = 0; i < digits; i++) {
+                    int h = hexValue(p[i]);
+                    if (h < 0) {
+                        return false;
+                    }
+                    v = v * 16 + h;
+                }
+                // Input is matched byte by byte so only code points which
+                // are a single UTF-8 byte can be expressed
+                if (e == 'u' && v > 0x7f) {
+                    return false;
+                }
+                p += digits;
+                *value = v;
+                return true;
+            }
+            case 'k':
+                return false;
+            default:
+                if (e >= '1' && e <= '9') {
+                    // Backreferences need the fallback
+                    return false;
+                }
+                *value = static_cast<unsigned char>(e);
+                return true;
+        }
+    }
+
+    int parseAlternate() {
+        if (++depth > kMaxRegexDepth) {
+            return -1;
+        }
+        int first = parseConcat();
+        if (first < 0) {
+            return -1;
+        }
+        if (p == end || *p != '|') {
+            depth--;
+            return first;
+        }
+        int alternate = newNode(RNAlternate);
+        nodes[alternate].children.push_back(first);
+        while (p < end && *p == '|') {
+            p++;
+            int next = parseConcat();
+            if (next < 0) {
+                return -1;
+            }
+            nodes[alternate].children.push_back(next);
+        }
+        depth--;
+        return alternate;
+    }
+
+    int parseConcat() {
+        int concat = newNode(RNConcat);
+        while (p < end && *p != '|' && *p != ')') {
+            int next = parseRepeat();
+            if (next < 0) {
+                return -1;
+            }
+            nodes[concat].children.push_back(next);
+        }
+        return concat;
+    }
+
+    // Parses {n}, {n,} or {n,m}, returns false if it isn't a valid bound
+    bool parseBounds(int *min, int *max) {
+        const char *q = p + 1;
+        int n = 0;
+        int digits = 0;
+        while (q < end && *q >= '0' && *q <= '9' && n <= kMaxRegexRepeat) {
+            n = n * 10 + (*q++ - '0');
+            digits++;
+        }
+        if (!digits || q == end) {
+            return false;
+        }
+        *min = n;
+        *max = n;
+        if (*q == ',') {
+            q++;
+            *max = -1;
+            if (q < end && *q >= '0' && *q <= '9') {
+                int m = 0;
+                while (q < end && *q >= '0' && *q <= '9' &&
+                       m <= kMaxRegexRepeat) {
+                    m = m * 10 + (*q++ - '0');
+                }
+                *max = m;
+            }
+        }
+        if (q == end || *q != '}') {
+            return false;
+        }
+        if (*min > kMaxRegexRepeat || *max > kMaxRegexRepeat ||
+            (*max != -1 && *max < *min)) {
+            return false;
+        }
+        p = q + 1;
+        return true;
+    }
+
+    int parseRepeat() {
+        int atom = parseAtom();
+        if (atom < 0 || p == end) {
+            return atom;
+        }
+        int min;
+        int max;
+        switch (*p) {
+            case '*':
+                min = 0;
+                max = -1;
+                p++;
+                break;
+            case '+':
+                min = 1;
+                max = -1;
+                p++;
+                break;
+            case '?':
+                min = 0;
+                max = 1;
+                p++;
+                break;
+            case '{':
+                if (!parseBounds(&min, &max)) {
+                    return -1;
+                }
+                break;
+            default:
+                return atom;
+        }
+        // Laziness doesn't change whether there is a match
+        if (p < end && *p == '?') {
+            p++;
+        }
+        if (p < end && (*p == '*' || *p == '+' || *p == '?' || *p == '{')) {
+            return -1;
+        }
+        RegexNodeType type = nodes[atom].type;
+        if (type == RNBeginLine || type == RNEndLine ||
+            type == RNWordBoundary || type == RNNotWordBoundary) {
+            return -1;
+        }
+        int repeat = newNode(RNRepeat);
+        nodes[repeat].min = min;
+        nodes[repeat].max = max;
+        nodes[repeat].children.push_back(atom);
+        return repeat;
+    }
+
+    int parseAtom() {
+        char c = *p;
+        switch (c) {
+            case '(': {
+                p++;
+                if (p < end && *p == '?') {
+                    if (end - p >= 2 && p[1] == ':') {
+                        p += 2;
+                    } else if (end - p >= 3 && p[1] == '<' && p[2] != '=' &&
+                               p[2] != '!') {
+                        // Named group, names are never referenced without
+                        // \k which isn't supported
+                        p += 2;
+                        while (p < end && *p != '>') {
+                            p++;
+                        }
+                        if (p == end) {
+                            return -1;
+                        }
+                        p++;
+                    } else {
+                        // Lookarounds
+                        return -1;
+                    }
+                }
+                int inner = parseAlternate();
+                if (inner < 0 || p == end || *p != ')') {
+                    return -1;
+                }
+                p++;
+                return inner;
+            }
+            case '[':
+                return parseClass();
+            case '.':
+                p++;
+                return newNode(RNAny);
+            case '^':
+                p++;
+                return newNode(RNBeginLine);
+            case '$':
+                p++;
+                return newNode(RNEndLine);
+            case '\\': {
+                p++;
+                if (p == end) {
+                    return -1;
+                }
+                char e = *p++;
+                if (e == 'b') {
+                    return newNode(RNWordBoundary);
+                }
+                if (e == 'B') {
+                    return newNode(RNNotWordBoundary);
+                }
+                if (isShorthand(e)) {
+                    int index = newClass();
+                    addShorthandToClass(index, e);
+                    return newNode(RNClass, index);
+                }
+                int value;
+                if (!parseCharEscape(e, &value)) {
+                    return -1;
+                }
+                return newNode(RNChar, value);
+            }
+            case '*':
+            case '+':
+            case '?':
+            case '{':
+                return -1;
+            default:
+                p++;
+                return newNode(RNChar, static_cast<unsigned char>(c));
+        }
+    }
+
+    // Parses a single class member, |value| is -1 for \d style sets
+    bool parseClassAtom(int index, int *value) {
+        if (*p != '\\') {
+            *value = static_cast<unsigned char>(*p++);
+            return true;
+        }
+        p++;
+        if (p == end) {
+            return false;
+        }
+        char e = *p++;
+        if (isShorthand(e)) {
+            addShorthandToClass(index, e);
+            *value = -1;
+            return true;
+        }
+        if (e == 'b') {
+            *value = '\b';
+            return true;
+        }
+        return parseCharEscape(e, value);
+    }
+
+    int parseClass() {
+        p++;
+        int index = newClass();
+        bool negate = false;
+        if (p < end && *p == '^') {
+            negate = true;
+            p++;
+        }
+        while (true) {
+            if (p == end) {
+                return -1;
+            }
+            if (*p == ']') {
+                p++;
+                break;
+            }
+            int lo;
+            if (!parseClassAtom(index, &lo)) {
+                return -1;
+            }
+            if (end - p >= 2 && *p == '-' && p[1] != ']') {
+                p++;
+                int hi;
+                if (lo < 0 || !parseClassAtom(index, &hi) || hi < lo) {
+                    return -1;
+                }
+                for (int c = lo; c <= hi; c++) {
+                    addToClass(index, c);
+                }
+            } else if (lo >= 0) {
+                addToClass(index, lo);
+            }
+        }
+        if (negate) {
+            for (int i = 0; i < 8; i++) {
+                (*classes)[index * 8 + i] = ~(*classes)[index * 8 + i];
+            }
+        }
+        return newNode(RNClass, index);
+    }
+
+    const char *p;
+    const char *end;
+    std::vector<uint32_t> *classes;
+    int depth;
+};
+
+// Emits Thompson automaton instructions for a parsed tree
+class RegexCompiler {
+public:
+    RegexCompiler(const std::vector<RegexNode> &nodes,
+                  std::vector<RegexInst> *insts) : nodes(nodes), insts(insts) {
+    }
+
+    bool emit(int index) {
+        if (full()) {
+            return false;
+        }
+        const RegexNode &node = nodes[index];
+        switch (node.type) {
+            case RNChar:
+                push(ROChar, node.arg);
+                return true;
+            case RNClass:
+                push(ROClass, node.arg);
+                return true;
+            case RNAny:
+                push(ROAny);
+                return true;
+            case RNBeginLine:
+                push(ROBeginLine);
+                return true;
+            case RNEndLine:
+                push(ROEndLine);
+                return true;
+            case RNWordBoundary:
+                push(ROWordBoundary);
+                return true;
+            case RNNotWordBoundary:
+                push(RONotWordBoundary);
+                return true;
+            case RNConcat:
+                for (size_t i = 0; i < node.children.size(); i++) {
+                    if (!emit(node.children[i])) {
+                        return false;
+                    }
+                }
+                return true;
+            case RNAlternate:
+                return emitAlternate(node);
+            case RNRepeat:
+                return emitRepeat(node);
+        }
+        return false;
+    }
+
+private:
+    int push(RegexOp op, int arg = 0) {
+        RegexInst inst = {op, arg, 0, 0, 0};
+        insts->push_back(inst);
+        return static_cast<int>(insts->size()) - 1;
+    }
+
+    int next() const {
+        return static_cast<int>(insts->size());
+    }
+
+    bool full() const {
+        return insts->size() > static_cast<size_t>(kMaxRegexInsts);
+    }
+
+    bool emitAlternate(const RegexNode &node) {
+        std::vector<int> jumps;
+        size_t last = node.children.size() - 1;
+        for (size_t i = 0; i < last; i++) {
+            int split = push(ROSplit);
+            (*insts)[split].x = next();
+            if (!emit(node.children[i])) {
+                return false;
+            }
+            jumps.push_back(push(ROJmp));
+            (*insts)[split].y = next();
+        }
+        if (!emit(node.children[last])) {
+            return false;
+        }
+        for (size_t i = 0; i < jumps.size(); i++) {
+            (*insts)[jumps[i]].x = next();
+        }
+        return true;
+    }
+
+    bool emitRepeat(const RegexNode &node) {
+        int child = node.children[0];
+        for (int i = 0; i < node.min; i++) {
+            if (!emit(child)) {
+                return false;
+            }
+        }
+        if (node.max == -1) {
+            int split = push(ROSplit);
+            (*insts)[split].x = next();
+            if (!emit(child)) {
+                return false;
+            }
+            (*insts)[push(ROJmp)].x = split;
+            (*insts)[split].y = next();
+            return true;
+        }
+        std::vector<int> splits;
+        for (int i = node.min; i < node.max; i++) {
+            int split = push(ROSplit);
+            (*insts)[split].x = next();
+            splits.push_back(split);
+            if (!emit(child)) {
+                return false;
+            }
+        }
+        for (size_t i = 0; i < splits.size(); i++) {
+            (*insts)[splits[i]].y = next();
+        }
+        return true;
+    }
+
+    const std::vector<RegexNode> &nodes;
+    std::vector<RegexInst> *insts;
+};
+
+bool RegexProgram::compile(const char *pattern, int patternLen, int owner) {
+    size_t instsSize = insts.size();
+    size_t classesSize = classes.size();
+    RegexParser parser(pattern, patternLen, &classes);
+    int root = parser.parse();
+    RegexCompiler compiler(parser.nodes, &insts);
+    if (root < 0 || !compiler.emit(root)) {
+        insts.resize(instsSize);
+        classes.resize(classesSize);
+        return false;
+    }
+    RegexInst match = {ROMatch, 0, 0, 0, 0};
+    insts.push_back(match);
+    for (size_t i = instsSize; i < insts.size(); i++) {
+        insts[i].owner = owner;
+    }
+    starts.push_back(static_cast<int>(instsSize));
+    return true;
+}
+
+// Set of instruction indexes with O(1) insert, lookup and clear
+struct RegexThreadList {
+    int *dense;
+    int *sparse;
+    int size;
+
+    bool contains(int pc) const {
+        int i = sparse[pc];
+        return i < size && dense[i] == pc;
+    }
+
+    void insert(int pc) {
+        sparse[pc] = size;
+        dense[size++] = pc;
+    }
+};
+
+static inline bool hasMatched(const uint64_t *matches, int owner) {
+    return (matches[owner / 64] >> (owner % 64)) & 1;
+}
+
+int RegexProgram::run(const char *input, int inputLen, uint64_t *matches,
+                      int numOwners) const {
+    int numInsts = static_cast<int>(insts.size());
+    if (!numInsts) {
+        return 0;
+    }
+    // Reused between searches so matching doesn't allocate, sparse sets
+    // don't need their memory to be cleared
+    thread_local std::vector<int> scratch;
+    size_t needed = static_cast<size_t>(numInsts) * 6 + 2;
+    if (scratch.size() < needed) {
+        scratch.resize(needed);
+    }
+    RegexThreadList lists[2] = {
+        {&scratch[0], &scratch[numInsts], 0},
+        {&scratch[numInsts * 2], &scratch[numInsts * 3], 0}
+    };
+    int *stack = &scratch[numInsts * 4];
+    RegexThreadList *current = &lists[0];
+    RegexThreadList *upcoming = &lists[1];
+    int found = 0;
+
+    // Follows the empty transitions from |start| at |pos|
+    auto addThread = [&](RegexThreadList *list, int start, int pos) {
+        int top = 0;
+        stack[top++] = start;
+        while (top) {
+            int pc = stack[--top];
+            if (list->contains(pc)) {
+                continue;
+            }
+            list->insert(pc);
+            const RegexInst &inst = insts[pc];
+            switch (inst.op) {
+                case ROJmp:
+                    stack[top++] = inst.x;
+                    break;
+                case ROSplit:
+                    stack[top++] = inst.y;
+                    stack[top++] = inst.x;
+                    break;
+                case ROBeginLine:
+                    if (pos == 0) {
+                        stack[top++] = pc + 1;
+                    }
+                    break;
+                case ROEndLine:
+                    if (pos == inputLen) {
+                        stack[top++] = pc + 1;
+                    }
+                    break;
+                case ROWordBoundary:
+                case RONotWordBoundary: {
+                    bool before = pos > 0 && isRegexWordChar(
+                            static_cast<unsigned char>(input[pos - 1]));
+                    bool after = pos < inputLen && isRegexWordChar(
+                            static_cast<unsigned char>(input[pos]));
+                    if ((before != after) == (inst.op == ROWordBoundary)) {
+                        stack[top++] = pc + 1;
+                    }
+                    break;
+                }
+                case ROMatch:
+                    if (!hasMatched(matches, inst.owner)) {
+                        matches[inst.owner / 64] |= 1ULL << (inst.owner % 64);
+                        found++;
+                    }
+                    break;
+                default:
+                    break;
+            }
+        }
+    };
+
+    for (int pos = 0; pos <= inputLen; pos++) {
+        unsigned char c = pos < inputLen ?
+                          static_cast<unsigned char>(input[pos]) : 0;
+        // Every position is a potential start since the search is unanchored
+        for (size_t i = 0; i < starts.size(); i++) {
+            const RegexInst &inst = insts[starts[i]];
+            if (hasMatched(matches, inst.owner)) {
+                continue;
+            }
+            if (inst.op == ROChar && (pos == inputLen || c != inst.arg)) {
+                continue;
+            }
+            addThread(current, starts[i], pos);
+            if (found == numOwners) {
+                return found;
+            }
+        }
+        if (pos == inputLen || !current->size) {
+            current->size = 0;
+            continue;
+        }
+        upcoming->size = 0;
+        for (int i = 0; i < current->size; i++) {
+            int pc = current->dense[i];
+            const RegexInst &inst = insts[pc];
+            if (hasMatched(matches, inst.owner)) {
+                continue;
+            }
+            bool step;
+            switch (inst.op) {
+                case ROChar:
+                    step = c == inst.arg;
+                    break;
+                case ROClass:
+                    step = classContains(inst.arg, c);
+                    break;
+                case ROAny:
+                    step = c != '\n' && c != '\r';
+                    break;
+                default:
+                    step = false;
+                    break;
+            }
+            if (step) {
+                addThread(upcoming, pc + 1, pos + 1);
+                if (found == numOwners) {
+                    return found;
+                }
+            }
+        }
+        RegexThreadList *temp = current;
+        current = upcoming;
+        upcoming = temp;
+    }
+    return found;
+}
+
+Regex::Regex(const char *pattern, int patternLen) :
+        linear(false), fallback(nullptr), patternLen(patternLen) {
+    linear = program.compile(pattern, patternLen, 0);
+    if (linear) {
+        return;
+    }
+#ifdef ENABLE_REGEX
+    try {
+        fallback = new std::regex(std::string(pattern, patternLen),
+                                  std::regex_constants::ECMAScript);
+    } catch (std::regex_error &ignore) {
+        fallback = nullptr;
+    }
+#endif
+}
+
+Regex::~Regex() {
+#ifdef ENABLE_REGEX
+    delete static_cast<std::regex *>(fallback);
+#endif
+}
+
+bool Regex::search(const char *input, int inputLen) const {
+    if (linear) {
+        uint64_t matches = 0;
+        return program.run(input, inputLen, &matches, 1) > 0;
+    }
+#ifdef ENABLE_REGEX
+    if (!fallback) {
+        return false;
+    }
+    // std::regex can backtrack exponentially, skip inputs which could take
+    // more than the budget even for a well behaved pattern
+    if (static_cast<int64_t>(patternLen) * inputLen > kRegexStepBudget) {
+        return false;
+    }
+    try {
+        return std::regex_search(input, input + inputLen,
+                                 *static_cast<std::regex *>(fallback));
+    } catch (std::regex_error &ignore) {
+        return false;
+    }
+#else
+    return false;
+#endif
+}
+
+RegexSet::RegexSet() : size(0) {
+}
+
+int RegexSet::add(const char *pattern, int patternLen) {
+    if (!program.compile(pattern, patternLen, size)) {
+        return -1;
+    }
+    return size++;
+}
+
+void RegexSet::match(const char *input, int inputLen,
+                     uint64_t *matches) const {
+    program.run(input, inputLen, matches, size);
+}
+
+RegexSetMatches::RegexSetMatches(const RegexSet *regexSet,
+                                 const char *input, int inputLen) :
+        regexSet(regexSet), input(input), inputLen(inputLen),
+        evaluated(false), words(inlineWords) {
+}
+
+RegexSetMatches::~RegexSetMatches() {
+    if (words != inlineWords) {
+        delete[] words;
+    }
+}
+
+bool RegexSetMatches::contains(int id) {
+    if (id < 0 || !regexSet) {
+        return false;
+    }
+    if (!evaluated) {
+        int numWords = regexSet->getMatchesWords();
+        if (numWords > kInlineWords) {
+            words = new uint64_t[numWords];
+        }
+        memset(words, 0, sizeof(uint64_t) * numWords);
+        regexSet->match(input, inputLen, words);
+        evaluated = true;
+    }
+    return (words[id / 64] >> (id % 64)) & 1;
+}
@@ -0,0 +1,165 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef REGEX_MATCHER_H_
+#define REGEX_MATCHER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+#include "./base.h"
+
+// Upper bound of pattern length * input length for a std::regex fallback
+// search, std::regex has no step hook so the work is bounded up front.
+extern const int kRegexStepBudget;
+
+enum RegexOp {
+    ROChar,
+    ROClass,
+    ROAny,
+    ROSplit,
+    ROJmp,
+    ROMatch,
+    ROBeginLine,
+    ROEndLine,
+    ROWordBoundary,
+    RONotWordBoundary
+};
+
+struct RegexInst {
+    RegexOp op;
+    // ROChar: the byte, ROClass: index of the byte set
+    int arg;
+    // ROSplit/ROJmp: branch targets
+    int x;
+    int y;
+    // Id of the pattern this instruction belongs to
+    int owner;
+};
+
+// Thompson automaton shared by Regex and RegexSet
+struct RegexProgram {
+    std::vector<RegexInst> insts;
+    // 256 bit byte sets for ROClass
+    std::vector<uint32_t> classes;
+    std::vector<int> starts;
+
+    bool classContains(int index, unsigned char c) const {
+        return (classes[index * 8 + c / 32] >> (c % 32)) & 1;
+    }
+
+    // Appends the compiled pattern, returns false if the pattern is not
+    // supported by the automaton in which case nothing is appended.
+    bool compile(const char *pattern, int patternLen, int owner);
+
+    // Sets bit |owner| of |matches| for every pattern found in the input
+    // and returns the number of newly matched patterns. Stops as soon as
+    // |numOwners| patterns are matched.
+    int run(const char *input, int inputLen, uint64_t *matches,
+            int numOwners) const;
+
+    // Bytes allocated for the instructions, classes and starts
+    size_t getAllocatedSize() const {
+        return insts.capacity() * sizeof(RegexInst)
+               + classes.capacity() * sizeof(uint32_t)
+               + starts.capacity() * sizeof(int);
+    }
+};
+
+/**
+ * Matcher for a single regex filter using the ECMAScript subset filter
+ * lists use: literals, escapes, classes, groups, alternation, quantifiers,
+ * ^, $ and word boundaries.
+ *
+ * Supported patterns are searched in O(pattern * input) time. Patterns with
+ * backreferences or lookarounds fall back to std::regex, which is skipped
+ * when the input is too long for kRegexStepBudget.
+ */
+class Regex {
+public:
+    Regex(const char *pattern, int patternLen);
+
+    ~Regex();
+
+    bool search(const char *input, int inputLen) const;
+
+    // true if the pattern runs on the linear time automaton
+    bool isLinear() const {
+        return linear;
+    }
+
+    // Bytes allocated for the automaton, a std::regex fallback isn't
+    // counted
+    size_t getAllocatedSize() const {
+        return program.getAllocatedSize();
+    }
+
+private:
+    RegexProgram program;
+    bool linear;
+    // std::regex, only used for patterns the automaton doesn't support
+    void *fallback;
+    int patternLen;
+};
+
+/**
+ * Combines many regex filters into one automaton so the input is scanned
+ * once for all of them.
+ */
+class RegexSet {
+public:
+    RegexSet();
+
+    // Returns the id of the pattern in the set or -1 if the pattern
+    // can't run on the automaton, in which case it isn't added.
+    int add(const char *pattern, int patternLen);
+
+    int getSize() const {
+        return size;
+    }
+
+    // Bytes allocated for the automaton
+    size_t getAllocatedSize() const {
+        return program.getAllocatedSize();
+    }
+
+    // Number of uint64_t words a matches bitset must hold
+    int getMatchesWords() const {
+        return (size + 63) / 64;
+    }
+
+    // Sets bit |id| of |matches| for every pattern found in the input,
+    // |matches| must be zeroed by the caller.
+    void match(const char *input, int inputLen, uint64_t *matches) const;
+
+private:
+    RegexProgram program;
+    int size;
+};
+
+/**
+ * Result of a RegexSet scan for one input. The scan only happens the first
+ * time a pattern of the set is asked for, so inputs that never reach a
+ * regex filter don't pay for it.
+ */
+class RegexSetMatches {
+public:
+    RegexSetMatches(const RegexSet *regexSet, const char *input, int inputLen);
+
+    ~RegexSetMatches();
+
+    bool contains(int id);
+
+private:
+    static const int kInlineWords = 8;
+
+    const RegexSet *regexSet;
+    const char *input;
+    int inputLen;
+    bool evaluated;
+    uint64_t inlineWords[kInlineWords];
+    uint64_t *words;
+};
+
+#endif  // REGEX_MATCHER_H_
@@ -0,0 +1,44 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include <fcntl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "./shared_memory.h"
+
+// Older libc headers lack the memfd declarations, the values are part of
+// the kernel ABI
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC 0x0001U
+#define MFD_ALLOW_SEALING 0x0002U
+#endif
+#ifndef F_ADD_SEALS
+#define F_ADD_SEALS 1033
+#define F_GET_SEALS 1034
+#define F_SEAL_SEAL 0x0001
+#define F_SEAL_SHRINK 0x0002
+#define F_SEAL_GROW 0x0004
+#define F_SEAL_WRITE 0x0008
+#endif
+
+static const int kImmutableSeals = F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE;
+
+int createSharedMemory(const char *name) {
+#ifdef __NR_memfd_create
+    // Called directly since libc only wraps it in recent versions
+    return static_cast<int>(syscall(__NR_memfd_create, name,
+                                    MFD_CLOEXEC | MFD_ALLOW_SEALING));
+#else
+    return -1;
+#endif
+}
+
+bool sealSharedMemory(int fd) {
+    return fcntl(fd, F_ADD_SEALS, kImmutableSeals | F_SEAL_SEAL) == 0;
+}
+
+bool isSealedSharedMemory(int fd) {
+    int seals = fcntl(fd, F_GET_SEALS);
+    return seals >= 0 && (seals & kImmutableSeals) == kImmutableSeals;
+}
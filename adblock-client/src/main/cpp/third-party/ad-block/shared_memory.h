@@ -0,0 +1,22 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+// Anonymous shared memory for handing processed data to other processes.
+// The memory is a memfd which is sealed once written, so a process
+// receiving the descriptor can map it knowing it can't change anymore.
+
+#ifndef SHARED_MEMORY_H_
+#define SHARED_MEMORY_H_
+
+// Creates empty shared memory which can be sealed, |name| only shows up
+// in /proc. Returns -1 if the kernel doesn't support memfds.
+int createSharedMemory(const char *name);
+
+// Prevents any further change of the size or content of |fd|
+bool sealSharedMemory(int fd);
+
+// Whether |fd| is shared memory which can't be changed anymore
+bool isSealedSharedMemory(int fd);
+
+#endif  // SHARED_MEMORY_H_
@@ -0,0 +1,49 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "./string_pool.h"
+
+#include <string.h>
+#include "./arena.h"
+#include "../hashset-cpp/hashFn.h"
+
+static HashFn fn(19);
+
+size_t StringPool::KeyHash::operator()(const Key &key) const {
+    return static_cast<size_t>(fn(key.data, static_cast<int>(key.len)));
+}
+
+bool StringPool::KeyEqual::operator()(const Key &a, const Key &b) const {
+    return a.len == b.len && !memcmp(a.data, b.data, a.len);
+}
+
+StringPool::StringPool(Arena *arena) : arena(arena) {
+}
+
+char *StringPool::intern(const char *data, size_t len) {
+    auto found = strings.find(Key{data, len});
+    if (found != strings.end()) {
+        return const_cast<char *>(found->data);
+    }
+    char *copy = arena->copy(data, len);
+    strings.insert(Key{copy, len});
+    return copy;
+}
+
+uint32_t StringTable::add(const char *str) {
+    return add(str, strlen(str));
+}
+
+uint32_t StringTable::add(const char *str, size_t len) {
+    std::string key(str, len);
+    auto found = offsets.find(key);
+    if (found != offsets.end()) {
+        return found->second;
+    }
+    auto offset = static_cast<uint32_t>(data.size());
+    data.append(key);
+    data.push_back('\0');
+    offsets.emplace(std::move(key), offset);
+    return offset;
+}
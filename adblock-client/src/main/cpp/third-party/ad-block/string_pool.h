@@ -0,0 +1,85 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef STRING_POOL_H_
+#define STRING_POOL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include "./base.h"
+
+class Arena;
+
+/**
+ * Interns strings into an Arena while a list is parsed, so rules which
+ * share a domain list or a selector share one copy of it. The pooled
+ * strings live as long as the arena, the pool itself is only needed
+ * while adding strings and can be dropped before that.
+ *
+ * Not thread safe.
+ */
+class StringPool {
+public:
+    explicit StringPool(Arena *arena);
+
+    // Returns the pooled copy of |len| chars of |data| plus a terminator,
+    // the same pointer for every equal string
+    char *intern(const char *data, size_t len);
+
+    // Number of distinct strings
+    size_t getSize() const {
+        return strings.size();
+    }
+
+private:
+    struct Key {
+        const char *data;
+        size_t len;
+    };
+
+    struct KeyHash {
+        size_t operator()(const Key &key) const;
+    };
+
+    struct KeyEqual {
+        bool operator()(const Key &a, const Key &b) const;
+    };
+
+    StringPool(const StringPool &) = delete;
+
+    StringPool &operator=(const StringPool &) = delete;
+
+    Arena *arena;
+    std::unordered_set<Key, KeyHash, KeyEqual> strings;
+};
+
+/**
+ * Collects the strings of a serialized string table section, each is
+ * stored once NUL terminated and referenced by its offset.
+ */
+class StringTable {
+public:
+    // Adds |str| unless it's there already, returns its offset
+    uint32_t add(const char *str);
+
+    // Same as above for |len| chars of |str|, which needn't be terminated
+    uint32_t add(const char *str, size_t len);
+
+    const char *getData() const {
+        return data.data();
+    }
+
+    uint32_t getSize() const {
+        return static_cast<uint32_t>(data.size());
+    }
+
+private:
+    std::string data;
+    std::unordered_map<std::string, uint32_t> offsets;
+};
+
+#endif  // STRING_POOL_H_
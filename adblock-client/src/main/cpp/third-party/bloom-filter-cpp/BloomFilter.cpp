@@ -13,7 +13,8 @@
 
 BloomFilter::BloomFilter(unsigned int bitsPerElement,
                          unsigned int estimatedNumElements, HashFn *hashFns, int numHashFns) :
-        hashFns(nullptr), numHashFns(0), byteBufferSize(0), buffer(nullptr) {
+        hashFns(nullptr), numHashFns(0), byteBufferSize(0), buffer(nullptr),
+        borrowedBuffer(false) {
     this->hashFns = hashFns;
     this->numHashFns = numHashFns;
     byteBufferSize = bitsPerElement * estimatedNumElements / 8 + 1;
@@ -25,7 +26,8 @@ BloomFilter::BloomFilter(unsigned int bitsPerElement,
 // Constructs a BloomFilter by copying the specified buffer and number of bytes
 BloomFilter::BloomFilter(const char *buffer, int byteBufferSize,
                          HashFn *hashFns, int numHashFns) :
-        hashFns(nullptr), numHashFns(0), byteBufferSize(0), buffer(nullptr) {
+        hashFns(nullptr), numHashFns(0), byteBufferSize(0), buffer(nullptr),
+        borrowedBuffer(false) {
     this->hashFns = hashFns;
     this->numHashFns = numHashFns;
     this->byteBufferSize = byteBufferSize;
@@ -34,13 +36,36 @@ BloomFilter::BloomFilter(const char *buffer, int byteBufferSize,
     memcpy(this->buffer, buffer, byteBufferSize);
 }
 
+BloomFilter::BloomFilter(const char *buffer, int byteBufferSize, bool borrowBuffer,
+                         HashFn *hashFns, int numHashFns) :
+        hashFns(hashFns), numHashFns(numHashFns), byteBufferSize(byteBufferSize),
+        bitBufferSize(byteBufferSize * 8), buffer(nullptr), borrowedBuffer(borrowBuffer) {
+    if (borrowBuffer) {
+        // Never written through while borrowed, see ownBuffer()
+        this->buffer = const_cast<char *>(buffer);
+    } else {
+        this->buffer = new char[byteBufferSize];
+        memcpy(this->buffer, buffer, byteBufferSize);
+    }
+}
+
 BloomFilter::~BloomFilter() {
-    if (buffer) {
+    if (buffer && !borrowedBuffer) {
         delete[] buffer;
     }
 }
 
+void BloomFilter::ownBuffer() {
+    char *copy = new char[byteBufferSize];
+    memcpy(copy, buffer, byteBufferSize);
+    buffer = copy;
+    borrowedBuffer = false;
+}
+
 void BloomFilter::setBit(unsigned int bitLocation) {
+    if (borrowedBuffer) {
+        ownBuffer();
+    }
     buffer[bitLocation / 8] |= 1 << bitLocation % 8;
 }
 
@@ -110,5 +135,16 @@ bool BloomFilter::substringExists(const char *data, int substringLength) {
 }
 
 void BloomFilter::clear() {
+    if (borrowedBuffer) {
+        ownBuffer();
+    }
     memset(buffer, 0, byteBufferSize);
 }
+
+unsigned int BloomFilter::getNumSetBits() {
+    unsigned int count = 0;
+    for (unsigned int i = 0; i < byteBufferSize; i++) {
+        count += __builtin_popcount(static_cast<unsigned char>(buffer[i]));
+    }
+    return count;
+}
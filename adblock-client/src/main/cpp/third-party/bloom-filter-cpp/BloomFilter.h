@@ -38,6 +38,12 @@ public:
                 HashFn hashFns[] = defaultHashFns,
                 int numHashFns = sizeof(defaultHashFns) / sizeof(defaultHashFns[0]));
 
+    // With |borrowBuffer| the buffer is used without copying it and must
+    // outlive the filter, it is only copied once a bit gets set
+    BloomFilter(const char *buffer, int byteBufferSize, bool borrowBuffer,
+                HashFn hashFns[] = defaultHashFns,
+                int numHashFns = sizeof(defaultHashFns) / sizeof(defaultHashFns[0]));
+
     virtual ~BloomFilter();
 
     // Sets the specified bit in the buffer
@@ -95,12 +101,36 @@ public:
         return byteBufferSize;
     }
 
+    /**
+     * Obtains the number of bits of the buffer
+     */
+    unsigned int getBitBufferSize() {
+        return bitBufferSize;
+    }
+
+    /**
+     * Counts the bits which are set, the fill ratio is that divided by the
+     * number of bits
+     */
+    unsigned int getNumSetBits();
+
+    /**
+     * Whether the buffer is used in place instead of owned
+     */
+    bool isBufferBorrowed() {
+        return borrowedBuffer;
+    }
+
 private:
     HashFn *hashFns;
     int numHashFns;
     unsigned int byteBufferSize;
     unsigned int bitBufferSize;
     char *buffer;
+    bool borrowedBuffer;
+
+    // Replaces a borrowed buffer by an own copy before it gets modified
+    void ownBuffer();
 
     /**
      * Obtains the hashes for the specified charCodes
@@ -11,7 +11,7 @@
 #ifndef BASE_H_
 #define BASE_H_
 
-#if !defined(nullptr) && !defined(_MSC_VER)
+#if !defined(nullptr) && !defined(_MSC_VER) && __cplusplus < 201103L
 #define nullptr 0
 #endif
 
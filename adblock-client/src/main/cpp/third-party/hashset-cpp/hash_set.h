@@ -24,6 +24,8 @@
 
 #include "./base.h"
 #include "./hash_item.h"
+#include "./lazy_items.h"
+#include "./little_endian.h"
 
 template<class T>
 class HashSet {
@@ -55,6 +57,7 @@ public:
      * @return true if the data was added
      */
     bool Add(const T &item_to_add, bool update_if_exists = true) {
+        MaterializeInPlaceItems();
         if (!check_buckets()) return false;
         uint64_t hash = item_to_add.GetHash();
         HashItem<T> *hash_item = buckets_[hash % bucket_count_];
@@ -94,6 +97,14 @@ public:
      * @return true if the data found
      */
     bool Exists(const T &data_to_check) {
+        if (slots_) {
+            bool found = false;
+            FindInPlace(data_to_check, [&found](uint32_t) {
+                found = true;
+                return false;
+            });
+            return found;
+        }
         if (!check_buckets()) return false;
         uint64_t hash = data_to_check.GetHash();
         HashItem<T> *hash_item = buckets_[hash % bucket_count_];
@@ -117,8 +128,15 @@ public:
      * @return true if the data found
      */
     size_t GetMatchingCount(const T &data_to_check) {
-        if (!check_buckets()) return 0;
         size_t count = 0;
+        if (slots_) {
+            FindInPlace(data_to_check, [&count](uint32_t) {
+                count++;
+                return true;
+            });
+            return count;
+        }
+        if (!check_buckets()) return 0;
         uint64_t hash = data_to_check.GetHash();
         HashItem<T> *hash_item = buckets_[hash % bucket_count_];
         if (!hash_item) {
@@ -138,11 +156,20 @@ public:
     /**
      * Finds the specific data in the hash set.
      * This is useful because sometimes it contains more context
-     * than the object used for the lookup.
+     * than the object used for the lookup. An item of a set deserialized
+     * in place is built the first time it's found.
      * @param data_to_check The data to check
      * @return The data stored in the hash set or nullptr if none is found.
      */
     T *Find(const T &data_to_check) {
+        if (slots_) {
+            T *found = nullptr;
+            FindInPlace(data_to_check, [this, &found](uint32_t index) {
+                found = GetInPlaceItem(index);
+                return false;
+            });
+            return found;
+        }
         if (!check_buckets()) return nullptr;
         uint64_t hash = data_to_check.GetHash();
         HashItem<T> *hash_item = buckets_[hash % bucket_count_];
@@ -168,6 +195,13 @@ public:
      * @return The data stored in the hash set or nullptr if none is found.
      */
     void FindAll(const T &data_to_check, std::vector<T *> *result) {
+        if (slots_) {
+            FindInPlace(data_to_check, [this, result](uint32_t index) {
+                result->push_back(GetInPlaceItem(index));
+                return true;
+            });
+            return;
+        }
         if (!check_buckets()) return;
         uint64_t hash = data_to_check.GetHash();
         HashItem<T> *hash_item = buckets_[hash % bucket_count_];
@@ -189,6 +223,7 @@ public:
      * @return true if an item matching the data was removed
      */
     bool Remove(const T &data_to_check) {
+        MaterializeInPlaceItems();
         if (!check_buckets()) return false;
         uint64_t hash = data_to_check.GetHash();
         HashItem<T> *hash_item = buckets_[hash % bucket_count_];
@@ -225,6 +260,88 @@ public:
         return size_;
     }
 
+    /**
+     * Obtains the number of buckets, or of slots for a set deserialized in
+     * place
+     */
+    uint32_t GetBucketCount() const {
+        return slots_ ? slot_count_ : bucket_count_;
+    }
+
+    /**
+     * Obtains the bytes allocated for the set and its items, including what
+     * each item reports with GetAllocatedSize() but not the set itself. Of
+     * a set deserialized in place only the items built so far count.
+     */
+    size_t GetAllocatedSize() {
+        if (slots_) {
+            return sizeof(LazyItems<T>) + in_place_items_->GetAllocatedSize();
+        }
+        size_t size = bucket_count_ * sizeof(HashItem<T> *)
+                      + size_ * (sizeof(HashItem<T>) + sizeof(T));
+        ForEachItem([&size](T *item) { size += item->GetAllocatedSize(); });
+        return size;
+    }
+
+    /**
+     * Counts the buckets by the length of their chain into |histogram|,
+     * which is indexed by the length and grown as needed. The slots of a
+     * set deserialized in place are counted by the number of slots a
+     * lookup probes to reach their item instead, 0 for empty slots.
+     */
+    void GetChainLengths(std::vector<uint32_t> *histogram) const {
+        auto count = [histogram](uint32_t length) {
+            if (histogram->size() <= length) {
+                histogram->resize(length + 1);
+            }
+            (*histogram)[length]++;
+        };
+        if (slots_) {
+            uint32_t mask = slot_count_ - 1;
+            for (uint32_t slot = 0; slot < slot_count_; slot++) {
+                const char *p = slots_ + slot * kSlotSize;
+                if (getUint32LE(p + 4) == 0) {
+                    count(0);
+                } else {
+                    count(((slot - getUint32LE(p)) & mask) + 1);
+                }
+            }
+            return;
+        }
+        for (uint32_t i = 0; i < bucket_count_; i++) {
+            uint32_t length = 0;
+            for (HashItem<T> *hash_item = buckets_[i]; hash_item;
+                 hash_item = hash_item->next_) {
+                length++;
+            }
+            count(length);
+        }
+    }
+
+    /**
+     * Calls |f| with a pointer to each item. The items of a set deserialized
+     * in place are read into a temporary which only lives during the call.
+     */
+    template<typename F>
+    void ForEachItem(F f) {
+        if (slots_) {
+            for (uint32_t i = 0; i < size_; i++) {
+                T item;
+                if (ReadItem(i, &item)) {
+                    f(&item);
+                }
+            }
+            return;
+        }
+        for (uint32_t i = 0; i < bucket_count_; i++) {
+            HashItem<T> *hash_item = buckets_[i];
+            while (hash_item) {
+                f(hash_item->hash_item_storage_);
+                hash_item = hash_item->next_;
+            }
+        }
+    }
+
     /**
      * Serializes the parsed data and bloom filter data into a single buffer.
      * @param size The size is returned in the out parameter if it's needed to
@@ -240,90 +357,155 @@ public:
         return buffer;
     }
 
+    /**
+     * Serializes the bucket count, the multi set flag, the number of items
+     * and the number of slots as little endian uint32, followed by an open
+     * addressing slot table, the offset of every item from the start of the
+     * set as little endian uint32 and the items in bucket order. Every slot
+     * holds the low 32 bits of an item hash and the 1 based index of the
+     * item, 0 marks an empty slot. Items are placed by linear probing from
+     * hash & (slot count - 1), so the hash function is part of the format.
+     * @param buffer The buffer to fill or nullptr to only compute the size
+     * @return The number of bytes written or needed
+     */
     uint32_t Serialize(char *buffer) {
-        uint32_t total_size = 0;
-        char sz[512];
-        total_size += 1 + snprintf(sz, sizeof(sz), "%x,%x",
-                                   bucket_count_, multi_set_ ? 1 : 0);
+        uint32_t slot_count = GetSlotCount(size_);
+        uint32_t total_size = GetTableSize(slot_count, size_);
         if (buffer) {
-            memcpy(buffer, sz, total_size);
-        }
-        for (uint32_t i = 0; i < bucket_count_; i++) {
-            HashItem<T> *hash_item = buckets_[i];
-            while (hash_item) {
-                if (buffer) {
-                    total_size +=
-                            hash_item->hash_item_storage_->Serialize(buffer + total_size);
-                } else {
-                    total_size += hash_item->hash_item_storage_->Serialize(nullptr);
-                }
-                hash_item = hash_item->next_;
-            }
-            if (buffer) {
-                buffer[total_size] = '\0';
-            }
-            // Second null terminator to show next bucket
-            total_size++;
+            PutTable(buffer, slot_count);
         }
+        ForEachItem([&](T *item) {
+            total_size += item->Serialize(buffer ? buffer + total_size : nullptr);
+        });
         return total_size;
     }
 
+    /**
+     * Serializes like Serialize() in pieces, the header, slot table and
+     * item offsets first and then one item at a time. |writer| provides
+     * char *reserve(uint32_t size) for room to write the next piece into
+     * and void append(uint32_t size) to add it.
+     */
+    template<class W>
+    void SerializeTo(W *writer) {
+        uint32_t slot_count = GetSlotCount(size_);
+        uint32_t table_size = GetTableSize(slot_count, size_);
+        PutTable(writer->reserve(table_size), slot_count);
+        writer->append(table_size);
+        ForEachItem([&](T *item) {
+            uint32_t size = item->Serialize(nullptr);
+            item->Serialize(writer->reserve(size));
+            writer->append(size);
+        });
+    }
+
     /**
      * Deserializes the buffer.
      * Memory passed in will be used by this instance directly without copying
      * it in.
      * @param buffer The serialized data to deserialize
      * @param buffer_size the size of the buffer to deserialize
-     * @return true if the operation was successful
+     * @return The number of bytes consumed or 0 if the data is invalid
      */
     uint32_t Deserialize(char *buffer, uint32_t buffer_size) {
         Cleanup();
-        uint32_t pos = 0;
-        if (!HasNewlineBefore(buffer, buffer_size)) {
+        uint32_t bucket_count, size, slot_count;
+        uint32_t pos = ReadHeader(buffer, buffer_size, &bucket_count, &size,
+                                  &slot_count);
+        if (pos == 0) {
             return 0;
         }
+        Init(bucket_count);
+
+        // Items were written in bucket order, so they're appended to the
+        // chain which was extended last unless the bucket changes
+        uint32_t last_bucket = 0;
+        HashItem<T> *last_hash_item = nullptr;
+        for (uint32_t i = 0; i < size; i++) {
+            auto *hash_item = new HashItem<T>();
+            hash_item->hash_item_storage_ = new T();
+            uint32_t deserialize_size =
+                    hash_item->hash_item_storage_->Deserialize(buffer + pos,
+                                                               buffer_size - pos);
+            if (deserialize_size == 0) {
+                delete hash_item;
+                return 0;
+            }
+            pos += deserialize_size;
 
-        uint32_t multi_set = 0;
-        sscanf(buffer + pos, "%x,%x", &bucket_count_, &multi_set);
-        pos += static_cast<uint32_t>(strlen(buffer + pos)) + 1;
-        multi_set_ = multi_set != 0;
-        if (bucket_count_ == 0) {
-            return pos;// at this moment, pos == buffer_size
+            uint32_t bucket = hash_item->hash_item_storage_->GetHash() % bucket_count_;
+            if (!last_hash_item || bucket != last_bucket) {
+                last_hash_item = buckets_[bucket];
+                while (last_hash_item && last_hash_item->next_) {
+                    last_hash_item = last_hash_item->next_;
+                }
+            }
+            if (last_hash_item) {
+                last_hash_item->next_ = hash_item;
+            } else {
+                buckets_[bucket] = hash_item;
+            }
+            last_bucket = bucket;
+            last_hash_item = hash_item;
+            size_++;
         }
-        buckets_ = new HashItem<T> *[bucket_count_];
-        memset(buckets_, 0, sizeof(HashItem<T> *) * bucket_count_);
-        if (pos >= buffer_size) {
+        return pos;
+    }
+
+    /**
+     * Deserializes the buffer for lookups without building buckets or
+     * reading the items. The serialized slot table is probed in place and
+     * a candidate item is read from the buffer into a temporary to compare
+     * it, so loading takes constant time. Find() builds the items it
+     * returns into a side table, so they keep their address. The first
+     * Add or Remove turns the set into a regular one. The buffer has to
+     * outlive the set.
+     * @param buffer The serialized data to deserialize
+     * @param buffer_size the size of the buffer to deserialize
+     * @return |buffer_size|, since the items are only read once they're
+     * needed, or 0 if the header is invalid
+     */
+    uint32_t DeserializeInPlace(char *buffer, uint32_t buffer_size) {
+        Cleanup();
+        uint32_t bucket_count, size, slot_count;
+        uint32_t pos = ReadHeader(buffer, buffer_size, &bucket_count, &size,
+                                  &slot_count);
+        if (pos == 0) {
             return 0;
         }
-        for (uint32_t i = 0; i < bucket_count_; i++) {
-            HashItem<T> *last_hash_item = nullptr;
-            while (*(buffer + pos) != '\0') {
-                if (pos >= buffer_size) {
-                    return 0;
-                }
-
-                HashItem<T> *hash_item = new HashItem<T>();
-                hash_item->hash_item_storage_ = new T();
-                uint32_t deserialize_size =
-                        hash_item->hash_item_storage_->Deserialize(buffer + pos,
-                                                                   buffer_size - pos);
-                pos += deserialize_size;
-                if (pos >= buffer_size || deserialize_size == 0) {
-                    return 0;
-                }
+        bucket_count_ = bucket_count;
+        buffer_ = buffer;
+        buffer_size_ = buffer_size;
+        slots_ = buffer + kSerializedHeaderSize;
+        slot_count_ = slot_count;
+        offsets_ = slots_ + slot_count * kSlotSize;
+        size_ = size;
+        in_place_items_ = new LazyItems<T>();
+        in_place_items_->Reset(size);
+        // Taken here, so only the items of sets deserialized in place need
+        // to support Deserialize()
+        read_item_ = &ReadItemAt;
+        return buffer_size;
+    }
 
-                size_++;
+    /**
+     * Finds the index of |item| in a set deserialized in place, which
+     * Find() returned
+     */
+    bool IndexOf(const T *item, uint32_t *index) const {
+        return slots_ && in_place_items_->IndexOf(item, index);
+    }
 
-                if (last_hash_item) {
-                    last_hash_item->next_ = hash_item;
-                } else {
-                    buckets_[i] = hash_item;
-                }
-                last_hash_item = hash_item;
-            }
-            pos++;
+    /**
+     * Reads item |index| of a set deserialized in place into |item|,
+     * returns false if there's no such item or it's damaged
+     */
+    bool ReadItem(uint32_t index, T *item) const {
+        if (!slots_ || index >= size_) {
+            return false;
         }
-        return pos;
+        return read_item_(buffer_, buffer_size_,
+                          getUint32LE(offsets_ + index * 4), item);
     }
 
     /**
@@ -344,20 +526,19 @@ public:
     }
 
 private:
-    bool HasNewlineBefore(char *buffer, uint32_t buffer_size) {
-        char *p = buffer;
-        for (uint32_t i = 0; i < buffer_size; ++i) {
-            if (*p == '\0')
-                return true;
-            p++;
-        }
-        return false;
-    }
+    static const uint32_t kSlotSize = 8;
 
     void Init(uint32_t num_buckets) {
         bucket_count_ = num_buckets;
         buckets_ = nullptr;
         size_ = 0;
+        buffer_ = nullptr;
+        buffer_size_ = 0;
+        slots_ = nullptr;
+        slot_count_ = 0;
+        offsets_ = nullptr;
+        in_place_items_ = nullptr;
+        read_item_ = nullptr;
         if (bucket_count_ != 0) {
             buckets_ = new HashItem<T> *[bucket_count_];
             memset(buckets_, 0, sizeof(HashItem<T> *) * bucket_count_);
@@ -376,12 +557,158 @@ private:
             }
             delete[] buckets_;
             buckets_ = nullptr;
-            bucket_count_ = 0;
-            size_ = 0;
+        }
+        delete in_place_items_;
+        in_place_items_ = nullptr;
+        buffer_ = nullptr;
+        buffer_size_ = 0;
+        slots_ = nullptr;
+        slot_count_ = 0;
+        offsets_ = nullptr;
+        read_item_ = nullptr;
+        bucket_count_ = 0;
+        size_ = 0;
+    }
+
+    // Reads the header and checks that the slot table and the item offsets
+    // fit, returns the position of the first item or 0 if the header is
+    // invalid
+    uint32_t ReadHeader(const char *buffer, uint32_t buffer_size,
+                        uint32_t *bucket_count, uint32_t *size,
+                        uint32_t *slot_count) {
+        if (buffer_size < kSerializedHeaderSize) {
+            return 0;
+        }
+        *bucket_count = getUint32LE(buffer);
+        multi_set_ = getUint32LE(buffer + 4) != 0;
+        *size = getUint32LE(buffer + 8);
+        *slot_count = getUint32LE(buffer + 12);
+        if ((*size > 0 && *bucket_count == 0) || *size > *slot_count
+            || (*slot_count & (*slot_count - 1)) != 0
+            || *slot_count > (buffer_size - kSerializedHeaderSize) / kSlotSize
+            || *size > (buffer_size - kSerializedHeaderSize
+                        - *slot_count * kSlotSize) / 4) {
+            return 0;
+        }
+        return GetTableSize(*slot_count, *size);
+    }
+
+    // Size of the header, the slot table and the item offsets
+    static uint32_t GetTableSize(uint32_t slot_count, uint32_t size) {
+        return kSerializedHeaderSize + slot_count * kSlotSize + size * 4;
+    }
+
+    // Smallest power of 2 which keeps the slot table at most 3/4 full
+    static uint32_t GetSlotCount(uint32_t size) {
+        if (size == 0) {
+            return 0;
+        }
+        uint32_t slot_count = 1;
+        while (static_cast<uint64_t>(slot_count) * 3 / 4 < size) {
+            slot_count <<= 1;
+        }
+        return slot_count;
+    }
+
+    // Writes the header, the slot table of |slot_count| slots and the
+    // offsets of the items
+    void PutTable(char *buffer, uint32_t slot_count) {
+        putUint32LE(buffer, bucket_count_);
+        putUint32LE(buffer + 4, multi_set_ ? 1 : 0);
+        putUint32LE(buffer + 8, size_);
+        putUint32LE(buffer + 12, slot_count);
+        memset(buffer + kSerializedHeaderSize, 0, slot_count * kSlotSize);
+        char *offsets = buffer + kSerializedHeaderSize + slot_count * kSlotSize;
+        uint32_t offset = GetTableSize(slot_count, size_);
+        uint32_t index = 0;
+        ForEachItem([&](T *item) {
+            putUint32LE(offsets + index * 4, offset);
+            offset += item->Serialize(nullptr);
+            PutSlot(buffer + kSerializedHeaderSize, slot_count,
+                    item->GetHash(), ++index);
+        });
+    }
+
+    static void PutSlot(char *slots, uint32_t slot_count, uint64_t hash,
+                        uint32_t index) {
+        uint32_t mask = slot_count - 1;
+        uint32_t slot = static_cast<uint32_t>(hash) & mask;
+        while (getUint32LE(slots + slot * kSlotSize + 4) != 0) {
+            slot = (slot + 1) & mask;
+        }
+        putUint32LE(slots + slot * kSlotSize, static_cast<uint32_t>(hash));
+        putUint32LE(slots + slot * kSlotSize + 4, index);
+    }
+
+    // Reads the item at |offset| of |buffer| into |item|
+    static bool ReadItemAt(char *buffer, uint32_t buffer_size,
+                           uint32_t offset, T *item) {
+        return offset < buffer_size
+               && item->Deserialize(buffer + offset, buffer_size - offset) != 0;
+    }
+
+    // Item |index| of a set deserialized in place, built on first use
+    T *GetInPlaceItem(uint32_t index) {
+        return in_place_items_->Get(index, [this, index](void *room) {
+            T *item = new (room) T();
+            ReadItem(index, item);
+        });
+    }
+
+    // Calls |on_match| with the index of each item deserialized in place
+    // which equals |data_to_check|, in the order they were added, until it
+    // returns false. Damaged items never match.
+    template<typename F>
+    void FindInPlace(const T &data_to_check, F on_match) {
+        if (slot_count_ == 0) {
+            return;
+        }
+        uint64_t hash = data_to_check.GetHash();
+        uint32_t mask = slot_count_ - 1;
+        uint32_t slot = static_cast<uint32_t>(hash) & mask;
+        for (uint32_t i = 0; i < slot_count_; i++) {
+            const char *p = slots_ + slot * kSlotSize;
+            uint32_t index = getUint32LE(p + 4);
+            if (index == 0) {
+                return;
+            }
+            if (getUint32LE(p) == static_cast<uint32_t>(hash)
+                && index <= size_) {
+                T item;
+                if (ReadItem(index - 1, &item) && item == data_to_check
+                    && !on_match(index - 1)) {
+                    return;
+                }
+            }
+            slot = (slot + 1) & mask;
         }
     }
 
 protected:
+    static const uint32_t kSerializedHeaderSize = 16;
+
+    // Turns a set deserialized in place into a regular one, copying the
+    // items into buckets
+    void MaterializeInPlaceItems() {
+        if (!slots_) {
+            return;
+        }
+        char *buffer = buffer_;
+        uint32_t buffer_size = buffer_size_;
+        const char *offsets = offsets_;
+        uint32_t size = size_;
+        auto read_item = read_item_;
+        delete in_place_items_;
+        Init(bucket_count_);
+        for (uint32_t i = 0; i < size; i++) {
+            T item;
+            if (read_item(buffer, buffer_size, getUint32LE(offsets + i * 4),
+                          &item)) {
+                Add(item, false);
+            }
+        }
+    }
+
     bool check_buckets() {
         return buckets_ && bucket_count_ > 0;
     }
@@ -391,6 +718,18 @@ protected:
     uint32_t bucket_count_;
     HashItem<T> **buckets_;
     uint32_t size_;
+
+private:
+    // Set by DeserializeInPlace until the set is changed, the slots, the
+    // item offsets and the items are in the deserialized buffer
+    char *buffer_;
+    uint32_t buffer_size_;
+    const char *slots_;
+    uint32_t slot_count_;
+    const char *offsets_;
+    LazyItems<T> *in_place_items_;
+    bool (*read_item_)(char *buffer, uint32_t buffer_size, uint32_t offset,
+                       T *item);
 };
 
 #endif  // HASH_SET_H_
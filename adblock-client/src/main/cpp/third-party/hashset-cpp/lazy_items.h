@@ -0,0 +1,112 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+// Side table for items which are used in place from a serialized buffer
+// and only built into objects when they're asked for, e.g. because they
+// keep runtime state. Room for every item is reserved up front, so a
+// built item keeps its address and its index can be told from it.
+
+#ifndef LAZY_ITEMS_H_
+#define LAZY_ITEMS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+#include <new>
+
+template<class T>
+class LazyItems {
+public:
+    LazyItems() : items_(nullptr), built_(nullptr), size_(0) {
+    }
+
+    ~LazyItems() {
+        Reset(0);
+    }
+
+    /**
+     * Destroys the built items and reserves room for |size| items, none
+     * of which is built. Must not run along Get().
+     */
+    void Reset(uint32_t size) {
+        for (uint32_t i = 0; i < size_; i++) {
+            if (built_[i].load(std::memory_order_relaxed)) {
+                items_[i].~T();
+            }
+        }
+        ::operator delete(items_);
+        delete[] built_;
+        items_ = nullptr;
+        built_ = nullptr;
+        size_ = size;
+        if (size > 0) {
+            items_ = static_cast<T *>(::operator new(sizeof(T) * size));
+            built_ = new std::atomic<bool>[size]();
+        }
+    }
+
+    uint32_t GetSize() const {
+        return size_;
+    }
+
+    /**
+     * Returns item |index|, which has to be below the size. The first time
+     * it's asked for |build| is called with the room of the item to
+     * construct it there. Safe to call from several threads.
+     */
+    template<typename F>
+    T *Get(uint32_t index, F build) {
+        if (!built_[index].load(std::memory_order_acquire)) {
+            std::lock_guard<std::mutex> guard(lock_);
+            if (!built_[index].load(std::memory_order_relaxed)) {
+                build(static_cast<void *>(items_ + index));
+                built_[index].store(true, std::memory_order_release);
+            }
+        }
+        return items_ + index;
+    }
+
+    /**
+     * Finds the index of |item| if it's one of the items
+     */
+    bool IndexOf(const T *item, uint32_t *index) const {
+        auto address = reinterpret_cast<uintptr_t>(item);
+        auto begin = reinterpret_cast<uintptr_t>(items_);
+        if (!items_ || address < begin
+            || address - begin >= static_cast<uintptr_t>(size_) * sizeof(T)
+            || (address - begin) % sizeof(T) != 0) {
+            return false;
+        }
+        *index = static_cast<uint32_t>((address - begin) / sizeof(T));
+        return true;
+    }
+
+    /**
+     * Obtains the bytes allocated for the flags and the items built so
+     * far, including what each reports with GetAllocatedSize(). The room
+     * of items which weren't built is never touched and isn't counted.
+     */
+    size_t GetAllocatedSize() const {
+        size_t size = size_ * sizeof(std::atomic<bool>);
+        for (uint32_t i = 0; i < size_; i++) {
+            if (built_[i].load(std::memory_order_acquire)) {
+                size += sizeof(T) + items_[i].GetAllocatedSize();
+            }
+        }
+        return size;
+    }
+
+private:
+    LazyItems(const LazyItems &) = delete;
+
+    LazyItems &operator=(const LazyItems &) = delete;
+
+    T *items_;
+    std::atomic<bool> *built_;
+    uint32_t size_;
+    std::mutex lock_;
+};
+
+#endif  // LAZY_ITEMS_H_
@@ -0,0 +1,29 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+// Fixed width little endian integers for the binary serialization, safe
+// for unaligned buffers and independent of the host byte order
+
+#ifndef LITTLE_ENDIAN_H_
+#define LITTLE_ENDIAN_H_
+
+#include <stdint.h>
+
+inline void putUint32LE(char *buffer, uint32_t value) {
+    auto *p = reinterpret_cast<unsigned char *>(buffer);
+    p[0] = static_cast<unsigned char>(value);
+    p[1] = static_cast<unsigned char>(value >> 8);
+    p[2] = static_cast<unsigned char>(value >> 16);
+    p[3] = static_cast<unsigned char>(value >> 24);
+}
+
+inline uint32_t getUint32LE(const char *buffer) {
+    auto *p = reinterpret_cast<const unsigned char *>(buffer);
+    return static_cast<uint32_t>(p[0])
+           | static_cast<uint32_t>(p[1]) << 8
+           | static_cast<uint32_t>(p[2]) << 16
+           | static_cast<uint32_t>(p[3]) << 24;
+}
+
+#endif  // LITTLE_ENDIAN_H_
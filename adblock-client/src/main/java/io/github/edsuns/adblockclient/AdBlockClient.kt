@@ -16,8 +16,15 @@
 
 package io.github.edsuns.adblockclient
 
+import android.content.ComponentCallbacks2
 import android.net.Uri
+import android.os.ParcelFileDescriptor
 import timber.log.Timber
+import java.io.File
+import java.nio.ByteBuffer
+import java.util.concurrent.locks.ReentrantReadWriteLock
+import kotlin.concurrent.read
+import kotlin.concurrent.write
 
 
 /**
@@ -30,12 +37,16 @@ import timber.log.Timber
 class AdBlockClient(override val id: String) : Client {
 
     private val nativeClientPointer: Long
-    private var rawDataPointer: Long
     private var processedDataPointer: Long
 
+    // Queries returning what trimMemory() frees read it under this lock
+    private val trimLock = ReentrantReadWriteLock()
+
+    // Enabling the latency stats creates them, which mustn't race reading them
+    private val latencyStatsLock = Any()
+
     init {
         nativeClientPointer = createClient()
-        rawDataPointer = 0
         processedDataPointer = 0
     }
 
@@ -47,10 +58,24 @@ class AdBlockClient(override val id: String) : Client {
     fun loadBasicData(data: ByteArray, preserveRules: Boolean = false) {
         val timestamp = System.currentTimeMillis()
         Timber.d("Loading basic data for $id")
-        rawDataPointer = loadBasicData(nativeClientPointer, data, preserveRules)
+        loadBasicData(nativeClientPointer, data, preserveRules)
         Timber.d("Loading basic data for $id completed in ${System.currentTimeMillis() - timestamp}ms")
     }
 
+    /**
+     * Parses the UTF-8 filter list in [file] straight from a mapping of the file,
+     * so the list is never copied into a [ByteArray] or native memory.
+     *
+     * @return false if the file can't be read
+     */
+    fun loadBasicFile(file: File, preserveRules: Boolean = false): Boolean {
+        val timestamp = System.currentTimeMillis()
+        Timber.d("Loading basic file for $id")
+        val loaded = loadBasicFile(nativeClientPointer, file.path, preserveRules)
+        Timber.d("Loading basic file for $id completed in ${System.currentTimeMillis() - timestamp}ms")
+        return loaded
+    }
+
     override var isGenericElementHidingEnabled: Boolean
         get() = isGenericElementHidingEnabled(nativeClientPointer)
         set(value) = setGenericElementHidingEnabled(nativeClientPointer, value)
@@ -63,7 +88,13 @@ class AdBlockClient(override val id: String) : Client {
         clientPointer: Long,
         data: ByteArray,
         preserveRules: Boolean
-    ): Long
+    )
+
+    private external fun loadBasicFile(
+        clientPointer: Long,
+        path: String,
+        preserveRules: Boolean
+    ): Boolean
 
     fun loadProcessedData(data: ByteArray) {
         val timestamp = System.currentTimeMillis()
@@ -74,10 +105,99 @@ class AdBlockClient(override val id: String) : Client {
 
     private external fun loadProcessedData(clientPointer: Long, data: ByteArray): Long
 
+    /**
+     * Loads the file written by [saveProcessedData] by mapping it into memory
+     * instead of copying it. The file must be replaced by renaming a new one
+     * over it rather than rewritten while the client is alive. Nothing is
+     * parsed, but the network filters are still built one by one, so the time
+     * grows with the number of rules.
+     *
+     * @return false if the file can't be mapped or is corrupted
+     */
+    fun loadProcessedFile(file: File): Boolean {
+        val timestamp = System.currentTimeMillis()
+        Timber.d("Loading preprocessed file for $id")
+        val loaded = loadProcessedFile(nativeClientPointer, file.path)
+        Timber.d("Loading preprocessed file for $id completed in ${System.currentTimeMillis() - timestamp}ms")
+        return loaded
+    }
+
+    private external fun loadProcessedFile(clientPointer: Long, path: String): Boolean
+
+    /**
+     * Loads the data published by [shareProcessedData] in another process by mapping
+     * the shared memory, so the processes share one copy of the data.
+     *
+     * @return false if the memory isn't sealed or the data is corrupted
+     */
+    fun loadSharedData(fd: ParcelFileDescriptor): Boolean {
+        val timestamp = System.currentTimeMillis()
+        Timber.d("Loading shared data for $id")
+        val loaded = loadSharedData(nativeClientPointer, fd.fd)
+        Timber.d("Loading shared data for $id completed in ${System.currentTimeMillis() - timestamp}ms")
+        return loaded
+    }
+
+    private external fun loadSharedData(clientPointer: Long, fd: Int): Boolean
+
     fun getProcessedData(): ByteArray = getProcessedData(nativeClientPointer)
 
     private external fun getProcessedData(clientPointer: Long): ByteArray
 
+    /**
+     * Writes the processed data to [file] without holding a copy of it in memory.
+     * The file is replaced atomically, so clients which loaded it with
+     * [loadProcessedFile] aren't affected.
+     *
+     * @return false if the file can't be written
+     */
+    fun saveProcessedData(file: File): Boolean {
+        val timestamp = System.currentTimeMillis()
+        Timber.d("Saving processed data for $id")
+        val saved = saveProcessedData(nativeClientPointer, file.path)
+        Timber.d("Saving processed data for $id completed in ${System.currentTimeMillis() - timestamp}ms")
+        return saved
+    }
+
+    private external fun saveProcessedData(clientPointer: Long, path: String): Boolean
+
+    fun interface SaveCallback {
+        fun onSaved(saved: Boolean)
+    }
+
+    /**
+     * Like [saveProcessedData] but on a background native thread, the client can be
+     * used meanwhile. [callback] is called on that thread once the file is written
+     * and must not load or save data with this client, which waits for the thread.
+     */
+    fun saveProcessedDataAsync(file: File, callback: SaveCallback) {
+        Timber.d("Saving processed data for $id in the background")
+        saveProcessedDataAsync(nativeClientPointer, file.path, callback)
+    }
+
+    private external fun saveProcessedDataAsync(
+        clientPointer: Long,
+        path: String,
+        callback: SaveCallback
+    )
+
+    /**
+     * Writes the processed data to sealed shared memory which can't be changed
+     * anymore. Send the descriptor to other processes, e.g. through a Binder call,
+     * and load it there with [loadSharedData].
+     *
+     * @return null if the device doesn't support sealed shared memory
+     */
+    fun shareProcessedData(): ParcelFileDescriptor? {
+        val timestamp = System.currentTimeMillis()
+        Timber.d("Sharing processed data for $id")
+        val fd = shareProcessedData(nativeClientPointer, id)
+        Timber.d("Sharing processed data for $id completed in ${System.currentTimeMillis() - timestamp}ms")
+        return if (fd < 0) null else ParcelFileDescriptor.adoptFd(fd)
+    }
+
+    private external fun shareProcessedData(clientPointer: Long, name: String): Int
+
     fun getFiltersCount(): Int = getFiltersCount(nativeClientPointer)
 
     private external fun getFiltersCount(clientPointer: Long): Int
@@ -88,7 +208,9 @@ class AdBlockClient(override val id: String) : Client {
         resourceType: ResourceType
     ): MatchResult {
         val firstPartyDomain = documentUrl.baseHost() ?: return MatchResult(false, null, null)
-        return matches(nativeClientPointer, url, firstPartyDomain, resourceType.filterOption)
+        return trimLock.read {
+            matches(nativeClientPointer, url, firstPartyDomain, resourceType.filterOption)
+        }
     }
 
     private external fun matches(
@@ -98,17 +220,95 @@ class AdBlockClient(override val id: String) : Client {
         filterOption: Int
     ): MatchResult
 
+    override fun matchesPacked(
+        url: String,
+        documentUrl: String,
+        resourceType: ResourceType
+    ): PackedMatchResult {
+        val firstPartyDomain = documentUrl.baseHost() ?: return PackedMatchResult.NONE
+        return PackedMatchResult(
+            matchesPacked(nativeClientPointer, url, firstPartyDomain, resourceType.filterOption)
+        )
+    }
+
+    private external fun matchesPacked(
+        clientPointer: Long,
+        url: String,
+        firstPartyDomain: String,
+        filterOption: Int
+    ): Long
+
+    /**
+     * Same as [matchesPacked] with the UTF-8 bytes of [url] from its position, they go
+     * to the engine as they are instead of being converted from a [String].
+     *
+     * @param url a direct [ByteBuffer]
+     */
+    fun matchesPacked(
+        url: ByteBuffer,
+        documentUrl: String,
+        resourceType: ResourceType,
+        urlLength: Int = url.remaining()
+    ): PackedMatchResult {
+        url.requireDirect()
+        val firstPartyDomain = documentUrl.baseHost() ?: return PackedMatchResult.NONE
+        return PackedMatchResult(
+            matchesBytes(
+                nativeClientPointer, url, null, url.position(), urlLength,
+                firstPartyDomain, resourceType.filterOption
+            )
+        )
+    }
+
+    /**
+     * Same as [matchesPacked] with the UTF-8 bytes of [url] from [urlOffset].
+     */
+    fun matchesPacked(
+        url: ByteArray,
+        documentUrl: String,
+        resourceType: ResourceType,
+        urlOffset: Int = 0,
+        urlLength: Int = url.size - urlOffset
+    ): PackedMatchResult {
+        val firstPartyDomain = documentUrl.baseHost() ?: return PackedMatchResult.NONE
+        return PackedMatchResult(
+            matchesBytes(
+                nativeClientPointer, null, url, urlOffset, urlLength,
+                firstPartyDomain, resourceType.filterOption
+            )
+        )
+    }
+
+    /**
+     * Either [urlBuffer] or [urlBytes] holds the URL, the result is 0 if it's shorter
+     * than [urlLength].
+     */
+    private external fun matchesBytes(
+        clientPointer: Long,
+        urlBuffer: ByteBuffer?,
+        urlBytes: ByteArray?,
+        urlOffset: Int,
+        urlLength: Int,
+        firstPartyDomain: String,
+        filterOption: Int
+    ): Long
+
+    override fun getRuleText(ruleId: Int): String? =
+        if (ruleId < 0) null else trimLock.read { getRuleText(nativeClientPointer, ruleId) }
+
+    private external fun getRuleText(clientPointer: Long, ruleId: Int): String?
+
     override fun getElementHidingSelectors(url: String): String? =
-        getElementHidingSelectors(nativeClientPointer, url)
+        trimLock.read { getElementHidingSelectors(nativeClientPointer, url) }
 
     override fun getExtendedCssSelectors(url: String): Array<String>? =
-        getExtendedCssSelectors(nativeClientPointer, url)
+        trimLock.read { getExtendedCssSelectors(nativeClientPointer, url) }
 
     override fun getCssRules(url: String): Array<String>? =
-        getCssRules(nativeClientPointer, url)
+        trimLock.read { getCssRules(nativeClientPointer, url) }
 
     override fun getScriptlets(url: String): Array<String>? =
-        getScriptlets(nativeClientPointer, url)
+        trimLock.read { getScriptlets(nativeClientPointer, url) }
 
     private external fun getElementHidingSelectors(clientPointer: Long, url: String): String?
 
@@ -118,24 +318,181 @@ class AdBlockClient(override val id: String) : Client {
 
     private external fun getScriptlets(clientPointer: Long, url: String): Array<String>?
 
+    // Cosmetic queries with the URL as UTF-8 bytes, like matchesPacked()
+
+    fun getElementHidingSelectors(url: ByteBuffer, urlLength: Int = url.remaining()): String? =
+        trimLock.read {
+            getElementHidingSelectorsBytes(
+                nativeClientPointer, url.requireDirect(), null, url.position(), urlLength
+            )
+        }
+
+    fun getElementHidingSelectors(
+        url: ByteArray,
+        urlOffset: Int = 0,
+        urlLength: Int = url.size - urlOffset
+    ): String? = trimLock.read {
+        getElementHidingSelectorsBytes(nativeClientPointer, null, url, urlOffset, urlLength)
+    }
+
+    fun getExtendedCssSelectors(url: ByteBuffer, urlLength: Int = url.remaining()): Array<String>? =
+        trimLock.read {
+            getExtendedCssSelectorsBytes(
+                nativeClientPointer, url.requireDirect(), null, url.position(), urlLength
+            )
+        }
+
+    fun getExtendedCssSelectors(
+        url: ByteArray,
+        urlOffset: Int = 0,
+        urlLength: Int = url.size - urlOffset
+    ): Array<String>? = trimLock.read {
+        getExtendedCssSelectorsBytes(nativeClientPointer, null, url, urlOffset, urlLength)
+    }
+
+    fun getCssRules(url: ByteBuffer, urlLength: Int = url.remaining()): Array<String>? =
+        trimLock.read {
+            getCssRulesBytes(
+                nativeClientPointer, url.requireDirect(), null, url.position(), urlLength
+            )
+        }
+
+    fun getCssRules(
+        url: ByteArray,
+        urlOffset: Int = 0,
+        urlLength: Int = url.size - urlOffset
+    ): Array<String>? = trimLock.read {
+        getCssRulesBytes(nativeClientPointer, null, url, urlOffset, urlLength)
+    }
+
+    fun getScriptlets(url: ByteBuffer, urlLength: Int = url.remaining()): Array<String>? =
+        trimLock.read {
+            getScriptletsBytes(
+                nativeClientPointer, url.requireDirect(), null, url.position(), urlLength
+            )
+        }
+
+    fun getScriptlets(
+        url: ByteArray,
+        urlOffset: Int = 0,
+        urlLength: Int = url.size - urlOffset
+    ): Array<String>? = trimLock.read {
+        getScriptletsBytes(nativeClientPointer, null, url, urlOffset, urlLength)
+    }
+
+    private external fun getElementHidingSelectorsBytes(
+        clientPointer: Long, urlBuffer: ByteBuffer?, urlBytes: ByteArray?,
+        urlOffset: Int, urlLength: Int
+    ): String?
+
+    private external fun getExtendedCssSelectorsBytes(
+        clientPointer: Long, urlBuffer: ByteBuffer?, urlBytes: ByteArray?,
+        urlOffset: Int, urlLength: Int
+    ): Array<String>?
+
+    private external fun getCssRulesBytes(
+        clientPointer: Long, urlBuffer: ByteBuffer?, urlBytes: ByteArray?,
+        urlOffset: Int, urlLength: Int
+    ): Array<String>?
+
+    private external fun getScriptletsBytes(
+        clientPointer: Long, urlBuffer: ByteBuffer?, urlBytes: ByteArray?,
+        urlOffset: Int, urlLength: Int
+    ): Array<String>?
+
+    /**
+     * Releases memory the client rebuilds when it's needed again, pass the level of
+     * [ComponentCallbacks2.onTrimMemory]. The cached cosmetic results are dropped at
+     * any level, from [ComponentCallbacks2.TRIM_MEMORY_RUNNING_LOW] on the cosmetic
+     * rules and rule texts loaded from processed data are dropped too.
+     *
+     * @return an estimate of the bytes freed
+     */
+    override fun trimMemory(level: Int): Long {
+        @Suppress("DEPRECATION")
+        val trimLevel = if (level >= ComponentCallbacks2.TRIM_MEMORY_RUNNING_LOW) {
+            TRIM_SECTIONS
+        } else {
+            TRIM_CACHES
+        }
+        val freed = trimLock.write { trim(nativeClientPointer, trimLevel) }
+        Timber.d("Trimmed $freed bytes of $id at level $level")
+        return freed
+    }
+
+    private external fun trim(clientPointer: Long, level: Int): Long
+
+    /**
+     * Reports where the memory of the client goes as a JSON object. It holds the
+     * estimated `heapBytes` in total and per entry of `structures`, the size of the
+     * loaded processed data as `deserializedBytes`, the number of buckets by chain
+     * length of each of `hashSets` and the fill ratio of each of `bloomFilters`.
+     */
+    fun getMemoryReport(): String = trimLock.write { getMemoryReport(nativeClientPointer) }
+
+    private external fun getMemoryReport(clientPointer: Long): String
+
+    /**
+     * Whether [matches] and the cosmetic getters record how long each of their phases
+     * takes, off by default. The durations are kept when it's turned off again.
+     */
+    var isLatencyStatsEnabled: Boolean
+        get() = isLatencyStatsEnabled(nativeClientPointer)
+        set(value) = synchronized(latencyStatsLock) {
+            setLatencyStatsEnabled(nativeClientPointer, value)
+        }
+
+    private external fun isLatencyStatsEnabled(clientPointer: Long): Boolean
+
+    private external fun setLatencyStatsEnabled(clientPointer: Long, enabled: Boolean)
+
+    /**
+     * Reports the durations recorded while [isLatencyStatsEnabled] as a JSON object,
+     * or null if it was never enabled. Its `phases` hold the `count`, `p50`, `p90`,
+     * `p99` and `maxNanos` of each phase and their log-linear `buckets` as pairs of
+     * the lower bound in nanoseconds and the count.
+     */
+    fun getLatencyStats(): String? =
+        synchronized(latencyStatsLock) { getLatencyStats(nativeClientPointer) }
+
+    private external fun getLatencyStats(clientPointer: Long): String?
+
+    fun resetLatencyStats() = synchronized(latencyStatsLock) { resetLatencyStats(nativeClientPointer) }
+
+    private external fun resetLatencyStats(clientPointer: Long)
+
+    private fun ByteBuffer.requireDirect(): ByteBuffer {
+        require(isDirect) { "url isn't a direct ByteBuffer" }
+        return this
+    }
+
     @Suppress("unused", "protectedInFinal")
     protected fun finalize() {
-        releaseClient(nativeClientPointer, rawDataPointer, processedDataPointer)
+        releaseClient(nativeClientPointer, processedDataPointer)
     }
 
-    private external fun releaseClient(
-        clientPointer: Long,
-        rawDataPointer: Long,
-        processedDataPointer: Long
-    )
+    private external fun releaseClient(clientPointer: Long, processedDataPointer: Long)
 
     private fun String.baseHost(): String? {
         return Uri.parse(this).host?.removePrefix("www.")
     }
 
     companion object {
+        // TrimLevel of the engine
+        private const val TRIM_CACHES = 0
+        private const val TRIM_SECTIONS = 1
+
         init {
             System.loadLibrary("adblock-client")
         }
+
+        /**
+         * Version of the processed data format, data written by a version of the
+         * engine with another format version can't be loaded.
+         */
+        val engineFormatVersion: Int by lazy { getEngineFormatVersion() }
+
+        @JvmStatic
+        private external fun getEngineFormatVersion(): Int
     }
 }
@@ -31,6 +31,10 @@ interface Client {
 
     fun matches(url: String, documentUrl: String, resourceType: ResourceType): MatchResult
 
+    fun matchesPacked(url: String, documentUrl: String, resourceType: ResourceType): PackedMatchResult
+
+    fun getRuleText(ruleId: Int): String?
+
     fun getElementHidingSelectors(url: String): String?
 
     fun getExtendedCssSelectors(url: String): Array<String>?
@@ -39,4 +43,12 @@ interface Client {
 
     fun getScriptlets(url: String): Array<String>?
 
+    /**
+     * Releases memory which is rebuilt when it's needed again.
+     *
+     * @param level the level of [android.content.ComponentCallbacks2.onTrimMemory]
+     * @return an estimate of the bytes freed
+     */
+    fun trimMemory(level: Int): Long
+
 }
\ No newline at end of file
@@ -21,3 +21,36 @@ data class MatchResult(
 )
 
 val MatchResult.hasException: Boolean get() = matchedExceptionRule != null
+
+/**
+ * [MatchResult] packed into a [Long], so matching doesn't allocate.
+ *
+ * Matched rules are kept as rule ids, [Client.getRuleText] turns them into rule text.
+ * Rule ids are valid until the client loads other data.
+ */
+@JvmInline
+value class PackedMatchResult(val bits: Long) {
+
+    /**
+     * true if has matched rule and no matched exception rule
+     */
+    val shouldBlock: Boolean get() = (bits and 1L) != 0L
+
+    /**
+     * -1 if no rule matched
+     */
+    val matchedRuleId: Int get() = ((bits ushr 1) and ID_MASK).toInt() - 1
+
+    /**
+     * -1 if no exception rule matched
+     */
+    val matchedExceptionRuleId: Int get() = ((bits ushr 32) and ID_MASK).toInt() - 1
+
+    val hasException: Boolean get() = matchedExceptionRuleId >= 0
+
+    companion object {
+        private const val ID_MASK = 0x7fffffffL
+
+        val NONE = PackedMatchResult(0L)
+    }
+}
@@ -0,0 +1,63 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+// Checks that bad fingerprints are skipped for fingerprint sizes other
+// than the one the table was trained for. Built with the whole table,
+// see ENABLE_BadFingerprints_Exclusion.
+
+#include <stdio.h>
+#include <string.h>
+
+#include "ad-block/ad_block_client.h"
+#include "bloom-filter-cpp/BloomFilter.h"
+
+// One of the entries of bad_fingerprints.h
+static const char *kBadFingerprint = "banner";
+
+static int failures = 0;
+
+static void expect(bool condition, const char *message, int size) {
+    if (!condition) {
+        fprintf(stderr, "FAILED (size %d): %s\n", size, message);
+        failures++;
+    }
+}
+
+// |input| starts with |kBadFingerprint| so that the first window is bad
+static void checkGetFingerprint(const char *input, int size) {
+    char buffer[AdBlockClient::kMaxFingerprintSize + 1];
+    bool found = AdBlockClient::getFingerprint(buffer, input, size);
+    expect(found, "no fingerprint", size);
+    if (size <= AdBlockClient::kFingerprintSize) {
+        expect(strncmp(buffer, kBadFingerprint, size) != 0,
+               "truncated bad fingerprint picked", size);
+    } else {
+        expect(!strstr(buffer, kBadFingerprint),
+               "fingerprint containing a bad one picked", size);
+    }
+}
+
+int main() {
+    checkGetFingerprint("banner_qzjx_vkwq", AdBlockClient::kFingerprintSize);
+    checkGetFingerprint("banner_qzjx_vkwq", 4);
+    checkGetFingerprint("banner_qzjx_vkwq", 8);
+
+    // Parsing with a non-default size keeps the bad fingerprint out of
+    // the bloom filter and uses a later window instead
+    char expected[AdBlockClient::kMaxFingerprintSize + 1];
+    AdBlockClient::getFingerprint(expected, "banner_qzjx_vkwq", 4);
+    AdBlockClient client;
+    expect(client.setFingerprintSize(4), "size not accepted", 4);
+    client.parse("banner_qzjx_vkwq\n");
+    expect(!client.bloomFilter->exists("bann", 4),
+           "bad fingerprint in the bloom filter", 4);
+    expect(client.bloomFilter->exists(expected, 4),
+           "later window not in the bloom filter", 4);
+
+    if (failures) {
+        return 1;
+    }
+    printf("OK\n");
+    return 0;
+}
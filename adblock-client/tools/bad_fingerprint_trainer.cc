@@ -0,0 +1,102 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+// Regenerates bad_fingerprints.h from the bloom filter false positives
+// a URL corpus produces against a set of filter lists.
+//
+// Usage:
+//   bad-fingerprint-trainer -o bad_fingerprints.h -u corpus.tsv
+//       easylist.txt [easyprivacy.txt ...]
+//
+// The corpus uses the trace format of tool_util.h, one URL per line
+// optionally followed by a tab separated document URL and resource type.
+// The fingerprints of the checked-in table are kept, so running the
+// trainer repeatedly refines it. The engine only excludes the table when
+// built with ENABLE_BadFingerprints_Exclusion, the trainer reads it anyway.
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+#include "ad-block/ad_block_client.h"
+#include "ad-block/bad_fingerprint.h"
+#include "./tool_util.h"
+
+// The whole table, the engine library is built without it
+#define ENABLE_BadFingerprints_Exclusion
+namespace checked_in {
+#include "ad-block/bad_fingerprints.h"
+}  // namespace checked_in
+
+static void printUsage(const char *program) {
+    fprintf(stderr, "Usage: %s -o <output header> -u <url corpus> "
+                    "<filter list>...\n", program);
+}
+
+int main(int argc, char **argv) {
+    const char *outputPath = nullptr;
+    const char *corpusPath = nullptr;
+    std::vector<const char *> listPaths;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-o") && i + 1 < argc) {
+            outputPath = argv[++i];
+        } else if (!strcmp(argv[i], "-u") && i + 1 < argc) {
+            corpusPath = argv[++i];
+        } else if (argv[i][0] == '-') {
+            printUsage(argv[0]);
+            return 1;
+        } else {
+            listPaths.push_back(argv[i]);
+        }
+    }
+    if (!outputPath || !corpusPath || listPaths.empty()) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    AdBlockClient client;
+    client.enableBadFingerprintDetection();
+    for (const char *fingerprint : checked_in::badFingerprints) {
+        client.badFingerprintsHashSet->Add(BadFingerprint(fingerprint));
+    }
+    uint32_t numCheckedIn = client.badFingerprintsHashSet->GetSize();
+    for (const char *path : listPaths) {
+        char *list = readFile(path);
+        if (!list) {
+            fprintf(stderr, "Can't read filter list %s\n", path);
+            return 1;
+        }
+        client.parse(list);
+        delete[] list;
+    }
+
+    std::vector<TraceEntry> corpus;
+    if (!readTrace(corpusPath, &corpus)) {
+        fprintf(stderr, "Can't read url corpus %s\n", corpusPath);
+        return 1;
+    }
+
+    int numBlocked = 0;
+    for (const TraceEntry &entry : corpus) {
+        Filter *matchedFilter;
+        Filter *matchedExceptionFilter;
+        if (client.matches(entry.url.c_str(), entry.filterOption,
+                           entry.firstPartyDomain.c_str(),
+                           &matchedFilter, &matchedExceptionFilter)) {
+            numBlocked++;
+        }
+    }
+
+    if (!client.badFingerprintsHashSet->generateHeader(outputPath)) {
+        fprintf(stderr, "Can't write %s\n", outputPath);
+        return 1;
+    }
+
+    printf("Urls: %zu, blocked: %d\n", corpus.size(), numBlocked);
+    printf("Bloom filter false positives: %u, exception false positives: %u\n",
+           client.numFalsePositives.load(), client.numExceptionFalsePositives.load());
+    printf("Bad fingerprints written to %s: %u, %u of them checked in before\n",
+           outputPath, client.badFingerprintsHashSet->GetSize(), numCheckedIn);
+    return 0;
+}
@@ -0,0 +1,361 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+// Measures parse, serialize, deserialize, matching and cosmetic lookups of
+// the engine on the host.
+//
+// Usage:
+//   engine-benchmark [-l <filter list>]... [-u <url trace>] [-o <json>]
+//       [-t <min ms per benchmark>] [-p]
+//
+// Without -l the easylist_sample and easyprivacy_sample fixtures are used,
+// without -u a built in mix of ad, tracker and clean URLs. Results are
+// printed as a table and, with -o, written as JSON for regression tracking.
+// With -p the urls are matched once more with latency stats enabled to
+// print the percentiles of each phase.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "ad-block/ad_block_client.h"
+#include "ad-block/latency_stats.h"
+#include "./tool_util.h"
+
+static std::atomic<uint64_t> numAllocations(0);
+static std::atomic<uint64_t> numAllocatedBytes(0);
+
+static void *countedAlloc(size_t size) {
+    numAllocations.fetch_add(1, std::memory_order_relaxed);
+    numAllocatedBytes.fetch_add(size, std::memory_order_relaxed);
+    void *p = malloc(size ? size : 1);
+    if (!p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void *operator new(size_t size) {
+    return countedAlloc(size);
+}
+
+void *operator new[](size_t size) {
+    return countedAlloc(size);
+}
+
+void operator delete(void *p) noexcept {
+    free(p);
+}
+
+void operator delete[](void *p) noexcept {
+    free(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+    free(p);
+}
+
+void operator delete[](void *p, size_t) noexcept {
+    free(p);
+}
+
+struct BenchmarkResult {
+    std::string name;
+    uint64_t iterations;
+    double nsPerOp;
+    double allocationsPerOp;
+    double bytesPerOp;
+};
+
+static const char *kDefaultUrls[][3] = {
+        {"https://www.googletagservices.com/tag/js/gpt.js", "https://news.example.com/", "SCRIPT"},
+        {"https://pagead2.googlesyndication.com/pagead/show_ads.js", "https://blog.example.org/", "SCRIPT"},
+        {"https://ad.doubleclick.net/ddm/adi/N1234.5678/B9;sz=300x250", "https://news.example.com/", "SUBDOCUMENT"},
+        {"https://static.example.com/banners/ad_728x90.gif", "https://www.example.com/", "IMAGE"},
+        {"https://www.google-analytics.com/analytics.js", "https://shop.example.net/", "SCRIPT"},
+        {"https://www.google-analytics.com/collect?v=1&_v=j79&a=123&t=pageview", "https://shop.example.net/", "IMAGE"},
+        {"https://connect.facebook.net/en_US/fbevents.js", "https://shop.example.net/", "SCRIPT"},
+        {"https://stats.example.com/pixel.gif?uid=abc&ref=https%3A%2F%2Fexample.com", "https://www.example.com/", "IMAGE"},
+        {"https://cdn.jsdelivr.net/npm/jquery@3.6.0/dist/jquery.min.js", "https://docs.example.com/", "SCRIPT"},
+        {"https://fonts.gstatic.com/s/roboto/v30/KFOmCnqEu92Fr1Mu4mxK.woff2", "https://docs.example.com/", "FONT"},
+        {"https://www.example.com/static/css/main.4f2a1c.css", "https://www.example.com/", "CSS"},
+        {"https://api.example.com/v2/search?q=adblock&page=2&sort=recent", "https://www.example.com/", "XMLHTTPREQUEST"},
+        {"https://images.example.org/photos/2021/07/beach-sunset-1920x1080.jpg", "https://blog.example.org/", "IMAGE"},
+        {"https://video.example.net/hls/segment_00042.ts", "https://video.example.net/", "MEDIA"},
+        {"https://github.com/edsuns/AdblockAndroid/blob/main/README.md", "https://github.com/", "UNKNOWN"},
+        {"https://en.wikipedia.org/wiki/Bloom_filter", "https://en.wikipedia.org/", "UNKNOWN"},
+        // Blocked, excepted and regex matched by the default fixtures
+        {"https://imasdk.googleapis.com/js/sdkloader/ima3.js", "https://news.example.com/", "SCRIPT"},
+        {"https://imasdk.googleapis.com/js/sdkloader/ima3_debug.js", "https://video.example.net/", "SCRIPT"},
+        {"https://exception-rule.com/ads/banner_300x250.gif", "https://blog.example.org/", "IMAGE"},
+        {"https://exception-rule.com/a/b/info", "https://blog.example.org/", "XMLHTTPREQUEST"},
+        {"https://cdn.tagcommander.com/4012/analytics.js", "https://shop.example.net/", "SCRIPT"},
+        {"https://cdn.tagcommander.com/4012/tc_Shop_1.js", "https://shop.example.net/", "SCRIPT"},
+        {"https://www.laredoute.fr/static/tagcommander/tc_laredoute.js", "https://www.laredoute.fr/", "SCRIPT"},
+        {"https://cdscdn.com/Js/external/tagcommander/tc_nav.js", "https://www.cdiscount.com/", "SCRIPT"},
+        {"https://shop.example.com/TagCommander.cfc?ref=home", "https://shop.example.com/", "IMAGE"},
+        {"https://ads.example.com:8080/fr/a-1234-56-7.html", "https://news.example.com/", "SUBDOCUMENT"},
+        {"https://ads.example.com:8080/fr/a-1-56-7.html", "https://news.example.com/", "SUBDOCUMENT"},
+};
+
+static double nowNs() {
+    return static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+// Runs |fn| with a growing batch size until a batch takes at least
+// |minNs|, then reports the per op cost of the last batch
+template<typename F>
+BenchmarkResult runBenchmark(const char *name, double minNs, F fn) {
+    fn(0);
+    uint64_t iterations = 1;
+    while (true) {
+        uint64_t allocationsBefore = numAllocations.load();
+        uint64_t bytesBefore = numAllocatedBytes.load();
+        double start = nowNs();
+        for (uint64_t i = 0; i < iterations; i++) {
+            fn(i);
+        }
+        double elapsed = nowNs() - start;
+        if (elapsed >= minNs || iterations >= (1ULL << 30)) {
+            BenchmarkResult result;
+            result.name = name;
+            result.iterations = iterations;
+            result.nsPerOp = elapsed / iterations;
+            result.allocationsPerOp =
+                    static_cast<double>(numAllocations.load() - allocationsBefore) / iterations;
+            result.bytesPerOp =
+                    static_cast<double>(numAllocatedBytes.load() - bytesBefore) / iterations;
+            return result;
+        }
+        uint64_t next = elapsed > 0 ? static_cast<uint64_t>(iterations * minNs / elapsed) : 0;
+        iterations = next > iterations * 2 ? next + next / 10 : iterations * 2;
+    }
+}
+
+static void writeJsonString(FILE *file, const char *s) {
+    fputc('"', file);
+    for (const char *p = s; *p != '\0'; p++) {
+        if (*p == '"' || *p == '\\') {
+            fputc('\\', file);
+        }
+        fputc(*p, file);
+    }
+    fputc('"', file);
+}
+
+static bool writeJson(const char *path, const std::vector<BenchmarkResult> &results,
+                      const std::vector<const char *> &listPaths, size_t numUrls,
+                      int numBlocked, int numExceptions) {
+    FILE *file = fopen(path, "w");
+    if (!file) {
+        return false;
+    }
+    fprintf(file, "{\n  \"lists\": [");
+    for (size_t i = 0; i < listPaths.size(); i++) {
+        fputs(i ? ", " : "", file);
+        writeJsonString(file, listPaths[i]);
+    }
+    fprintf(file, "],\n  \"urls\": %zu,\n  \"blocked\": %d,\n  \"exceptions\": %d,\n"
+                  "  \"block_ratio\": %.3f,\n  \"exception_ratio\": %.3f,\n  \"benchmarks\": [\n",
+            numUrls, numBlocked, numExceptions, static_cast<double>(numBlocked) / numUrls,
+            static_cast<double>(numExceptions) / numUrls);
+    for (size_t i = 0; i < results.size(); i++) {
+        const BenchmarkResult &r = results[i];
+        fputs("    {\"name\": ", file);
+        writeJsonString(file, r.name.c_str());
+        fprintf(file, ", \"iterations\": %llu, \"ns_per_op\": %.1f, "
+                      "\"allocs_per_op\": %.2f, \"bytes_per_op\": %.1f}%s\n",
+                static_cast<unsigned long long>(r.iterations),  // NOLINT
+                r.nsPerOp, r.allocationsPerOp, r.bytesPerOp,
+                i + 1 < results.size() ? "," : "");
+    }
+    fprintf(file, "  ]\n}\n");
+    return fclose(file) == 0;
+}
+
+static void printUsage(const char *program) {
+    fprintf(stderr, "Usage: %s [-l <filter list>]... [-u <url trace>] [-o <json output>] "
+                    "[-t <min ms per benchmark>] [-p]\n", program);
+}
+
+int main(int argc, char **argv) {
+    std::vector<const char *> listPaths;
+    const char *tracePath = nullptr;
+    const char *outputPath = nullptr;
+    double minNs = 200 * 1e6;
+    bool phases = false;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-l") && i + 1 < argc) {
+            listPaths.push_back(argv[++i]);
+        } else if (!strcmp(argv[i], "-u") && i + 1 < argc) {
+            tracePath = argv[++i];
+        } else if (!strcmp(argv[i], "-o") && i + 1 < argc) {
+            outputPath = argv[++i];
+        } else if (!strcmp(argv[i], "-t") && i + 1 < argc) {
+            minNs = atof(argv[++i]) * 1e6;
+        } else if (!strcmp(argv[i], "-p")) {
+            phases = true;
+        } else {
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+    if (listPaths.empty()) {
+        listPaths.push_back(ADBLOCK_FIXTURES_DIR "/easylist_sample");
+        listPaths.push_back(ADBLOCK_FIXTURES_DIR "/easyprivacy_sample");
+    }
+
+    // All lists are benchmarked as one, the way the engine merges parse() calls
+    std::string list;
+    for (const char *path : listPaths) {
+        char *buffer = readFile(path);
+        if (!buffer) {
+            fprintf(stderr, "Can't read filter list %s\n", path);
+            return 1;
+        }
+        list.append(buffer).append("\n");
+        delete[] buffer;
+    }
+
+    std::vector<TraceEntry> urls;
+    if (tracePath) {
+        if (!readTrace(tracePath, &urls)) {
+            fprintf(stderr, "Can't read url trace %s\n", tracePath);
+            return 1;
+        }
+    } else {
+        for (auto &url : kDefaultUrls) {
+            TraceEntry entry;
+            entry.url = url[0];
+            entry.firstPartyDomain = baseHost(url[1]);
+            entry.filterOption = toFilterOption(url[2]);
+            urls.push_back(entry);
+        }
+    }
+    if (urls.empty()) {
+        fprintf(stderr, "No urls to match\n");
+        return 1;
+    }
+
+    AdBlockClient client;
+    client.parse(list.c_str(), true);
+    int serializedSize = 0;
+    char *serialized = client.serialize(&serializedSize, false);
+
+    std::vector<BenchmarkResult> results;
+    results.push_back(runBenchmark("parse", minNs, [&](uint64_t) {
+        AdBlockClient parsed;
+        parsed.parse(list.c_str(), true);
+    }));
+    results.push_back(runBenchmark("serialize", minNs, [&](uint64_t) {
+        int size;
+        delete[] client.serialize(&size, false);
+    }));
+    results.push_back(runBenchmark("deserialize", minNs, [&](uint64_t) {
+        AdBlockClient deserialized;
+        deserialized.deserialize(serialized);
+    }));
+
+    // Exceptions count the urls a block filter matched but an exception
+    // filter let through
+    int numBlocked = 0;
+    int numExceptions = 0;
+    for (const TraceEntry &entry : urls) {
+        Filter *matchedFilter;
+        Filter *matchedExceptionFilter;
+        if (client.matches(entry.url.c_str(), entry.filterOption,
+                           entry.firstPartyDomain.c_str(),
+                           &matchedFilter, &matchedExceptionFilter)) {
+            numBlocked++;
+        } else if (matchedFilter && matchedExceptionFilter) {
+            numExceptions++;
+        }
+    }
+    results.push_back(runBenchmark("matches", minNs, [&](uint64_t i) {
+        const TraceEntry &entry = urls[i % urls.size()];
+        Filter *matchedFilter;
+        Filter *matchedExceptionFilter;
+        client.matches(entry.url.c_str(), entry.filterOption,
+                       entry.firstPartyDomain.c_str(),
+                       &matchedFilter, &matchedExceptionFilter);
+    }));
+
+    results.push_back(runBenchmark("element_hiding_selectors", minNs, [&](uint64_t i) {
+        client.getElementHidingSelectors(urls[i % urls.size()].url.c_str());
+    }));
+    results.push_back(runBenchmark("element_hiding_selectors_uncached", minNs,
+                                   [&](uint64_t i) {
+        const std::string &host = urls[i % urls.size()].firstPartyDomain;
+        delete[] client.getElementHidingSelectors(host.c_str(),
+                                                  static_cast<int>(host.length()));
+    }));
+    results.push_back(runBenchmark("extended_css_selectors", minNs, [&](uint64_t i) {
+        client.getExtendedCssSelectors(urls[i % urls.size()].url.c_str());
+    }));
+    results.push_back(runBenchmark("css_rules", minNs, [&](uint64_t i) {
+        client.getCssRules(urls[i % urls.size()].url.c_str());
+    }));
+    results.push_back(runBenchmark("scriptlets", minNs, [&](uint64_t i) {
+        client.getScriptlets(urls[i % urls.size()].url.c_str());
+    }));
+
+    // Separate from the benchmarks above, so the clock reads don't skew them
+    if (phases) {
+        client.setLatencyStatsEnabled(true);
+        for (const TraceEntry &entry : urls) {
+            Filter *matchedFilter;
+            Filter *matchedExceptionFilter;
+            client.matches(entry.url.c_str(), entry.filterOption,
+                           entry.firstPartyDomain.c_str(),
+                           &matchedFilter, &matchedExceptionFilter);
+            client.getElementHidingSelectors(entry.url.c_str());
+            client.getExtendedCssSelectors(entry.url.c_str());
+            client.getCssRules(entry.url.c_str());
+            client.getScriptlets(entry.url.c_str());
+        }
+        client.setLatencyStatsEnabled(false);
+    }
+
+    delete[] serialized;
+
+    printf("Serialized size: %d bytes, urls: %zu, blocked: %d, exceptions: %d\n",
+           serializedSize, urls.size(), numBlocked, numExceptions);
+    printf("%-36s %12s %14s %12s %14s\n", "benchmark", "iterations", "ns/op",
+           "allocs/op", "bytes/op");
+    for (const BenchmarkResult &r : results) {
+        printf("%-36s %12llu %14.1f %12.2f %14.1f\n", r.name.c_str(),
+               static_cast<unsigned long long>(r.iterations),  // NOLINT
+               r.nsPerOp, r.allocationsPerOp, r.bytesPerOp);
+    }
+
+    if (phases) {
+        const LatencyStats *stats = client.getLatencyStats();
+        printf("\n%-36s %12s %10s %10s %10s %10s\n", "phase", "count", "p50 ns", "p90 ns",
+               "p99 ns", "max ns");
+        for (int i = 0; i < LPNumPhases; i++) {
+            auto phase = static_cast<LatencyPhase>(i);
+            const LatencyHistogram &histogram = stats->getHistogram(phase);
+            printf("%-36s %12llu %10llu %10llu %10llu %10llu\n",  // NOLINT
+                   LatencyStats::getPhaseName(phase),
+                   static_cast<unsigned long long>(histogram.getCount()),  // NOLINT
+                   static_cast<unsigned long long>(histogram.getPercentile(50)),  // NOLINT
+                   static_cast<unsigned long long>(histogram.getPercentile(90)),  // NOLINT
+                   static_cast<unsigned long long>(histogram.getPercentile(99)),  // NOLINT
+                   static_cast<unsigned long long>(histogram.getMax()));  // NOLINT
+        }
+    }
+
+    if (outputPath && !writeJson(outputPath, results, listPaths, urls.size(),
+                                 numBlocked, numExceptions)) {
+        fprintf(stderr, "Can't write %s\n", outputPath);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,140 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+// Helpers shared by the host side tools
+
+#ifndef TOOLS_TOOL_UTIL_H_
+#define TOOLS_TOOL_UTIL_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include "ad-block/filter.h"
+
+// Reads a whole file into a NUL terminated buffer which should be deleted,
+// returns nullptr if the file can't be read
+inline char *readFile(const char *path, long *size = nullptr) {  // NOLINT
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        return nullptr;
+    }
+    fseek(file, 0, SEEK_END);
+    long len = ftell(file);  // NOLINT
+    fseek(file, 0, SEEK_SET);
+    if (len < 0) {
+        fclose(file);
+        return nullptr;
+    }
+    char *buffer = new char[len + 1];
+    size_t read = fread(buffer, 1, len, file);
+    fclose(file);
+    if (read != static_cast<size_t>(len)) {
+        delete[] buffer;
+        return nullptr;
+    }
+    buffer[len] = '\0';
+    if (size) {
+        *size = len;
+    }
+    return buffer;
+}
+
+// Host of |url| without a leading "www.", the first party domain which
+// AdBlockClient.kt passes to the engine
+inline std::string baseHost(const char *url) {
+    const char *p = strstr(url, "://");
+    p = p ? p + 3 : url;
+    const char *end = p;
+    while (*end != '\0' && *end != '/' && *end != ':' && *end != '?' &&
+           *end != '#') {
+        end++;
+    }
+    if (end - p > 4 && !strncmp(p, "www.", 4)) {
+        p += 4;
+    }
+    return std::string(p, end - p);
+}
+
+// Maps a ResourceType name from ResourceType.kt or a number to the
+// FilterOption passed to matches()
+inline FilterOption toFilterOption(const char *resourceType) {
+    static const struct {
+        const char *name;
+        int filterOption;
+    } kResourceTypes[] = {
+            {"UNKNOWN",        0},
+            {"SCRIPT",         FOScript},
+            {"IMAGE",          FOImage},
+            {"CSS",            FOStylesheet},
+            {"XMLHTTPREQUEST", FOXmlHttpRequest},
+            {"SUBDOCUMENT",    FOSubdocument},
+            {"FONT",           FOFont},
+            {"MEDIA",          FOMedia},
+    };
+    if (!resourceType || *resourceType == '\0') {
+        return FONoFilterOption;
+    }
+    for (auto &type : kResourceTypes) {
+        if (!strcmp(type.name, resourceType)) {
+            return static_cast<FilterOption>(type.filterOption);
+        }
+    }
+    return static_cast<FilterOption>(strtol(resourceType, nullptr, 0));
+}
+
+// A request as Detector.shouldBlock receives it
+struct TraceEntry {
+    std::string url;
+    std::string firstPartyDomain;
+    FilterOption filterOption;
+};
+
+// Reads "<url>[\t<documentUrl>[\t<resourceType>]]" lines, empty lines and
+// lines starting with # are skipped. Without a document url the request
+// is treated as first party.
+inline bool readTrace(const char *path, std::vector<TraceEntry> *entries) {
+    char *buffer = readFile(path);
+    if (!buffer) {
+        return false;
+    }
+    char *line = buffer;
+    while (*line != '\0') {
+        char *lineEnd = line;
+        while (*lineEnd != '\0' && *lineEnd != '\n') {
+            lineEnd++;
+        }
+        bool last = *lineEnd == '\0';
+        *lineEnd = '\0';
+        if (lineEnd > line && lineEnd[-1] == '\r') {
+            lineEnd[-1] = '\0';
+        }
+        if (*line != '\0' && *line != '#') {
+            char *fields[3] = {line, nullptr, nullptr};
+            for (int i = 1; i < 3; i++) {
+                char *tab = strchr(fields[i - 1], '\t');
+                if (!tab) {
+                    break;
+                }
+                *tab = '\0';
+                fields[i] = tab + 1;
+            }
+            TraceEntry entry;
+            entry.url = fields[0];
+            entry.firstPartyDomain = baseHost(fields[1] ? fields[1] : fields[0]);
+            entry.filterOption = toFilterOption(fields[2]);
+            entries->push_back(entry);
+        }
+        if (last) {
+            break;
+        }
+        line = lineEnd + 1;
+    }
+    delete[] buffer;
+    return true;
+}
+
+#endif  // TOOLS_TOOL_UTIL_H_
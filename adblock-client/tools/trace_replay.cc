@@ -0,0 +1,241 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+// Replays a recorded request trace against filter lists the way
+// Detector.shouldBlock does and reports the latency distribution.
+//
+// Usage:
+//   trace-replay -t <trace> [-c <compiled list>]... [-l <filter list>]...
+//       [-j <threads>] [-r <rounds>]
+//
+// Compiled lists are the processed data the app stores after
+// installation and are mapped like the app loads them, filter lists are
+// parsed at startup. Every list becomes its own client, as in the app.
+// The trace uses the format of tool_util.h:
+// "<url>\t<documentUrl>\t<resourceType>" per line.
+//
+// The trace is replayed once on a single thread and, with -j, split
+// between the given number of threads.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "ad-block/ad_block_client.h"
+#include "./tool_util.h"
+
+enum Verdict {
+    VerdictAllowed,
+    VerdictBlocked,
+    VerdictException,
+    VerdictCount
+};
+
+struct ReplayStats {
+    ReplayStats() : verdicts() {
+    }
+
+    std::vector<uint64_t> latenciesNs;
+    uint64_t verdicts[VerdictCount];
+};
+
+struct Counters {
+    unsigned int bloomFilterSaves;
+    unsigned int exceptionBloomFilterSaves;
+    unsigned int hashSetSaves;
+    unsigned int exceptionHashSetSaves;
+    unsigned int falsePositives;
+    unsigned int exceptionFalsePositives;
+};
+
+static Counters readCounters(const std::vector<AdBlockClient *> &clients) {
+    Counters counters = {0, 0, 0, 0, 0, 0};
+    for (AdBlockClient *client : clients) {
+        counters.bloomFilterSaves += client->numBloomFilterSaves.load();
+        counters.exceptionBloomFilterSaves += client->numExceptionBloomFilterSaves.load();
+        counters.hashSetSaves += client->numHashSetSaves.load();
+        counters.exceptionHashSetSaves += client->numExceptionHashSetSaves.load();
+        counters.falsePositives += client->numFalsePositives.load();
+        counters.exceptionFalsePositives += client->numExceptionFalsePositives.load();
+    }
+    return counters;
+}
+
+// Mirrors DetectorImpl.shouldBlock: an exception in any client allows the
+// request, otherwise any client may block it
+static Verdict shouldBlock(const std::vector<AdBlockClient *> &clients,
+                           const TraceEntry &entry) {
+    Verdict verdict = VerdictAllowed;
+    for (AdBlockClient *client : clients) {
+        Filter *matchedFilter;
+        Filter *matchedExceptionFilter;
+        bool blocked = client->matches(entry.url.c_str(), entry.filterOption,
+                                       entry.firstPartyDomain.c_str(),
+                                       &matchedFilter, &matchedExceptionFilter);
+        if (matchedExceptionFilter) {
+            return VerdictException;
+        }
+        if (blocked) {
+            verdict = VerdictBlocked;
+        }
+    }
+    return verdict;
+}
+
+static void replay(const std::vector<AdBlockClient *> &clients,
+                   const std::vector<TraceEntry> &trace, size_t first, size_t step,
+                   int rounds, ReplayStats *stats) {
+    for (int round = 0; round < rounds; round++) {
+        for (size_t i = first; i < trace.size(); i += step) {
+            auto start = std::chrono::steady_clock::now();
+            Verdict verdict = shouldBlock(clients, trace[i]);
+            auto end = std::chrono::steady_clock::now();
+            stats->latenciesNs.push_back(static_cast<uint64_t>(
+                    std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count()));
+            stats->verdicts[verdict]++;
+        }
+    }
+}
+
+static uint64_t percentile(const std::vector<uint64_t> &sorted, double p) {
+    if (sorted.empty()) {
+        return 0;
+    }
+    size_t index = static_cast<size_t>(p * (sorted.size() - 1) + 0.5);
+    return sorted[std::min(index, sorted.size() - 1)];
+}
+
+static void runReplay(const char *name, const std::vector<AdBlockClient *> &clients,
+                      const std::vector<TraceEntry> &trace, int numThreads, int rounds) {
+    Counters before = readCounters(clients);
+    std::vector<ReplayStats> stats(numThreads);
+    for (ReplayStats &s : stats) {
+        s.latenciesNs.reserve(trace.size() / numThreads * rounds + rounds);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    if (numThreads == 1) {
+        replay(clients, trace, 0, 1, rounds, &stats[0]);
+    } else {
+        std::vector<std::thread> threads;
+        for (int t = 0; t < numThreads; t++) {
+            threads.emplace_back(replay, std::cref(clients), std::cref(trace),
+                                 static_cast<size_t>(t), static_cast<size_t>(numThreads),
+                                 rounds, &stats[t]);
+        }
+        for (std::thread &thread : threads) {
+            thread.join();
+        }
+    }
+    double elapsedMs = std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now() - start).count();
+    Counters after = readCounters(clients);
+
+    ReplayStats total;
+    for (ReplayStats &s : stats) {
+        total.latenciesNs.insert(total.latenciesNs.end(),
+                                 s.latenciesNs.begin(), s.latenciesNs.end());
+        for (int v = 0; v < VerdictCount; v++) {
+            total.verdicts[v] += s.verdicts[v];
+        }
+    }
+    std::sort(total.latenciesNs.begin(), total.latenciesNs.end());
+    size_t numRequests = total.latenciesNs.size();
+
+    printf("%s: %zu requests on %d thread%s in %.1f ms (%.0f requests/s)\n",
+           name, numRequests, numThreads, numThreads == 1 ? "" : "s", elapsedMs,
+           elapsedMs > 0 ? numRequests / (elapsedMs / 1000) : 0);
+    printf("  latency us: p50 %.1f, p90 %.1f, p99 %.1f, max %.1f\n",
+           percentile(total.latenciesNs, 0.5) / 1000.0,
+           percentile(total.latenciesNs, 0.9) / 1000.0,
+           percentile(total.latenciesNs, 0.99) / 1000.0,
+           numRequests ? total.latenciesNs.back() / 1000.0 : 0);
+    printf("  verdicts: blocked %llu, exception %llu, allowed %llu\n",
+           static_cast<unsigned long long>(total.verdicts[VerdictBlocked]),  // NOLINT
+           static_cast<unsigned long long>(total.verdicts[VerdictException]),  // NOLINT
+           static_cast<unsigned long long>(total.verdicts[VerdictAllowed]));  // NOLINT
+    printf("  bloom filter saves %u, exception bloom filter saves %u\n",
+           after.bloomFilterSaves - before.bloomFilterSaves,
+           after.exceptionBloomFilterSaves - before.exceptionBloomFilterSaves);
+    printf("  hash set saves %u, exception hash set saves %u\n",
+           after.hashSetSaves - before.hashSetSaves,
+           after.exceptionHashSetSaves - before.exceptionHashSetSaves);
+    printf("  false positives %u, exception false positives %u\n",
+           after.falsePositives - before.falsePositives,
+           after.exceptionFalsePositives - before.exceptionFalsePositives);
+}
+
+static void printUsage(const char *program) {
+    fprintf(stderr, "Usage: %s -t <trace> [-c <compiled list>]... [-l <filter list>]... "
+                    "[-j <threads>] [-r <rounds>]\n", program);
+}
+
+int main(int argc, char **argv) {
+    const char *tracePath = nullptr;
+    std::vector<const char *> compiledPaths;
+    std::vector<const char *> listPaths;
+    int numThreads = 0;
+    int rounds = 1;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-t") && i + 1 < argc) {
+            tracePath = argv[++i];
+        } else if (!strcmp(argv[i], "-c") && i + 1 < argc) {
+            compiledPaths.push_back(argv[++i]);
+        } else if (!strcmp(argv[i], "-l") && i + 1 < argc) {
+            listPaths.push_back(argv[++i]);
+        } else if (!strcmp(argv[i], "-j") && i + 1 < argc) {
+            numThreads = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-r") && i + 1 < argc) {
+            rounds = atoi(argv[++i]);
+        } else {
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+    if (!tracePath || (compiledPaths.empty() && listPaths.empty()) || rounds < 1) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    std::vector<AdBlockClient *> clients;
+    for (const char *path : compiledPaths) {
+        auto *client = new AdBlockClient();
+        if (!client->deserializeFile(path)) {
+            fprintf(stderr, "Can't load compiled list %s\n", path);
+            return 1;
+        }
+        clients.push_back(client);
+    }
+    for (const char *path : listPaths) {
+        char *buffer = readFile(path);
+        if (!buffer) {
+            fprintf(stderr, "Can't read filter list %s\n", path);
+            return 1;
+        }
+        auto *client = new AdBlockClient();
+        client->parse(buffer, true);
+        delete[] buffer;
+        clients.push_back(client);
+    }
+
+    std::vector<TraceEntry> trace;
+    if (!readTrace(tracePath, &trace)) {
+        fprintf(stderr, "Can't read trace %s\n", tracePath);
+        return 1;
+    }
+
+    runReplay("single thread", clients, trace, 1, rounds);
+    if (numThreads > 1) {
+        runReplay("multi thread", clients, trace, numThreads, rounds);
+    }
+
+    for (AdBlockClient *client : clients) {
+        delete client;
+    }
+    return 0;
+}